@@ -0,0 +1,164 @@
+
+/*
+   ----------------------------------------------------------------
+
+   Notice that the following BSD-style license applies to this one
+   file (cachegrind.h) only.  The rest of Valgrind is licensed under the
+   terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+
+   ----------------------------------------------------------------
+
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   Copyright (C) 2023-2023 Nicholas Nethercote.  All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+   2. The origin of this software must not be misrepresented; you must
+      not claim that you wrote the original software.  If you use this
+      software in a product, an acknowledgment in the product
+      documentation would be appreciated but is not required.
+
+   3. Altered source versions must be plainly marked as such, and must
+      not be misrepresented as being the original software.
+
+   4. The name of the author may not be used to endorse or promote
+      products derived from this software without specific prior written
+      permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+   OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+   ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+   ----------------------------------------------------------------
+
+   Notice that the above BSD-style license applies to this one file
+   (cachegrind.h) only.  The entire rest of Valgrind is licensed under
+   the terms of the GNU General Public License, version 2.  See the
+   COPYING file in the source distribution for details.
+
+   ----------------------------------------------------------------
+*/
+
+#ifndef __CACHEGRIND_H
+#define __CACHEGRIND_H
+
+#include "valgrind.h"
+
+/* !! ABIWARNING !! ABIWARNING !! ABIWARNING !! ABIWARNING !!
+   This enum comprises an ABI exported by Valgrind to programs
+   which use client requests.  DO NOT CHANGE THE ORDER OF THESE
+   ENTRIES, NOR DELETE ANY -- add new ones at the end.
+ */
+
+typedef
+   enum {
+      VG_USERREQ__CG_START_INSTRUMENTATION = VG_USERREQ_TOOL_BASE('C','G'),
+      VG_USERREQ__CG_STOP_INSTRUMENTATION,
+      VG_USERREQ__CG_SAVE_CACHE_STATE,
+      VG_USERREQ__CG_LOAD_CACHE_STATE,
+      VG_USERREQ__CG_DUMP_STATS,
+      VG_USERREQ__CG_ZERO_STATS,
+      VG_USERREQ__CG_DUMP_STATS_AND_ZERO,
+      VG_USERREQ__CG_REGION_BEGIN,
+      VG_USERREQ__CG_REGION_END,
+      VG_USERREQ__CG_SIM_RANGE_ADD,
+      VG_USERREQ__CG_SIM_RANGE_REMOVE
+   } Vg_CachegrindClientRequest;
+
+/* Start instrumentation if not already on. */
+#define CACHEGRIND_START_INSTRUMENTATION                                \
+  VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__CG_START_INSTRUMENTATION, \
+                                  0, 0, 0, 0, 0)
+
+/* Stop instrumentation if not already off. */
+#define CACHEGRIND_STOP_INSTRUMENTATION                                 \
+  VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__CG_STOP_INSTRUMENTATION,  \
+                                  0, 0, 0, 0, 0)
+
+/* Write the complete cache simulator state (I1/D1/LL contents, LRU
+   order, word-usage bitvectors and the 3C classification structures)
+   to _qzz_file.  Evaluates to 0 on success. */
+#define CACHEGRIND_SAVE_CACHE_STATE(_qzz_file)                          \
+  (unsigned)VALGRIND_DO_CLIENT_REQUEST_EXPR(1,                          \
+                            VG_USERREQ__CG_SAVE_CACHE_STATE,            \
+                            (_qzz_file), 0, 0, 0, 0)
+
+/* Replace the cache simulator state with one previously written by
+   CACHEGRIND_SAVE_CACHE_STATE or --save-cache-state.  The cache
+   configuration must match.  Evaluates to 0 on success;  on failure the
+   state is left as it was. */
+#define CACHEGRIND_LOAD_CACHE_STATE(_qzz_file)                          \
+  (unsigned)VALGRIND_DO_CLIENT_REQUEST_EXPR(1,                          \
+                            VG_USERREQ__CG_LOAD_CACHE_STATE,            \
+                            (_qzz_file), 0, 0, 0, 0)
+
+/* Write the counters gathered so far to the usual output files, with
+   "._qzz_name" inserted before any per-thread suffix (or ".dump<n>" if
+   _qzz_name is NULL).  Translations and the cache state are untouched.
+   Evaluates to 0. */
+#define CACHEGRIND_DUMP_STATS(_qzz_name)                                \
+  (unsigned)VALGRIND_DO_CLIENT_REQUEST_EXPR(0,                          \
+                            VG_USERREQ__CG_DUMP_STATS,                  \
+                            (_qzz_name), 0, 0, 0, 0)
+
+/* Zero all counters, keeping the cache state. */
+#define CACHEGRIND_ZERO_STATS                                           \
+  VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__CG_ZERO_STATS,            \
+                                  0, 0, 0, 0, 0)
+
+/* CACHEGRIND_DUMP_STATS followed by CACHEGRIND_ZERO_STATS, for one
+   profile per phase of a long-running process. */
+#define CACHEGRIND_DUMP_STATS_AND_ZERO(_qzz_name)                       \
+  (unsigned)VALGRIND_DO_CLIENT_REQUEST_EXPR(0,                          \
+                            VG_USERREQ__CG_DUMP_STATS_AND_ZERO,         \
+                            (_qzz_name), 0, 0, 0, 0)
+
+/* Open measurement region _qzz_name inside the calling thread's current
+   region, if any.  Until the matching CACHEGRIND_REGION_END, the
+   thread's accesses are also counted against the region;  regions with
+   the same name and enclosing region are merged.  A summary with
+   exclusive and inclusive counts per region is written at exit. */
+#define CACHEGRIND_REGION_BEGIN(_qzz_name)                              \
+  VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__CG_REGION_BEGIN,          \
+                                  (_qzz_name), 0, 0, 0, 0)
+
+/* Close the calling thread's innermost region. */
+#define CACHEGRIND_REGION_END()                                         \
+  VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__CG_REGION_END,            \
+                                  0, 0, 0, 0, 0)
+
+/* Simulate the data accesses to [_qzz_addr, _qzz_addr + _qzz_len), as
+   --sim-range does.  Once any range has been given, data accesses that
+   touch none of them are counted but not simulated, even if the ranges
+   are later removed again.  Evaluates to 0 on success, 1 if there are
+   too many ranges. */
+#define CACHEGRIND_SIM_RANGE_ADD(_qzz_addr, _qzz_len)                   \
+  (unsigned)VALGRIND_DO_CLIENT_REQUEST_EXPR(1,                          \
+                            VG_USERREQ__CG_SIM_RANGE_ADD,               \
+                            (_qzz_addr), (_qzz_len), 0, 0, 0)
+
+/* Remove a range given before, with the same address and length.
+   Evaluates to 0 on success, 1 if there was no such range. */
+#define CACHEGRIND_SIM_RANGE_REMOVE(_qzz_addr, _qzz_len)                \
+  (unsigned)VALGRIND_DO_CLIENT_REQUEST_EXPR(1,                          \
+                            VG_USERREQ__CG_SIM_RANGE_REMOVE,            \
+                            (_qzz_addr), (_qzz_len), 0, 0, 0)
+
+#endif
@@ -0,0 +1,268 @@
+/*--------------------------------------------------------------------*/
+/*--- Convert Cachegrind binary output to text         cg_bin2text.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Regenerates, from one --output-format=binary file, the files the tool
+   would otherwise have written:  cachegrind.out (for cg_annotate) and the
+   D1/LL cacheusage files (for visu.py and friends).  The output is
+   byte-for-byte what the text writers in cg_main.c produce.
+
+   Build:  gcc -O2 -o cg_bin2text cg_bin2text.c cg_binread.c
+
+   Usage:  cg_bin2text [-o <cachegrind.out>] [-d <cacheusage.d1.out>]
+                       [-l <cacheusage.ll.out>] <binary-file>
+
+   With no -o/-d/-l, the cachegrind.out text goes to stdout. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cg_binread.h"
+
+#define MAX_NUM_BINS  8
+
+typedef enum { OutCachegrind, OutUsageD1, OutUsageLL } OutKind;
+
+static void print_header(FILE* fp, const CgbFile* f)
+{
+   const CgbHeader* h = f->hdr;
+
+   if (h->thread)
+      fprintf(fp, "desc: thread:          %u (tid %u)\n", h->thread, h->tid);
+   if (h->flags & CGB_FLAG_CACHE_SIM) {
+      fprintf(fp, "desc: I1 cache:         %s\n"
+                  "desc: D1 cache:         %s\n"
+                  "desc: LL cache:         %s\n",
+                  cgb_string(f, h->desc_str[0]),
+                  cgb_string(f, h->desc_str[1]),
+                  cgb_string(f, h->desc_str[2]));
+   }
+   fprintf(fp, "cmd: %s", cgb_string(f, h->cmd_str));
+}
+
+static void print_events(FILE* fp, const CgbFile* f, OutKind kind)
+{
+   Bool cache  = (f->hdr->flags & CGB_FLAG_CACHE_SIM)  != 0;
+   Bool branch = (f->hdr->flags & CGB_FLAG_BRANCH_SIM) != 0;
+   int  i;
+
+   if (kind != OutCachegrind) {
+      fprintf(fp, "\nbins: Access# Miss# Comp# Conf# Cap# Cacheline# ");
+      for (i = 0; i < MAX_NUM_BINS; i++)
+         fprintf(fp, "%d-words ", i+1);
+      fprintf(fp, "\n");
+   } else if (cache && branch) {
+      fprintf(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
+                  "Bc Bcm Bi Bim\n");
+   } else if (cache) {
+      fprintf(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw \n");
+   } else if (branch) {
+      fprintf(fp, "\nevents: Ir Bc Bcm Bi Bim\n");
+   } else {
+      fprintf(fp, "\nevents: Ir\n");
+   }
+}
+
+// The column values of a cachegrind.out line/summary, in events: order.
+static int cachegrind_cols(const CgbFile* f, CgbColumn* cols)
+{
+   static const CgbColumn cache_cols[] = {
+      CGB_Ir, CGB_I1mr, CGB_ILmr, CGB_Dr, CGB_D1mr, CGB_DLmr,
+      CGB_Dw, CGB_D1mw, CGB_DLmw
+   };
+   static const CgbColumn branch_cols[] = { CGB_Bc, CGB_Bcm, CGB_Bi, CGB_Bim };
+   int n = 0, i;
+
+   if (f->hdr->flags & CGB_FLAG_CACHE_SIM) {
+      for (i = 0; i < 9; i++) cols[n++] = cache_cols[i];
+   } else {
+      cols[n++] = CGB_Ir;
+   }
+   if (f->hdr->flags & CGB_FLAG_BRANCH_SIM) {
+      for (i = 0; i < 4; i++) cols[n++] = branch_cols[i];
+   }
+   return n;
+}
+
+static int convert(const CgbFile* f, OutKind kind, FILE* fp)
+{
+   const CgbHeader* h = f->hdr;
+   Bool   cache = (h->flags & CGB_FLAG_CACHE_SIM) != 0;
+   CgbColumn cols[CGB_N_COLS];
+   int    n_cols = cachegrind_cols(f, cols);
+   UInt   curr_file = CGB_NO_STR, curr_fn = CGB_NO_STR;
+   ULong  usage_sum[5 + MAX_NUM_BINS];
+   UInt   max_rows = 0, b, r;
+   Int*   lines = NULL;
+   ULong* vals  = NULL;
+   int    i;
+
+   memset(usage_sum, 0, sizeof(usage_sum));
+   print_header(fp, f);
+   print_events(fp, f, kind);
+
+   for (b = 0; b < h->n_blocks; b++) {
+      const CgbIndexEntry* e = &f->index[b];
+
+      if (e->n_rows > max_rows) {
+         max_rows = e->n_rows;
+         lines = realloc(lines, max_rows * sizeof(Int));
+         vals  = realloc(vals,  (size_t)max_rows * CGB_N_COLS * sizeof(ULong));
+         if (!lines || !vals) {
+            fprintf(stderr, "cg_bin2text: out of memory\n");
+            return -1;
+         }
+      }
+      if (cgb_decode_block(f, b, lines, vals) != 0) {
+         fprintf(stderr, "cg_bin2text: block %u is corrupt\n", b);
+         free(lines);
+         free(vals);
+         return -1;
+      }
+
+      for (r = 0; r < e->n_rows; r++) {
+         const ULong* v = &vals[(size_t)r * CGB_N_COLS];
+         Bool just_hit_a_new_file = False;
+
+         // Same fl=/fn= rules as the tool, which prints them for every
+         // line it visits, whether or not the line itself is printed.
+         if (e->file_str != curr_file) {
+            curr_file = e->file_str;
+            fprintf(fp, "fl=%s\n", cgb_string(f, curr_file));
+            just_hit_a_new_file = True;
+         }
+         if (just_hit_a_new_file || e->fn_str != curr_fn) {
+            curr_fn = e->fn_str;
+            fprintf(fp, "fn=%s\n", cgb_string(f, curr_fn));
+         }
+
+         if (kind == OutCachegrind) {
+            fprintf(fp, "%d", lines[r]);
+            for (i = 0; i < n_cols; i++)
+               fprintf(fp, " %llu", (unsigned long long)v[cols[i]]);
+            fprintf(fp, "\n");
+         } else {
+            ULong row[5 + MAX_NUM_BINS], total_line = 0;
+            cgb_usage_row(kind == OutUsageLL, v, row);
+            for (i = 0; i < MAX_NUM_BINS; i++) {
+               usage_sum[5+i] += row[5+i];
+               total_line     += row[5+i];
+            }
+            if (cache && total_line) {
+               for (i = 0; i < 5; i++)
+                  usage_sum[i] += row[i];
+               fprintf(fp, "%d %llu %llu %llu %llu %llu %llu",
+                       lines[r], (unsigned long long)row[0],
+                       (unsigned long long)row[1], (unsigned long long)row[2],
+                       (unsigned long long)row[3], (unsigned long long)row[4],
+                       (unsigned long long)total_line);
+               for (i = 0; i < MAX_NUM_BINS; i++)
+                  fprintf(fp, " %llu", (unsigned long long)row[5+i]);
+               fprintf(fp, "\n");
+            }
+         }
+      }
+   }
+
+   if (kind == OutCachegrind) {
+      fprintf(fp, "summary:");
+      for (i = 0; i < n_cols; i++)
+         fprintf(fp, " %llu", (unsigned long long)f->totals[cols[i]]);
+      fprintf(fp, "\n");
+   } else if (cache) {
+      ULong total = 0;
+      for (i = 0; i < MAX_NUM_BINS; i++)
+         total += usage_sum[5+i];
+      fprintf(fp, "summary: %llu %llu %llu %llu %llu %llu",
+              (unsigned long long)usage_sum[0], (unsigned long long)usage_sum[1],
+              (unsigned long long)usage_sum[2], (unsigned long long)usage_sum[3],
+              (unsigned long long)usage_sum[4], (unsigned long long)total);
+      for (i = 0; i < MAX_NUM_BINS; i++)
+         fprintf(fp, " %llu", (unsigned long long)usage_sum[5+i]);
+      fprintf(fp, "\n");
+   }
+
+   free(lines);
+   free(vals);
+   return 0;
+}
+
+static int convert_to(const CgbFile* f, OutKind kind, const char* name)
+{
+   FILE* fp = strcmp(name, "-") == 0 ? stdout : fopen(name, "w");
+   int   res;
+
+   if (!fp) {
+      fprintf(stderr, "cg_bin2text: can't open '%s' for writing\n", name);
+      return -1;
+   }
+   res = convert(f, kind, fp);
+   if (fp != stdout && fclose(fp) != 0)
+      res = -1;
+   return res;
+}
+
+static void usage(void)
+{
+   fprintf(stderr,
+      "usage: cg_bin2text [-o <cachegrind.out>] [-d <cacheusage.d1.out>]\n"
+      "                   [-l <cacheusage.ll.out>] <binary-file>\n");
+   exit(1);
+}
+
+int main(int argc, char** argv)
+{
+   const char* out_name[3] = { NULL, NULL, NULL };
+   const char* in_name = NULL;
+   const char* err;
+   CgbFile f;
+   int i, k, res = 0;
+
+   for (i = 1; i < argc; i++) {
+      if      (strcmp(argv[i], "-o") == 0 && i+1 < argc) out_name[OutCachegrind] = argv[++i];
+      else if (strcmp(argv[i], "-d") == 0 && i+1 < argc) out_name[OutUsageD1]    = argv[++i];
+      else if (strcmp(argv[i], "-l") == 0 && i+1 < argc) out_name[OutUsageLL]    = argv[++i];
+      else if (argv[i][0] == '-' || in_name)             usage();
+      else                                               in_name = argv[i];
+   }
+   if (!in_name)
+      usage();
+   if (!out_name[0] && !out_name[1] && !out_name[2])
+      out_name[OutCachegrind] = "-";
+
+   if (cgb_open(&f, in_name, &err) != 0) {
+      fprintf(stderr, "cg_bin2text: %s: %s\n", in_name, err);
+      return 1;
+   }
+   for (k = 0; k < 3; k++) {
+      if (out_name[k] && convert_to(&f, (OutKind)k, out_name[k]) != 0)
+         res = 1;
+   }
+   cgb_close(&f);
+   return res;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                            cg_bin2text.c ---*/
+/*--------------------------------------------------------------------*/
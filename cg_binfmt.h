@@ -0,0 +1,156 @@
+/*--------------------------------------------------------------------*/
+/*--- Cachegrind binary output format                  cg_binfmt.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Written by the tool (cg_main.c, --output-format=binary) and read by
+   cg_binread.c.  Shared between the two, so it only uses the basic
+   Valgrind types;  native code gets those from cg_native.h.
+
+   Layout (all fixed-size integers in host byte order):
+
+     CgbHeader                        patched in place once all else is out
+     blocks                           one per function, in CC table order:
+                                        varint line deltas (zigzag), then
+                                        for each present column, in column
+                                        order, one varint per row
+     string table at strtab_off:      UInt offsets[n_strings], then the
+                                        NUL-terminated strings
+     index at index_off (8-aligned):  CgbIndexEntry[n_blocks]
+     totals at totals_off:            ULong[CGB_N_COLS], all columns
+
+   Strings (file and function names, desc and cmd lines) are numbered in
+   order of first use.  Columns not in col_mask are simply absent from the
+   blocks; their totals are zero.
+*/
+
+#ifndef __CG_BINFMT_H
+#define __CG_BINFMT_H
+
+#define CGB_MAGIC    "CGBIN001"
+#define CGB_NO_STR   0xFFFFFFFFU
+
+typedef enum {
+   CGB_Ir, CGB_I1mr, CGB_ILmr,
+   CGB_Dr, CGB_D1mr, CGB_DLmr,
+   CGB_Dw, CGB_D1mw, CGB_DLmw,
+   CGB_Bc, CGB_Bcm, CGB_Bi, CGB_Bim,
+   // 3C split of the D1/LL misses above
+   CGB_D1mr_comp, CGB_D1mr_conf, CGB_D1mr_cap,
+   CGB_D1mw_comp, CGB_D1mw_conf, CGB_D1mw_cap,
+   CGB_DLmr_comp, CGB_DLmr_conf, CGB_DLmr_cap,
+   CGB_DLmw_comp, CGB_DLmw_conf, CGB_DLmw_cap,
+   // evictions with 1..8 words used
+   CGB_EvD1_1, CGB_EvD1_2, CGB_EvD1_3, CGB_EvD1_4,
+   CGB_EvD1_5, CGB_EvD1_6, CGB_EvD1_7, CGB_EvD1_8,
+   CGB_EvLL_1, CGB_EvLL_2, CGB_EvLL_3, CGB_EvLL_4,
+   CGB_EvLL_5, CGB_EvLL_6, CGB_EvLL_7, CGB_EvLL_8,
+   CGB_N_COLS
+} CgbColumn;
+
+#define CGB_COL(c)   (1ULL << (c))
+
+// Column groups, as selected by the tool's options.
+#define CGB_COLS_IR      CGB_COL(CGB_Ir)
+#define CGB_COLS_CACHE   (CGB_COL(CGB_I1mr) | CGB_COL(CGB_ILmr)         \
+                          | CGB_COL(CGB_Dr) | CGB_COL(CGB_D1mr)         \
+                          | CGB_COL(CGB_DLmr) | CGB_COL(CGB_Dw)         \
+                          | CGB_COL(CGB_D1mw) | CGB_COL(CGB_DLmw)       \
+                          | (0xFFULL << CGB_EvD1_1)                     \
+                          | (0xFFULL << CGB_EvLL_1))
+#define CGB_COLS_BRANCH  (CGB_COL(CGB_Bc) | CGB_COL(CGB_Bcm)            \
+                          | CGB_COL(CGB_Bi) | CGB_COL(CGB_Bim))
+#define CGB_COLS_3C_D1   (0x3FULL << CGB_D1mr_comp)
+#define CGB_COLS_3C_LL   (0x3FULL << CGB_DLmr_comp)
+
+#define CGB_FLAG_CACHE_SIM   0x1
+#define CGB_FLAG_BRANCH_SIM  0x2
+
+typedef struct {
+   HChar magic[8];
+   UInt  flags;           // CGB_FLAG_*
+   UInt  thread;          // thread serial, 0 for the aggregate
+   UInt  tid;             // and its ThreadId
+   UInt  cmd_str;
+   ULong col_mask;        // CGB_COL() of each column present in blocks
+   UInt  desc_str[3];     // I1/D1/LL desc lines, or CGB_NO_STR
+   UInt  n_strings;
+   UInt  n_blocks;
+   UInt  pad;
+   ULong n_rows;
+   ULong strtab_off;
+   ULong index_off;
+   ULong totals_off;
+} CgbHeader;
+
+typedef struct {
+   UInt  file_str;
+   UInt  fn_str;
+   UInt  n_rows;
+   UInt  size;            // bytes of block data
+   ULong offset;          // from the start of the file
+} CgbIndexEntry;
+
+/* LEB128, at most 10 bytes for a ULong.  Zigzag for the signed line
+   deltas. */
+#define CGB_MAX_VARINT  10
+
+static __inline__ UInt cgb_put_varint(UChar* p, ULong v)
+{
+   UInt n = 0;
+   while (v >= 0x80) {
+      p[n++] = (UChar)(v | 0x80);
+      v >>= 7;
+   }
+   p[n++] = (UChar)v;
+   return n;
+}
+
+static __inline__ ULong cgb_get_varint(const UChar** pp)
+{
+   const UChar* p = *pp;
+   ULong v = 0;
+   UInt  shift = 0;
+   while (*p & 0x80) {
+      v |= (ULong)(*p++ & 0x7F) << shift;
+      shift += 7;
+   }
+   v |= (ULong)*p++ << shift;
+   *pp = p;
+   return v;
+}
+
+static __inline__ ULong cgb_zigzag(Long v)
+{
+   return ((ULong)v << 1) ^ (ULong)(v >> 63);
+}
+
+static __inline__ Long cgb_unzigzag(ULong v)
+{
+   return (Long)(v >> 1) ^ -(Long)(v & 1);
+}
+
+#endif   // __CG_BINFMT_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                              cg_binfmt.h ---*/
+/*--------------------------------------------------------------------*/
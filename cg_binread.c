@@ -0,0 +1,230 @@
+/*--------------------------------------------------------------------*/
+/*--- Reader for Cachegrind binary output              cg_binread.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cg_binread.h"
+
+static const char* const col_names[CGB_N_COLS] = {
+   "Ir", "I1mr", "ILmr",
+   "Dr", "D1mr", "DLmr",
+   "Dw", "D1mw", "DLmw",
+   "Bc", "Bcm", "Bi", "Bim",
+   "D1mr.comp", "D1mr.conf", "D1mr.cap",
+   "D1mw.comp", "D1mw.conf", "D1mw.cap",
+   "DLmr.comp", "DLmr.conf", "DLmr.cap",
+   "DLmw.comp", "DLmw.conf", "DLmw.cap",
+   "EvD1.1w", "EvD1.2w", "EvD1.3w", "EvD1.4w",
+   "EvD1.5w", "EvD1.6w", "EvD1.7w", "EvD1.8w",
+   "EvLL.1w", "EvLL.2w", "EvLL.3w", "EvLL.4w",
+   "EvLL.5w", "EvLL.6w", "EvLL.7w", "EvLL.8w",
+};
+
+static int fail(const char** err, const char* why)
+{
+   if (err) *err = why;
+   return -1;
+}
+
+int cgb_open(CgbFile* f, const char* path, const char** err)
+{
+   struct stat st;
+   const CgbHeader* h;
+   int  fd;
+   UInt i;
+
+   memset(f, 0, sizeof(*f));
+   fd = open(path, O_RDONLY);
+   if (fd < 0)
+      return fail(err, "can't open file");
+   if (fstat(fd, &st) != 0 || (SizeT)st.st_size < sizeof(CgbHeader)) {
+      close(fd);
+      return fail(err, "file too short");
+   }
+   f->size = st.st_size;
+   f->base = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (f->base == MAP_FAILED) {
+      f->base = NULL;
+      return fail(err, "can't map file");
+   }
+
+   h = f->hdr = (const CgbHeader*)f->base;
+   if (memcmp(h->magic, CGB_MAGIC, sizeof(h->magic)) != 0) {
+      cgb_close(f);
+      return fail(err, "not a Cachegrind binary output file");
+   }
+   if (h->strtab_off > f->size
+       || (f->size - h->strtab_off) / sizeof(UInt) < h->n_strings
+       || h->index_off > f->size || (h->index_off & 7)
+       || (f->size - h->index_off) / sizeof(CgbIndexEntry) < h->n_blocks
+       || h->totals_off > f->size
+       || f->size - h->totals_off < CGB_N_COLS * sizeof(ULong)) {
+      cgb_close(f);
+      return fail(err, "bad section offsets");
+   }
+   f->str_offs = (const UInt*)(f->base + h->strtab_off);
+   f->str_data = (const HChar*)(f->str_offs + h->n_strings);
+   f->index    = (const CgbIndexEntry*)(f->base + h->index_off);
+   f->totals   = (const ULong*)(f->base + h->totals_off);
+
+   // Every string must be terminated before the index starts, and every
+   // block must lie before the string table.
+   for (i = 0; i < h->n_strings; i++) {
+      const HChar* end = (const HChar*)(f->base + h->index_off);
+      if (f->str_data > end || f->str_offs[i] >= (SizeT)(end - f->str_data)
+          || !memchr(f->str_data + f->str_offs[i], '\0',
+                     end - (f->str_data + f->str_offs[i]))) {
+         cgb_close(f);
+         return fail(err, "bad string table");
+      }
+   }
+   for (i = 0; i < h->n_blocks; i++) {
+      const CgbIndexEntry* e = &f->index[i];
+      if (e->offset < sizeof(CgbHeader) || e->offset > h->strtab_off
+          || h->strtab_off - e->offset < e->size
+          || e->file_str >= h->n_strings || e->fn_str >= h->n_strings) {
+         cgb_close(f);
+         return fail(err, "bad index");
+      }
+   }
+   return 0;
+}
+
+void cgb_close(CgbFile* f)
+{
+   if (f->base)
+      munmap((void*)f->base, f->size);
+   memset(f, 0, sizeof(*f));
+}
+
+const char* cgb_string(const CgbFile* f, UInt id)
+{
+   if (id == CGB_NO_STR || id >= f->hdr->n_strings)
+      return NULL;
+   return f->str_data + f->str_offs[id];
+}
+
+Bool cgb_has_col(const CgbFile* f, CgbColumn c)
+{
+   return (f->hdr->col_mask & CGB_COL(c)) != 0;
+}
+
+const char* cgb_col_name(CgbColumn c)
+{
+   return c < CGB_N_COLS ? col_names[c] : "?";
+}
+
+// Like cgb_get_varint, but never reads at or past 'end'.
+static int get_varint(const UChar** pp, const UChar* end, ULong* v)
+{
+   const UChar* p = *pp;
+   UInt shift = 0;
+
+   *v = 0;
+   while (p < end && shift < 64) {
+      UChar b = *p++;
+      *v |= (ULong)(b & 0x7F) << shift;
+      if (!(b & 0x80)) {
+         *pp = p;
+         return 0;
+      }
+      shift += 7;
+   }
+   return -1;
+}
+
+int cgb_decode_block(const CgbFile* f, UInt b, Int* lines, ULong* vals)
+{
+   const CgbIndexEntry* e;
+   const UChar *p, *end;
+   ULong v;
+   Long  line = 0;
+   UInt  r, c;
+
+   if (b >= f->hdr->n_blocks)
+      return -1;
+   e   = &f->index[b];
+   p   = f->base + e->offset;
+   end = p + e->size;
+
+   for (r = 0; r < e->n_rows; r++) {
+      if (get_varint(&p, end, &v) != 0)
+         return -1;
+      line += cgb_unzigzag(v);
+      lines[r] = (Int)line;
+   }
+   memset(vals, 0, (SizeT)e->n_rows * CGB_N_COLS * sizeof(ULong));
+   for (c = 0; c < CGB_N_COLS; c++) {
+      if (!(f->hdr->col_mask & CGB_COL(c)))
+         continue;
+      for (r = 0; r < e->n_rows; r++) {
+         if (get_varint(&p, end, &vals[(SizeT)r * CGB_N_COLS + c]) != 0)
+            return -1;
+      }
+   }
+   return p == end ? 0 : -1;
+}
+
+void cgb_usage_row(Bool ll, const ULong* v, ULong* out)
+{
+   int i;
+
+   if (!ll) {
+      out[0] = v[CGB_Dr] + v[CGB_Dw];
+      out[1] = v[CGB_D1mr] + v[CGB_D1mw];
+      out[2] = v[CGB_D1mr_comp] + v[CGB_D1mw_comp];
+      out[3] = v[CGB_D1mr_conf] + v[CGB_D1mw_conf];
+      out[4] = v[CGB_D1mr_cap]  + v[CGB_D1mw_cap];
+      for (i = 0; i < CGB_N_BINS; i++) out[5+i] = v[CGB_EvD1_1 + i];
+   } else {
+      out[0] = v[CGB_D1mr] + v[CGB_D1mw];
+      out[1] = v[CGB_DLmr] + v[CGB_DLmw];
+      out[2] = v[CGB_DLmr_comp] + v[CGB_DLmw_comp];
+      out[3] = v[CGB_DLmr_conf] + v[CGB_DLmw_conf];
+      out[4] = v[CGB_DLmr_cap]  + v[CGB_DLmw_cap];
+      for (i = 0; i < CGB_N_BINS; i++) out[5+i] = v[CGB_EvLL_1 + i];
+   }
+}
+
+long cgb_find_fn(const CgbFile* f, const char* file, const char* fn)
+{
+   UInt i;
+
+   for (i = 0; i < f->hdr->n_blocks; i++) {
+      const CgbIndexEntry* e = &f->index[i];
+      if (strcmp(cgb_string(f, e->fn_str), fn) == 0
+          && (!file || strcmp(cgb_string(f, e->file_str), file) == 0))
+         return i;
+   }
+   return -1;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                             cg_binread.c ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,83 @@
+/*--------------------------------------------------------------------*/
+/*--- Reader for Cachegrind binary output              cg_binread.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* A small library for reading --output-format=binary files.  The file
+   is mapped, not read:  opening costs a validation pass over the index
+   and string table, and a function's rows are only decoded when asked
+   for, so tools can jump straight to the functions they care about. */
+
+#ifndef __CG_BINREAD_H
+#define __CG_BINREAD_H
+
+#include "cg_native.h"
+#include "cg_binfmt.h"
+
+typedef struct {
+   const UChar*         base;
+   SizeT                size;
+   const CgbHeader*     hdr;
+   const UInt*          str_offs;   // hdr->n_strings entries
+   const HChar*         str_data;
+   const CgbIndexEntry* index;      // hdr->n_blocks entries
+   const ULong*         totals;     // CGB_N_COLS entries
+} CgbFile;
+
+/* Map and check 'path'.  Returns 0 on success;  otherwise -1, with
+   '*err' pointing at a description. */
+int cgb_open(CgbFile* f, const char* path, const char** err);
+void cgb_close(CgbFile* f);
+
+/* String 'id', or NULL for CGB_NO_STR. */
+const char* cgb_string(const CgbFile* f, UInt id);
+
+/* Whether column 'c' was recorded. */
+Bool cgb_has_col(const CgbFile* f, CgbColumn c);
+
+/* The name used for column 'c' in cachegrind.out "events:" lines, or a
+   descriptive one for the columns that have no such name. */
+const char* cgb_col_name(CgbColumn c);
+
+/* Decode block 'b' into lines[n_rows] and vals[n_rows * CGB_N_COLS],
+   row-major;  absent columns read as zero.  Returns 0, or -1 if the block
+   is corrupt. */
+int cgb_decode_block(const CgbFile* f, UInt b, Int* lines, ULong* vals);
+
+/* The cacheusage files' eviction histogram has a bin per word of a
+   line:  CGB_EvD1_1..8 and CGB_EvLL_1..8. */
+#define CGB_N_BINS  8
+
+/* A cacheusage row from a line's column values 'v':  Access# Miss# Comp#
+   Conf# Cap# and then the CGB_N_BINS bins, for D1 or, if 'll', for LL.
+   D1 "accesses" are all D refs;  LL ones are the D1 misses. */
+void cgb_usage_row(Bool ll, const ULong* v, ULong* out);
+
+/* Index of the block for function 'fn' in file 'file' (file may be NULL
+   to match any), or -1. */
+long cgb_find_fn(const CgbFile* f, const char* file, const char* fn);
+
+#endif   // __CG_BINREAD_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                             cg_binread.h ---*/
+/*--------------------------------------------------------------------*/
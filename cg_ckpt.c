@@ -0,0 +1,546 @@
+/*--------------------------------------------------------------------*/
+/*--- Cache state checkpointing                          cg_ckpt.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Notes:
+  - saves/restores everything the simulator in cg_sim.c and cg_helper.c
+    carries from one access to the next: I1/D1/LL tags, LRU order and
+    word-usage bitvectors, the INFI bitmaps and the FA LRU stacks.
+    Counters are not part of the state; they stay with the run.
+  - the file is an image of the in-memory arrays, written and read back
+    with one bulk transfer per array, so loading involves no parsing.
+    Tools can't map files themselves, hence read() rather than mmap().
+  - cachelines point at the eviction bins (EvictCC) of the line that
+    brought them in.  Those are saved as an index into a table of
+    (file, fn, line) locations and resolved against the CC table again
+    on load, to the shared counters' bins.
+  - the file is only meaningful for the same cache configuration, LL
+    page map and host word size; all are checked on load.
+  - loading reads and checks the whole file before it touches the
+    simulator, so a bad file leaves the state as it was.  The LRU rows
+    are checked to be orders of their set's ways, as they index it.
+
+  Layout (all integers in host byte order):
+    CkptHeader
+    location table:   n_locs x { UInt file_len, fn_len; Int line;
+                                 file bytes; fn bytes }
+    for I1, D1, LL:   cacheline_t[sets*assoc]   (src fields junk)
+                      UInt loc_idx[sets*assoc]   (0 = none, else 1+idx)
+                      UInt lru_list[sets*assoc]
+    INFI:             Int n_ranges, then per range
+                      { Addr addr; ULong bitmap[INFI_BITMAP_WORDS] }
+    FA_D1, FA_LL:     Int n_blocks, then UWord block_addr[n_blocks]
+                      from MRU to LRU (n_blocks == 0 if not in use)
+*/
+
+#define CKPT_MAGIC    "CGCKPT03"
+#define CKPT_IO_CHUNK (1 << 20)
+
+typedef struct {
+   HChar magic[8];
+   UInt  word_size;
+   UInt  cacheline_size;               /* sizeof(cacheline_t) */
+   Int   geom[3][3];                   /* I1/D1/LL size, assoc, line_size */
+   UInt  n_locs;
+   LLMap ll_map;                       /* see cg_sim.c */
+} CkptHeader;
+
+// Line id -> location index, only used while saving.
+typedef struct _CkptLoc {
+   struct _CkptLoc* next;
+   UWord            key;               /* EvictCC.id */
+   UInt             idx;
+} CkptLoc;
+
+// Defined in cg_main.c, which includes this file before its CC table
+// operations.
+static const CodeLoc* evict_cc_loc(const EvictCC* ev);
+static EvictCC* evict_cc_from_loc(const HChar* file, const HChar* fn,
+                                  Int line);
+
+static Bool ckpt_write(Int fd, const void* buf, SizeT len)
+{
+   const UChar* p = buf;
+   while (len > 0) {
+      Int n = len > CKPT_IO_CHUNK ? CKPT_IO_CHUNK : (Int)len;
+      if (VG_(write)(fd, p, n) != n)
+         return False;
+      p   += n;
+      len -= n;
+   }
+   return True;
+}
+
+static Bool ckpt_read(Int fd, void* buf, SizeT len)
+{
+   UChar* p = buf;
+   while (len > 0) {
+      Int n = len > CKPT_IO_CHUNK ? CKPT_IO_CHUNK : (Int)len;
+      if (VG_(read)(fd, p, n) != n)
+         return False;
+      p   += n;
+      len -= n;
+   }
+   return True;
+}
+
+static void ckpt_fill_geom(Int geom[3][3])
+{
+   cache_t2* caches[3] = { &I1, &D1, &LL };
+   Int i;
+   for (i = 0; i < 3; i++) {
+      geom[i][0] = caches[i]->size;
+      geom[i][1] = caches[i]->assoc;
+      geom[i][2] = caches[i]->line_size;
+   }
+}
+
+/*------------------------------------------------------------*/
+/*--- Saving                                               ---*/
+/*------------------------------------------------------------*/
+
+static UInt ckpt_loc_index(VgHashTable* locs, XArray* order, EvictCC* ev)
+{
+   const CodeLoc* loc;
+   CkptLoc*       l;
+
+   if (ev == NULL)
+      return 0;
+
+   l = VG_(HT_lookup)(locs, ev->id);
+   if (l == NULL) {
+      loc    = evict_cc_loc(ev);
+      l      = VG_(malloc)("cg.ckpt.cli.1", sizeof(CkptLoc));
+      l->key = ev->id;
+      l->idx = VG_(sizeXA)(order);
+      VG_(addToXA)(order, &loc);
+      VG_(HT_add_node)(locs, l);
+   }
+   return 1 + l->idx;
+}
+
+static Bool ckpt_save_cache(Int fd, cache_t2* c, UInt* loc_idx)
+{
+   Int n = c->sets * c->assoc;
+
+   return ckpt_write(fd, c->cachelines, n * sizeof(cacheline_t))
+       && ckpt_write(fd, loc_idx,       n * sizeof(UInt))
+       && ckpt_write(fd, c->lru_list,   n * sizeof(UInt));
+}
+
+static Bool ckpt_save_fa(Int fd, cache_fa* c)
+{
+   Int         i, n = c->table ? c->num_blocks : 0;
+   UWord*      addrs;
+   CacheBlock* b;
+   Bool        ok;
+
+   if (!ckpt_write(fd, &n, sizeof(Int)))
+      return False;
+   if (n == 0)
+      return True;
+
+   addrs = VG_(malloc)("cg.ckpt.csf.1", n * sizeof(UWord));
+   for (i = 0, b = c->top; i < n; i++, b = b->down)
+      addrs[i] = b->block_addr;
+   ok = ckpt_write(fd, addrs, n * sizeof(UWord));
+   VG_(free)(addrs);
+   return ok;
+}
+
+static Bool ckpt_save_infi(Int fd, cache_infi* c)
+{
+   Int i;
+
+   if (!ckpt_write(fd, &c->cur_num_ranges, sizeof(Int)))
+      return False;
+   for (i = 0; i < c->cur_num_ranges; i++) {
+      if (!ckpt_write(fd, &c->ranges[i].addr, sizeof(Addr))
+          || !ckpt_write(fd, c->ranges[i].bitmap,
+                         INFI_BITMAP_WORDS * sizeof(ULong)))
+         return False;
+   }
+   return True;
+}
+
+// Returns False if the state could not be written.
+static Bool cachesim_save_state(const HChar* file)
+{
+   cache_t2*    caches[3] = { &I1, &D1, &LL };
+   UInt*        loc_idx[3];
+   VgHashTable* locs;
+   XArray*      order;
+   CkptHeader   hdr;
+   SysRes       sres;
+   Int          fd, i, j;
+   Bool         ok;
+
+   sres = VG_(open)(file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                          VKI_S_IRUSR|VKI_S_IWUSR);
+   if (sr_isError(sres)) {
+      VG_(umsg)("error: can't open cache state file '%s' for writing\n",
+                file);
+      return False;
+   }
+   fd = sr_Res(sres);
+
+   // Number the lines referenced from cachelines.
+   locs  = VG_(HT_construct)("cg.ckpt.css.1");
+   order = VG_(newXA)(VG_(malloc), "cg.ckpt.css.2", VG_(free),
+                      sizeof(CodeLoc*));
+   for (i = 0; i < 3; i++) {
+      Int n = caches[i]->sets * caches[i]->assoc;
+      loc_idx[i] = VG_(malloc)("cg.ckpt.css.3", n * sizeof(UInt));
+      for (j = 0; j < n; j++)
+         loc_idx[i][j] = ckpt_loc_index(locs, order,
+                                        caches[i]->cachelines[j].src);
+   }
+
+   VG_(memset)(&hdr, 0, sizeof(hdr));
+   VG_(memcpy)(hdr.magic, CKPT_MAGIC, sizeof(hdr.magic));
+   hdr.word_size      = sizeof(UWord);
+   hdr.cacheline_size = sizeof(cacheline_t);
+   hdr.n_locs         = VG_(sizeXA)(order);
+   hdr.ll_map         = LL_map;
+   ckpt_fill_geom(hdr.geom);
+
+   ok = ckpt_write(fd, &hdr, sizeof(hdr));
+
+   for (i = 0; ok && i < hdr.n_locs; i++) {
+      const CodeLoc* loc = *(const CodeLoc**)VG_(indexXA)(order, i);
+      UInt           lens[2];
+      lens[0] = VG_(strlen)(loc->file);
+      lens[1] = VG_(strlen)(loc->fn);
+      ok = ckpt_write(fd, lens, sizeof(lens))
+        && ckpt_write(fd, &loc->line, sizeof(Int))
+        && ckpt_write(fd, loc->file, lens[0])
+        && ckpt_write(fd, loc->fn, lens[1]);
+   }
+
+   for (i = 0; ok && i < 3; i++)
+      ok = ckpt_save_cache(fd, caches[i], loc_idx[i]);
+
+   ok = ok && ckpt_save_infi(fd, &INFI)
+           && ckpt_save_fa(fd, &FA_D1)
+           && ckpt_save_fa(fd, &FA_LL);
+
+   VG_(close)(fd);
+
+   for (i = 0; i < 3; i++)
+      VG_(free)(loc_idx[i]);
+   VG_(deleteXA)(order);
+   VG_(HT_destruct)(locs, VG_(free));
+
+   if (!ok)
+      VG_(umsg)("error: failed writing cache state file '%s'\n", file);
+   return ok;
+}
+
+/*------------------------------------------------------------*/
+/*--- Loading                                              ---*/
+/*------------------------------------------------------------*/
+
+/* A state file is read and checked in full into a CkptState first, and
+   only then put in place, so a file that turns out to be bad leaves the
+   simulator as it was. */
+typedef struct {
+   UInt         n_locs;
+   HChar**      loc_strs;          /* file, NUL, fn, NUL */
+   UInt*        loc_fns;           /* where fn starts in loc_strs */
+   Int*         loc_lines;
+   cacheline_t* lines[3];          /* I1, D1, LL */
+   UInt*        loc_idx[3];
+   UInt*        lru_list[3];
+   Int          n_ranges;
+   MemRange*    ranges;
+   Int          n_blocks[2];       /* FA_D1, FA_LL;  -1 if skipped */
+   UWord*       block_addrs[2];
+} CkptState;
+
+static void ckpt_free_state(CkptState* st)
+{
+   Int i;
+
+   for (i = 0; i < (Int)st->n_locs; i++)
+      VG_(free)(st->loc_strs[i]);
+   VG_(free)(st->loc_strs);
+   VG_(free)(st->loc_fns);
+   VG_(free)(st->loc_lines);
+   for (i = 0; i < 3; i++) {
+      VG_(free)(st->lines[i]);
+      VG_(free)(st->loc_idx[i]);
+      VG_(free)(st->lru_list[i]);
+   }
+   for (i = 0; i < st->n_ranges; i++)
+      VG_(free)(st->ranges[i].bitmap);
+   VG_(free)(st->ranges);
+   for (i = 0; i < 2; i++)
+      VG_(free)(st->block_addrs[i]);
+}
+
+static Bool ckpt_read_locs(Int fd, CkptState* st, UInt n_locs)
+{
+   UInt i;
+
+   if (n_locs == 0)
+      return True;
+   st->loc_strs  = VG_(calloc)("cg.ckpt.crl.1", n_locs, sizeof(HChar*));
+   st->loc_fns   = VG_(malloc)("cg.ckpt.crl.2", n_locs * sizeof(UInt));
+   st->loc_lines = VG_(malloc)("cg.ckpt.crl.3", n_locs * sizeof(Int));
+   for (i = 0; i < n_locs; i++) {
+      UInt lens[2];
+      if (!ckpt_read(fd, lens, sizeof(lens))
+          || !ckpt_read(fd, &st->loc_lines[i], sizeof(Int))
+          || lens[0] >= VKI_PATH_MAX || lens[1] >= VKI_PATH_MAX)
+         return False;
+      st->loc_strs[i] = VG_(malloc)("cg.ckpt.crl.4", lens[0] + lens[1] + 2);
+      st->loc_fns[i]  = lens[0] + 1;
+      st->n_locs++;
+      if (!ckpt_read(fd, st->loc_strs[i], lens[0])
+          || !ckpt_read(fd, st->loc_strs[i] + lens[0] + 1, lens[1]))
+         return False;
+      st->loc_strs[i][lens[0]] = '\0';
+      st->loc_strs[i][lens[0] + 1 + lens[1]] = '\0';
+   }
+   return True;
+}
+
+// Every set's LRU row must be an order of its ways, as the simulator
+// indexes the set's lines with it.
+static Bool ckpt_lru_ok(const cache_t2* c, const UInt* lru_list)
+{
+   UChar* seen = VG_(malloc)("cg.ckpt.clo.1", c->assoc);
+   Bool   ok   = True;
+   Int    s, w;
+
+   for (s = 0; ok && s < c->sets; s++) {
+      const UInt* row = &lru_list[s * c->assoc];
+      VG_(memset)(seen, 0, c->assoc);
+      for (w = 0; ok && w < c->assoc; w++) {
+         ok = row[w] < (UInt)c->assoc && !seen[row[w]];
+         if (ok)
+            seen[row[w]] = 1;
+      }
+   }
+   VG_(free)(seen);
+   return ok;
+}
+
+static Bool ckpt_read_cache(Int fd, const cache_t2* c, CkptState* st,
+                            Int k)
+{
+   Int n = c->sets * c->assoc;
+   Int j;
+
+   st->lines[k]    = VG_(malloc)("cg.ckpt.crc.1", n * sizeof(cacheline_t));
+   st->loc_idx[k]  = VG_(malloc)("cg.ckpt.crc.2", n * sizeof(UInt));
+   st->lru_list[k] = VG_(malloc)("cg.ckpt.crc.3", n * sizeof(UInt));
+   if (!ckpt_read(fd, st->lines[k],    n * sizeof(cacheline_t))
+       || !ckpt_read(fd, st->loc_idx[k],  n * sizeof(UInt))
+       || !ckpt_read(fd, st->lru_list[k], n * sizeof(UInt)))
+      return False;
+   for (j = 0; j < n; j++) {
+      if (st->loc_idx[k][j] > st->n_locs)
+         return False;
+   }
+   return ckpt_lru_ok(c, st->lru_list[k]);
+}
+
+static Bool ckpt_read_infi(Int fd, CkptState* st, Long left)
+{
+   Int i, n;
+
+   if (!ckpt_read(fd, &n, sizeof(Int)) || n < 0
+       || n > left / (Long)(sizeof(Addr) + INFI_BITMAP_WORDS * sizeof(ULong)))
+      return False;
+   if (n == 0)
+      return True;
+
+   st->ranges = VG_(calloc)("cg.ckpt.cri.1", n, sizeof(MemRange));
+   for (i = 0; i < n; i++) {
+      st->ranges[i].bitmap = VG_(calloc)("InfiCache.bitmap",
+                                         RANGE_SIZE / sizeof(long),
+                                         sizeof(long));
+      st->n_ranges++;
+      if (!ckpt_read(fd, &st->ranges[i].addr, sizeof(Addr))
+          || !ckpt_read(fd, st->ranges[i].bitmap,
+                        INFI_BITMAP_WORDS * sizeof(ULong)))
+         return False;
+      // The ranges are kept sorted, and aligned, by cacheinfi.
+      if ((st->ranges[i].addr & ~RANGE_MASK) != 0
+          || (i > 0 && st->ranges[i].addr <= st->ranges[i-1].addr))
+         return False;
+   }
+   return True;
+}
+
+static Bool ckpt_read_fa(Int fd, const cache_fa* c, CkptState* st, Int k)
+{
+   Int n;
+
+   if (!ckpt_read(fd, &n, sizeof(Int)) || n < 0)
+      return False;
+   st->n_blocks[k] = n;
+   if (n == 0)
+      return True;
+   // A mode without this FA cache loads a state that has one: skip it.
+   if (c->table == NULL) {
+      st->n_blocks[k] = -1;
+      return VG_(lseek)(fd, n * sizeof(UWord), VKI_SEEK_CUR) >= 0;
+   }
+   if (n != c->num_blocks)
+      return False;
+   st->block_addrs[k] = VG_(malloc)("cg.ckpt.crf.1", n * sizeof(UWord));
+   return ckpt_read(fd, st->block_addrs[k], n * sizeof(UWord));
+}
+
+static void ckpt_commit_cache(cache_t2* c, CkptState* st, Int k,
+                              EvictCC** evs)
+{
+   Int j, n = c->sets * c->assoc;
+
+   VG_(memcpy)(c->cachelines, st->lines[k], n * sizeof(cacheline_t));
+   VG_(memcpy)(c->lru_list, st->lru_list[k], n * sizeof(UInt));
+   for (j = 0; j < n; j++) {
+      UInt idx = st->loc_idx[k][j];
+      c->cachelines[j].src = idx == 0 ? NULL : evs[idx - 1];
+   }
+}
+
+// Takes the ranges over from 'st'.
+static void ckpt_commit_infi(cache_infi* c, CkptState* st)
+{
+   Int i;
+
+   for (i = 0; i < c->cur_num_ranges; i++)
+      VG_(free)(c->ranges[i].bitmap);
+   VG_(free)(c->ranges);
+   c->ranges         = st->ranges;
+   c->cur_num_ranges = st->n_ranges;
+   c->max_num_ranges = st->n_ranges;
+   st->ranges   = NULL;
+   st->n_ranges = 0;
+}
+
+static void ckpt_commit_fa(cache_fa* c, CkptState* st, Int k)
+{
+   Int i, n = st->n_blocks[k];
+
+   if (n <= 0)
+      return;
+   // Rebuild the circular list in saved MRU..LRU order, and the hash.
+   for (i = 0; i < c->table->size; i++)
+      c->table->buckets[i] = NULL;
+   for (i = 0; i < n; i++) {
+      CacheBlock* b = &c->blocks_list[i];
+      b->block_addr = st->block_addrs[k][i];
+      b->down       = &c->blocks_list[(i + 1) % n];
+      b->up         = &c->blocks_list[(i + n - 1) % n];
+      b->bucket     = NULL;
+      if (b->block_addr) {
+         Int bucket_id = b->block_addr % c->table->size;
+         b->bucket = c->table->buckets[bucket_id];
+         c->table->buckets[bucket_id] = b;
+      }
+   }
+   c->top = c->blocks_list;
+}
+
+// Returns False, with the simulator state untouched, if the state could
+// not be loaded.
+static Bool cachesim_load_state(const HChar* file)
+{
+   cache_t2*   caches[3] = { &I1, &D1, &LL };
+   cache_fa*   fas[2]    = { &FA_D1, &FA_LL };
+   EvictCC**   evs = NULL;
+   CkptState   st;
+   CkptHeader  hdr;
+   Int         geom[3][3];
+   SysRes      sres;
+   Long        size;
+   Int         fd, i;
+   Bool        ok;
+
+   sres = VG_(open)(file, VKI_O_RDONLY, 0);
+   if (sr_isError(sres)) {
+      VG_(umsg)("error: can't open cache state file '%s'\n", file);
+      return False;
+   }
+   fd   = sr_Res(sres);
+   size = VG_(fsize)(fd);
+
+   ckpt_fill_geom(geom);
+   if (!ckpt_read(fd, &hdr, sizeof(hdr))
+       || VG_(memcmp)(hdr.magic, CKPT_MAGIC, sizeof(hdr.magic)) != 0
+       || hdr.word_size != sizeof(UWord)
+       || hdr.cacheline_size != sizeof(cacheline_t)) {
+      VG_(umsg)("error: '%s' is not a cache state file for this platform\n",
+                file);
+      VG_(close)(fd);
+      return False;
+   }
+   if (VG_(memcmp)(hdr.geom, geom, sizeof(geom)) != 0
+       || VG_(memcmp)(&hdr.ll_map, &LL_map, sizeof(LLMap)) != 0) {
+      VG_(umsg)("error: cache state file '%s' was saved with a different\n"
+                "       cache configuration; not loading it\n", file);
+      VG_(close)(fd);
+      return False;
+   }
+
+   // Each location takes at least its lengths and line number.
+   VG_(memset)(&st, 0, sizeof(st));
+   ok = size >= 0
+     && hdr.n_locs <= (size - (Long)sizeof(hdr)) / (3 * sizeof(UInt))
+     && ckpt_read_locs(fd, &st, hdr.n_locs);
+   for (i = 0; ok && i < 3; i++)
+      ok = ckpt_read_cache(fd, caches[i], &st, i);
+   ok = ok && ckpt_read_infi(fd, &st, size - VG_(lseek)(fd, 0, VKI_SEEK_CUR))
+           && ckpt_read_fa(fd, fas[0], &st, 0)
+           && ckpt_read_fa(fd, fas[1], &st, 1);
+   VG_(close)(fd);
+
+   if (ok) {
+      if (st.n_locs > 0)
+         evs = VG_(malloc)("cg.ckpt.cls.1", st.n_locs * sizeof(EvictCC*));
+      for (i = 0; i < (Int)st.n_locs; i++) {
+         const HChar* strs = st.loc_strs[i];
+         evs[i] = evict_cc_from_loc(strs, strs + st.loc_fns[i],
+                                    st.loc_lines[i]);
+      }
+      for (i = 0; i < 3; i++)
+         ckpt_commit_cache(caches[i], &st, i, evs);
+      ckpt_commit_infi(&INFI, &st);
+      ckpt_commit_fa(fas[0], &st, 0);
+      ckpt_commit_fa(fas[1], &st, 1);
+      VG_(free)(evs);
+   } else {
+      VG_(umsg)("error: cache state file '%s' is truncated or corrupt\n",
+                file);
+   }
+   ckpt_free_state(&st);
+   return ok;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                cg_ckpt.c ---*/
+/*--------------------------------------------------------------------*/
@@ -21,6 +21,9 @@
 #define BITMAP_MASK ((((long)1 << LOG2RANGE) - 1) & ~BM_BLOCK_MASK & ~CB_MASK)
 #define RANGE_MASK (~(((long)1 << LOG2RANGE) - 1))
 
+/* number of bitmap words actually indexed within one range */
+#define INFI_BITMAP_WORDS (1 << (LOG2RANGE - LOG2BM_BLOCK))
+
 VgFile  *cu_fp = NULL;
 
 typedef struct {
@@ -314,12 +317,18 @@ Bool cacheinfi_ref_is_miss(cache_infi* c, Addr a, UChar size)
         return cacheinfi_handle_access(c, a, size);
     else
     {
-        size1 = (1 << LOG2CB) - (CB_MASK & a) - 1; //TODO using c->line_size_bits 
-        a1 = a + size1 + 1;
-        if(!cacheinfi_handle_access(c, a, size1))
-           return cacheinfi_handle_access(c, a1, size - size1);
-        else
+        Bool miss1;
+
+        size1 = (1 << LOG2CB) - (CB_MASK & a); //TODO using c->line_size_bits 
+        a1 = a + size1;
+
+        /* always do both, as state is updated as side effect: the
+           D1 helpers rely on every block that reaches D1 being
+           recorded here */
+        miss1 = cacheinfi_handle_access(c, a, size1);
+        if(cacheinfi_handle_access(c, a1, size - size1))
            return True;
+        return miss1;
     }
 }
 
@@ -336,11 +345,15 @@ Bool cachefa_ref_is_miss(cache_fa* c, Addr a, UChar size)
         return cachefa_handle_access(c, a, size);
     else
     {
-        size1 = (1 << LOG2CB) - (CB_MASK & a) - 1; //TODO using c->line_size_bits 
-        a1 = a + size1 + 1;
-        if(!cachefa_handle_access(c, a, size1))
-           return cachefa_handle_access(c, a1, size - size1);
-        else
+        Bool miss1;
+
+        size1 = (1 << LOG2CB) - (CB_MASK & a); //TODO using c->line_size_bits 
+        a1 = a + size1;
+
+        /* always do both, as the LRU order is updated as side effect */
+        miss1 = cachefa_handle_access(c, a, size1);
+        if(cachefa_handle_access(c, a1, size - size1))
            return True;
+        return miss1;
     }
 }
@@ -34,19 +34,25 @@
 #include "pub_tool_libcfile.h"
 #include "pub_tool_libcprint.h"
 #include "pub_tool_libcproc.h"
+#include "pub_tool_hashtable.h"
 #include "pub_tool_mallocfree.h"
 #include "pub_tool_options.h"
-#include "pub_tool_oset.h"
+#include "pub_tool_poolalloc.h"
 #include "pub_tool_tooliface.h"
 #include "pub_tool_transtab.h"
 #include "pub_tool_xarray.h"
 #include "pub_tool_clientstate.h"
 #include "pub_tool_machine.h"      // VG_(fnptr_to_fnentry)
+#include "pub_tool_vkiscnums.h"    // __NR_execve
 
 #include "cachegrind.h"
+#include "cg_binfmt.h"
+#include "cg_ring.h"
+#include "cg_trace.h"
 #include "cg_arch.h"
 #include "cg_helper.c"
 #include "cg_sim.c"
+#include "cg_ckpt.c"
 #include "cg_branchpred.c"
 
 /*------------------------------------------------------------*/
@@ -63,6 +69,24 @@
 static Bool  clo_cache_sim  = False; /* do cache simulation? */
 static Bool  clo_branch_sim = False; /* do branch simulation? */
 static Bool  clo_instr_at_start = True; /* instrument at startup? */
+static MissClassify clo_miss_classify = MissClassifyAll; /* 3C classification */
+static const HChar* clo_load_cache_state = NULL; /* warm caches from file */
+static const HChar* clo_save_cache_state = NULL; /* save caches at exit */
+static Bool  clo_per_thread = False; /* per-thread counts and output? */
+static Bool  clo_binary_output = False; /* --output-format=binary? */
+static ULong clo_interval = 0;          /* snapshot every N instrs, 0: off */
+static Bool  clo_batch_sim = False;     /* buffer accesses, simulate in bulk? */
+static const HChar* clo_sim_daemon = NULL; /* simulate in this program */
+static const HChar* clo_record_trace = NULL; /* write accesses to file */
+static LLMap clo_LL_map = { LLPageIdentity, 4096, 1, 0, 0 }; /* LL indexing */
+static UInt  clo_evict_pairs = 0;       /* eviction graph counters, 0: off */
+static Bool  clo_access_patterns = False; /* classify data access patterns? */
+static UInt  clo_miss_samples = 0;      /* top missing instrs kept, 0: off */
+static const HChar* clo_interval_out_file = "cachegrind.intervals.%p";
+static const HChar* clo_region_out_file = "cachegrind.regions.%p";
+static const HChar* clo_evict_out_file = "cachegrind.evictions.%p";
+static const HChar* clo_patterns_out_file = "cachegrind.patterns.%p";
+static const HChar* clo_samples_out_file = "cachegrind.samples.%p";
 static const HChar* clo_cachegrind_out_file = "cachegrind.out.%p";
 static const HChar* clo_cacheusage_d1_out_file = "cacheusage.d1.out.%p";
 static const HChar* clo_cacheusage_ll_out_file = "cacheusage.ll.out.%p";
@@ -76,8 +100,42 @@ static Int min_line_size = 0; /* min of L1 and LL cache line sizes */
 //------------------------------------------------------------
 // Primary data structure #1: CC table
 // more details moved to cg_sim.c
+// - a hash table of CCNodes, keyed by hash_CodeLoc() of the interned file
+//   and function name pointers and the line.  Looking up a line is then
+//   one hash and some pointer compares, rather than an AVL descent doing a
+//   strcmp of the file and function names at every level.
+// - the file/fn/line order the output files need is only established
+//   when the table is traversed, by sorting;  see CC_table_ResetIter.
+// - a node only names its line and gives it a dense id;  the counts are
+//   in the counter columns, by that id (see below).
+
+typedef struct {
+   CodeLoc loc;
+   UInt    id;             // dense, from 0;  the counter columns' index
+} SrcLine;
+
+typedef struct {
+   VgHashNode top;         // key: hash_CodeLoc(line.loc)
+   SrcLine    line;
+} CCNode;
+
+// What lookups pass for the node to compare against.
+typedef struct {
+   VgHashNode top;
+   CodeLoc    loc;
+} CCKey;
+
+static VgHashTable* CC_table;
+static UInt         n_lineCCs   = 0;     // line ids handed out so far
 
-static OSet* CC_table;
+// The lines by id, for naming the lines of the eviction graph and of
+// checkpointed cachelines.
+static SrcLine**    lineCCs_by_id = NULL;
+static UInt         lineCCs_by_id_size = 0;
+
+static SrcLine**    CC_sorted   = NULL;  // every line, in file/fn/line order
+static UInt         CC_n_sorted = 0;     // stale unless == n_lineCCs
+static UInt         CC_iter     = 0;
 
 //------------------------------------------------------------
 // Primary data structure #2: InstrInfo table
@@ -85,24 +143,170 @@ static OSet* CC_table;
 // - table(SB_start_addr, list(InstrInfo))
 // - For each SB, each InstrInfo in the list holds info about the
 //   instruction (instrLen, instrAddr, etc), plus a pointer to its line
-//   CC.  This node is what's passed to the simulation function.
+//   and the line's id.  This node is what's passed to the simulation
+//   function.
 // - When SBs are discarded the relevant list(instr_details) is freed.
+// - a hash table keyed by SB address.  The SB_infos themselves come from
+//   per-size-class pools, so that the steady churn of discards and
+//   retranslations recycles nodes rather than going to the allocator.
+
+typedef struct _PatternInfo PatternInfo;
 
 typedef struct _InstrInfo InstrInfo;
 struct _InstrInfo {
    Addr    instr_addr;
    UChar   instr_len;
-   LineCC* parent;         // parent line-CC
+   UChar   n_folded;       // following instrs this one counts;  see fold_events
+   UChar   n_Dr_hits;      // known D1 hits of this instr, counted by the
+   UChar   n_Dw_hits;      //   first instr of its run
+   UInt    trace_id;       // 1 + index in the --record-trace instrs, or 0
+   UInt    line_id;        // parent->id, for the counter columns
+   SrcLine* parent;        // parent line
+   PatternInfo* pattern;   // with --access-patterns=yes, else NULL
 };
 
 typedef struct _SB_info SB_info;
 struct _SB_info {
-   Addr      SB_addr;      // key;  MUST BE FIRST
-   Int       n_instrs;
-   InstrInfo instrs[0];
+   VgHashNode top;         // key: SB address;  MUST BE FIRST
+   Int        n_instrs;
+   Int        size_class;  // index into SB_info_pools, or -1 if malloc'd
+   InstrInfo  instrs[0];
+};
+
+static VgHashTable* instrInfoTable;
+
+// Size class c holds SB_infos of up to (SB_INFO_MIN_INSTRS << c) instrs;
+// bigger ones (rare) are malloc'd.
+#define SB_INFO_MIN_INSTRS  4
+#define SB_INFO_N_CLASSES   6
+#define SB_INFO_PER_POOL    256
+
+static PoolAlloc* SB_info_pools[SB_INFO_N_CLASSES];
+
+//------------------------------------------------------------
+// Access pattern table (--access-patterns=yes)
+// - a small state machine per memory instruction, as in a stride
+//   prefetcher's reference prediction table:  the last address, the last
+//   stride, and a confidence that goes up when the stride repeats and
+//   down when it doesn't.  Each access is classed by that state as
+//   constant, sequential (a stride no bigger than the access), fixed
+//   stride, or irregular.
+// - a hash table keyed by instruction address rather than a field of
+//   InstrInfo, so that it outlives SB discards:  a retranslated
+//   instruction finds its state again through InstrInfo.pattern.
+
+typedef enum {
+   PatConst,
+   PatSeq,
+   PatStride,
+   PatIrregular,
+   PatN
+} AccessPattern;
+
+#define PAT_CONF_MAX     3
+#define PAT_CONF_STEADY  2     // the stride has repeated twice
+
+struct _PatternInfo {
+   VgHashNode top;         // key: instruction address;  MUST BE FIRST
+   SrcLine*   parent;
+   Addr       last_addr;
+   Long       stride;      // the one being tracked
+   Long       steady;      // the last stride classed PatSeq or PatStride
+   UInt       conf;
+   ULong      n_accesses;
+   ULong      n[PatN];     // accesses after the first, by class
 };
 
-static OSet* instrInfoTable;
+static VgHashTable* patternTable;
+
+//------------------------------------------------------------
+// Miss samples (--miss-samples)
+// - for D1 misses, and for LL misses, a Space-Saving sketch (see cg_sim.c)
+//   of the instructions that miss most, keyed by instruction address.
+// - each counter holds a reservoir of up to MISS_RESERVOIR of the misses
+//   behind its count, picked uniformly (Vitter's algorithm R) from those
+//   since the counter was given to its instruction, as a hardware
+//   sampler would give a few of every instruction's misses.
+
+#define MISS_RESERVOIR  16
+
+typedef struct {
+   Addr  addr;
+   Bool  is_write;
+   Bool  missed_LL;
+} MissSample;
+
+typedef struct {
+   SrcLine*   parent;
+   ULong      n_seen;      // misses since the counter was taken
+   MissSample s[MISS_RESERVOIR];
+} MissEntry;
+
+typedef struct {
+   SSketch    ss;
+   MissEntry* entries;     // by counter
+} MissProfile;
+
+static MissProfile miss_D1;
+static MissProfile miss_LL;
+static ULong       miss_rng_state = 0x9E3779B97F4A7C15ULL;
+
+//------------------------------------------------------------
+// Simulation filters (--sim-range, CACHEGRIND_SIM_RANGE_*, --sim-fn)
+// - data accesses outside the selected address ranges, or made by code
+//   outside the selected functions, are counted but not simulated:  they
+//   don't touch INFI, the FA caches or D1/LL, and never miss.  Fetches
+//   are always simulated.
+// - functions are decided at instrumentation time (see fold_events), once
+//   per interned function name.  Ranges can change at any time, so they
+//   are checked per access, but only once there are any.  An access is
+//   simulated if any of its bytes is in a range.  The data accesses
+//   fold_events folds lie within the one before them, so they are never
+//   in a range that one isn't in, and a folded hit is counted just as an
+//   access outside the ranges is.
+// - sim_ranges holds the ranges as given, so that a client can remove
+//   one;  sim_merged the sorted union, which is what gets looked up.
+// - the accesses a range filters out aren't in a --record-trace trace.
+
+#define SIM_MAX_RANGES  64
+
+typedef struct {
+   Addr start;
+   Addr end;               // exclusive
+} SimRange;
+
+static SimRange sim_ranges[SIM_MAX_RANGES];
+static UInt     n_sim_ranges = 0;
+static SimRange sim_merged[SIM_MAX_RANGES];
+static UInt     n_sim_merged = 0;
+static Bool     sim_ranges_on = False;  // a range has ever been given
+
+typedef struct {
+   VgHashNode top;         // key: interned function name
+   Bool       selected;
+} SimFnNode;
+
+static XArray*      sim_fns = NULL;       // HChar*, the --sim-fn globs
+static VgHashTable* sim_fn_memo;
+
+//------------------------------------------------------------
+// Address -> line memo
+// - a direct-mapped cache of get_lineCC results, by instruction address,
+//   which saves the debug info lookup and the CC table lookup when an
+//   instruction is translated again.
+// - SB discards leave it alone.  It is flushed when the debug info epoch
+//   moves on, since an address may then belong to different code.
+
+#define LINECC_MEMO_BITS  14
+#define LINECC_MEMO_SIZE  (1 << LINECC_MEMO_BITS)
+
+typedef struct {
+   Addr     addr;
+   SrcLine* lineCC;        // NULL if the entry is empty
+} LineCCMemo;
+
+static LineCCMemo lineCC_memo[LINECC_MEMO_SIZE];
+static DiEpoch    lineCC_memo_epoch;
 
 //------------------------------------------------------------
 // Secondary data structure: string table
@@ -110,9 +314,27 @@ static OSet* instrInfoTable;
 // - used for filenames and function names, each of which will be
 //   pointed to by one or more CCs.
 // - it also allows equality checks just by pointer comparison, which
-//   is good when printing the output file at the end.
-
-static OSet* stringTable;
+//   is good when printing the output file at the end, and is what the CC
+//   table is keyed on.
+// - a hash table of StrNodes, keyed by hash_string() of the contents.
+// - the "dir/file" names get_lineCC builds are interned too, in a table
+//   keyed by the pair of (interned) dir and file pointers, so the path is
+//   only formed the first time that pair is seen.
+
+typedef struct {
+   VgHashNode top;         // key: hash_string(str)
+   HChar*     str;
+} StrNode;
+
+typedef struct {
+   VgHashNode   top;       // key: hash_ptrs(dir, file, 0)
+   const HChar* dir;
+   const HChar* file;
+   HChar*       path;      // interned "dir/file"
+} PathNode;
+
+static VgHashTable* stringTable;
+static VgHashTable* pathTable;
 
 //------------------------------------------------------------
 // Stats
@@ -126,33 +348,192 @@ static Int  full_debugs         = 0;
 static Int  file_line_debugs    = 0;
 static Int  fn_debugs           = 0;
 static Int  no_debugs           = 0;
+static Int  memo_lineCC_hits    = 0;
+
+static Int  folded_Irs          = 0;
+static Int  folded_Ds           = 0;
 
 //------------------------------------------------------------
 // Instrumentation control
 static Bool instr_enabled = True;
 
+//------------------------------------------------------------
+// Counter columns
+// - a line's counts aren't kept in one record, but in a dense column per
+//   feature, indexed by the line's id (which InstrInfo.line_id holds, so
+//   the helpers needn't go through the parent):
+//     Ir      fetch counts, with --cache-sim=no
+//     cache   Ir/Dr/Dw CacheCCs, with --cache-sim=yes
+//     evict   eviction bins, with --cache-sim=yes
+//     branch  Bc/Bi BranchCCs, with --branch-sim=yes
+//   Only the columns of the features in use are allocated, and a helper's
+//   increments go to a row holding little else.
+// - columns are allocated CC_CHUNK rows at a time, on first touch, and
+//   the chunks never move:  cachelines point at evict rows.
+// - output puts a LineCC together from the columns;  see output_lineCC.
+
+typedef enum {
+   CCColIr,
+   CCColCache,
+   CCColEvict,
+   CCColBranch,
+   CCColN
+} CCCol;
+
+typedef struct {
+   CacheCC  Ir;
+   CacheCC  Dr;
+   CacheCC  Dw;
+} LineCacheCC;
+
+typedef struct {
+   BranchCC Bc;
+   BranchCC Bi;
+} LineBranchCC;
+
+#define CC_CHUNK_BITS  10
+#define CC_CHUNK       (1 << CC_CHUNK_BITS)
+
+typedef struct {
+   UInt   n_chunks;        // size of each of chunks[]
+   UChar** chunks[CCColN]; // CC_CHUNK rows each;  NULL if never touched
+} CCColumns;
+
+static const SizeT cc_row_size[CCColN] = {
+   sizeof(ULong), sizeof(LineCacheCC), sizeof(EvictCC), sizeof(LineBranchCC)
+};
+
+static Bool      cc_col_on[CCColN];   // set by cg_post_clo_init
+static CCColumns shared_ccs;          // what no shard is charged
+
+//------------------------------------------------------------
+// Counter shards (--per-thread=yes, and measurement regions)
+// - a shard is a private set of counter columns, whose chunks are only
+//   allocated once a line in them is charged while it is selected.
+// - the helpers charge the selected shard's columns rather than the
+//   shared ones;  output sums the shards back up (see output_lineCC).
+//   With no shard selected, as when neither feature is in use, the
+//   shared columns are charged directly.
+// - the selected shard depends on the running thread (with --per-thread)
+//   and on that thread's innermost open region.
+// - ThreadIds get reused, so threads are numbered by instance, in order of
+//   first appearance.  Exited threads' shards are kept until the end.
+
+typedef struct _Region Region;
+
+typedef struct {
+   UInt     serial;     // 1 for the first thread to run client code, ...
+   ThreadId tid;
+   Region*  region;     // innermost open region, NULL if none
+   XArray*  shards;     // CCShard*, this thread's (with --per-thread)
+} ThreadInfo;
+
+typedef struct {
+   ThreadInfo* thread;  // NULL without --per-thread
+   Region*     region;  // NULL outside any region
+   UInt        id;      // its place on all_shards, from 1
+   CCColumns   ccs;
+} CCShard;
+
+// A node in the tree of regions;  a region is identified by its name and
+// the region it was opened in.
+struct _Region {
+   HChar*   name;
+   Region*  parent;
+   Region*  children;   // first child
+   Region*  next;       // next sibling
+   ULong    entries;    // times opened
+   XArray*  shards;     // CCShard*, by thread serial (0 w/o --per-thread)
+};
+
+static ThreadInfo* threads[VG_N_THREADS];    // live thread instances
+static XArray*     all_threads = NULL;       // all ThreadInfo*, by serial
+static ThreadInfo* cur_thread = NULL;        // the running one
+static XArray*     all_shards = NULL;        // all CCShard*
+static XArray*     no_region_shards = NULL;  // CCShard*, by thread serial
+static Region*     top_regions = NULL;       // first top-level region
+static CCShard*    cur_shard = NULL;         // NULL: charge shared_ccs
+
 /*------------------------------------------------------------*/
 /*--- String table operations                              ---*/
 /*------------------------------------------------------------*/
 
-static Word stringCmp( const void* key, const void* elem )
+// FNV-1a.
+static UWord hash_string(const HChar* s)
 {
-   return VG_(strcmp)(*(const HChar *const *)key, *(const HChar *const *)elem);
+   UInt h = 2166136261U;
+   for ( ; *s; s++)
+      h = (h ^ (UChar)*s) * 16777619U;
+   return h;
+}
+
+// For keys made of interned pointers:  those are all distinct heap
+// addresses, so it's enough to mix away their common low zero bits.
+static UWord hash_ptrs(const void* a, const void* b, UWord c)
+{
+   UWord h = (UWord)a;
+   h = (h ^ (h >> 4)) * 31 + (UWord)b;
+   h = (h ^ (h >> 4)) * 31 + c;
+   return h ^ (h >> 16);
+}
+
+static Word cmp_StrNode(const void* key, const void* elem)
+{
+   return VG_(strcmp)(((const StrNode*)key)->str, ((const StrNode*)elem)->str);
 }
 
 // Get a permanent string;  either pull it out of the string table if it's
 // been encountered before, or dup it and put it into the string table.
 static HChar* get_perm_string(const HChar* s)
 {
-   HChar** s_ptr = VG_(OSetGen_Lookup)(stringTable, &s);
-   if (s_ptr) {
-      return *s_ptr;
-   } else {
-      HChar** s_node = VG_(OSetGen_AllocNode)(stringTable, sizeof(HChar*));
-      *s_node = VG_(strdup)("cg.main.gps.1", s);
-      VG_(OSetGen_Insert)(stringTable, s_node);
-      return *s_node;
+   StrNode  key;
+   StrNode* node;
+
+   key.top.key = hash_string(s);
+   key.str     = (HChar*)s;
+   node = VG_(HT_gen_lookup)(stringTable, &key, cmp_StrNode);
+   if (!node) {
+      node          = VG_(malloc)("cg.main.gps.1", sizeof(StrNode));
+      node->top.key = key.top.key;
+      node->str     = VG_(strdup)("cg.main.gps.2", s);
+      VG_(HT_add_node)(stringTable, node);
+   }
+   return node->str;
+}
+
+static Word cmp_PathNode(const void* key, const void* elem)
+{
+   const PathNode* a = key;
+   const PathNode* b = elem;
+   return (a->dir == b->dir && a->file == b->file) ? 0 : 1;
+}
+
+// The permanent "dir/file" for a permanent 'dir' and 'file';  just 'file'
+// if there's no directory.
+static HChar* get_perm_path(const HChar* dir, const HChar* file)
+{
+   PathNode  key;
+   PathNode* node;
+
+   if (!dir[0])
+      return (HChar*)file;
+
+   key.top.key = hash_ptrs(dir, file, 0);
+   key.dir     = dir;
+   key.file    = file;
+   node = VG_(HT_gen_lookup)(pathTable, &key, cmp_PathNode);
+   if (!node) {
+      HChar absfile[VG_(strlen)(dir) + 1 + VG_(strlen)(file) + 1];
+      VG_(sprintf)(absfile, "%s/%s", dir, file);
+
+      node          = VG_(malloc)("cg.main.gpp.1", sizeof(PathNode));
+      node->top.key = key.top.key;
+      node->dir     = dir;
+      node->file    = file;
+      node->path    = get_perm_string(absfile);
+      VG_(HT_add_node)(pathTable, node);
    }
+   return node->path;
 }
 
 /*------------------------------------------------------------*/
@@ -188,213 +569,1482 @@ static void get_debug_info(Addr instr_addr, const HChar **dir,
    }
 }
 
-// Do a three step traversal: by file, then fn, then line.
-// Returns a pointer to the line CC, creates a new one if necessary.
-static LineCC* get_lineCC(Addr origAddr)
+static Word cmp_CCNode(const void* key, const void* elem)
+{
+   const CodeLoc* a = &((const CCKey*)key)->loc;
+   const CodeLoc* b = &((const CCNode*)elem)->line.loc;
+   return (a->file == b->file && a->fn == b->fn && a->line == b->line) ? 0 : 1;
+}
+
+// Returns a pointer to the line, creates a new one if necessary.
+// 'file' and 'fn' must be permanent strings.
+static SrcLine* get_perm_lineCC(HChar* file, const HChar* fn, Int line)
+{
+   CCKey   key;
+   CCNode* node;
+
+   key.loc.file = file;
+   key.loc.fn   = fn;
+   key.loc.line = line;
+   key.top.key  = hash_ptrs(file, fn, (UWord)line);
+
+   node = VG_(HT_gen_lookup)(CC_table, &key, cmp_CCNode);
+   if (!node) {
+      // Allocate and zero a new node.
+      node = VG_(malloc)("cg.main.gplc.1", sizeof(CCNode));
+      VG_(memset)(node, 0, sizeof(CCNode));
+      node->top.key    = key.top.key;
+      node->line.loc = key.loc;
+      node->line.id  = n_lineCCs++;
+
+      VG_(HT_add_node)(CC_table, node);
+
+      if (node->line.id >= lineCCs_by_id_size) {
+         lineCCs_by_id_size = lineCCs_by_id_size ? 2 * lineCCs_by_id_size
+                                                 : 1024;
+         lineCCs_by_id = VG_(realloc)("cg.main.gplc.2", lineCCs_by_id,
+                                      lineCCs_by_id_size * sizeof(SrcLine*));
+      }
+      lineCCs_by_id[node->line.id] = &node->line;
+   }
+
+   return &node->line;
+}
+
+// As above, for names that needn't be permanent.
+// 'file' must already be absolute if a directory is known.
+static SrcLine* get_lineCC_from_loc(const HChar* file, const HChar* fn,
+                                    Int line)
+{
+   return get_perm_lineCC(get_perm_string(file), get_perm_string(fn), line);
+}
+
+static SrcLine* get_lineCC(Addr origAddr)
 {
    const HChar *fn, *file, *dir;
    UInt    line;
-   CodeLoc loc;
-   LineCC* lineCC;
-   Int     i;
+   DiEpoch ep = VG_(current_DiEpoch)();
+   LineCCMemo* memo = &lineCC_memo[(origAddr ^ (origAddr >> LINECC_MEMO_BITS))
+                                   & (LINECC_MEMO_SIZE - 1)];
+
+   if (ep.n != lineCC_memo_epoch.n) {
+      VG_(memset)(lineCC_memo, 0, sizeof(lineCC_memo));
+      lineCC_memo_epoch = ep;
+   }
+   if (memo->lineCC && memo->addr == origAddr) {
+      memo_lineCC_hits++;
+      return memo->lineCC;
+   }
 
    get_debug_info(origAddr, &dir, &file, &fn, &line);
 
    // Form an absolute pathname if a directory is available
-   HChar absfile[VG_(strlen)(dir) + 1 + VG_(strlen)(file) + 1];
+   memo->addr   = origAddr;
+   memo->lineCC = get_perm_lineCC(get_perm_path(get_perm_string(dir),
+                                                get_perm_string(file)),
+                                  get_perm_string(fn), line);
+   return memo->lineCC;
+}
 
-   if (dir[0]) {
-      VG_(sprintf)(absfile, "%s/%s", dir, file);
+static Int cmp_SrcLine_ptrs(const void* va, const void* vb)
+{
+   const SrcLine* a = *(const SrcLine* const*)va;
+   const SrcLine* b = *(const SrcLine* const*)vb;
+   Word res = cmp_CodeLoc(&a->loc, &b->loc);
+   return res < 0 ? -1 : res > 0 ? 1 : 0;
+}
+
+// Start a traversal of the CC table in file/fn/line order.  The sorted
+// order is kept, and only redone if lines have been added since.
+static void CC_table_ResetIter(void)
+{
+   if (CC_n_sorted != n_lineCCs) {
+      CCNode* node;
+      UInt    n = 0;
+
+      CC_sorted = VG_(realloc)("cg.main.ctri.1", CC_sorted,
+                               (n_lineCCs ? n_lineCCs : 1) * sizeof(SrcLine*));
+      VG_(HT_ResetIter)(CC_table);
+      while ( (node = VG_(HT_Next)(CC_table)) )
+         CC_sorted[n++] = &node->line;
+      tl_assert(n == n_lineCCs);
+
+      VG_(ssort)(CC_sorted, n, sizeof(SrcLine*), cmp_SrcLine_ptrs);
+      CC_n_sorted = n;
+   }
+   CC_iter = 0;
+}
+
+static SrcLine* CC_table_Next(void)
+{
+   return CC_iter < CC_n_sorted ? CC_sorted[CC_iter++] : NULL;
+}
+
+/*------------------------------------------------------------*/
+/*--- Counter shards: threads and regions                  ---*/
+/*------------------------------------------------------------*/
+
+static ThreadInfo* get_ThreadInfo(ThreadId tid)
+{
+   ThreadInfo* t = threads[tid];
+
+   if (!t) {
+      t         = VG_(calloc)("cg.main.gti.1", 1, sizeof(ThreadInfo));
+      t->serial = VG_(sizeXA)(all_threads) + 1;
+      t->tid    = tid;
+      t->shards = VG_(newXA)(VG_(malloc), "cg.main.gti.2", VG_(free),
+                             sizeof(CCShard*));
+      threads[tid] = t;
+      VG_(addToXA)(all_threads, &t);
+   }
+   return t;
+}
+
+// Point cur_shard at the running thread's shard for its current region,
+// creating it if need be.
+static void select_shard(void)
+{
+   XArray*   shards;
+   CCShard** sp;
+   CCShard*  null = NULL;
+   Word      idx;
+
+   if (!cur_thread || (!cur_thread->region && !clo_per_thread)) {
+      cur_shard = NULL;
+      return;
+   }
+
+   shards = cur_thread->region ? cur_thread->region->shards
+                               : no_region_shards;
+   idx    = clo_per_thread ? cur_thread->serial : 0;
+   while (VG_(sizeXA)(shards) <= idx)
+      VG_(addToXA)(shards, &null);
+   sp = VG_(indexXA)(shards, idx);
+   if (!*sp) {
+      *sp = VG_(calloc)("cg.main.ss.1", 1, sizeof(CCShard));
+      (*sp)->thread = clo_per_thread ? cur_thread : NULL;
+      (*sp)->region = cur_thread->region;
+      VG_(addToXA)(all_shards, sp);
+      (*sp)->id     = VG_(sizeXA)(all_shards);
+      if (clo_per_thread)
+         VG_(addToXA)(cur_thread->shards, sp);
+   }
+   cur_shard = *sp;
+}
+
+// CACHEGRIND_REGION_BEGIN:  open region 'name' inside thread 'tid's
+// current region.
+static void region_begin(ThreadId tid, const HChar* name)
+{
+   ThreadInfo* t  = get_ThreadInfo(tid);
+   Region**    rp = t->region ? &t->region->children : &top_regions;
+   Region*     r;
+
+   if (name == NULL)
+      name = "???";
+   for (r = *rp; r; r = r->next) {
+      if (VG_(strcmp)(r->name, name) == 0)
+         break;
+      rp = &r->next;
+   }
+   if (!r) {
+      // Appended, so that siblings are listed in order of first use.
+      r         = VG_(calloc)("cg.main.rb.1", 1, sizeof(Region));
+      r->name   = VG_(strdup)("cg.main.rb.2", name);
+      r->parent = t->region;
+      r->shards = VG_(newXA)(VG_(malloc), "cg.main.rb.3", VG_(free),
+                             sizeof(CCShard*));
+      *rp = r;
+   }
+   r->entries++;
+   t->region = r;
+   if (t == cur_thread)
+      select_shard();
+}
+
+// CACHEGRIND_REGION_END:  close thread 'tid's innermost region.  Returns
+// False if it has none open.
+static Bool region_end(ThreadId tid)
+{
+   ThreadInfo* t = get_ThreadInfo(tid);
+
+   if (!t->region)
+      return False;
+   t->region = t->region->parent;
+   if (t == cur_thread)
+      select_shard();
+   return True;
+}
+
+static void drain_accesses(void);   // see --batch-sim
+
+// Before the shard accesses are charged to changes:  the buffered ones
+// belong to the old one.  The simulator daemon's records carry their
+// shard, so its misses needn't be in yet.
+static void settle_accesses(void)
+{
+   drain_accesses();
+}
+
+static void cg_start_client_code(ThreadId tid, ULong blocks_done)
+{
+   if (cur_thread && cur_thread->tid == tid)
+      return;
+   settle_accesses();
+   cur_thread = get_ThreadInfo(tid);
+   select_shard();
+}
+
+static void cg_pre_thread_ll_exit(ThreadId tid)
+{
+   // The shards stay on all_shards;  a later thread that gets the same
+   // tid starts afresh.
+   if (cur_thread == threads[tid]) {
+      settle_accesses();
+      cur_thread = NULL;
+      cur_shard  = NULL;
+   }
+   threads[tid] = NULL;
+}
+
+// Zero a chunk of 'col', whose first row is line 'base'.
+static void clear_cc_chunk(CCCol col, UChar* chunk, UInt base)
+{
+   UInt i;
+
+   VG_(memset)(chunk, 0, CC_CHUNK * cc_row_size[col]);
+   if (col == CCColEvict) {
+      for (i = 0; i < CC_CHUNK; i++)
+         ((EvictCC*)chunk)[i].id = base + i;
+   }
+}
+
+// Slow path of cc_row:  grow the chunk index and/or allocate the chunk.
+static void* new_cc_chunk(CCColumns* cols, CCCol col, UInt id)
+{
+   UInt c = id >> CC_CHUNK_BITS;
+   Int  k;
+
+   tl_assert(cc_col_on[col]);
+   if (c >= cols->n_chunks) {
+      UInt n = cols->n_chunks ? cols->n_chunks : 64;
+      while (n <= c) n *= 2;
+      for (k = 0; k < CCColN; k++) {
+         cols->chunks[k] = VG_(realloc)("cg.main.ncc.1", cols->chunks[k],
+                                        n * sizeof(UChar*));
+         VG_(memset)(cols->chunks[k] + cols->n_chunks, 0,
+                     (n - cols->n_chunks) * sizeof(UChar*));
+      }
+      cols->n_chunks = n;
+   }
+   if (!cols->chunks[col][c]) {
+      cols->chunks[col][c] = VG_(malloc)("cg.main.ncc.2",
+                                         CC_CHUNK * cc_row_size[col]);
+      clear_cc_chunk(col, cols->chunks[col][c], c << CC_CHUNK_BITS);
+   }
+   return cols->chunks[col][c] + (id & (CC_CHUNK - 1)) * cc_row_size[col];
+}
+
+// Line 'id's row of 'col' in 'cols', allocated if need be.
+__attribute__((always_inline))
+static __inline__
+void* cc_row(CCColumns* cols, const CCCol col, UInt id)
+{
+   UInt   c = id >> CC_CHUNK_BITS;
+   UChar* chunk;
+
+   if (LIKELY(c < cols->n_chunks)
+       && LIKELY((chunk = cols->chunks[col][c]) != NULL))
+      return chunk + (id & (CC_CHUNK - 1)) * cc_row_size[col];
+   return new_cc_chunk(cols, col, id);
+}
+
+// As cc_row, but NULL if the row was never touched.
+static const void* cc_row_if_any(const CCColumns* cols, CCCol col, UInt id)
+{
+   UInt c = id >> CC_CHUNK_BITS;
+
+   if (c >= cols->n_chunks || !cols->chunks[col][c])
+      return NULL;
+   return cols->chunks[col][c] + (id & (CC_CHUNK - 1)) * cc_row_size[col];
+}
+
+// The columns that accesses are charged to now.
+__attribute__((always_inline))
+static __inline__
+CCColumns* cur_ccs(void)
+{
+   return LIKELY(cur_shard == NULL) ? &shared_ccs : &cur_shard->ccs;
+}
+
+// The rows that an access by instruction 'n' is charged to.
+__attribute__((always_inline))
+static __inline__
+ULong* Ir_count_of(InstrInfo* n)
+{
+   return cc_row(cur_ccs(), CCColIr, n->line_id);
+}
+
+__attribute__((always_inline))
+static __inline__
+LineCacheCC* cache_cc_of(InstrInfo* n)
+{
+   return cc_row(cur_ccs(), CCColCache, n->line_id);
+}
+
+__attribute__((always_inline))
+static __inline__
+EvictCC* evict_cc_of(InstrInfo* n)
+{
+   return cc_row(cur_ccs(), CCColEvict, n->line_id);
+}
+
+__attribute__((always_inline))
+static __inline__
+LineBranchCC* branch_cc_of(InstrInfo* n)
+{
+   return cc_row(cur_ccs(), CCColBranch, n->line_id);
+}
+
+static void zero_ccs(CCColumns* cols)
+{
+   UInt c;
+   Int  k;
+
+   for (k = 0; k < CCColN; k++) {
+      for (c = 0; c < cols->n_chunks; c++) {
+         if (cols->chunks[k][c])
+            clear_cc_chunk(k, cols->chunks[k][c], c << CC_CHUNK_BITS);
+      }
+   }
+}
+
+// For cg_ckpt.c.
+static const CodeLoc* evict_cc_loc(const EvictCC* ev)
+{
+   tl_assert(ev->id < n_lineCCs);
+   return &lineCCs_by_id[ev->id]->loc;
+}
+
+static EvictCC* evict_cc_from_loc(const HChar* file, const HChar* fn,
+                                  Int line)
+{
+   return cc_row(&shared_ccs, CCColEvict,
+                 get_lineCC_from_loc(file, fn, line)->id);
+}
+
+static void add_CacheCC(CacheCC* dst, const CacheCC* src)
+{
+   dst->a       += src->a;
+   dst->m1      += src->m1;
+   dst->mL      += src->mL;
+   dst->m1_comp += src->m1_comp;
+   dst->m1_conf += src->m1_conf;
+   dst->m1_cap  += src->m1_cap;
+   dst->mL_comp += src->mL_comp;
+   dst->mL_conf += src->mL_conf;
+   dst->mL_cap  += src->mL_cap;
+}
+
+static void add_lineCC(LineCC* dst, const LineCC* src)
+{
+   Int i;
+
+   add_CacheCC(&dst->Ir, &src->Ir);
+   add_CacheCC(&dst->Dr, &src->Dr);
+   add_CacheCC(&dst->Dw, &src->Dw);
+   dst->Bc.b  += src->Bc.b;
+   dst->Bc.mp += src->Bc.mp;
+   dst->Bi.b  += src->Bi.b;
+   dst->Bi.mp += src->Bi.mp;
+   for (i = 0; i < MAX_NUM_BINS; i++) {
+      dst->ev.D1[i] += src->ev.D1[i];
+      dst->ev.LL[i] += src->ev.LL[i];
+   }
+}
+
+// Add line 'id's rows in 'cols', if any, to 'dst'.
+static void add_cc_rows(LineCC* dst, const CCColumns* cols, UInt id)
+{
+   const ULong*        Ir = cc_row_if_any(cols, CCColIr, id);
+   const LineCacheCC*  c  = cc_row_if_any(cols, CCColCache, id);
+   const EvictCC*      ev = cc_row_if_any(cols, CCColEvict, id);
+   const LineBranchCC* b  = cc_row_if_any(cols, CCColBranch, id);
+   Int i;
+
+   if (Ir)
+      dst->Ir.a += *Ir;
+   if (c) {
+      add_CacheCC(&dst->Ir, &c->Ir);
+      add_CacheCC(&dst->Dr, &c->Dr);
+      add_CacheCC(&dst->Dw, &c->Dw);
+   }
+   if (ev) {
+      for (i = 0; i < MAX_NUM_BINS; i++) {
+         dst->ev.D1[i] += ev->D1[i];
+         dst->ev.LL[i] += ev->LL[i];
+      }
+   }
+   if (b) {
+      dst->Bc.b  += b->Bc.b;
+      dst->Bc.mp += b->Bc.mp;
+      dst->Bi.b  += b->Bi.b;
+      dst->Bi.mp += b->Bi.mp;
+   }
+}
+
+// Whether all of 'cc's counts are zero;  its ev.id must be 0 too.
+static Bool lineCC_is_zero(const LineCC* cc)
+{
+   const UChar* p   = (const UChar*)&cc->Ir;
+   const UChar* end = (const UChar*)(cc + 1);
+
+   for (; p < end; p++) {
+      if (*p)
+         return False;
+   }
+   return True;
+}
+
+// Returns the counts to print for 'line':  for the aggregate (t == NULL)
+// the shared columns plus all shards;  for thread 't', the sum of its
+// shards, or NULL if it has no counts for the line.  Sums are built in
+// 'tmp'.
+static LineCC* output_lineCC(const SrcLine* line, const ThreadInfo* t,
+                             LineCC* tmp)
+{
+   XArray* shards = t ? t->shards : all_shards;
+   Word    i, n;
+
+   VG_(memset)(tmp, 0, sizeof(LineCC));
+   tmp->loc = line->loc;
+   tmp->id  = line->id;
+   if (!t)
+      add_cc_rows(tmp, &shared_ccs, line->id);
+   n = shards ? VG_(sizeXA)(shards) : 0;
+   for (i = 0; i < n; i++) {
+      CCShard* s = *(CCShard**)VG_(indexXA)(shards, i);
+      add_cc_rows(tmp, &s->ccs, line->id);
+   }
+   return t && lineCC_is_zero(tmp) ? NULL : tmp;
+}
+
+/*------------------------------------------------------------*/
+/*--- Access patterns                                      ---*/
+/*------------------------------------------------------------*/
+
+static PatternInfo* get_PatternInfo(Addr instr_addr, SrcLine* parent)
+{
+   PatternInfo* p = VG_(HT_lookup)(patternTable, instr_addr);
+
+   if (!p) {
+      p = VG_(malloc)("cg.main.gpi.1", sizeof(PatternInfo));
+      VG_(memset)(p, 0, sizeof(PatternInfo));
+      p->top.key = instr_addr;
+      VG_(HT_add_node)(patternTable, p);
+   }
+   // The address may belong to different code by now.
+   p->parent = parent;
+   return p;
+}
+
+static void note_pattern(PatternInfo* p, Addr a, Word size)
+{
+   Long          d = (Long)(a - p->last_addr);
+   AccessPattern k;
+
+   p->last_addr = a;
+   if (p->n_accesses++ == 0)
+      return;
+
+   if (d == p->stride) {
+      if (p->conf < PAT_CONF_MAX)
+         p->conf++;
+   } else if (p->conf > 0) {
+      p->conf--;
    } else {
-      VG_(sprintf)(absfile, "%s", file);
+      p->stride = d;
    }
 
-   loc.file = absfile;
-   loc.fn   = fn;
-   loc.line = line;
+   if (p->conf < PAT_CONF_STEADY) {
+      k = PatIrregular;
+   } else if (p->stride == 0) {
+      k = PatConst;
+   } else {
+      k = p->stride >= -size && p->stride <= size ? PatSeq : PatStride;
+      p->steady = p->stride;
+   }
+   p->n[k]++;
+}
 
-   lineCC = VG_(OSetGen_Lookup)(CC_table, &loc);
-   if (!lineCC) {
-      // Allocate and zero a new node.
-      lineCC           = VG_(OSetGen_AllocNode)(CC_table, sizeof(LineCC));
-      lineCC->loc.file = get_perm_string(loc.file);
-      lineCC->loc.fn   = get_perm_string(loc.fn);
-      lineCC->loc.line = loc.line;
-      lineCC->Ir.a     = 0;
-      lineCC->Ir.m1    = 0;
-      lineCC->Ir.mL    = 0;
-      lineCC->Dr.a     = 0;
-      lineCC->Dr.m1    = 0;
-      lineCC->Dr.mL    = 0;
-      lineCC->Dw.a     = 0;
-      lineCC->Dw.m1    = 0;
-      lineCC->Dw.mL    = 0;
-      lineCC->Bc.b     = 0;
-      lineCC->Bc.mp    = 0;
-      lineCC->Bi.b     = 0;
-      lineCC->Bi.mp    = 0;
+// Called for every data access the simulator sees.
+__attribute__((always_inline))
+static __inline__
+void note_access_pattern(InstrInfo* n, Addr a, Word size)
+{
+   if (UNLIKELY(n->pattern != NULL))
+      note_pattern(n->pattern, a, size);
+}
 
-      for(i = 0; i < MAX_NUM_BINS; i++)
-      {
-        lineCC->num_evicts_D1[i] = 0;
-        lineCC->num_evicts_LL[i] = 0;
+// Zero the class counts, but not the state.
+static void zero_patterns(void)
+{
+   PatternInfo* p;
+
+   if (!patternTable)
+      return;
+   VG_(HT_ResetIter)(patternTable);
+   while ( (p = VG_(HT_Next)(patternTable)) ) {
+      p->n_accesses = 0;
+      VG_(memset)(p->n, 0, sizeof(p->n));
+   }
+}
+
+/*------------------------------------------------------------*/
+/*--- Miss samples                                         ---*/
+/*------------------------------------------------------------*/
+
+static void init_miss_profile(MissProfile* mp, UInt k)
+{
+   ss_init(&mp->ss, k);
+   mp->entries = VG_(malloc)("cg.main.imp.1", k * sizeof(MissEntry));
+}
+
+// xorshift64*, for the reservoirs.
+static ULong miss_rng(void)
+{
+   miss_rng_state ^= miss_rng_state >> 12;
+   miss_rng_state ^= miss_rng_state << 25;
+   miss_rng_state ^= miss_rng_state >> 27;
+   return miss_rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void sample_miss_in(MissProfile* mp, InstrInfo* n, Addr a,
+                           Bool is_write, Bool missed_LL)
+{
+   Bool       fresh;
+   UInt       c  = ss_count(&mp->ss, n->instr_addr, &fresh);
+   MissEntry* me = &mp->entries[c];
+   ULong      j;
+
+   if (fresh)
+      me->n_seen = 0;
+   me->parent = n->parent;
+   j = me->n_seen++;
+   if (j >= MISS_RESERVOIR) {
+      j = miss_rng() % (j + 1);
+      if (j >= MISS_RESERVOIR)
+         return;
+   }
+   me->s[j].addr      = a;
+   me->s[j].is_write  = is_write;
+   me->s[j].missed_LL = missed_LL;
+}
+
+static void sample_miss(InstrInfo* n, Addr a, Bool is_write, Bool missed_LL)
+{
+   sample_miss_in(&miss_D1, n, a, is_write, missed_LL);
+   if (missed_LL)
+      sample_miss_in(&miss_LL, n, a, is_write, True);
+}
+
+// Called after every simulated data access, with whether it missed D1
+// and its line's LL miss count before and after.
+__attribute__((always_inline))
+static __inline__
+void note_miss(InstrInfo* n, Addr a, Bool is_write, Bool m1, ULong mL_before,
+               ULong mL_after)
+{
+   if (UNLIKELY(m1) && UNLIKELY(clo_miss_samples != 0))
+      sample_miss(n, a, is_write, mL_after != mL_before);
+}
+
+static void zero_miss_samples(void)
+{
+   if (clo_miss_samples) {
+      ss_reset(&miss_D1.ss);
+      ss_reset(&miss_LL.ss);
+   }
+}
+
+/*------------------------------------------------------------*/
+/*--- Simulation filters                                   ---*/
+/*------------------------------------------------------------*/
+
+static Int cmp_SimRange(const void* va, const void* vb)
+{
+   const SimRange* a = va;
+   const SimRange* b = vb;
+
+   return a->start < b->start ? -1 : a->start > b->start ? 1 : 0;
+}
+
+static void merge_sim_ranges(void)
+{
+   UInt i;
+
+   VG_(memcpy)(sim_merged, sim_ranges, n_sim_ranges * sizeof(SimRange));
+   VG_(ssort)(sim_merged, n_sim_ranges, sizeof(SimRange), cmp_SimRange);
+   n_sim_merged = 0;
+   for (i = 0; i < n_sim_ranges; i++) {
+      SimRange* last = n_sim_merged ? &sim_merged[n_sim_merged - 1] : NULL;
+      if (last && sim_merged[i].start <= last->end) {
+         if (sim_merged[i].end > last->end)
+            last->end = sim_merged[i].end;
+      } else {
+         sim_merged[n_sim_merged++] = sim_merged[i];
+      }
+   }
+}
+
+// Returns False if there are too many ranges already.
+static Bool add_sim_range(Addr start, SizeT len)
+{
+   if (n_sim_ranges == SIM_MAX_RANGES)
+      return False;
+   sim_ranges[n_sim_ranges].start = start;
+   sim_ranges[n_sim_ranges].end   = start + len;
+   n_sim_ranges++;
+   sim_ranges_on = True;
+   merge_sim_ranges();
+   return True;
+}
+
+// Removes a range given before, exactly;  False if there's none.
+static Bool remove_sim_range(Addr start, SizeT len)
+{
+   UInt i;
+
+   for (i = 0; i < n_sim_ranges; i++) {
+      if (sim_ranges[i].start == start && sim_ranges[i].end == start + len) {
+         sim_ranges[i] = sim_ranges[--n_sim_ranges];
+         merge_sim_ranges();
+         return True;
+      }
+   }
+   return False;
+}
+
+// Whether any of [a, a+size) is in a range.
+static Bool in_sim_ranges(Addr a, SizeT size)
+{
+   UInt lo = 0, hi = n_sim_merged;
+
+   // The first range that ends after a;  they are sorted and disjoint.
+   while (lo < hi) {
+      UInt mid = (lo + hi) / 2;
+      if (sim_merged[mid].end <= a)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo < n_sim_merged && sim_merged[lo].start < a + size;
+}
+
+// Whether the data access of 'size' bytes at 'a' is to be simulated, as
+// far as the ranges go.
+__attribute__((always_inline))
+static __inline__
+Bool sim_data_access(Addr a, SizeT size)
+{
+   return LIKELY(!sim_ranges_on) || in_sim_ranges(a, size);
+}
+
+// Whether the data accesses of 'n' are to be simulated, as far as
+// --sim-fn goes.  Only used at instrumentation time.
+static Bool sim_fn_ok(const InstrInfo* n)
+{
+   const HChar* fn = n->parent->loc.fn;
+   SimFnNode*   node;
+   Word         i;
+
+   if (LIKELY(sim_fns == NULL))
+      return True;
+   node = VG_(HT_lookup)(sim_fn_memo, (UWord)fn);
+   if (!node) {
+      node = VG_(malloc)("cg.main.sfo.1", sizeof(SimFnNode));
+      node->top.key  = (UWord)fn;
+      node->selected = False;
+      for (i = 0; i < VG_(sizeXA)(sim_fns) && !node->selected; i++)
+         node->selected = VG_(string_match)(
+                             *(HChar**)VG_(indexXA)(sim_fns, i), fn);
+      VG_(HT_add_node)(sim_fn_memo, node);
+   }
+   return node->selected;
+}
+
+// Count a data access without simulating it, for the accesses of
+// functions --sim-fn leaves out that fold_events can't fold.
+static VG_REGPARM(1)
+void count_0Ir_1Dr(InstrInfo* n)
+{
+   cache_cc_of(n)->Dr.a++;
+}
+
+static VG_REGPARM(1)
+void count_0Ir_1Dw(InstrInfo* n)
+{
+   cache_cc_of(n)->Dw.a++;
+}
+
+/*------------------------------------------------------------*/
+/*--- Cache simulation functions                           ---*/
+/*------------------------------------------------------------*/
+
+/* A common case for an instruction read event is that the
+ * bytes read belong to the same cache line in both L1I and LL
+ * (if cache line sizes of L1 and LL are the same).
+ * As this can be detected at instrumentation time, and results
+ * in faster simulation, special-casing is benefical.
+ *
+ * Abbreviations used in var/function names:
+ *  IrNoX - instruction read does not cross cache lines
+ *  IrGen - generic instruction read; not detected as IrNoX
+ *  Ir    - not known / not important whether it is an IrNoX
+ */
+
+/* Count what fold_events took out of the IR for the run of instructions
+ * starting at n:  the fetches of the n->n_folded instructions after it,
+ * and the known D1 hits of all of them.  Every helper that handles an
+ * instruction fetch calls this;  'cache_sim' is a constant, the
+ * --cache-sim setting the helper is for.
+ */
+__attribute__((always_inline))
+static __inline__
+void count_folded(InstrInfo* n, const Bool cache_sim)
+{
+   Int k;
+
+   if (LIKELY((n->n_folded | n->n_Dr_hits | n->n_Dw_hits) == 0))
+      return;
+   for (k = 0; k <= n->n_folded; k++) {
+      if (!cache_sim) {
+         if (k > 0)
+            (*Ir_count_of(&n[k]))++;
+      } else {
+         LineCacheCC* cc = cache_cc_of(&n[k]);
+         if (k > 0)
+            cc->Ir.a++;
+         cc->Dr.a += n[k].n_Dr_hits;
+         cc->Dw.a += n[k].n_Dw_hits;
+      }
+   }
+}
+
+// Only used with --cache-sim=no.
+static VG_REGPARM(1)
+void log_1Ir(InstrInfo* n)
+{
+   ULong* cc = Ir_count_of(n);
+   (*cc)++;
+   count_folded(n, False);
+}
+
+// Only used with --cache-sim=no.
+static VG_REGPARM(2)
+void log_2Ir(InstrInfo* n, InstrInfo* n2)
+{
+   ULong* cc = Ir_count_of(n);
+   ULong* cc2 = Ir_count_of(n2);
+   (*cc)++;
+   (*cc2)++;
+   count_folded(n, False);
+   count_folded(n2, False);
+}
+
+// Only used with --cache-sim=no.
+static VG_REGPARM(3)
+void log_3Ir(InstrInfo* n, InstrInfo* n2, InstrInfo* n3)
+{
+   ULong* cc = Ir_count_of(n);
+   ULong* cc2 = Ir_count_of(n2);
+   ULong* cc3 = Ir_count_of(n3);
+   (*cc)++;
+   (*cc2)++;
+   (*cc3)++;
+   count_folded(n, False);
+   count_folded(n2, False);
+   count_folded(n3, False);
+}
+
+// Generic case for instruction reads: may cross cache lines.
+// All other Ir handlers expect IrNoX instruction reads.
+static VG_REGPARM(1)
+void log_1IrGen_0D_cache_access(InstrInfo* n)
+{
+   //VG_(printf)("1IrGen_0D :  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n",
+   //             n, n->instr_addr, n->instr_len);
+   LineCacheCC* cc = cache_cc_of(n);
+   cachesim_I1_doref_Gen(n->instr_addr, n->instr_len,
+			 &cc->Ir.m1, &cc->Ir.mL);
+   cc->Ir.a++;
+   count_folded(n, True);
+}
+
+static VG_REGPARM(1)
+void log_1IrNoX_0D_cache_access(InstrInfo* n)
+{
+   //VG_(printf)("1IrNoX_0D :  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n",
+   //             n, n->instr_addr, n->instr_len);
+   LineCacheCC* cc = cache_cc_of(n);
+   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
+			 &cc->Ir.m1, &cc->Ir.mL);
+   cc->Ir.a++;
+   count_folded(n, True);
+}
+
+static VG_REGPARM(2)
+void log_2IrNoX_0D_cache_access(InstrInfo* n, InstrInfo* n2)
+{
+   //VG_(printf)("2IrNoX_0D : CC1addr=0x%010lx, i1addr=0x%010lx, i1size=%lu\n"
+   //            "            CC2addr=0x%010lx, i2addr=0x%010lx, i2size=%lu\n",
+   //            n,  n->instr_addr,  n->instr_len,
+   //            n2, n2->instr_addr, n2->instr_len);
+   LineCacheCC* cc = cache_cc_of(n);
+   LineCacheCC* cc2 = cache_cc_of(n2);
+   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
+			 &cc->Ir.m1, &cc->Ir.mL);
+   cc->Ir.a++;
+   cachesim_I1_doref_NoX(n2->instr_addr, n2->instr_len,
+			 &cc2->Ir.m1, &cc2->Ir.mL);
+   cc2->Ir.a++;
+   count_folded(n, True);
+   count_folded(n2, True);
+}
+
+static VG_REGPARM(3)
+void log_3IrNoX_0D_cache_access(InstrInfo* n, InstrInfo* n2, InstrInfo* n3)
+{
+   //VG_(printf)("3IrNoX_0D : CC1addr=0x%010lx, i1addr=0x%010lx, i1size=%lu\n"
+   //            "            CC2addr=0x%010lx, i2addr=0x%010lx, i2size=%lu\n"
+   //            "            CC3addr=0x%010lx, i3addr=0x%010lx, i3size=%lu\n",
+   //            n,  n->instr_addr,  n->instr_len,
+   //            n2, n2->instr_addr, n2->instr_len,
+   //            n3, n3->instr_addr, n3->instr_len);
+   LineCacheCC* cc = cache_cc_of(n);
+   LineCacheCC* cc2 = cache_cc_of(n2);
+   LineCacheCC* cc3 = cache_cc_of(n3);
+   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
+			 &cc->Ir.m1, &cc->Ir.mL);
+   cc->Ir.a++;
+   cachesim_I1_doref_NoX(n2->instr_addr, n2->instr_len,
+			 &cc2->Ir.m1, &cc2->Ir.mL);
+   cc2->Ir.a++;
+   cachesim_I1_doref_NoX(n3->instr_addr, n3->instr_len,
+			 &cc3->Ir.m1, &cc3->Ir.mL);
+   cc3->Ir.a++;
+   count_folded(n, True);
+   count_folded(n2, True);
+   count_folded(n3, True);
+}
+
+/* With --batch-sim=yes, the instrumented code doesn't call a helper per
+ * cache access.  It appends an AccRec for each to acc_buf (see
+ * buffer_events), and the records are fed to the simulator in a tight
+ * loop when the buffer fills, or before anything looks at the counts or
+ * changes what they are charged to:  thread switches, client requests,
+ * interval snapshots, SB discards (which free the InstrInfos) and exit.
+ * Only one thread runs at a time, and we drain whenever another one is
+ * scheduled, so the one buffer is always the running thread's.
+ * Branch events still go straight to their helpers;  they don't touch
+ * the caches, so their order relative to the buffered accesses doesn't
+ * matter.
+ */
+typedef
+   enum {
+      AccIrNoX,
+      AccIrGen,
+      AccDr,             // also Dm
+      AccDw
+   }
+   AccKind;
+
+#define ACC_KIND_BITS   2
+#define ACC_KIND_MASK   ((1 << ACC_KIND_BITS) - 1)
+
+typedef
+   struct {
+      InstrInfo* inode;
+      Addr       addr;   // data address;  not set for fetches
+      UWord      info;   // AccKind | size << ACC_KIND_BITS
+   }
+   AccRec;
+
+#define ACC_BUF_RECS    16384
+#define ACC_PREFETCH    8   // records ahead to prefetch D1 sets for
+
+static AccRec  acc_buf[ACC_BUF_RECS];
+static AccRec* acc_cur = acc_buf;
+
+static void record_accesses(void);   // see --record-trace
+
+// Append a record from a helper, rather than from inline IR.
+__attribute__((always_inline))
+static __inline__
+void buffer_access(InstrInfo* n, Addr addr, UWord info)
+{
+   if (acc_cur == &acc_buf[ACC_BUF_RECS])
+      drain_accesses();
+   acc_cur->inode = n;
+   acc_cur->addr  = addr;
+   acc_cur->info  = info;
+   acc_cur++;
+}
+
+// addEvent_D_guarded uses the 0Ir ones in batch mode.  The others only
+// complete the --sim-daemon helper family:  buffer_events leaves
+// flushEvents no cache events to use them on.
+static VG_REGPARM(3)
+void buffer_1IrNoX_1Dr(InstrInfo* n, Addr data_addr, Word data_size)
+{
+   buffer_access(n, 0, AccIrNoX);
+   buffer_access(n, data_addr, AccDr | data_size << ACC_KIND_BITS);
+}
+
+static VG_REGPARM(3)
+void buffer_1IrNoX_1Dw(InstrInfo* n, Addr data_addr, Word data_size)
+{
+   buffer_access(n, 0, AccIrNoX);
+   buffer_access(n, data_addr, AccDw | data_size << ACC_KIND_BITS);
+}
+
+static VG_REGPARM(3)
+void buffer_0Ir_1Dr(InstrInfo* n, Addr data_addr, Word data_size)
+{
+   buffer_access(n, data_addr, AccDr | data_size << ACC_KIND_BITS);
+}
+
+static VG_REGPARM(3)
+void buffer_0Ir_1Dw(InstrInfo* n, Addr data_addr, Word data_size)
+{
+   buffer_access(n, data_addr, AccDw | data_size << ACC_KIND_BITS);
+}
+
+/* The data-access helpers come in one family per --miss-classify mode.
+ * The bodies are shared and always inlined; 'mc' is a constant in each
+ * instantiation, so the compiler drops the FA/INFI work a mode doesn't
+ * need.  See DCacheHelpers below for how a family is picked.
+ */
+__attribute__((always_inline))
+static __inline__
+void do_1IrNoX_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size,
+                                const MissClassify mc)
+{
+   //VG_(printf)("1IrNoX_1Dr:  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n"
+   //            "                               daddr=0x%010lx,  dsize=%lu\n",
+   //            n, n->instr_addr, n->instr_len, data_addr, data_size);
+   LineCacheCC* cc = cache_cc_of(n);
+   ULong   mL;
+   Bool    m1;
+   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
+			 &cc->Ir.m1, &cc->Ir.mL);
+   cc->Ir.a++;
+   count_folded(n, True);
+
+   if (UNLIKELY(!sim_data_access(data_addr, data_size))) {
+      cc->Dr.a++;
+      return;
+   }
+   note_access_pattern(n, data_addr, data_size);
+   mL = cc->Dr.mL;
+   m1 = cachesim_D1_doref(data_addr, data_size, &cc->Dr.m1, &cc->Dr.mL, n->parent->loc.line, evict_cc_of(n), &cc->Dr, mc);
+   note_miss(n, data_addr, False, m1, mL, cc->Dr.mL);
+
+   cc->Dr.a++;
+}
+
+__attribute__((always_inline))
+static __inline__
+void do_1IrNoX_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size,
+                                const MissClassify mc)
+{
+   //VG_(printf)("1IrNoX_1Dw:  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n"
+   //            "                               daddr=0x%010lx,  dsize=%lu\n",
+   //            n, n->instr_addr, n->instr_len, data_addr, data_size);
+   LineCacheCC* cc = cache_cc_of(n);
+   ULong   mL;
+   Bool    m1;
+   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
+			 &cc->Ir.m1, &cc->Ir.mL);
+   cc->Ir.a++;
+   count_folded(n, True);
+
+   if (UNLIKELY(!sim_data_access(data_addr, data_size))) {
+      cc->Dw.a++;
+      return;
+   }
+   note_access_pattern(n, data_addr, data_size);
+   mL = cc->Dw.mL;
+   m1 = cachesim_D1_doref(data_addr, data_size, &cc->Dw.m1, &cc->Dw.mL, n->parent->loc.line, evict_cc_of(n), &cc->Dw, mc);
+   note_miss(n, data_addr, True, m1, mL, cc->Dw.mL);
+
+   cc->Dw.a++;
+}
+
+__attribute__((always_inline))
+static __inline__
+void do_0Ir_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size,
+                             const MissClassify mc)
+{
+   //VG_(printf)("0Ir_1Dr:  CCaddr=0x%010lx,  daddr=0x%010lx,  dsize=%lu\n",
+   //            n, data_addr, data_size);
+   LineCacheCC* cc = cache_cc_of(n);
+   ULong   mL;
+   Bool    m1;
+   if (UNLIKELY(!sim_data_access(data_addr, data_size))) {
+      cc->Dr.a++;
+      return;
+   }
+   note_access_pattern(n, data_addr, data_size);
+   mL = cc->Dr.mL;
+   m1 = cachesim_D1_doref(data_addr, data_size, &cc->Dr.m1, &cc->Dr.mL, n->parent->loc.line, evict_cc_of(n), &cc->Dr, mc);
+   note_miss(n, data_addr, False, m1, mL, cc->Dr.mL);
+
+   cc->Dr.a++;
+}
+
+__attribute__((always_inline))
+static __inline__
+void do_0Ir_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size,
+                             const MissClassify mc)
+{
+   //VG_(printf)("0Ir_1Dw:  CCaddr=0x%010lx,  daddr=0x%010lx,  dsize=%lu\n",
+   //            n, data_addr, data_size);
+   LineCacheCC* cc = cache_cc_of(n);
+   ULong   mL;
+   Bool    m1;
+   if (UNLIKELY(!sim_data_access(data_addr, data_size))) {
+      cc->Dw.a++;
+      return;
+   }
+   note_access_pattern(n, data_addr, data_size);
+   mL = cc->Dw.mL;
+   m1 = cachesim_D1_doref(data_addr, data_size, &cc->Dw.m1, &cc->Dw.mL, n->parent->loc.line, evict_cc_of(n), &cc->Dw, mc);
+   note_miss(n, data_addr, True, m1, mL, cc->Dw.mL);
+
+   cc->Dw.a++;
+}
+
+/* Simulate and empty acc_buf.  The D1 set of each data access is
+ * prefetched a few records early;  the simulator's own work on a record
+ * is too short to hide a miss on the cache state. */
+__attribute__((always_inline))
+static __inline__
+void do_drain_accesses(const MissClassify mc)
+{
+   AccRec* r;
+   AccRec* end = acc_cur;
+
+   record_accesses();
+   for (r = acc_buf; r < end; r++) {
+      if (r + ACC_PREFETCH < end
+          && (r[ACC_PREFETCH].info & ACC_KIND_MASK) >= AccDr) {
+         UInt set = (r[ACC_PREFETCH].addr >> D1.line_size_bits)
+                    & D1.sets_min_1;
+         __builtin_prefetch(&D1.cachelines[set * D1.assoc]);
+         __builtin_prefetch(&D1.lru_list[set * D1.assoc]);
+      }
+      switch (r->info & ACC_KIND_MASK) {
+         case AccIrNoX:
+            log_1IrNoX_0D_cache_access(r->inode);
+            break;
+         case AccIrGen:
+            log_1IrGen_0D_cache_access(r->inode);
+            break;
+         case AccDr:
+            do_0Ir_1Dr_cache_access(r->inode, r->addr,
+                                    r->info >> ACC_KIND_BITS, mc);
+            break;
+         case AccDw:
+            do_0Ir_1Dw_cache_access(r->inode, r->addr,
+                                    r->info >> ACC_KIND_BITS, mc);
+            break;
       }
+   }
+   acc_cur = acc_buf;
+}
+
+/* Note that addEvent_D_guarded assumes that log_0Ir_1Dr_cache_access_*
+   and log_0Ir_1Dw_cache_access_* have exactly the same prototype.  If
+   you change them, you must change addEvent_D_guarded too. */
+#define MAKE_D_CACHE_HELPERS(sfx, mc)                                      \
+   static VG_REGPARM(3)                                                    \
+   void log_1IrNoX_1Dr_cache_access_##sfx(InstrInfo* n, Addr data_addr,   \
+                                          Word data_size)                  \
+   {                                                                       \
+      do_1IrNoX_1Dr_cache_access(n, data_addr, data_size, mc);             \
+   }                                                                       \
+   static VG_REGPARM(3)                                                    \
+   void log_1IrNoX_1Dw_cache_access_##sfx(InstrInfo* n, Addr data_addr,   \
+                                          Word data_size)                  \
+   {                                                                       \
+      do_1IrNoX_1Dw_cache_access(n, data_addr, data_size, mc);             \
+   }                                                                       \
+   static VG_REGPARM(3)                                                    \
+   void log_0Ir_1Dr_cache_access_##sfx(InstrInfo* n, Addr data_addr,      \
+                                       Word data_size)                     \
+   {                                                                       \
+      do_0Ir_1Dr_cache_access(n, data_addr, data_size, mc);                \
+   }                                                                       \
+   static VG_REGPARM(3)                                                    \
+   void log_0Ir_1Dw_cache_access_##sfx(InstrInfo* n, Addr data_addr,      \
+                                       Word data_size)                     \
+   {                                                                       \
+      do_0Ir_1Dw_cache_access(n, data_addr, data_size, mc);                \
+   }                                                                       \
+   static                                                                  \
+   void drain_accesses_##sfx(void)                                         \
+   {                                                                       \
+      do_drain_accesses(mc);                                               \
+   }
+
+MAKE_D_CACHE_HELPERS(none, MissClassifyNone)
+MAKE_D_CACHE_HELPERS(d1,   MissClassifyD1)
+MAKE_D_CACHE_HELPERS(all,  MissClassifyAll)
+
+#undef MAKE_D_CACHE_HELPERS
 
-      VG_(OSetGen_Insert)(CC_table, lineCC);
+/*------------------------------------------------------------*/
+/*--- Simulator daemon                                     ---*/
+/*------------------------------------------------------------*/
+
+/* With --sim-daemon=<prog>, which implies --batch-sim=yes, the buffered
+ * accesses aren't simulated here.  They are shipped to <prog> (cg_simd.c)
+ * through a ring in a shared, unlinked file (see cg_ring.h), and it runs
+ * the same simulator, splitting it over two cores.  The access counts and
+ * count_folded's work stay here;  the miss counts come back at the next
+ * sync, for the shard each record was charged to (see CgrRec), so the
+ * daemon charges an eviction to the shard that brought the line in, as
+ * the tool does.  We sync wherever batch mode drains before reading the
+ * counts.  A shard change or an SB discard only needs a drain, as the
+ * records carry everything the daemon needs.
+ *
+ * A child that the client forks inherits the mapping but not the daemon.
+ * It detaches, and simulates in-process from then on, with cold caches.
+ * The daemon is stopped before an exec(), and exits if the tool dies.
+ */
+static CgrHeader* ring_hdr = NULL;
+static CgrRec*    ring_recs;
+static CgrResult* ring_results;
+static ULong      ring_head = 0;      // records published
+static ULong      ring_tail = 0;      // ring_hdr->tail, when last read
+static ULong      ring_seq  = 0;      // syncs requested
+static Int        ring_pid;           // the process the daemon works for
+static Int        sim_daemon_pid;
+
+static Bool sim_daemon_live(void)
+{
+   if (ring_hdr && VG_(getpid)() != ring_pid)
+      ring_hdr = NULL;
+   return ring_hdr != NULL;
+}
+
+// Called while waiting for the daemon, which had better still be there.
+static void ring_wait(UInt* spins)
+{
+   Int status;
+
+   if ((++*spins & 0xFFFF) == 0
+       && VG_(waitpid)(sim_daemon_pid, &status, VKI_WNOHANG) == sim_daemon_pid) {
+      VG_(umsg)("Cachegrind: cannot continue: the simulator daemon died.\n");
+      VG_(exit)(1);
+   }
+}
+
+// The Drain helper of the daemon family.
+static void ship_accesses(void)
+{
+   AccRec* r;
+   UInt    spins = 0;
+
+   if (!sim_daemon_live()) {
+      switch (clo_miss_classify) {
+         case MissClassifyNone: drain_accesses_none(); break;
+         case MissClassifyD1:   drain_accesses_d1();   break;
+         case MissClassifyAll:  drain_accesses_all();  break;
+      }
+      return;
    }
 
-   return lineCC;
+   record_accesses();
+   for (r = acc_buf; r < acc_cur; r++) {
+      InstrInfo*   n    = r->inode;
+      LineCacheCC* cc   = cache_cc_of(n);
+      UWord        kind = r->info & ACC_KIND_MASK;
+      CgrRec*      s;
+
+      if (kind >= AccDr
+          && UNLIKELY(!sim_data_access(r->addr, r->info >> ACC_KIND_BITS))) {
+         if (kind == AccDr)
+            cc->Dr.a++;
+         else
+            cc->Dw.a++;
+         continue;
+      }
+      if (ring_head - ring_tail == ring_hdr->n_slots) {
+         CGR_STORE(&ring_hdr->head, ring_head);
+         while (ring_head - (ring_tail = CGR_LOAD(&ring_hdr->tail))
+                == ring_hdr->n_slots)
+            ring_wait(&spins);
+      }
+      s = &ring_recs[ring_head++ & (ring_hdr->n_slots - 1)];
+      s->id    = n->line_id;
+      s->shard = cur_shard ? cur_shard->id : 0;
+      s->line  = n->parent->loc.line;
+      s->kind  = kind;       // AccKind and CgrKind agree
+      if (kind < AccDr) {
+         s->addr = n->instr_addr;
+         s->size = n->instr_len;
+         cc->Ir.a++;
+         count_folded(n, True);
+      } else {
+         s->addr = r->addr;
+         s->size = r->info >> ACC_KIND_BITS;
+         note_access_pattern(n, s->addr, s->size);
+         if (kind == AccDr)
+            cc->Dr.a++;
+         else
+            cc->Dw.a++;
+      }
+   }
+   CGR_STORE(&ring_hdr->head, ring_head);
+   acc_cur = acc_buf;
 }
 
-/*------------------------------------------------------------*/
-/*--- Cache simulation functions                           ---*/
-/*------------------------------------------------------------*/
+typedef
+   struct {
+      const HChar* name;
+      void*        addr;
+   }
+   HelperFn;
+
+#define HELPER_FN(fn)  { #fn, &fn }
+
+// One data-access helper family, as used by flushEvents.
+typedef
+   struct {
+      HelperFn IrNoX_Dr;
+      HelperFn IrNoX_Dw;
+      HelperFn Dr;
+      HelperFn Dw;
+      HelperFn Drain;
+   }
+   DCacheHelpers;
+
+// Indexed by MissClassify.
+static const DCacheHelpers d_cache_helpers[3] = {
+   { HELPER_FN(log_1IrNoX_1Dr_cache_access_none),
+     HELPER_FN(log_1IrNoX_1Dw_cache_access_none),
+     HELPER_FN(log_0Ir_1Dr_cache_access_none),
+     HELPER_FN(log_0Ir_1Dw_cache_access_none),
+     HELPER_FN(drain_accesses_none) },
+   { HELPER_FN(log_1IrNoX_1Dr_cache_access_d1),
+     HELPER_FN(log_1IrNoX_1Dw_cache_access_d1),
+     HELPER_FN(log_0Ir_1Dr_cache_access_d1),
+     HELPER_FN(log_0Ir_1Dw_cache_access_d1),
+     HELPER_FN(drain_accesses_d1) },
+   { HELPER_FN(log_1IrNoX_1Dr_cache_access_all),
+     HELPER_FN(log_1IrNoX_1Dw_cache_access_all),
+     HELPER_FN(log_0Ir_1Dr_cache_access_all),
+     HELPER_FN(log_0Ir_1Dw_cache_access_all),
+     HELPER_FN(drain_accesses_all) },
+};
+
+// Used with --sim-daemon.
+static const DCacheHelpers sim_daemon_helpers = {
+   HELPER_FN(buffer_1IrNoX_1Dr),
+   HELPER_FN(buffer_1IrNoX_1Dw),
+   HELPER_FN(buffer_0Ir_1Dr),
+   HELPER_FN(buffer_0Ir_1Dw),
+   HELPER_FN(ship_accesses)
+};
 
-/* A common case for an instruction read event is that the
- * bytes read belong to the same cache line in both L1I and LL
- * (if cache line sizes of L1 and LL are the same).
- * As this can be detected at instrumentation time, and results
- * in faster simulation, special-casing is benefical.
- *
- * Abbreviations used in var/function names:
- *  IrNoX - instruction read does not cross cache lines
- *  IrGen - generic instruction read; not detected as IrNoX
- *  Ir    - not known / not important whether it is an IrNoX
- */
+#undef HELPER_FN
 
-// Only used with --cache-sim=no.
-static VG_REGPARM(1)
-void log_1Ir(InstrInfo* n)
-{
-   n->parent->Ir.a++;
-}
+// The family in use; set in cg_post_clo_init from --miss-classify.
+static const DCacheHelpers* d_helpers = &d_cache_helpers[MissClassifyAll];
 
-// Only used with --cache-sim=no.
-static VG_REGPARM(2)
-void log_2Ir(InstrInfo* n, InstrInfo* n2)
+static void drain_accesses(void)
 {
-   n->parent->Ir.a++;
-   n2->parent->Ir.a++;
+   if (acc_cur != acc_buf)
+      ((void (*)(void))d_helpers->Drain.addr)();
 }
 
-// Only used with --cache-sim=no.
-static VG_REGPARM(3)
-void log_3Ir(InstrInfo* n, InstrInfo* n2, InstrInfo* n3)
+static void add_sim_results(CacheCC* cc, const ULong* v)
 {
-   n->parent->Ir.a++;
-   n2->parent->Ir.a++;
-   n3->parent->Ir.a++;
+   cc->m1      += v[0];
+   cc->mL      += v[1];
+   cc->m1_comp += v[2];
+   cc->m1_conf += v[3];
+   cc->m1_cap  += v[4];
+   cc->mL_comp += v[5];
+   cc->mL_conf += v[6];
+   cc->mL_cap  += v[7];
 }
 
-// Generic case for instruction reads: may cross cache lines.
-// All other Ir handlers expect IrNoX instruction reads.
-static VG_REGPARM(1)
-void log_1IrGen_0D_cache_access(InstrInfo* n)
+// Merge the batch of results the daemon has just published.
+static void merge_sim_results(void)
 {
-   //VG_(printf)("1IrGen_0D :  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n",
-   //             n, n->instr_addr, n->instr_len);
-   cachesim_I1_doref_Gen(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
-   n->parent->Ir.a++;
+   UInt i, k;
+
+   for (i = 0; i < ring_hdr->n_results; i++) {
+      const CgrResult* r = &ring_results[i];
+      CCColumns*   cols;
+      LineCacheCC* cc;
+      EvictCC*     ev;
+
+      tl_assert(r->id < n_lineCCs);
+      tl_assert(r->shard <= VG_(sizeXA)(all_shards));
+      cols = r->shard == 0
+             ? &shared_ccs
+             : &(*(CCShard**)VG_(indexXA)(all_shards, r->shard - 1))->ccs;
+      cc = cc_row(cols, CCColCache, r->id);
+      ev = cc_row(cols, CCColEvict, r->id);
+      cc->Ir.m1 += r->v[CGR_Ir_m1];
+      cc->Ir.mL += r->v[CGR_Ir_mL];
+      add_sim_results(&cc->Dr, &r->v[CGR_Dr_m1]);
+      add_sim_results(&cc->Dw, &r->v[CGR_Dw_m1]);
+      for (k = 0; k < MAX_NUM_BINS; k++) {
+         ev->D1[k] += r->v[CGR_EvD1_1 + k];
+         ev->LL[k] += r->v[CGR_EvLL_1 + k];
+      }
+   }
 }
 
-static VG_REGPARM(1)
-void log_1IrNoX_0D_cache_access(InstrInfo* n)
+// Wait for the daemon to simulate everything shipped, and merge its
+// counts.  With 'finishing', it also charges the lines still in the
+// caches to the eviction bins, and exits.
+static void ring_sync(Bool finishing)
 {
-   //VG_(printf)("1IrNoX_0D :  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n",
-   //             n, n->instr_addr, n->instr_len);
-   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
-   n->parent->Ir.a++;
+   UInt spins = 0;
+
+   CGR_STORE(&ring_hdr->head, ring_head);
+   if (finishing)
+      CGR_STORE(&ring_hdr->finishing, 1);
+   CGR_STORE(&ring_hdr->sync_req, ++ring_seq);
+   for (;;) {
+      ULong res_seq = CGR_LOAD(&ring_hdr->res_seq);
+      if (res_seq != ring_hdr->res_ack) {
+         merge_sim_results();
+         CGR_STORE(&ring_hdr->res_ack, res_seq);
+      } else if (CGR_LOAD(&ring_hdr->sync_done) == ring_seq) {
+         break;
+      } else {
+         ring_wait(&spins);
+      }
+   }
+   ring_tail = CGR_LOAD(&ring_hdr->tail);
 }
 
-static VG_REGPARM(2)
-void log_2IrNoX_0D_cache_access(InstrInfo* n, InstrInfo* n2)
+// Like drain_accesses, but also brings the miss counts up to date when
+// the simulation is done by the daemon.
+static void sync_accesses(void)
 {
-   //VG_(printf)("2IrNoX_0D : CC1addr=0x%010lx, i1addr=0x%010lx, i1size=%lu\n"
-   //            "            CC2addr=0x%010lx, i2addr=0x%010lx, i2size=%lu\n",
-   //            n,  n->instr_addr,  n->instr_len,
-   //            n2, n2->instr_addr, n2->instr_len);
-   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
-   n->parent->Ir.a++;
-   cachesim_I1_doref_NoX(n2->instr_addr, n2->instr_len,
-			 &n2->parent->Ir.m1, &n2->parent->Ir.mL);
-   n2->parent->Ir.a++;
+   drain_accesses();
+   if (sim_daemon_live())
+      ring_sync(False);
 }
 
-static VG_REGPARM(3)
-void log_3IrNoX_0D_cache_access(InstrInfo* n, InstrInfo* n2, InstrInfo* n3)
+static void sim_daemon_failed(const HChar* what)
 {
-   //VG_(printf)("3IrNoX_0D : CC1addr=0x%010lx, i1addr=0x%010lx, i1size=%lu\n"
-   //            "            CC2addr=0x%010lx, i2addr=0x%010lx, i2size=%lu\n"
-   //            "            CC3addr=0x%010lx, i3addr=0x%010lx, i3size=%lu\n",
-   //            n,  n->instr_addr,  n->instr_len,
-   //            n2, n2->instr_addr, n2->instr_len,
-   //            n3, n3->instr_addr, n3->instr_len);
-   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
-   n->parent->Ir.a++;
-   cachesim_I1_doref_NoX(n2->instr_addr, n2->instr_len,
-			 &n2->parent->Ir.m1, &n2->parent->Ir.mL);
-   n2->parent->Ir.a++;
-   cachesim_I1_doref_NoX(n3->instr_addr, n3->instr_len,
-			 &n3->parent->Ir.m1, &n3->parent->Ir.mL);
-   n3->parent->Ir.a++;
+   VG_(umsg)("Cachegrind: cannot continue: %s for --sim-daemon.\n", what);
+   VG_(umsg)("  Exiting now.\n");
+   VG_(exit)(1);
 }
 
-static VG_REGPARM(3)
-void log_1IrNoX_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
+// Create the ring and start the daemon on it.
+static void start_sim_daemon(cache_t I1c, cache_t D1c, cache_t LLc)
 {
-   //VG_(printf)("1IrNoX_1Dr:  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n"
-   //            "                               daddr=0x%010lx,  dsize=%lu\n",
-   //            n, n->instr_addr, n->instr_len, data_addr, data_size);
-   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
-   n->parent->Ir.a++;
-
-   cachesim_D1_doref(data_addr, data_size, &n->parent->Dr.m1, &n->parent->Dr.mL, n->parent->loc.line, n->parent, &n->parent->Dr);
-
-   n->parent->Dr.a++;
+   const cache_t* c[3] = { &I1c, &D1c, &LLc };
+   const HChar* argv[3];
+   CgrHeader    h;
+   HChar*       ring_file;
+   HChar        fd_str[16];
+   SysRes       sres;
+   UChar        zero = 0;
+   Int          fd, pid, i;
+
+   VG_(memset)(&h, 0, sizeof(h));
+   VG_(memcpy)(h.magic, CGR_MAGIC, sizeof(h.magic));
+   h.n_slots       = CGR_N_SLOTS;
+   h.n_results_max = CGR_N_RESULTS;
+   h.miss_classify = clo_miss_classify;
+   for (i = 0; i < 3; i++) {
+      h.cache[i][0] = c[i]->size;
+      h.cache[i][1] = c[i]->assoc;
+      h.cache[i][2] = c[i]->line_size;
+   }
+   h.ll_page_map  = LL_map.page_map;
+   h.ll_page_size = LL_map.page_size;
+   h.ll_slices    = LL_map.slices;
+   h.ll_seed      = LL_map.seed;
+
+   // The daemon inherits the fd, so the file can go at once, and is
+   // never left behind.
+   ring_file = VG_(malloc)("cg.main.ssd.1",
+                           VG_(strlen)(VG_(tmpdir)()) + 64);
+   fd = VG_(mkstemp)("cachegrind_ring", ring_file);
+   if (fd < 0)
+      sim_daemon_failed("cannot create the ring file");
+   VG_(unlink)(ring_file);
+   VG_(free)(ring_file);
+   if (VG_(write)(fd, &h, sizeof(h)) != sizeof(h)
+       || VG_(lseek)(fd, CGR_FILE_SIZE(&h) - 1, VKI_SEEK_SET) < 0
+       || VG_(write)(fd, &zero, 1) != 1)
+      sim_daemon_failed("cannot size the ring file");
+   sres = VG_(am_shared_mmap_file_float_valgrind)(
+             CGR_FILE_SIZE(&h), VKI_PROT_READ|VKI_PROT_WRITE, fd, 0);
+   if (sr_isError(sres))
+      sim_daemon_failed("cannot map the ring file");
+
+   ring_hdr     = (CgrHeader*)sr_Res(sres);
+   ring_recs    = (CgrRec*)((UChar*)ring_hdr + CGR_RING_OFF(ring_hdr));
+   ring_results = (CgrResult*)((UChar*)ring_hdr + CGR_RESULTS_OFF(ring_hdr));
+   ring_pid     = VG_(getpid)();
+
+   VG_(sprintf)(fd_str, "%d", fd);
+   argv[0] = clo_sim_daemon;
+   argv[1] = fd_str;
+   argv[2] = NULL;
+   pid = VG_(fork)();
+   if (pid == 0) {
+      VG_(execv)(clo_sim_daemon, argv);
+      VG_(umsg)("Cachegrind: cannot run '%s'\n", clo_sim_daemon);
+      VG_(exit)(1);
+   }
+   VG_(close)(fd);
+   if (pid < 0)
+      sim_daemon_failed("cannot fork");
+   sim_daemon_pid = pid;
 }
 
-static VG_REGPARM(3)
-void log_1IrNoX_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
+static void stop_sim_daemon(void)
 {
-   //VG_(printf)("1IrNoX_1Dw:  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n"
-   //            "                               daddr=0x%010lx,  dsize=%lu\n",
-   //            n, n->instr_addr, n->instr_len, data_addr, data_size);
-   cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
-   n->parent->Ir.a++;
+   Int status;
 
-   cachesim_D1_doref(data_addr, data_size, &n->parent->Dw.m1, &n->parent->Dw.mL, n->parent->loc.line, n->parent, &n->parent->Dw);
-
-   n->parent->Dw.a++;
+   drain_accesses();
+   ring_sync(True);
+   VG_(waitpid)(sim_daemon_pid, &status, 0);
+   ring_hdr = NULL;
 }
 
-/* Note that addEvent_D_guarded assumes that log_0Ir_1Dr_cache_access
-   and log_0Ir_1Dw_cache_access have exactly the same prototype.  If
-   you change them, you must change addEvent_D_guarded too. */
-static VG_REGPARM(3)
-void log_0Ir_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
+// The daemon can't tell that the client has exec()d, as the pid stays,
+// so it's stopped first.  If the exec fails, we go on in-process with
+// cold caches, as a forked child does.
+static void cg_pre_syscall(ThreadId tid, UInt syscallno,
+                           UWord* args, UInt nArgs)
 {
-   //VG_(printf)("0Ir_1Dr:  CCaddr=0x%010lx,  daddr=0x%010lx,  dsize=%lu\n",
-   //            n, data_addr, data_size);
-   cachesim_D1_doref(data_addr, data_size, &n->parent->Dr.m1, &n->parent->Dr.mL, n->parent->loc.line, n->parent, &n->parent->Dr);
-
-   n->parent->Dr.a++;
+   if ((syscallno == __NR_execve
+#if defined(__NR_execveat)
+        || syscallno == __NR_execveat
+#endif
+       ) && sim_daemon_live())
+      stop_sim_daemon();
 }
 
-/* See comment on log_0Ir_1Dr_cache_access. */
-static VG_REGPARM(3)
-void log_0Ir_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
+static void cg_post_syscall(ThreadId tid, UInt syscallno,
+                            UWord* args, UInt nArgs, SysRes res)
 {
-   //VG_(printf)("0Ir_1Dw:  CCaddr=0x%010lx,  daddr=0x%010lx,  dsize=%lu\n",
-   //            n, data_addr, data_size);
-   cachesim_D1_doref(data_addr, data_size, &n->parent->Dw.m1, &n->parent->Dw.mL, n->parent->loc.line, n->parent, &n->parent->Dw);
-
-   n->parent->Dw.a++;
 }
 
 /* For branches, we consult two different predictors, one which
@@ -407,8 +2057,9 @@ void log_cond_branch(InstrInfo* n, Word taken)
 {
    //VG_(printf)("cbrnch:  CCaddr=0x%010lx,  taken=0x%010lx\n",
    //             n, taken);
-   n->parent->Bc.b++;
-   n->parent->Bc.mp 
+   LineBranchCC* cc = branch_cc_of(n);
+   cc->Bc.b++;
+   cc->Bc.mp 
       += (1 & do_cond_branch_predict(n->instr_addr, taken));
 }
 
@@ -417,12 +2068,260 @@ void log_ind_branch(InstrInfo* n, UWord actual_dst)
 {
    //VG_(printf)("ibrnch:  CCaddr=0x%010lx,    dst=0x%010lx\n",
    //             n, actual_dst);
-   n->parent->Bi.b++;
-   n->parent->Bi.mp
+   LineBranchCC* cc = branch_cc_of(n);
+   cc->Bi.b++;
+   cc->Bi.mp
       += (1 & do_ind_branch_predict(n->instr_addr, actual_dst));
 }
 
 
+/*------------------------------------------------------------*/
+/*--- Interval snapshots (--interval)                      ---*/
+/*------------------------------------------------------------*/
+
+/* Every --interval guest instructions, the change since the previous
+   snapshot in the totals and in each function's counts is appended to
+   the --interval-out-file.  Instructions are counted per SB on entry
+   (see add_interval_count), so boundaries are accurate to within one
+   SB.  Deltas come from a walk over the CC table against the previous
+   snapshot's per-function sums, which keeps the helpers untouched. */
+
+typedef enum {
+   IV_Ir, IV_I1m, IV_ILm, IV_Dr, IV_Dw,
+   IV_D1m, IV_D1m_comp, IV_D1m_conf, IV_D1m_cap,
+   IV_DLm, IV_DLm_comp, IV_DLm_conf, IV_DLm_cap,
+   IV_EvD1,                            // MAX_NUM_BINS of these
+   IV_EvLL = IV_EvD1 + MAX_NUM_BINS,   // and of these
+   IV_N    = IV_EvLL + MAX_NUM_BINS
+} IntervalCol;
+
+typedef struct {
+   VgHashNode  node;       // key: hash of file and fn
+   HChar*      file;       // permanent strings
+   const HChar* fn;
+   ULong       prev[IV_N]; // sums at the previous snapshot
+} IntervalFn;
+
+static ULong        interval_icount = 0;   // guest instrs, bumped by IR
+static ULong        interval_next   = 0;   // next snapshot boundary
+static UInt         interval_seq    = 0;
+static VgHashTable* interval_fns    = NULL;
+static ULong        interval_prev_total[IV_N];
+static HChar*       interval_out_file = NULL;
+static Int          interval_out_pid  = 0;
+
+static void add_interval_cols(ULong* v, const LineCC* cc)
+{
+   Int i;
+
+   v[IV_Ir]       += cc->Ir.a;
+   v[IV_I1m]      += cc->Ir.m1;
+   v[IV_ILm]      += cc->Ir.mL;
+   v[IV_Dr]       += cc->Dr.a;
+   v[IV_Dw]       += cc->Dw.a;
+   v[IV_D1m]      += cc->Dr.m1      + cc->Dw.m1;
+   v[IV_D1m_comp] += cc->Dr.m1_comp + cc->Dw.m1_comp;
+   v[IV_D1m_conf] += cc->Dr.m1_conf + cc->Dw.m1_conf;
+   v[IV_D1m_cap]  += cc->Dr.m1_cap  + cc->Dw.m1_cap;
+   v[IV_DLm]      += cc->Dr.mL      + cc->Dw.mL;
+   v[IV_DLm_comp] += cc->Dr.mL_comp + cc->Dw.mL_comp;
+   v[IV_DLm_conf] += cc->Dr.mL_conf + cc->Dw.mL_conf;
+   v[IV_DLm_cap]  += cc->Dr.mL_cap  + cc->Dw.mL_cap;
+   for (i = 0; i < MAX_NUM_BINS; i++) {
+      v[IV_EvD1 + i] += cc->ev.D1[i];
+      v[IV_EvLL + i] += cc->ev.LL[i];
+   }
+}
+
+// Print 'cur - prev', and make 'prev' 'cur'.  Without --cache-sim only
+// Ir means anything.
+static void fprint_interval_delta(VgFile* fp, const ULong* cur, ULong* prev)
+{
+   Int i, n = clo_cache_sim ? IV_N : 1;
+
+   for (i = 0; i < n; i++) {
+      VG_(fprintf)(fp, i == 0 ? "%llu" : " %llu", cur[i] - prev[i]);
+      prev[i] = cur[i];
+   }
+   VG_(fprintf)(fp, "\n");
+}
+
+static Word cmp_IntervalFn(const void* key, const void* elem)
+{
+   const IntervalFn* a = key;
+   const IntervalFn* b = elem;
+   return (a->file == b->file && a->fn == b->fn) ? 0 : 1;
+}
+
+static IntervalFn* get_IntervalFn(HChar* file, const HChar* fn)
+{
+   IntervalFn  key, *ivf;
+
+   key.node.key = (UWord)file * 31 + (UWord)fn;
+   key.file     = file;
+   key.fn       = fn;
+   ivf = VG_(HT_gen_lookup)(interval_fns, &key, cmp_IntervalFn);
+   if (!ivf) {
+      ivf = VG_(calloc)("cg.main.gif.1", 1, sizeof(IntervalFn));
+      *ivf = key;
+      VG_(memset)(ivf->prev, 0, sizeof(ivf->prev));
+      VG_(HT_add_node)(interval_fns, ivf);
+   }
+   return ivf;
+}
+
+// The desc: and cmd: lines, as in cachegrind.out.
+static void fprint_iv_preamble(VgFile* fp)
+{
+   Int i;
+
+   if (clo_cache_sim) {
+      VG_(fprintf)(fp,  "desc: I1 cache:         %s\n"
+                        "desc: D1 cache:         %s\n"
+                        "desc: LL cache:         %s\n",
+                        I1.desc_line, D1.desc_line, LL.desc_line);
+   }
+   VG_(fprintf)(fp, "cmd: %s", VG_(args_the_exename));
+   for (i = 0; i < VG_(sizeXA)( VG_(args_for_client) ); i++) {
+      HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_client), i );
+      VG_(fprintf)(fp, " %s", arg);
+   }
+   VG_(fprintf)(fp, "\n");
+}
+
+// The events: line naming the IntervalCol columns printed.
+static void fprint_iv_events(VgFile* fp)
+{
+   Int i;
+
+   if (clo_cache_sim) {
+      VG_(fprintf)(fp, "events: Ir I1mr ILmr Dr Dw"
+                       " D1m D1m.comp D1m.conf D1m.cap"
+                       " DLm DLm.comp DLm.conf DLm.cap");
+      for (i = 0; i < MAX_NUM_BINS; i++)
+         VG_(fprintf)(fp, " EvD1.%dw", i+1);
+      for (i = 0; i < MAX_NUM_BINS; i++)
+         VG_(fprintf)(fp, " EvLL.%dw", i+1);
+      VG_(fprintf)(fp, "\n");
+   } else {
+      VG_(fprintf)(fp, "events: Ir\n");
+   }
+}
+
+// Open the interval file for appending;  the first time (in each process,
+// if the client forks) it is created and given its header lines.
+static VgFile* open_interval_file(void)
+{
+   VgFile* fp;
+   Bool    fresh = False;
+
+   if (interval_out_file == NULL || interval_out_pid != VG_(getpid)()) {
+      VG_(free)(interval_out_file);
+      interval_out_file = VG_(expand_file_name)("--interval-out-file",
+                                                clo_interval_out_file);
+      interval_out_pid  = VG_(getpid)();
+      fresh = True;
+   }
+   fp = VG_(fopen)(interval_out_file,
+                   VKI_O_CREAT|VKI_O_WRONLY|(fresh ? VKI_O_TRUNC : VKI_O_APPEND),
+                   VKI_S_IRUSR|VKI_S_IWUSR);
+   if (fp == NULL) {
+      VG_(umsg)("error: can't open interval output file '%s'\n",
+                interval_out_file);
+      return NULL;
+   }
+   if (fresh) {
+      fprint_iv_preamble(fp);
+      VG_(fprintf)(fp, "interval: %llu\n", clo_interval);
+      fprint_iv_events(fp);
+   }
+   return fp;
+}
+
+// Append one snapshot:  a "snapshot:" line, the total deltas, then
+// fl=/fn= blocks for the functions whose counts changed.
+static void write_interval_snapshot(Bool final)
+{
+   VgFile*      fp;
+   SrcLine*     node;
+   LineCC       *lineCC, tmp;
+   HChar        *currFile = NULL, *printedFile = NULL;
+   const HChar  *currFn = NULL;
+   ULong        fn_sum[IV_N], total[IV_N];
+   IntervalFn*  ivf;
+   struct vki_timeval tv;
+
+   fp = open_interval_file();
+   if (fp == NULL)
+      return;
+
+   // "time:" is wall-clock seconds since the epoch, for matching against
+   // the client's own logs;  "ms:" is milliseconds since start-up.
+   VG_(gettimeofday)(&tv, NULL);
+   VG_(fprintf)(fp, "snapshot: %u%s instrs: %llu time: %lld.%06lld ms: %u\n",
+                    ++interval_seq, final ? " final" : "", interval_icount,
+                    (Long)tv.tv_sec, (Long)tv.tv_usec,
+                    VG_(read_millisecond_timer)());
+
+   // Totals first, so a reader that only wants them can skip the rest.
+   VG_(memset)(total, 0, sizeof(total));
+   CC_table_ResetIter();
+   while ( (node = CC_table_Next()) ) {
+      lineCC = output_lineCC(node, NULL, &tmp);
+      add_interval_cols(total, lineCC);
+   }
+   VG_(fprintf)(fp, "total: ");
+   fprint_interval_delta(fp, total, interval_prev_total);
+
+   // Then per function;  the CC table is sorted by file, then function.
+   VG_(memset)(fn_sum, 0, sizeof(fn_sum));
+   CC_table_ResetIter();
+   while (True) {
+      node = CC_table_Next();
+      if (currFn &&
+          (!node || node->loc.file != currFile || node->loc.fn != currFn)) {
+         ivf = get_IntervalFn(currFile, currFn);
+         if (VG_(memcmp)(fn_sum, ivf->prev, sizeof(fn_sum)) != 0) {
+            if (currFile != printedFile) {
+               VG_(fprintf)(fp, "fl=%s\n", currFile);
+               printedFile = currFile;
+            }
+            VG_(fprintf)(fp, "fn=%s\n", currFn);
+            fprint_interval_delta(fp, fn_sum, ivf->prev);
+         }
+         VG_(memset)(fn_sum, 0, sizeof(fn_sum));
+      }
+      if (!node)
+         break;
+      currFile = node->loc.file;
+      currFn   = node->loc.fn;
+      add_interval_cols(fn_sum, output_lineCC(node, NULL, &tmp));
+   }
+
+   VG_(fclose)(fp);
+}
+
+// After the counters have been zeroed, deltas start from zero again;  what
+// accrued since the last snapshot is lost from the series.
+static void reset_interval_baseline(void)
+{
+   IntervalFn* ivf;
+
+   VG_(memset)(interval_prev_total, 0, sizeof(interval_prev_total));
+   VG_(HT_ResetIter)(interval_fns);
+   while ( (ivf = VG_(HT_Next)(interval_fns)) )
+      VG_(memset)(ivf->prev, 0, sizeof(ivf->prev));
+}
+
+// Called from the IR added by add_interval_count when interval_icount
+// reaches interval_next.
+static void interval_tick(void)
+{
+   sync_accesses();
+   write_interval_snapshot(False);
+   interval_next = (interval_icount / clo_interval + 1) * clo_interval;
+}
+
 /*------------------------------------------------------------*/
 /*--- Instrumentation types and structures                 ---*/
 /*------------------------------------------------------------*/
@@ -533,6 +2432,14 @@ static Int get_Event_dszB ( Event* ev ) {
 #define N_EVENTS 16
 
 
+/* 'base' is IRTemp_INVALID if nothing is known. */
+typedef
+   struct {
+      IRTemp base;
+      Long   offset;
+   }
+   AddrDef;
+
 /* A struct which holds all the running state during instrumentation.
    Mostly to avoid passing loads of parameters everywhere. */
 typedef
@@ -549,6 +2456,11 @@ typedef
 
       /* The output SB being constructed. */
       IRSB* sbOut;
+
+      /* For each temp of the input SB, the temp plus constant it is
+         known to hold, if any;  see note_addr_def. */
+      AddrDef* addr_defs;
+      Int      n_addr_defs;
    }
    CgState;
 
@@ -557,6 +2469,40 @@ typedef
 /*--- Instrumentation main                                 ---*/
 /*------------------------------------------------------------*/
 
+static SB_info* alloc_SB_info(Int n_instrs)
+{
+   SB_info* sbInfo;
+   Int      c = 0;
+
+   while (c < SB_INFO_N_CLASSES && n_instrs > (SB_INFO_MIN_INSTRS << c))
+      c++;
+
+   if (c == SB_INFO_N_CLASSES) {
+      sbInfo = VG_(malloc)("cg.main.asi.1",
+                           sizeof(SB_info) + n_instrs*sizeof(InstrInfo));
+      sbInfo->size_class = -1;
+      return sbInfo;
+   }
+   if (!SB_info_pools[c]) {
+      SB_info_pools[c] =
+         VG_(newPA)(sizeof(SB_info)
+                    + (SB_INFO_MIN_INSTRS << c) * sizeof(InstrInfo),
+                    SB_INFO_PER_POOL, VG_(malloc), "cg.main.asi.2",
+                    VG_(free));
+   }
+   sbInfo = VG_(allocEltPA)(SB_info_pools[c]);
+   sbInfo->size_class = c;
+   return sbInfo;
+}
+
+static void free_SB_info(SB_info* sbInfo)
+{
+   if (sbInfo->size_class < 0)
+      VG_(free)(sbInfo);
+   else
+      VG_(freeEltPA)(SB_info_pools[sbInfo->size_class], sbInfo);
+}
+
 // Note that origAddr is the real origAddr, not the address of the first
 // instruction in the block (they can be different due to redirection).
 static
@@ -577,16 +2523,15 @@ SB_info* get_SB_info(IRSB* sbIn, Addr origAddr)
    // If this assertion fails, there has been some screwup:  some
    // translations must have been discarded but Cachegrind hasn't discarded
    // the corresponding entries in the instr-info table.
-   sbInfo = VG_(OSetGen_Lookup)(instrInfoTable, &origAddr);
+   sbInfo = VG_(HT_lookup)(instrInfoTable, origAddr);
    tl_assert(NULL == sbInfo);
 
    // BB never translated before (at this address, at least;  could have
    // been unloaded and then reloaded elsewhere in memory)
-   sbInfo = VG_(OSetGen_AllocNode)(instrInfoTable,
-                                sizeof(SB_info) + n_instrs*sizeof(InstrInfo)); 
-   sbInfo->SB_addr  = origAddr;
+   sbInfo = alloc_SB_info(n_instrs);
+   sbInfo->top.key  = origAddr;
    sbInfo->n_instrs = n_instrs;
-   VG_(OSetGen_Insert)( instrInfoTable, sbInfo );
+   VG_(HT_add_node)( instrInfoTable, sbInfo );
 
    return sbInfo;
 }
@@ -642,12 +2587,310 @@ InstrInfo* setup_InstrInfo ( CgState* cgs, Addr instr_addr, UInt instr_len )
    i_node = &cgs->sbInfo->instrs[ cgs->sbInfo_i ];
    i_node->instr_addr = instr_addr;
    i_node->instr_len  = instr_len;
+   i_node->n_folded   = 0;
+   i_node->n_Dr_hits  = 0;
+   i_node->n_Dw_hits  = 0;
+   i_node->trace_id   = 0;
    i_node->parent     = get_lineCC(instr_addr);
+   i_node->line_id    = i_node->parent->id;
+   i_node->pattern    = clo_access_patterns
+                        ? get_PatternInfo(instr_addr, i_node->parent) : NULL;
    cgs->sbInfo_i++;
    return i_node;
 }
 
 
+/* For the IR that updates our own counters and buffers. */
+#if defined(VG_BIGENDIAN)
+#  define CG_END Iend_BE
+#elif defined(VG_LITTLEENDIAN)
+#  define CG_END Iend_LE
+#else
+#  error "Unknown endianness"
+#endif
+
+/* Record what 't = data' tells us about t, if it's a temp plus or minus
+   a constant.  Flattened IR computes most addresses like that. */
+static void note_addr_def ( CgState* cgs, IRTemp t, IRExpr* data )
+{
+   IRExpr*  a1;
+   IRExpr*  a2;
+   IRConst* con;
+   IRTemp   base;
+   Long     offset;
+
+   if (data->tag != Iex_Binop || t >= cgs->n_addr_defs)
+      return;
+   switch (data->Iex.Binop.op) {
+      case Iop_Add32: case Iop_Add64: case Iop_Sub32: case Iop_Sub64:
+         break;
+      default:
+         return;
+   }
+   a1 = data->Iex.Binop.arg1;
+   a2 = data->Iex.Binop.arg2;
+   if (a1->tag != Iex_RdTmp || a2->tag != Iex_Const)
+      return;
+
+   con = a2->Iex.Const.con;
+   switch (con->tag) {
+      case Ico_U32: offset = (Int)con->Ico.U32;  break;
+      case Ico_U64: offset = (Long)con->Ico.U64; break;
+      default:      return;
+   }
+   if (data->Iex.Binop.op == Iop_Sub32 || data->Iex.Binop.op == Iop_Sub64)
+      offset = -offset;
+
+   base = a1->Iex.RdTmp.tmp;
+   if (base < cgs->n_addr_defs && cgs->addr_defs[base].base != IRTemp_INVALID) {
+      offset += cgs->addr_defs[base].offset;
+      base    = cgs->addr_defs[base].base;
+   }
+   cgs->addr_defs[t].base   = base;
+   cgs->addr_defs[t].offset = offset;
+}
+
+/* Express an address atom as temp plus constant;  constant addresses
+   get base IRTemp_INVALID. */
+static void get_addr_def ( CgState* cgs, IRAtom* ea, AddrDef* def )
+{
+   if (ea->tag == Iex_Const) {
+      IRConst* con = ea->Iex.Const.con;
+      def->base   = IRTemp_INVALID;
+      def->offset = con->tag == Ico_U32 ? (Long)con->Ico.U32
+                                        : (Long)con->Ico.U64;
+      return;
+   }
+   tl_assert(ea->tag == Iex_RdTmp);
+   if (ea->Iex.RdTmp.tmp < cgs->n_addr_defs
+       && cgs->addr_defs[ea->Iex.RdTmp.tmp].base != IRTemp_INVALID) {
+      *def = cgs->addr_defs[ea->Iex.RdTmp.tmp];
+   } else {
+      def->base   = ea->Iex.RdTmp.tmp;
+      def->offset = 0;
+   }
+}
+
+/* Drop the events whose outcome is known at instrumentation time, and
+   have count_folded do their counting from the helper of an earlier
+   instruction in the same batch.  A batch is straight-line code (we flush
+   before every side exit), so that is exact:
+
+   - An IrNoX fetch from the same I1 line as the previous instruction's
+     fetch hits the MRU line, which changes nothing.  Each run of such
+     instructions becomes a fetch by the first plus counts for the rest.
+     With --cache-sim=no every fetch is just a count, so all runs fold.
+
+   - A data access that doesn't start before the previous one simulated
+     in the batch, and ends where it ended, can only touch the line(s)
+     that access just made MRU, in that order.  So it hits D1 and the FA
+     caches without changing them (or INFI, which only misses consult),
+     and its words are already marked used.  We can show that when the
+     two addresses are the same temp plus different constants.
+
+   The data access must also belong to an instruction whose fetch is in
+   the batch, so that the count happens if and only if it would have.
+   With --access-patterns=yes no data access is folded, as the classifier
+   must see every address.
+
+   The data accesses of the functions --sim-fn leaves out are folded too,
+   under the same condition, as they are never simulated;  flushEvents
+   has the ones left count themselves.  A folded access needs no
+   --sim-range check of its own:  it lies within the access before it,
+   so it is in no range that one isn't in, and a hit is counted just as
+   an access the ranges leave out is. */
+static void fold_events ( CgState* cgs )
+{
+   Int        i, j;
+   InstrInfo* first_Ir  = NULL;    // earliest instr fetched in the batch
+   InstrInfo* carrier   = NULL;    // first instr of the current run
+   InstrInfo* prev_Ir   = NULL;    // instr of the last fetch
+   EventTag   prev_tag  = Ev_IrGen;
+   Bool       have_D    = False;   // D event simulated yet in the batch?
+   AddrDef    prev_D;
+   Int        prev_D_szB = 0;
+
+   for (i = 0, j = 0; i < cgs->events_used; i++) {
+      Event*     ev    = &cgs->events[i];
+      InstrInfo* inode = ev->inode;
+      Bool       fold  = False;
+
+      switch (ev->tag) {
+         case Ev_IrNoX:
+         case Ev_IrGen:
+            if (!first_Ir)
+               first_Ir = inode;
+            if (carrier && inode == prev_Ir + 1 && carrier->n_folded < 255) {
+               if (!clo_cache_sim)
+                  fold = True;
+               else if (ev->tag == Ev_IrNoX && prev_tag == Ev_IrNoX)
+                  fold = (inode->instr_addr   >> I1.line_size_bits)
+                      == (prev_Ir->instr_addr >> I1.line_size_bits);
+            }
+            if (fold) {
+               carrier->n_folded++;
+               folded_Irs++;
+            } else {
+               carrier = inode;
+            }
+            prev_Ir  = inode;
+            prev_tag = ev->tag;
+            break;
+
+         case Ev_Dr:
+         case Ev_Dw:
+         case Ev_Dm: {
+            AddrDef def;
+            Int     szB = get_Event_dszB(ev);
+            UChar*  hits = ev->tag == Ev_Dw ? &inode->n_Dw_hits
+                                            : &inode->n_Dr_hits;
+            get_addr_def(cgs, get_Event_dea(ev), &def);
+            if (!sim_fn_ok(inode)) {
+               if (first_Ir && inode >= first_Ir && *hits < 255) {
+                  (*hits)++;
+                  folded_Ds++;
+                  fold = True;
+               }
+            } else if (!clo_access_patterns
+                && have_D && first_Ir && inode >= first_Ir && *hits < 255
+                && def.base == prev_D.base
+                && def.offset >= prev_D.offset
+                && def.offset + szB == prev_D.offset + prev_D_szB) {
+               (*hits)++;
+               folded_Ds++;
+               fold = True;
+            } else {
+               have_D     = True;
+               prev_D     = def;
+               prev_D_szB = szB;
+            }
+            break;
+         }
+
+         default:
+            break;
+      }
+
+      if (fold) {
+         if (DEBUG_CG) {
+            VG_(printf)("   fold  ");
+            showEvent( ev );
+         }
+      } else {
+         cgs->events[j++] = *ev;
+      }
+   }
+   cgs->events_used = j;
+}
+
+/* Store 'data' at word offset 'off' from the address in 'base'. */
+static void store_acc_field ( CgState* cgs, IRTemp base, UWord off,
+                              IRExpr* data )
+{
+   IRTemp a = newIRTemp(cgs->sbOut->tyenv,
+                        sizeof(HWord) == 4 ? Ity_I32 : Ity_I64);
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(a, IRExpr_Binop(sizeof(HWord) == 4 ? Iop_Add32 : Iop_Add64,
+                                   IRExpr_RdTmp(base),
+                                   mkIRExpr_HWord(off))) );
+   addStmtToIRSB( cgs->sbOut, IRStmt_Store(CG_END, IRExpr_RdTmp(a), data) );
+}
+
+/* Whether buffer_events takes 'ev':  all cache events but the data
+   accesses --sim-fn leaves out, which are only counted. */
+static Bool is_buffered_event ( Event* ev )
+{
+   switch (ev->tag) {
+      case Ev_IrNoX:
+      case Ev_IrGen: return True;
+      case Ev_Dr:
+      case Ev_Dm:
+      case Ev_Dw:    return sim_fn_ok(ev->inode);
+      default:       return False;
+   }
+}
+
+/* --batch-sim:  emit IR that appends an AccRec to acc_buf for each cache
+   event in the batch, draining it first if there isn't room for them
+   all, and leave only the branch events and the data accesses that are
+   only counted for flushEvents. */
+static void buffer_events ( CgState* cgs )
+{
+   IRType   tyW   = sizeof(HWord) == 4 ? Ity_I32 : Ity_I64;
+   IRTemp   cur0  = newIRTemp(cgs->sbOut->tyenv, tyW);
+   IRTemp   due   = newIRTemp(cgs->sbOut->tyenv, Ity_I1);
+   IRTemp   cur   = newIRTemp(cgs->sbOut->tyenv, tyW);
+   IRTemp   next  = newIRTemp(cgs->sbOut->tyenv, tyW);
+   IRDirty* di;
+   Int      i, j, n_recs = 0;
+
+   for (i = 0; i < cgs->events_used; i++) {
+      if (is_buffered_event(&cgs->events[i]))
+         n_recs++;
+   }
+   if (n_recs == 0)
+      return;
+
+   // if (acc_cur > &acc_buf[ACC_BUF_RECS - n_recs]) drain
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(cur0, IRExpr_Load(CG_END, tyW,
+                                     mkIRExpr_HWord( (HWord)&acc_cur ))) );
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(due,
+         IRExpr_Binop(sizeof(HWord) == 4 ? Iop_CmpLT32U : Iop_CmpLT64U,
+                      mkIRExpr_HWord( (HWord)&acc_buf[ACC_BUF_RECS - n_recs] ),
+                      IRExpr_RdTmp(cur0))) );
+   di = unsafeIRDirty_0_N( 0, d_helpers->Drain.name,
+                           VG_(fnptr_to_fnentry)( d_helpers->Drain.addr ),
+                           mkIRExprVec_0() );
+   di->guard = IRExpr_RdTmp(due);
+   di->mFx   = Ifx_Modify;
+   di->mAddr = mkIRExpr_HWord( (HWord)&acc_cur );
+   di->mSize = sizeof(acc_cur);
+   addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(cur, IRExpr_Load(CG_END, tyW,
+                                    mkIRExpr_HWord( (HWord)&acc_cur ))) );
+
+   for (i = 0, j = 0, n_recs = 0; i < cgs->events_used; i++) {
+      Event* ev   = &cgs->events[i];
+      UWord  rec  = n_recs * sizeof(AccRec);
+      UWord  info;
+
+      if (!is_buffered_event(ev)) {
+         cgs->events[j++] = *ev;
+         continue;
+      }
+      switch (ev->tag) {
+         case Ev_IrNoX: info = AccIrNoX; break;
+         case Ev_IrGen: info = AccIrGen; break;
+         case Ev_Dr:
+         case Ev_Dm:    info = AccDr;    break;
+         default:       info = AccDw;    break;
+      }
+      if (info >= AccDr) {
+         info |= (UWord)get_Event_dszB(ev) << ACC_KIND_BITS;
+         store_acc_field(cgs, cur, rec + offsetof(AccRec, addr),
+                         get_Event_dea(ev));
+      }
+      store_acc_field(cgs, cur, rec + offsetof(AccRec, inode),
+                      mkIRExpr_HWord( (HWord)ev->inode ));
+      store_acc_field(cgs, cur, rec + offsetof(AccRec, info),
+                      mkIRExpr_HWord( info ));
+      n_recs++;
+   }
+
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(next,
+         IRExpr_Binop(sizeof(HWord) == 4 ? Iop_Add32 : Iop_Add64,
+                      IRExpr_RdTmp(cur),
+                      mkIRExpr_HWord( n_recs * sizeof(AccRec) ))) );
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_Store(CG_END, mkIRExpr_HWord( (HWord)&acc_cur ),
+                   IRExpr_RdTmp(next)) );
+   cgs->events_used = j;
+}
+
 /* Generate code for all outstanding memory events, and mark the queue
    empty.  Code is generated into cgs->bbOut, and this activity
    'consumes' slots in cgs->sbInfo. */
@@ -664,6 +2907,10 @@ static void flushEvents ( CgState* cgs )
    Event*     ev2;
    Event*     ev3;
 
+   fold_events(cgs);
+   if (clo_batch_sim)
+      buffer_events(cgs);
+
    i = 0;
    while (i < cgs->events_used) {
 
@@ -691,19 +2938,16 @@ static void flushEvents ( CgState* cgs )
          i appropriately. */
       switch (ev->tag) {
          case Ev_IrNoX:
-            /* Merge an IrNoX with a following Dr/Dm. */
-            if (ev2 && (ev2->tag == Ev_Dr || ev2->tag == Ev_Dm)) {
-               /* Why is this true?  It's because we're merging an Ir
-                  with a following Dr or Dm.  The Ir derives from the
-                  instruction's IMark and the Dr/Dm from data
-                  references which follow it.  In short it holds
-                  because each insn starts with an IMark, hence an
-                  Ev_Ir, and so these Dr/Dm must pertain to the
-                  immediately preceding Ir.  Same applies to analogous
-                  assertions in the subsequent cases. */
-               tl_assert(ev2->inode == ev->inode);
-               helperName = "log_1IrNoX_1Dr_cache_access";
-               helperAddr = &log_1IrNoX_1Dr_cache_access;
+            /* Merge an IrNoX with a following Dr/Dm of the same insn.
+               Each insn starts with an IMark, hence an Ev_Ir, so a
+               Dr/Dm following an Ir used to always pertain to it;  but
+               fold_events may have dropped the Ir of the Dr/Dm's own
+               insn, so check.  Same for the Dw case.  Accesses that
+               --sim-fn leaves out are only counted, on their own. */
+            if (ev2 && (ev2->tag == Ev_Dr || ev2->tag == Ev_Dm)
+                && ev2->inode == ev->inode && sim_fn_ok(ev2->inode)) {
+               helperName = d_helpers->IrNoX_Dr.name;
+               helperAddr = d_helpers->IrNoX_Dr.addr;
                argv = mkIRExprVec_3( i_node_expr,
                                      get_Event_dea(ev2),
                                      mkIRExpr_HWord( get_Event_dszB(ev2) ) );
@@ -712,10 +2956,10 @@ static void flushEvents ( CgState* cgs )
             }
             /* Merge an IrNoX with a following Dw. */
             else
-            if (ev2 && ev2->tag == Ev_Dw) {
-               tl_assert(ev2->inode == ev->inode);
-               helperName = "log_1IrNoX_1Dw_cache_access";
-               helperAddr = &log_1IrNoX_1Dw_cache_access;
+            if (ev2 && ev2->tag == Ev_Dw && ev2->inode == ev->inode
+                && sim_fn_ok(ev2->inode)) {
+               helperName = d_helpers->IrNoX_Dw.name;
+               helperAddr = d_helpers->IrNoX_Dw.addr;
                argv = mkIRExprVec_3( i_node_expr,
                                      get_Event_dea(ev2),
                                      mkIRExpr_HWord( get_Event_dszB(ev2) ) );
@@ -783,8 +3027,16 @@ static void flushEvents ( CgState* cgs )
          case Ev_Dr:
          case Ev_Dm:
             /* Data read or modify */
-            helperName = "log_0Ir_1Dr_cache_access";
-            helperAddr = &log_0Ir_1Dr_cache_access;
+            if (!sim_fn_ok(ev->inode)) {
+               helperName = "count_0Ir_1Dr";
+               helperAddr = &count_0Ir_1Dr;
+               argv = mkIRExprVec_1( i_node_expr );
+               regparms = 1;
+               i++;
+               break;
+            }
+            helperName = d_helpers->Dr.name;
+            helperAddr = d_helpers->Dr.addr;
             argv = mkIRExprVec_3( i_node_expr, 
                                   get_Event_dea(ev), 
                                   mkIRExpr_HWord( get_Event_dszB(ev) ) );
@@ -793,8 +3045,16 @@ static void flushEvents ( CgState* cgs )
             break;
          case Ev_Dw:
             /* Data write */
-            helperName = "log_0Ir_1Dw_cache_access";
-            helperAddr = &log_0Ir_1Dw_cache_access;
+            if (!sim_fn_ok(ev->inode)) {
+               helperName = "count_0Ir_1Dw";
+               helperAddr = &count_0Ir_1Dw;
+               argv = mkIRExprVec_1( i_node_expr );
+               regparms = 1;
+               i++;
+               break;
+            }
+            helperName = d_helpers->Dw.name;
+            helperAddr = d_helpers->Dw.addr;
             argv = mkIRExprVec_3( i_node_expr,
                                   get_Event_dea(ev), 
                                   mkIRExpr_HWord( get_Event_dszB(ev) ) );
@@ -943,18 +3203,36 @@ void addEvent_D_guarded ( CgState* cgs, InstrInfo* inode,
    Int          regparms;
    IRDirty*     di;
    i_node_expr = mkIRExpr_HWord( (HWord)inode );
-   helperName  = isWrite ? "log_0Ir_1Dw_cache_access"
-                         : "log_0Ir_1Dr_cache_access";
-   helperAddr  = isWrite ? &log_0Ir_1Dw_cache_access
-                         : &log_0Ir_1Dr_cache_access;
+   helperName  = isWrite ? d_helpers->Dw.name
+                         : d_helpers->Dr.name;
+   helperAddr  = isWrite ? d_helpers->Dw.addr
+                         : d_helpers->Dr.addr;
+   // In batch mode, it joins the buffer, in order.
+   if (clo_batch_sim) {
+      helperName = isWrite ? "buffer_0Ir_1Dw" : "buffer_0Ir_1Dr";
+      helperAddr = isWrite ? (void*)&buffer_0Ir_1Dw : (void*)&buffer_0Ir_1Dr;
+   }
    argv        = mkIRExprVec_3( i_node_expr,
                                 ea, mkIRExpr_HWord( datasize ) );
    regparms    = 3;
+   // If --sim-fn leaves it out, it's only counted.
+   if (!sim_fn_ok(inode)) {
+      helperName = isWrite ? "count_0Ir_1Dw" : "count_0Ir_1Dr";
+      helperAddr = isWrite ? (void*)&count_0Ir_1Dw : (void*)&count_0Ir_1Dr;
+      argv       = mkIRExprVec_1( i_node_expr );
+      regparms   = 1;
+   }
    di          = unsafeIRDirty_0_N(
                     regparms, 
                     helperName, VG_(fnptr_to_fnentry)( helperAddr ), 
                     argv );
    di->guard = guard;
+   if (clo_batch_sim && regparms == 3) {
+      // As for the drain in buffer_events.
+      di->mFx   = Ifx_Modify;
+      di->mAddr = mkIRExpr_HWord( (HWord)&acc_cur );
+      di->mSize = sizeof(acc_cur);
+   }
    addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
 }
 
@@ -999,6 +3277,48 @@ void addEvent_Bi ( CgState* cgs, InstrInfo* inode, IRAtom* whereTo )
    cgs->events_used++;
 }
 
+/* Add 'n_instrs' to interval_icount inline, and call interval_tick if
+   that reaches interval_next.  The counter is kept in memory rather than
+   in a helper so the common case costs a load, add, store and compare. */
+
+static
+void add_interval_count ( CgState* cgs, Int n_instrs )
+{
+   IRTemp   old_count = newIRTemp(cgs->sbOut->tyenv, Ity_I64);
+   IRTemp   new_count = newIRTemp(cgs->sbOut->tyenv, Ity_I64);
+   IRTemp   next      = newIRTemp(cgs->sbOut->tyenv, Ity_I64);
+   IRTemp   due       = newIRTemp(cgs->sbOut->tyenv, Ity_I1);
+   IRDirty* di;
+
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(old_count,
+                   IRExpr_Load(CG_END, Ity_I64,
+                               mkIRExpr_HWord( (HWord)&interval_icount ))) );
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(new_count,
+                   IRExpr_Binop(Iop_Add64, IRExpr_RdTmp(old_count),
+                                IRExpr_Const(IRConst_U64(n_instrs)))) );
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_Store(CG_END, mkIRExpr_HWord( (HWord)&interval_icount ),
+                   IRExpr_RdTmp(new_count)) );
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(next,
+                   IRExpr_Load(CG_END, Ity_I64,
+                               mkIRExpr_HWord( (HWord)&interval_next ))) );
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_WrTmp(due,
+                   IRExpr_Binop(Iop_CmpLE64U, IRExpr_RdTmp(next),
+                                IRExpr_RdTmp(new_count))) );
+
+   di = unsafeIRDirty_0_N( 0, "interval_tick",
+                           VG_(fnptr_to_fnentry)( &interval_tick ),
+                           mkIRExprVec_0() );
+   di->guard = IRExpr_RdTmp(due);
+   addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+}
+
+#undef CG_END
+
 ////////////////////////////////////////////////////////////
 
 
@@ -1055,6 +3375,28 @@ IRSB* cg_instrument ( VgCallbackClosure* closure,
    cgs.sbInfo      = get_SB_info(sbIn, (Addr)closure->readdr);
    cgs.sbInfo_i    = 0;
 
+   // Room to track the input temps for fold_events.  Only the D-access
+   // folding uses it, so don't bother without cache simulation.
+   cgs.addr_defs   = NULL;
+   cgs.n_addr_defs = 0;
+   if (clo_cache_sim) {
+      static AddrDef* addr_defs    = NULL;
+      static Int      addr_defs_sz = 0;
+      Int t;
+      if (addr_defs_sz < tyenv->types_used) {
+         addr_defs_sz = tyenv->types_used * 2;
+         addr_defs = VG_(realloc)("cg.main.cgi.1", addr_defs,
+                                  addr_defs_sz * sizeof(AddrDef));
+      }
+      for (t = 0; t < tyenv->types_used; t++)
+         addr_defs[t].base = IRTemp_INVALID;
+      cgs.addr_defs   = addr_defs;
+      cgs.n_addr_defs = tyenv->types_used;
+   }
+
+   if (clo_interval > 0)
+      add_interval_count(&cgs, cgs.sbInfo->n_instrs);
+
    if (DEBUG_CG)
       VG_(printf)("\n\n---------- cg_instrument ----------\n");
 
@@ -1095,6 +3437,7 @@ IRSB* cg_instrument ( VgCallbackClosure* closure,
 
          case Ist_WrTmp: {
             IRExpr* data = st->Ist.WrTmp.data;
+            note_addr_def( &cgs, st->Ist.WrTmp.tmp, data );
             if (data->tag == Iex_Load) {
                IRExpr* aexpr = data->Iex.Load.addr;
                // Note also, endianness info is ignored.  I guess
@@ -1339,35 +3682,74 @@ static CacheCC  Dw_total;
 static BranchCC Bc_total;
 static BranchCC Bi_total;
 
-static void fprint_CC_table_and_calc_totals(void)
+// Returns the expanded name of the output file given by option 'clo_name',
+// whose value is 'clo_val'.  A mid-run dump (see CACHEGRIND_DUMP_STATS)
+// adds ".<dump>", and a thread's file (t != NULL) ".t<serial>".  The
+// caller frees it.
+//
+// Nb: it's important to do this now, ie. as late as possible.  If we do
+// it at start-up and the program forks and the output file format string
+// contains a %p (pid) specifier, both the parent and child will
+// incorrectly write to the same file;  this happened in 3.3.0.
+static HChar* output_file_name(const HChar* clo_name, const HChar* clo_val,
+                               const ThreadInfo* t, const HChar* dump)
+{
+   HChar* out_file = VG_(expand_file_name)(clo_name, clo_val);
+
+   if (t || dump) {
+      HChar* file = VG_(malloc)("cg.main.ofn.1", VG_(strlen)(out_file) + 16
+                                + (dump ? VG_(strlen)(dump) + 1 : 0));
+      VG_(strcpy)(file, out_file);
+      if (dump)
+         VG_(sprintf)(file + VG_(strlen)(file), ".%s", dump);
+      if (t)
+         VG_(sprintf)(file + VG_(strlen)(file), ".t%u", t->serial);
+      VG_(free)(out_file);
+      out_file = file;
+   }
+   return out_file;
+}
+
+static void complain_output_file(const HChar* out_file)
+{
+   // If the file can't be opened for whatever reason (conflict
+   // between multiple cachegrinded processes?), give up now.
+   VG_(umsg)("error: can't open output data file '%s'\n", out_file);
+   VG_(umsg)("       ... so detailed results will be missing.\n");
+}
+
+// Opens a text output file, see output_file_name;  a thread's file also
+// gets a "desc: thread:" line.  Complains and returns NULL on failure.
+static VgFile* open_output_file(const HChar* clo_name, const HChar* clo_val,
+                                const ThreadInfo* t, const HChar* dump)
+{
+   HChar*  out_file = output_file_name(clo_name, clo_val, t, dump);
+   VgFile* fp = VG_(fopen)(out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                                     VKI_S_IRUSR|VKI_S_IWUSR);
+   if (fp == NULL) {
+      complain_output_file(out_file);
+   } else if (t) {
+      VG_(fprintf)(fp, "desc: thread:          %u (tid %u)\n",
+                       t->serial, (UInt)t->tid);
+   }
+   VG_(free)(out_file);
+   return fp;
+}
+
+static void fprint_CC_table_and_calc_totals(const ThreadInfo* t, const HChar* dump)
 {
    Int     i;
    VgFile  *fp;
+   CacheCC  Ir_sum = { 0 }, Dr_sum = { 0 }, Dw_sum = { 0 };
+   BranchCC Bc_sum = { 0 }, Bi_sum = { 0 };
    HChar   *currFile = NULL;
    const HChar *currFn = NULL;
-   LineCC* lineCC;
-
-   // Setup output filename.  Nb: it's important to do this now, ie. as late
-   // as possible.  If we do it at start-up and the program forks and the
-   // output file format string contains a %p (pid) specifier, both the
-   // parent and child will incorrectly write to the same file;  this
-   // happened in 3.3.0.
-   HChar* cachegrind_out_file =
-      VG_(expand_file_name)("--cachegrind-out-file", clo_cachegrind_out_file);
+   SrcLine *node;
+   LineCC  *lineCC, tmp;
 
-   fp = VG_(fopen)(cachegrind_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
-                                        VKI_S_IRUSR|VKI_S_IWUSR);
-   if (fp == NULL) {
-      // If the file can't be opened for whatever reason (conflict
-      // between multiple cachegrinded processes?), give up now.
-      VG_(umsg)("error: can't open output data file '%s'\n",
-                cachegrind_out_file );
-      VG_(umsg)("       ... so detailed results will be missing.\n");
-      VG_(free)(cachegrind_out_file);
+   fp = open_output_file("--cachegrind-out-file", clo_cachegrind_out_file, t, dump);
+   if (fp == NULL)
       return;
-   } else {
-      VG_(free)(cachegrind_out_file);
-   }
 
    if (clo_cache_sim) {
       // "desc:" lines (giving I1/D1/LL cache configuration). The spaces after
@@ -1401,9 +3783,12 @@ static void fprint_CC_table_and_calc_totals(void)
    }
 
    // Traverse every lineCC
-   VG_(OSetGen_ResetIter)(CC_table);
-   while ( (lineCC = VG_(OSetGen_Next)(CC_table)) ) {
+   CC_table_ResetIter();
+   while ( (node = CC_table_Next()) ) {
       Bool just_hit_a_new_file = False;
+      lineCC = output_lineCC(node, t, &tmp);
+      if (lineCC == NULL)
+         continue;      // not touched by this thread
       // If we've hit a new file, print a "fl=" line.  Note that because
       // each string is stored exactly once in the string table, we can use
       // pointer comparison rather than strcmp() to test for equality, which
@@ -1412,7 +3797,7 @@ static void fprint_CC_table_and_calc_totals(void)
       if ( lineCC->loc.file != currFile ) {
          currFile = lineCC->loc.file;
          VG_(fprintf)(fp, "fl=%s\n", currFile);
-         distinct_files++;
+         if (!t && !dump) distinct_files++;
          just_hit_a_new_file = True;
       }
       // If we've hit a new function, print a "fn=" line.  We know to do
@@ -1422,7 +3807,7 @@ static void fprint_CC_table_and_calc_totals(void)
       if ( just_hit_a_new_file || lineCC->loc.fn != currFn ) {
          currFn = lineCC->loc.fn;
          VG_(fprintf)(fp, "fn=%s\n", currFn);
-         distinct_fns++;
+         if (!t && !dump) distinct_fns++;
       }
 
       // Print the LineCC
@@ -1462,21 +3847,21 @@ static void fprint_CC_table_and_calc_totals(void)
       }
 
       // Update summary stats
-      Ir_total.a  += lineCC->Ir.a;
-      Ir_total.m1 += lineCC->Ir.m1;
-      Ir_total.mL += lineCC->Ir.mL;
-      Dr_total.a  += lineCC->Dr.a;
-      Dr_total.m1 += lineCC->Dr.m1;
-      Dr_total.mL += lineCC->Dr.mL;
-      Dw_total.a  += lineCC->Dw.a;
-      Dw_total.m1 += lineCC->Dw.m1;
-      Dw_total.mL += lineCC->Dw.mL;
-      Bc_total.b  += lineCC->Bc.b;
-      Bc_total.mp += lineCC->Bc.mp;
-      Bi_total.b  += lineCC->Bi.b;
-      Bi_total.mp += lineCC->Bi.mp;
-
-      distinct_lines++;
+      Ir_sum.a  += lineCC->Ir.a;
+      Ir_sum.m1 += lineCC->Ir.m1;
+      Ir_sum.mL += lineCC->Ir.mL;
+      Dr_sum.a  += lineCC->Dr.a;
+      Dr_sum.m1 += lineCC->Dr.m1;
+      Dr_sum.mL += lineCC->Dr.mL;
+      Dw_sum.a  += lineCC->Dw.a;
+      Dw_sum.m1 += lineCC->Dw.m1;
+      Dw_sum.mL += lineCC->Dw.mL;
+      Bc_sum.b  += lineCC->Bc.b;
+      Bc_sum.mp += lineCC->Bc.mp;
+      Bi_sum.b  += lineCC->Bi.b;
+      Bi_sum.mp += lineCC->Bi.mp;
+
+      if (!t && !dump) distinct_lines++;
    }
 
    // Summary stats must come after rest of table, since we calculate them
@@ -1487,68 +3872,60 @@ static void fprint_CC_table_and_calc_totals(void)
                         " %llu %llu %llu"
                         " %llu %llu %llu"
                         " %llu %llu %llu %llu\n", 
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
+                        Ir_sum.a, Ir_sum.m1, Ir_sum.mL,
+                        Dr_sum.a, Dr_sum.m1, Dr_sum.mL,
+                        Dw_sum.a, Dw_sum.m1, Dw_sum.mL,
+                        Bc_sum.b, Bc_sum.mp, 
+                        Bi_sum.b, Bi_sum.mp);
    }
    else if (clo_cache_sim && !clo_branch_sim) {
       VG_(fprintf)(fp,  "summary:"
                         " %llu %llu %llu"
                         " %llu %llu %llu"
                         " %llu %llu %llu\n",
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL);
+                        Ir_sum.a, Ir_sum.m1, Ir_sum.mL,
+                        Dr_sum.a, Dr_sum.m1, Dr_sum.mL,
+                        Dw_sum.a, Dw_sum.m1, Dw_sum.mL);
    }
    else if (!clo_cache_sim && clo_branch_sim) {
       VG_(fprintf)(fp,  "summary:"
                         " %llu"
                         " %llu %llu %llu %llu\n", 
-                        Ir_total.a,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
+                        Ir_sum.a,
+                        Bc_sum.b, Bc_sum.mp, 
+                        Bi_sum.b, Bi_sum.mp);
    }
    else {
       VG_(fprintf)(fp, "summary:"
                         " %llu\n", 
-                        Ir_total.a);
+                        Ir_sum.a);
    }
 
    VG_(fclose)(fp);
+
+   // Only the aggregate's totals go in the final summary.
+   if (!t) {
+      Ir_total = Ir_sum;
+      Dr_total = Dr_sum;
+      Dw_total = Dw_sum;
+      Bc_total = Bc_sum;
+      Bi_total = Bi_sum;
+   }
 }
 
-static void fprint_CC_table_and_cache_d1_usage(void)
+static void fprint_CC_table_and_cache_d1_usage(const ThreadInfo* t, const HChar* dump)
 {
    Int     i;
    ULong   total_line, summary[MAX_NUM_BINS], total, access, miss, miss_comp, miss_conf, miss_cap;
    VgFile  *fp;
    HChar   *currFile = NULL;
    const HChar *currFn = NULL;
-   LineCC* lineCC;
-
-   // Setup output filename.  Nb: it's important to do this now, ie. as late
-   // as possible.  If we do it at start-up and the program forks and the
-   // output file format string contains a %p (pid) specifier, both the
-   // parent and child will incorrectly write to the same file;  this
-   // happened in 3.3.0.
-   HChar* cacheusage_out_file =
-      VG_(expand_file_name)("--cacheusage-d1-out-file", clo_cacheusage_d1_out_file);
+   SrcLine *node;
+   LineCC  *lineCC, tmp;
 
-   fp = VG_(fopen)(cacheusage_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
-                                        VKI_S_IRUSR|VKI_S_IWUSR);
-   if (fp == NULL) {
-      // If the file can't be opened for whatever reason (conflict
-      // between multiple cachegrinded processes?), give up now.
-      VG_(umsg)("error: can't open output data file '%s'\n",
-                cacheusage_out_file );
-      VG_(umsg)("       ... so detailed results will be missing.\n");
-      VG_(free)(cacheusage_out_file);
+   fp = open_output_file("--cacheusage-d1-out-file", clo_cacheusage_d1_out_file, t, dump);
+   if (fp == NULL)
       return;
-   } else {
-      VG_(free)(cacheusage_out_file);
-   }
 
    if (clo_cache_sim) {
       // "desc:" lines (giving I1/D1/LL cache configuration). The spaces after
@@ -1599,9 +3976,12 @@ static void fprint_CC_table_and_cache_d1_usage(void)
    }
 
    // Traverse every lineCC
-   VG_(OSetGen_ResetIter)(CC_table);
-   while ( (lineCC = VG_(OSetGen_Next)(CC_table)) ) {
+   CC_table_ResetIter();
+   while ( (node = CC_table_Next()) ) {
       Bool just_hit_a_new_file = False;
+      lineCC = output_lineCC(node, t, &tmp);
+      if (lineCC == NULL)
+         continue;      // not touched by this thread
       // If we've hit a new file, print a "fl=" line.  Note that because
       // each string is stored exactly once in the string table, we can use
       // pointer comparison rather than strcmp() to test for equality, which
@@ -1610,7 +3990,7 @@ static void fprint_CC_table_and_cache_d1_usage(void)
       if ( lineCC->loc.file != currFile ) {
          currFile = lineCC->loc.file;
          VG_(fprintf)(fp, "fl=%s\n", currFile);
-         distinct_files++;
+         if (!t && !dump) distinct_files++;
          just_hit_a_new_file = True;
       }
       // If we've hit a new function, print a "fn=" line.  We know to do
@@ -1620,7 +4000,7 @@ static void fprint_CC_table_and_cache_d1_usage(void)
       if ( just_hit_a_new_file || lineCC->loc.fn != currFn ) {
          currFn = lineCC->loc.fn;
          VG_(fprintf)(fp, "fn=%s\n", currFn);
-         distinct_fns++;
+         if (!t && !dump) distinct_fns++;
       }
 
       // Print the LineCC
@@ -1628,10 +4008,10 @@ static void fprint_CC_table_and_cache_d1_usage(void)
       for(i = 0; i < MAX_NUM_BINS; i++)
       {
         // Update summary stats
-        summary[i] += lineCC->num_evicts_D1[i]; 
+        summary[i] += lineCC->ev.D1[i]; 
 
         // Calculate stats per line
-        total_line += lineCC->num_evicts_D1[i]; 
+        total_line += lineCC->ev.D1[i]; 
       }
 
       if (clo_cache_sim && total_line) {
@@ -1649,9 +4029,9 @@ static void fprint_CC_table_and_cache_d1_usage(void)
                            " %llu %llu\n",
                            lineCC->loc.line, lineCC->Dr.a + lineCC->Dw.a, lineCC->Dr.m1 + lineCC->Dw.m1, 
                            lineCC->Dr.m1_comp + lineCC->Dw.m1_comp, lineCC->Dr.m1_conf + lineCC->Dw.m1_conf, lineCC->Dr.m1_cap + lineCC->Dw.m1_cap, total_line,
-                           lineCC->num_evicts_D1[0], lineCC->num_evicts_D1[1], lineCC->num_evicts_D1[2],
-                           lineCC->num_evicts_D1[3], lineCC->num_evicts_D1[4], lineCC->num_evicts_D1[5],
-                           lineCC->num_evicts_D1[6], lineCC->num_evicts_D1[7]);
+                           lineCC->ev.D1[0], lineCC->ev.D1[1], lineCC->ev.D1[2],
+                           lineCC->ev.D1[3], lineCC->ev.D1[4], lineCC->ev.D1[5],
+                           lineCC->ev.D1[6], lineCC->ev.D1[7]);
       }
    }
 
@@ -1679,36 +4059,19 @@ static void fprint_CC_table_and_cache_d1_usage(void)
    VG_(fclose)(fp);
 }
 
-static void fprint_CC_table_and_cache_ll_usage(void)
+static void fprint_CC_table_and_cache_ll_usage(const ThreadInfo* t, const HChar* dump)
 {
    Int     i;
    ULong   total_line, summary[MAX_NUM_BINS], total, access, miss, miss_comp, miss_conf, miss_cap;
    VgFile  *fp;
    HChar   *currFile = NULL;
    const HChar *currFn = NULL;
-   LineCC* lineCC;
+   SrcLine *node;
+   LineCC  *lineCC, tmp;
 
-   // Setup output filename.  Nb: it's important to do this now, ie. as late
-   // as possible.  If we do it at start-up and the program forks and the
-   // output file format string contains a %p (pid) specifier, both the
-   // parent and child will incorrectly write to the same file;  this
-   // happened in 3.3.0.
-   HChar* cacheusage_out_file =
-      VG_(expand_file_name)("--cacheusage-ll-out-file", clo_cacheusage_ll_out_file);
-
-   fp = VG_(fopen)(cacheusage_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
-                                        VKI_S_IRUSR|VKI_S_IWUSR);
-   if (fp == NULL) {
-      // If the file can't be opened for whatever reason (conflict
-      // between multiple cachegrinded processes?), give up now.
-      VG_(umsg)("error: can't open output data file '%s'\n",
-                cacheusage_out_file );
-      VG_(umsg)("       ... so detailed results will be missing.\n");
-      VG_(free)(cacheusage_out_file);
+   fp = open_output_file("--cacheusage-ll-out-file", clo_cacheusage_ll_out_file, t, dump);
+   if (fp == NULL)
       return;
-   } else {
-      VG_(free)(cacheusage_out_file);
-   }
 
    if (clo_cache_sim) {
       // "desc:" lines (giving I1/D1/LL cache configuration). The spaces after
@@ -1758,85 +4121,694 @@ static void fprint_CC_table_and_cache_ll_usage(void)
       summary[i] = 0;
    }
 
-   // Traverse every lineCC
-   VG_(OSetGen_ResetIter)(CC_table);
-   while ( (lineCC = VG_(OSetGen_Next)(CC_table)) ) {
-      Bool just_hit_a_new_file = False;
-      // If we've hit a new file, print a "fl=" line.  Note that because
-      // each string is stored exactly once in the string table, we can use
-      // pointer comparison rather than strcmp() to test for equality, which
-      // is good because most of the time the comparisons are equal and so
-      // the whole strings would have to be checked.
-      if ( lineCC->loc.file != currFile ) {
-         currFile = lineCC->loc.file;
-         VG_(fprintf)(fp, "fl=%s\n", currFile);
-         distinct_files++;
-         just_hit_a_new_file = True;
-      }
-      // If we've hit a new function, print a "fn=" line.  We know to do
-      // this when the function name changes, and also every time we hit a
-      // new file (in which case the new function name might be the same as
-      // in the old file, hence the just_hit_a_new_file test).
-      if ( just_hit_a_new_file || lineCC->loc.fn != currFn ) {
-         currFn = lineCC->loc.fn;
-         VG_(fprintf)(fp, "fn=%s\n", currFn);
-         distinct_fns++;
-      }
+   // Traverse every lineCC
+   CC_table_ResetIter();
+   while ( (node = CC_table_Next()) ) {
+      Bool just_hit_a_new_file = False;
+      lineCC = output_lineCC(node, t, &tmp);
+      if (lineCC == NULL)
+         continue;      // not touched by this thread
+      // If we've hit a new file, print a "fl=" line.  Note that because
+      // each string is stored exactly once in the string table, we can use
+      // pointer comparison rather than strcmp() to test for equality, which
+      // is good because most of the time the comparisons are equal and so
+      // the whole strings would have to be checked.
+      if ( lineCC->loc.file != currFile ) {
+         currFile = lineCC->loc.file;
+         VG_(fprintf)(fp, "fl=%s\n", currFile);
+         if (!t && !dump) distinct_files++;
+         just_hit_a_new_file = True;
+      }
+      // If we've hit a new function, print a "fn=" line.  We know to do
+      // this when the function name changes, and also every time we hit a
+      // new file (in which case the new function name might be the same as
+      // in the old file, hence the just_hit_a_new_file test).
+      if ( just_hit_a_new_file || lineCC->loc.fn != currFn ) {
+         currFn = lineCC->loc.fn;
+         VG_(fprintf)(fp, "fn=%s\n", currFn);
+         if (!t && !dump) distinct_fns++;
+      }
+
+      // Print the LineCC
+      total_line = 0;
+      for(i = 0; i < MAX_NUM_BINS; i++)
+      {
+        // Update summary stats
+        summary[i] += lineCC->ev.LL[i];
+
+        // Calculate stats per line
+        total_line += lineCC->ev.LL[i]; 
+      }
+
+      if (clo_cache_sim && total_line) {
+
+         access += lineCC->Dr.m1 + lineCC->Dw.m1;
+         miss += lineCC->Dr.mL + lineCC->Dw.mL;
+         miss_comp += lineCC->Dr.mL_comp + lineCC->Dw.mL_comp;
+         miss_conf += lineCC->Dr.mL_conf + lineCC->Dw.mL_conf;
+         miss_cap += lineCC->Dr.mL_cap + lineCC->Dw.mL_cap;
+
+         VG_(fprintf)(fp,  "%d %llu %llu %llu" 
+                           " %llu %llu %llu"
+                           " %llu %llu %llu"
+                           " %llu %llu %llu"
+                           " %llu %llu\n",
+                           lineCC->loc.line, lineCC->Dr.m1 + lineCC->Dw.m1, lineCC->Dr.mL + lineCC->Dw.mL,
+                           lineCC->Dr.mL_comp + lineCC->Dw.mL_comp, lineCC->Dr.mL_conf + lineCC->Dw.mL_conf, lineCC->Dr.mL_cap + lineCC->Dw.mL_cap, total_line,
+                           lineCC->ev.LL[0], lineCC->ev.LL[1], lineCC->ev.LL[2],
+                           lineCC->ev.LL[3], lineCC->ev.LL[4], lineCC->ev.LL[5],
+                           lineCC->ev.LL[6], lineCC->ev.LL[7]);
+      }
+   }
+
+   // Summary stats must come after rest of table, since we calculate them
+   // during traversal.
+   total = 0;
+   for(i = 0; i < MAX_NUM_BINS; i++)
+   {
+      total += summary[i];
+   }
+
+   if (clo_cache_sim) {
+      VG_(fprintf)(fp,  "summary: %llu %llu %llu"
+                        " %llu %llu %llu"
+                        " %llu %llu %llu"
+                        " %llu %llu %llu"
+                        " %llu %llu\n",
+                        access, miss,
+                        miss_comp, miss_conf, miss_cap, total,
+                        summary[0],summary[1], summary[2],
+                        summary[3],summary[4], summary[5],
+                        summary[6],summary[7]);
+   }
+
+   VG_(fclose)(fp);
+}
+
+/*------------------------------------------------------------*/
+/*--- Binary output (--output-format=binary)               ---*/
+/*------------------------------------------------------------*/
+
+/* Writes everything the three text files above hold -- the aggregate of
+   fprint_CC_table_and_calc_totals plus the 3C and eviction columns of the
+   cacheusage files -- in a single CC table traversal.  See cg_binfmt.h
+   for the layout;  cg_bin2text turns a file back into the text files. */
+
+#define CGB_BUF_SIZE  (64 * 1024)
+
+typedef struct {
+   Int    fd;
+   Bool   failed;
+   ULong  off;             // file offset of buf[0]
+   UInt   used;
+   UChar* buf;
+} CgbWriter;
+
+typedef struct {
+   VgHashNode  node;       // key: the permanent string's address
+   UInt        id;
+} CgbStr;
+
+typedef struct {
+   CgbWriter    w;
+   VgHashTable* str_ids;   // CgbStr, by address
+   XArray*      strs;      // const HChar*, by id
+   XArray*      index;     // CgbIndexEntry
+   ULong        col_mask;
+   // Rows of the function being accumulated.
+   UInt         n_rows, max_rows;
+   Int*         lines;
+   ULong*       vals;      // n_rows x CGB_N_COLS
+} CgbOut;
+
+static void cgb_flush(CgbWriter* w)
+{
+   UInt done = 0;
+   while (done < w->used && !w->failed) {
+      Int n = VG_(write)(w->fd, w->buf + done, w->used - done);
+      if (n <= 0)
+         w->failed = True;
+      else
+         done += n;
+   }
+   w->off += w->used;
+   w->used = 0;
+}
+
+static void cgb_emit(CgbWriter* w, const void* p, UInt n)
+{
+   const UChar* b = p;
+   while (n > 0) {
+      UInt chunk = CGB_BUF_SIZE - w->used;
+      if (chunk > n) chunk = n;
+      VG_(memcpy)(w->buf + w->used, b, chunk);
+      w->used += chunk;
+      b += chunk;
+      n -= chunk;
+      if (w->used == CGB_BUF_SIZE)
+         cgb_flush(w);
+   }
+}
+
+static __inline__ void cgb_emit_varint(CgbWriter* w, ULong v)
+{
+   if (w->used + CGB_MAX_VARINT > CGB_BUF_SIZE)
+      cgb_flush(w);
+   w->used += cgb_put_varint(w->buf + w->used, v);
+}
+
+static ULong cgb_tell(const CgbWriter* w)
+{
+   return w->off + w->used;
+}
+
+static void cgb_align8(CgbWriter* w)
+{
+   static const UChar zeroes[8] = { 0 };
+   UInt pad = (8 - (cgb_tell(w) & 7)) & 7;
+   cgb_emit(w, zeroes, pad);
+}
+
+// Number a string.  File and function names are permanent strings, so
+// they can be looked up by address.
+static UInt cgb_str(CgbOut* o, const HChar* s)
+{
+   CgbStr* cs = VG_(HT_lookup)(o->str_ids, (UWord)s);
+   if (!cs) {
+      cs = VG_(malloc)("cg.main.cgbs.1", sizeof(CgbStr));
+      cs->node.key = (UWord)s;
+      cs->id       = VG_(sizeXA)(o->strs);
+      VG_(HT_add_node)(o->str_ids, cs);
+      VG_(addToXA)(o->strs, &s);
+   }
+   return cs->id;
+}
+
+static void cgb_row_of(const LineCC* cc, ULong* v)
+{
+   Int i;
+
+   v[CGB_Ir]   = cc->Ir.a;  v[CGB_I1mr] = cc->Ir.m1; v[CGB_ILmr] = cc->Ir.mL;
+   v[CGB_Dr]   = cc->Dr.a;  v[CGB_D1mr] = cc->Dr.m1; v[CGB_DLmr] = cc->Dr.mL;
+   v[CGB_Dw]   = cc->Dw.a;  v[CGB_D1mw] = cc->Dw.m1; v[CGB_DLmw] = cc->Dw.mL;
+   v[CGB_Bc]   = cc->Bc.b;  v[CGB_Bcm]  = cc->Bc.mp;
+   v[CGB_Bi]   = cc->Bi.b;  v[CGB_Bim]  = cc->Bi.mp;
+   v[CGB_D1mr_comp] = cc->Dr.m1_comp;
+   v[CGB_D1mr_conf] = cc->Dr.m1_conf;
+   v[CGB_D1mr_cap]  = cc->Dr.m1_cap;
+   v[CGB_D1mw_comp] = cc->Dw.m1_comp;
+   v[CGB_D1mw_conf] = cc->Dw.m1_conf;
+   v[CGB_D1mw_cap]  = cc->Dw.m1_cap;
+   v[CGB_DLmr_comp] = cc->Dr.mL_comp;
+   v[CGB_DLmr_conf] = cc->Dr.mL_conf;
+   v[CGB_DLmr_cap]  = cc->Dr.mL_cap;
+   v[CGB_DLmw_comp] = cc->Dw.mL_comp;
+   v[CGB_DLmw_conf] = cc->Dw.mL_conf;
+   v[CGB_DLmw_cap]  = cc->Dw.mL_cap;
+   for (i = 0; i < MAX_NUM_BINS; i++) {
+      v[CGB_EvD1_1 + i] = cc->ev.D1[i];
+      v[CGB_EvLL_1 + i] = cc->ev.LL[i];
+   }
+}
+
+// The client's command line, as one string.
+static HChar* client_cmd_line(void)
+{
+   HChar* cmd;
+   Int    i, cmd_len;
+
+   cmd_len = VG_(strlen)(VG_(args_the_exename)) + 1;
+   for (i = 0; i < VG_(sizeXA)( VG_(args_for_client) ); i++) {
+      HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_client), i );
+      cmd_len += 1 + VG_(strlen)(arg);
+   }
+   cmd = VG_(malloc)("cg.main.ccl.1", cmd_len);
+   VG_(strcpy)(cmd, VG_(args_the_exename));
+   for (i = 0; i < VG_(sizeXA)( VG_(args_for_client) ); i++) {
+      HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_client), i );
+      VG_(strcat)(cmd, " ");
+      VG_(strcat)(cmd, arg);
+   }
+   return cmd;
+}
+
+// The string table:  the offsets, then the strings.
+static void cgb_emit_strtab(CgbOut* o)
+{
+   UInt n = VG_(sizeXA)(o->strs);
+   UInt c, off = 0;
+
+   for (c = 0; c < n; c++) {
+      const HChar* s = *(const HChar**)VG_(indexXA)(o->strs, c);
+      cgb_emit(&o->w, &off, sizeof(UInt));
+      off += VG_(strlen)(s) + 1;
+   }
+   for (c = 0; c < n; c++) {
+      const HChar* s = *(const HChar**)VG_(indexXA)(o->strs, c);
+      cgb_emit(&o->w, s, VG_(strlen)(s) + 1);
+   }
+}
+
+// Write out the accumulated rows of one function as a block:  the line
+// numbers, then one column at a time.
+static void cgb_end_block(CgbOut* o, const HChar* file, const HChar* fn)
+{
+   CgbIndexEntry e;
+   Int  prev_line = 0;
+   UInt r, c;
+
+   if (o->n_rows == 0)
+      return;
+
+   e.file_str = cgb_str(o, file);
+   e.fn_str   = cgb_str(o, fn);
+   e.n_rows   = o->n_rows;
+   e.offset   = cgb_tell(&o->w);
+
+   for (r = 0; r < o->n_rows; r++) {
+      cgb_emit_varint(&o->w, cgb_zigzag((Long)o->lines[r] - prev_line));
+      prev_line = o->lines[r];
+   }
+   for (c = 0; c < CGB_N_COLS; c++) {
+      if (!(o->col_mask & CGB_COL(c)))
+         continue;
+      for (r = 0; r < o->n_rows; r++)
+         cgb_emit_varint(&o->w, o->vals[r * CGB_N_COLS + c]);
+   }
+
+   e.size = cgb_tell(&o->w) - e.offset;
+   VG_(addToXA)(o->index, &e);
+   o->n_rows = 0;
+}
+
+static void write_CC_table_binary(const ThreadInfo* t, const HChar* dump)
+{
+   CgbOut      o;
+   CgbHeader   hdr;
+   SysRes      sres;
+   HChar*      out_file;
+   HChar*      cmd;
+   HChar       *currFile = NULL;
+   const HChar *currFn = NULL;
+   SrcLine*    node;
+   LineCC      *lineCC, tmp;
+   ULong       totals[CGB_N_COLS];
+   UInt        c;
+
+   out_file = output_file_name("--cachegrind-out-file",
+                               clo_cachegrind_out_file, t, dump);
+   sres = VG_(open)(out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                              VKI_S_IRUSR|VKI_S_IWUSR);
+   if (sr_isError(sres)) {
+      complain_output_file(out_file);
+      VG_(free)(out_file);
+      return;
+   }
+
+   VG_(memset)(&o, 0, sizeof(o));
+   o.w.fd    = sr_Res(sres);
+   o.w.buf   = VG_(malloc)("cg.main.wctb.1", CGB_BUF_SIZE);
+   o.str_ids = VG_(HT_construct)("cg.main.wctb.2");
+   o.strs    = VG_(newXA)(VG_(malloc), "cg.main.wctb.3", VG_(free),
+                          sizeof(HChar*));
+   o.index   = VG_(newXA)(VG_(malloc), "cg.main.wctb.4", VG_(free),
+                          sizeof(CgbIndexEntry));
+
+   o.col_mask = CGB_COLS_IR;
+   if (clo_cache_sim) {
+      o.col_mask |= CGB_COLS_CACHE;
+      if (clo_miss_classify != MissClassifyNone)
+         o.col_mask |= CGB_COLS_3C_D1;
+      if (clo_miss_classify == MissClassifyAll)
+         o.col_mask |= CGB_COLS_3C_LL;
+   }
+   if (clo_branch_sim)
+      o.col_mask |= CGB_COLS_BRANCH;
+
+   // Header placeholder;  rewritten at the end.
+   VG_(memset)(&hdr, 0, sizeof(hdr));
+   cgb_emit(&o.w, &hdr, sizeof(hdr));
+
+   VG_(memset)(totals, 0, sizeof(totals));
+
+   // The blocks, in a single traversal.
+   CC_table_ResetIter();
+   while ( (node = CC_table_Next()) ) {
+      lineCC = output_lineCC(node, t, &tmp);
+      if (lineCC == NULL)
+         continue;      // not touched by this thread
+
+      // Strings are permanent, so pointer comparison will do;  see
+      // fprint_CC_table_and_calc_totals.
+      if (lineCC->loc.file != currFile || lineCC->loc.fn != currFn) {
+         cgb_end_block(&o, currFile, currFn);
+         currFile = lineCC->loc.file;
+         currFn   = lineCC->loc.fn;
+      }
+
+      if (o.n_rows == o.max_rows) {
+         o.max_rows = o.max_rows ? 2 * o.max_rows : 256;
+         o.lines = VG_(realloc)("cg.main.wctb.5", o.lines,
+                                o.max_rows * sizeof(Int));
+         o.vals  = VG_(realloc)("cg.main.wctb.6", o.vals,
+                                o.max_rows * CGB_N_COLS * sizeof(ULong));
+      }
+      o.lines[o.n_rows] = lineCC->loc.line;
+      cgb_row_of(lineCC, &o.vals[o.n_rows * CGB_N_COLS]);
+      for (c = 0; c < CGB_N_COLS; c++)
+         totals[c] += o.vals[o.n_rows * CGB_N_COLS + c];
+      o.n_rows++;
+      hdr.n_rows++;
+   }
+   cgb_end_block(&o, currFile, currFn);
+
+   // The desc and cmd lines go in the string table too.
+   hdr.desc_str[0] = hdr.desc_str[1] = hdr.desc_str[2] = CGB_NO_STR;
+   if (clo_cache_sim) {
+      hdr.desc_str[0] = cgb_str(&o, I1.desc_line);
+      hdr.desc_str[1] = cgb_str(&o, D1.desc_line);
+      hdr.desc_str[2] = cgb_str(&o, LL.desc_line);
+   }
+   cmd = client_cmd_line();
+   hdr.cmd_str = cgb_str(&o, cmd);
+
+   hdr.n_strings  = VG_(sizeXA)(o.strs);
+   hdr.strtab_off = cgb_tell(&o.w);
+   cgb_emit_strtab(&o);
+
+   // Index and totals.
+   cgb_align8(&o.w);
+   hdr.n_blocks  = VG_(sizeXA)(o.index);
+   hdr.index_off = cgb_tell(&o.w);
+   if (hdr.n_blocks > 0)
+      cgb_emit(&o.w, VG_(indexXA)(o.index, 0),
+               hdr.n_blocks * sizeof(CgbIndexEntry));
+   hdr.totals_off = cgb_tell(&o.w);
+   cgb_emit(&o.w, totals, sizeof(totals));
+   cgb_flush(&o.w);
+
+   // Now the header proper.
+   VG_(memcpy)(hdr.magic, CGB_MAGIC, sizeof(hdr.magic));
+   hdr.flags    = (clo_cache_sim  ? CGB_FLAG_CACHE_SIM  : 0)
+                | (clo_branch_sim ? CGB_FLAG_BRANCH_SIM : 0);
+   hdr.thread   = t ? t->serial : 0;
+   hdr.tid      = t ? t->tid    : 0;
+   hdr.col_mask = o.col_mask;
+   if (VG_(lseek)(o.w.fd, 0, VKI_SEEK_SET) != 0) {
+      o.w.failed = True;
+   } else {
+      o.w.off = 0;
+      cgb_emit(&o.w, &hdr, sizeof(hdr));
+      cgb_flush(&o.w);
+   }
+   VG_(close)(o.w.fd);
+
+   if (o.w.failed) {
+      VG_(umsg)("error: can't write output data file '%s'\n", out_file);
+      VG_(umsg)("       ... so detailed results will be missing.\n");
+   }
+
+   // The cg_fini summary wants the aggregate's totals.
+   if (!t) {
+      Ir_total.a  = totals[CGB_Ir];
+      Ir_total.m1 = totals[CGB_I1mr];
+      Ir_total.mL = totals[CGB_ILmr];
+      Dr_total.a  = totals[CGB_Dr];
+      Dr_total.m1 = totals[CGB_D1mr];
+      Dr_total.mL = totals[CGB_DLmr];
+      Dw_total.a  = totals[CGB_Dw];
+      Dw_total.m1 = totals[CGB_D1mw];
+      Dw_total.mL = totals[CGB_DLmw];
+      Bc_total.b  = totals[CGB_Bc];
+      Bc_total.mp = totals[CGB_Bcm];
+      Bi_total.b  = totals[CGB_Bi];
+      Bi_total.mp = totals[CGB_Bim];
+      distinct_lines += hdr.n_rows;
+   }
+
+   VG_(free)(cmd);
+   VG_(free)(o.lines);
+   VG_(free)(o.vals);
+   VG_(deleteXA)(o.index);
+   VG_(deleteXA)(o.strs);
+   VG_(HT_destruct)(o.str_ids, VG_(free));
+   VG_(free)(o.w.buf);
+   VG_(free)(out_file);
+}
+
+/*------------------------------------------------------------*/
+/*--- Access traces (--record-trace)                       ---*/
+/*------------------------------------------------------------*/
+
+/* Records every access the simulator sees, in order, so that cg_replay
+   can run them through other cache configurations natively;  see
+   cg_trace.h.  Recording implies --batch-sim:  acc_buf is encoded each
+   time it is drained.  The records go out through the binary output's
+   writer as they come;  the tables they refer to are kept until the end.
+   A child the client forks stops recording, rather than write into its
+   parent's file. */
+
+typedef struct {
+   CgbOut   o;           // only the writer and the strings are used
+   Int      pid;         // the process recording
+   HChar*   file;
+   UChar*   blk;         // records of the block being built
+   UInt     blk_used;
+   UInt     blk_recs;
+   UInt     prev_instr;  // what the deltas are from;  0 at block start
+   Addr     prev_addr;
+   UInt     max_size;
+   ULong    n_recs;
+   XArray*  index;       // ULong, block offsets
+   XArray*  instrs;      // CgtInstr
+   XArray*  extras;      // CgtExtra
+} TraceOut;
+
+static TraceOut* trace = NULL;
+
+static void start_trace(void)
+{
+   HChar*    file = VG_(expand_file_name)("--record-trace", clo_record_trace);
+   CgtHeader hdr;
+   SysRes    sres;
+
+   sres = VG_(open)(file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                          VKI_S_IRUSR|VKI_S_IWUSR);
+   if (sr_isError(sres)) {
+      VG_(umsg)("error: can't open trace file '%s'\n", file);
+      VG_(umsg)("       ... so no trace will be recorded.\n");
+      VG_(free)(file);
+      return;
+   }
+
+   trace = VG_(calloc)("cg.main.st.1", 1, sizeof(TraceOut));
+   trace->file      = file;
+   trace->pid       = VG_(getpid)();
+   trace->o.w.fd    = sr_Res(sres);
+   trace->o.w.buf   = VG_(malloc)("cg.main.st.2", CGB_BUF_SIZE);
+   trace->o.str_ids = VG_(HT_construct)("cg.main.st.3");
+   trace->o.strs    = VG_(newXA)(VG_(malloc), "cg.main.st.4", VG_(free),
+                                 sizeof(HChar*));
+   trace->blk       = VG_(malloc)("cg.main.st.5", CGT_BLOCK_SIZE);
+   trace->index     = VG_(newXA)(VG_(malloc), "cg.main.st.6", VG_(free),
+                                 sizeof(ULong));
+   trace->instrs    = VG_(newXA)(VG_(malloc), "cg.main.st.7", VG_(free),
+                                 sizeof(CgtInstr));
+   trace->extras    = VG_(newXA)(VG_(malloc), "cg.main.st.8", VG_(free),
+                                 sizeof(CgtExtra));
+
+   // Header placeholder;  rewritten at the end.
+   VG_(memset)(&hdr, 0, sizeof(hdr));
+   cgb_emit(&trace->o.w, &hdr, sizeof(hdr));
+}
+
+static Bool trace_live(void)
+{
+   if (trace && VG_(getpid)() != trace->pid)
+      trace = NULL;
+   return trace != NULL;
+}
+
+static void trace_end_block(void)
+{
+   CgtBlock b;
+   ULong    off;
 
-      // Print the LineCC
-      total_line = 0;
-      for(i = 0; i < MAX_NUM_BINS; i++)
-      {
-        // Update summary stats
-        summary[i] += lineCC->num_evicts_LL[i];
+   if (trace->blk_recs == 0)
+      return;
+   off      = cgb_tell(&trace->o.w);
+   b.n_recs = trace->blk_recs;
+   b.size   = trace->blk_used;
+   VG_(addToXA)(trace->index, &off);
+   cgb_emit(&trace->o.w, &b, sizeof(b));
+   cgb_emit(&trace->o.w, trace->blk, trace->blk_used);
+   trace->blk_used   = 0;
+   trace->blk_recs   = 0;
+   trace->prev_instr = 0;
+   trace->prev_addr  = 0;
+}
 
-        // Calculate stats per line
-        total_line += lineCC->num_evicts_LL[i]; 
+// The index of 'n' in the instrs table, adding it if it isn't there.  Its
+// extras are what count_folded counts when it is fetched.
+static UInt trace_instr(InstrInfo* n)
+{
+   CgtInstr ti;
+   Int      k;
+
+   if (n->trace_id)
+      return n->trace_id - 1;
+
+   VG_(memset)(&ti, 0, sizeof(ti));
+   ti.addr        = n->instr_addr;
+   ti.len         = n->instr_len;
+   ti.line        = n->parent->id;
+   ti.first_extra = VG_(sizeXA)(trace->extras);
+   for (k = 0; k <= n->n_folded; k++) {
+      CgtExtra e;
+      e.line = n[k].parent->id;
+      e.Ir   = k > 0;
+      e.Dr   = n[k].n_Dr_hits;
+      e.Dw   = n[k].n_Dw_hits;
+      e.pad  = 0;
+      if (e.Ir | e.Dr | e.Dw) {
+         VG_(addToXA)(trace->extras, &e);
+         ti.n_extras++;
       }
+   }
+   VG_(addToXA)(trace->instrs, &ti);
+   n->trace_id = VG_(sizeXA)(trace->instrs);
+   return n->trace_id - 1;
+}
 
-      if (clo_cache_sim && total_line) {
+// Encode acc_buf.  AccKind and CgtKind agree.
+static void record_accesses(void)
+{
+   AccRec* r;
 
-         access += lineCC->Dr.m1 + lineCC->Dw.m1;
-         miss += lineCC->Dr.mL + lineCC->Dw.mL;
-         miss_comp += lineCC->Dr.mL_comp + lineCC->Dw.mL_comp;
-         miss_conf += lineCC->Dr.mL_conf + lineCC->Dw.mL_conf;
-         miss_cap += lineCC->Dr.mL_cap + lineCC->Dw.mL_cap;
+   if (acc_cur == acc_buf || !trace_live())
+      return;
 
-         VG_(fprintf)(fp,  "%d %llu %llu %llu" 
-                           " %llu %llu %llu"
-                           " %llu %llu %llu"
-                           " %llu %llu %llu"
-                           " %llu %llu\n",
-                           lineCC->loc.line, lineCC->Dr.m1 + lineCC->Dw.m1, lineCC->Dr.mL + lineCC->Dw.mL,
-                           lineCC->Dr.mL_comp + lineCC->Dw.mL_comp, lineCC->Dr.mL_conf + lineCC->Dw.mL_conf, lineCC->Dr.mL_cap + lineCC->Dw.mL_cap, total_line,
-                           lineCC->num_evicts_LL[0], lineCC->num_evicts_LL[1], lineCC->num_evicts_LL[2],
-                           lineCC->num_evicts_LL[3], lineCC->num_evicts_LL[4], lineCC->num_evicts_LL[5],
-                           lineCC->num_evicts_LL[6], lineCC->num_evicts_LL[7]);
+   for (r = acc_buf; r < acc_cur; r++) {
+      UWord  kind  = r->info & ACC_KIND_MASK;
+      UInt   instr;
+      UChar* p;
+
+      if (kind >= AccDr
+          && UNLIKELY(!sim_data_access(r->addr, r->info >> ACC_KIND_BITS)))
+         continue;
+      instr = trace_instr(r->inode);
+      if (trace->blk_used + CGT_MAX_REC > CGT_BLOCK_SIZE)
+         trace_end_block();
+      p = trace->blk + trace->blk_used;
+      if (kind < AccDr) {
+         p += cgb_put_varint(p, kind);
+      } else {
+         UWord size = r->info >> ACC_KIND_BITS;
+         p += cgb_put_varint(p, kind | size << CGT_KIND_BITS);
+         if (size > trace->max_size)
+            trace->max_size = size;
       }
+      p += cgb_put_varint(p, cgb_zigzag((Long)instr
+                                        - (Long)trace->prev_instr));
+      trace->prev_instr = instr;
+      if (kind >= AccDr) {
+         p += cgb_put_varint(p, cgb_zigzag((Long)(r->addr
+                                                  - trace->prev_addr)));
+         trace->prev_addr = r->addr;
+      }
+      trace->blk_used = p - trace->blk;
+      trace->blk_recs++;
+      trace->n_recs++;
    }
+}
 
-   // Summary stats must come after rest of table, since we calculate them
-   // during traversal.
-   total = 0;
-   for(i = 0; i < MAX_NUM_BINS; i++)
-   {
-      total += summary[i];
+// Write out 'xa', whose elements are 'szB' bytes.
+static void cgb_emit_XA(CgbWriter* w, XArray* xa, UInt szB)
+{
+   if (VG_(sizeXA)(xa) > 0)
+      cgb_emit(w, VG_(indexXA)(xa, 0), VG_(sizeXA)(xa) * szB);
+}
+
+static CgtCache trace_cache(const cache_t2* c)
+{
+   CgtCache t = { c->size, c->assoc, c->line_size };
+   return t;
+}
+
+static void finish_trace(void)
+{
+   CgtHeader hdr;
+   CgtLine*  lines;
+   SrcLine*  lineCC;
+   HChar*    cmd;
+
+   if (!trace_live())
+      return;
+   trace_end_block();
+
+   VG_(memset)(&hdr, 0, sizeof(hdr));
+   lines = VG_(calloc)("cg.main.ft.1", n_lineCCs + 1, sizeof(CgtLine));
+   CC_table_ResetIter();
+   while ( (lineCC = CC_table_Next()) ) {
+      CgtLine* l = &lines[lineCC->id];
+      l->file_str = cgb_str(&trace->o, lineCC->loc.file);
+      l->fn_str   = cgb_str(&trace->o, lineCC->loc.fn);
+      l->line     = lineCC->loc.line;
+   }
+   cmd = client_cmd_line();
+   hdr.cmd_str = cgb_str(&trace->o, cmd);
+
+   cgb_align8(&trace->o.w);
+   hdr.n_blocks   = VG_(sizeXA)(trace->index);
+   hdr.index_off  = cgb_tell(&trace->o.w);
+   cgb_emit_XA(&trace->o.w, trace->index, sizeof(ULong));
+   hdr.n_instrs   = VG_(sizeXA)(trace->instrs);
+   hdr.instrs_off = cgb_tell(&trace->o.w);
+   cgb_emit_XA(&trace->o.w, trace->instrs, sizeof(CgtInstr));
+   hdr.n_extras   = VG_(sizeXA)(trace->extras);
+   hdr.extras_off = cgb_tell(&trace->o.w);
+   cgb_emit_XA(&trace->o.w, trace->extras, sizeof(CgtExtra));
+   hdr.n_lines    = n_lineCCs;
+   hdr.lines_off  = cgb_tell(&trace->o.w);
+   cgb_emit(&trace->o.w, lines, n_lineCCs * sizeof(CgtLine));
+   hdr.n_strings  = VG_(sizeXA)(trace->o.strs);
+   hdr.strtab_off = cgb_tell(&trace->o.w);
+   cgb_emit_strtab(&trace->o);
+   cgb_flush(&trace->o.w);
+
+   // Now the header proper.
+   VG_(memcpy)(hdr.magic, CGT_MAGIC, sizeof(hdr.magic));
+   hdr.n_recs   = trace->n_recs;
+   hdr.max_size = trace->max_size;
+   hdr.I1       = trace_cache(&I1);
+   hdr.D1       = trace_cache(&D1);
+   hdr.LL       = trace_cache(&LL);
+   if (VG_(lseek)(trace->o.w.fd, 0, VKI_SEEK_SET) != 0) {
+      trace->o.w.failed = True;
+   } else {
+      trace->o.w.off = 0;
+      cgb_emit(&trace->o.w, &hdr, sizeof(hdr));
+      cgb_flush(&trace->o.w);
    }
+   VG_(close)(trace->o.w.fd);
 
-   if (clo_cache_sim) {
-      VG_(fprintf)(fp,  "summary: %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu\n",
-                        access, miss,
-                        miss_comp, miss_conf, miss_cap, total,
-                        summary[0],summary[1], summary[2],
-                        summary[3],summary[4], summary[5],
-                        summary[6],summary[7]);
+   if (trace->o.w.failed) {
+      VG_(umsg)("error: can't write trace file '%s'\n", trace->file);
+      VG_(umsg)("       ... so the trace is unusable.\n");
    }
 
-   VG_(fclose)(fp);
+   VG_(free)(cmd);
+   VG_(free)(lines);
+   VG_(deleteXA)(trace->extras);
+   VG_(deleteXA)(trace->instrs);
+   VG_(deleteXA)(trace->index);
+   VG_(free)(trace->blk);
+   VG_(deleteXA)(trace->o.strs);
+   VG_(HT_destruct)(trace->o.str_ids, VG_(free));
+   VG_(free)(trace->o.w.buf);
+   VG_(free)(trace->file);
+   VG_(free)(trace);
+   trace = NULL;
 }
 
 /*
@@ -1922,8 +4894,8 @@ static void fprint_CC_table_and_cache_usage(void)
    }
 
    // Traverse every lineCC
-   VG_(OSetGen_ResetIter)(CC_table);
-   while ( (lineCC = VG_(OSetGen_Next)(CC_table)) ) {
+   CC_table_ResetIter();
+   while ( (lineCC = CC_table_Next()) ) {
       Bool just_hit_a_new_file = False;
       // If we've hit a new file, print a "fl=" line.  Note that because
       // each string is stored exactly once in the string table, we can use
@@ -1952,12 +4924,12 @@ static void fprint_CC_table_and_cache_usage(void)
       for(i = 0; i < MAX_NUM_BINS; i++)
       {
         // Update summary stats
-        summary_D1[i] += lineCC->num_evicts_D1[i]; 
-        summary_LL[i] += lineCC->num_evicts_LL[i]; 
+        summary_D1[i] += lineCC->ev.D1[i]; 
+        summary_LL[i] += lineCC->ev.LL[i]; 
 
         // Calculate stats per line
-        total_line_D1 += lineCC->num_evicts_D1[i]; 
-        total_line_LL += lineCC->num_evicts_LL[i]; 
+        total_line_D1 += lineCC->ev.D1[i]; 
+        total_line_LL += lineCC->ev.LL[i]; 
       }
 
       if (clo_cache_sim && (total_line_D1 || total_line_LL)) {
@@ -1973,13 +4945,13 @@ static void fprint_CC_table_and_cache_usage(void)
                            " %llu %llu %llu"
                            " %llu %llu\n",
                            lineCC->loc.line, lineCC->Dr.a + lineCC->Dw.a, total_line_D1,
-                           lineCC->num_evicts_D1[0], lineCC->num_evicts_D1[1], lineCC->num_evicts_D1[2],
-                           lineCC->num_evicts_D1[3], lineCC->num_evicts_D1[4], lineCC->num_evicts_D1[5],
-                           lineCC->num_evicts_D1[6], lineCC->num_evicts_D1[7],
+                           lineCC->ev.D1[0], lineCC->ev.D1[1], lineCC->ev.D1[2],
+                           lineCC->ev.D1[3], lineCC->ev.D1[4], lineCC->ev.D1[5],
+                           lineCC->ev.D1[6], lineCC->ev.D1[7],
                            lineCC->Dr.m1 + lineCC->Dw.m1, lineCC->Dr.mL + lineCC->Dw.mL, total_line_LL,
-                           lineCC->num_evicts_LL[0], lineCC->num_evicts_LL[1], lineCC->num_evicts_LL[2],
-                           lineCC->num_evicts_LL[3], lineCC->num_evicts_LL[4], lineCC->num_evicts_LL[5],
-                           lineCC->num_evicts_LL[6], lineCC->num_evicts_LL[7]);
+                           lineCC->ev.LL[0], lineCC->ev.LL[1], lineCC->ev.LL[2],
+                           lineCC->ev.LL[3], lineCC->ev.LL[4], lineCC->ev.LL[5],
+                           lineCC->ev.LL[6], lineCC->ev.LL[7]);
       }
    }
 
@@ -2027,6 +4999,432 @@ static UInt ULong_width(ULong n)
    return w + (w-1)/3;   // add space for commas
 }
 
+// Write the aggregate (t == NULL) or one thread's counts, at exit
+// (dump == NULL) or for a mid-run dump.
+static void write_CC_table(const ThreadInfo* t, const HChar* dump)
+{
+   if (clo_binary_output) {
+      write_CC_table_binary(t, dump);
+   } else {
+      fprint_CC_table_and_calc_totals(t, dump);
+      fprint_CC_table_and_cache_d1_usage(t, dump);
+      fprint_CC_table_and_cache_ll_usage(t, dump);
+   }
+}
+
+// Sum of everything charged in region 'r' itself (excl) and in it and
+// the regions nested in it (incl).  Either may be NULL.
+static void sum_region(const Region* r, LineCC* excl, LineCC* incl)
+{
+   LineCC own;
+   const Region* c;
+   Word   i;
+   UInt   j;
+
+   VG_(memset)(&own, 0, sizeof(own));
+   for (i = 0; i < VG_(sizeXA)(r->shards); i++) {
+      CCShard* sh = *(CCShard**)VG_(indexXA)(r->shards, i);
+      if (!sh)
+         continue;
+      for (j = 0; j < n_lineCCs; j++)
+         add_cc_rows(&own, &sh->ccs, j);
+   }
+   if (excl)
+      *excl = own;
+   if (incl) {
+      *incl = own;
+      for (c = r->children; c; c = c->next) {
+         LineCC sub;
+         sum_region(c, NULL, &sub);
+         add_lineCC(incl, &sub);
+      }
+   }
+}
+
+static void fprint_region_path(VgFile* fp, const Region* r)
+{
+   if (r->parent) {
+      fprint_region_path(fp, r->parent);
+      VG_(fprintf)(fp, "/");
+   }
+   VG_(fprintf)(fp, "%s", r->name);
+}
+
+static void fprint_iv_cols(VgFile* fp, const HChar* what, const LineCC* cc)
+{
+   ULong v[IV_N];
+   Int   i, n = clo_cache_sim ? IV_N : 1;
+
+   VG_(memset)(v, 0, sizeof(v));
+   add_interval_cols(v, cc);
+   VG_(fprintf)(fp, "%s:", what);
+   for (i = 0; i < n; i++)
+      VG_(fprintf)(fp, " %llu", v[i]);
+   VG_(fprintf)(fp, "\n");
+}
+
+static void fprint_regions_from(VgFile* fp, const Region* r)
+{
+   LineCC excl, incl;
+
+   for (; r; r = r->next) {
+      sum_region(r, &excl, &incl);
+      VG_(fprintf)(fp, "region=");
+      fprint_region_path(fp, r);
+      VG_(fprintf)(fp, "\nentries: %llu\n", r->entries);
+      fprint_iv_cols(fp, "excl", &excl);
+      fprint_iv_cols(fp, "incl", &incl);
+      fprint_regions_from(fp, r->children);
+   }
+}
+
+// The region summary:  for each region, depth first, its path, how often
+// it was entered, and its exclusive and inclusive counts.  Only written
+// if the client used regions.
+static void fprint_regions(const HChar* dump)
+{
+   VgFile* fp;
+
+   if (!top_regions)
+      return;
+   fp = open_output_file("--region-out-file", clo_region_out_file,
+                         NULL, dump);
+   if (fp == NULL)
+      return;
+   fprint_iv_preamble(fp);
+   fprint_iv_events(fp);
+   fprint_regions_from(fp, top_regions);
+   VG_(fclose)(fp);
+}
+
+// Heaviest first.
+static const SSketch* sorted_sketch;
+
+static Int cmp_SSEntry_idx(const void* va, const void* vb)
+{
+   ULong a = sorted_sketch->e[*(const UInt*)va].count;
+   ULong b = sorted_sketch->e[*(const UInt*)vb].count;
+
+   return a > b ? -1 : a < b ? 1 : 0;
+}
+
+// The counters of 's' in use, heaviest first.  The caller frees them.
+static UInt* sorted_SSketch(const SSketch* s)
+{
+   UInt* idx = VG_(malloc)("cg.main.sss.1", (s->n ? s->n : 1) * sizeof(UInt));
+   UInt  i;
+
+   for (i = 0; i < s->n; i++)
+      idx[i] = i;
+   sorted_sketch = s;
+   VG_(ssort)(idx, s->n, sizeof(UInt), cmp_SSEntry_idx);
+   return idx;
+}
+
+static void fprint_evict_loc(VgFile* fp, UInt id)
+{
+   const SrcLine* l = lineCCs_by_id[id];
+
+   VG_(fprintf)(fp, "  %s:%d %s", l->loc.file, l->loc.line, l->loc.fn);
+}
+
+static void fprint_evict_graph_of(VgFile* fp, const HChar* name,
+                                  const EvictGraph* g)
+{
+   UInt* idx = sorted_SSketch(&g->ss);
+   UInt  i;
+
+   VG_(fprintf)(fp, "cache: %s\nevictions: %llu\n", name, g->ss.total);
+   for (i = 0; i < g->ss.n; i++) {
+      const SSEntry* e  = &g->ss.e[idx[i]];
+      const ULong*   bt = g->by_type[idx[i]];
+      VG_(fprintf)(fp, "%llu %llu", e->count, e->err);
+      if (clo_miss_classify == MissClassifyAll
+          || (clo_miss_classify == MissClassifyD1 && g == &EG_D1))
+         VG_(fprintf)(fp, " %llu %llu %llu", bt[MISS_COMPULSORY],
+                      bt[MISS_CONFLICT], bt[MISS_CAPACITY]);
+      fprint_evict_loc(fp, (UInt)(e->key >> 32));
+      fprint_evict_loc(fp, (UInt)e->key);
+      VG_(fprintf)(fp, "\n");
+   }
+   VG_(free)(idx);
+}
+
+// The eviction graph:  for D1, then LL, the number of evictions, then
+// the pairs kept, heaviest first, each as
+//
+//   count err [comp conf cap]  evictor-file:line fn  victim-file:line fn
+//
+// where count may be up to err too high (see cg_sim.c), and comp, conf
+// and cap split count by the kind of miss that evicted, if those misses
+// are classified.
+static void fprint_evict_graph(const HChar* dump)
+{
+   VgFile* fp;
+
+   if (!EG_on)
+      return;
+   fp = open_output_file("--evict-out-file", clo_evict_out_file, NULL, dump);
+   if (fp == NULL)
+      return;
+   fprint_iv_preamble(fp);
+   VG_(fprintf)(fp, "counters: %u\n", clo_evict_pairs);
+   fprint_evict_graph_of(fp, "D1", &EG_D1);
+   fprint_evict_graph_of(fp, "LL", &EG_LL);
+   VG_(fclose)(fp);
+}
+
+static const HChar* pattern_name[PatN] = {
+   "constant", "sequential", "stride", "irregular"
+};
+
+// File, function and line of the parent, then instruction address.
+static Int cmp_PatternInfo_ptrs(const void* va, const void* vb)
+{
+   const PatternInfo* a = *(const PatternInfo* const*)va;
+   const PatternInfo* b = *(const PatternInfo* const*)vb;
+   Word res = cmp_CodeLoc(&a->parent->loc, &b->parent->loc);
+
+   if (res != 0)
+      return res < 0 ? -1 : 1;
+   return a->top.key < b->top.key ? -1 : a->top.key > b->top.key ? 1 : 0;
+}
+
+// The access patterns:  under fl= and fn= lines as in cachegrind.out,
+// each line that has memory instructions, with its data counts
+//
+//   <line> Dr D1mr DLmr Dw D1mw DLmw
+//
+// and then each of those instructions, seen at least twice, as
+//
+//     0x<addr> <class> <stride> <accesses> <constant> <sequential>
+//              <stride> <irregular>
+//
+// where <class> is the one most of its accesses were in, <stride> the
+// last sequential or fixed stride (or "-" if it was neither), and the
+// last four the accesses after the first by class.
+static void fprint_access_patterns(const HChar* dump)
+{
+   PatternInfo**  ps;
+   PatternInfo*   p;
+   const SrcLine* prev = NULL;
+   HChar*         currFile = NULL;
+   const HChar*   currFn = NULL;
+   UInt           n = 0, i;
+   VgFile*        fp;
+
+   if (!patternTable)
+      return;
+   fp = open_output_file("--access-patterns-out-file", clo_patterns_out_file,
+                         NULL, dump);
+   if (fp == NULL)
+      return;
+   fprint_iv_preamble(fp);
+   VG_(fprintf)(fp, "events: Dr D1mr DLmr Dw D1mw DLmw\n");
+
+   ps = VG_(malloc)("cg.main.fap.1",
+                    (VG_(HT_count_nodes)(patternTable) + 1) * sizeof(*ps));
+   VG_(HT_ResetIter)(patternTable);
+   while ( (p = VG_(HT_Next)(patternTable)) ) {
+      if (p->n_accesses >= 2)
+         ps[n++] = p;
+   }
+   VG_(ssort)(ps, n, sizeof(*ps), cmp_PatternInfo_ptrs);
+
+   for (i = 0; i < n; i++) {
+      AccessPattern k, top = PatConst;
+
+      p = ps[i];
+      for (k = PatSeq; k < PatN; k++) {
+         if (p->n[k] > p->n[top])
+            top = k;
+      }
+      if (p->parent != prev) {
+         LineCC  tmp;
+         const LineCC* cc = output_lineCC(p->parent, NULL, &tmp);
+         Bool just_hit_a_new_file = False;
+
+         if (cc->loc.file != currFile) {
+            currFile = cc->loc.file;
+            VG_(fprintf)(fp, "fl=%s\n", currFile);
+            just_hit_a_new_file = True;
+         }
+         if (just_hit_a_new_file || cc->loc.fn != currFn) {
+            currFn = cc->loc.fn;
+            VG_(fprintf)(fp, "fn=%s\n", currFn);
+         }
+         VG_(fprintf)(fp, "%d %llu %llu %llu %llu %llu %llu\n",
+                      cc->loc.line, cc->Dr.a, cc->Dr.m1, cc->Dr.mL,
+                      cc->Dw.a, cc->Dw.m1, cc->Dw.mL);
+         prev = p->parent;
+      }
+      VG_(fprintf)(fp, "  0x%lx %s ", p->top.key, pattern_name[top]);
+      if (top == PatSeq || top == PatStride)
+         VG_(fprintf)(fp, "%lld", p->steady);
+      else
+         VG_(fprintf)(fp, "-");
+      VG_(fprintf)(fp, " %llu %llu %llu %llu %llu\n", p->n_accesses,
+                   p->n[PatConst], p->n[PatSeq], p->n[PatStride],
+                   p->n[PatIrregular]);
+   }
+   VG_(free)(ps);
+   VG_(fclose)(fp);
+}
+
+static void fprint_miss_top(VgFile* fp, const HChar* name,
+                            const MissProfile* mp, const UInt* idx)
+{
+   UInt i;
+
+   VG_(fprintf)(fp, "# %s misses: %llu;  instr count err  fn (file:line)\n",
+                name, mp->ss.total);
+   for (i = 0; i < mp->ss.n; i++) {
+      const SSEntry*   e  = &mp->ss.e[idx[i]];
+      const MissEntry* me = &mp->entries[idx[i]];
+      VG_(fprintf)(fp, "#   %lx %llu %llu  %s (%s:%d)\n", (Addr)e->key,
+                   e->count, e->err, me->parent->loc.fn,
+                   me->parent->loc.file, me->parent->loc.line);
+   }
+}
+
+static void fprint_miss_samples_of(VgFile* fp, const HChar* comm, Int pid,
+                                   const HChar* cache, const MissProfile* mp,
+                                   const UInt* idx)
+{
+   UInt i, j;
+
+   for (i = 0; i < mp->ss.n; i++) {
+      const SSEntry*   e  = &mp->ss.e[idx[i]];
+      const MissEntry* me = &mp->entries[idx[i]];
+      UInt  n = me->n_seen < MISS_RESERVOIR ? me->n_seen : MISS_RESERVOIR;
+      ULong period = n ? (e->count + n - 1) / n : 0;
+
+      for (j = 0; j < n; j++) {
+         const MissSample* sm = &me->s[j];
+         VG_(fprintf)(fp, "%s %d %llu %s%s: %lx %lx %s (%s:%d) %s\n",
+                      comm, pid, period, cache, sm->is_write ? "mw" : "mr",
+                      sm->addr, (Addr)e->key, me->parent->loc.fn,
+                      me->parent->loc.file, me->parent->loc.line,
+                      sm->missed_LL ? "mem" : "LL");
+      }
+   }
+}
+
+// The miss samples, laid out like "perf script -F comm,pid,period,event,
+// addr,ip,sym" output for PEBS memory samples, so the same scripts can
+// read simulated and sampled profiles.  After '#' comment lines giving
+// the configuration and the top instructions of each sketch, each sample
+// is a line
+//
+//   <comm> <pid> <period> <event>: <data addr> <ip> <fn> (<file>:<line>) <src>
+//
+// where <event> is D1mr, D1mw, DLmr or DLmw, <period> is how many misses
+// each of the instruction's samples stands for, and <src> is where the
+// line came from:  LL or mem.
+static void fprint_miss_samples(const HChar* dump)
+{
+   const HChar* comm = VG_(strrchr)(VG_(args_the_exename), '/');
+   UInt*        idx_D1;
+   UInt*        idx_LL;
+   VgFile*      fp;
+   Int          i;
+
+   if (!clo_miss_samples)
+      return;
+   fp = open_output_file("--miss-samples-out-file", clo_samples_out_file,
+                         NULL, dump);
+   if (fp == NULL)
+      return;
+   comm = comm ? comm + 1 : VG_(args_the_exename);
+
+   VG_(fprintf)(fp, "# desc: D1 cache: %s\n# desc: LL cache: %s\n",
+                D1.desc_line, LL.desc_line);
+   VG_(fprintf)(fp, "# cmd: %s", VG_(args_the_exename));
+   for (i = 0; i < VG_(sizeXA)( VG_(args_for_client) ); i++) {
+      HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_client), i );
+      VG_(fprintf)(fp, " %s", arg);
+   }
+   VG_(fprintf)(fp, "\n");
+
+   idx_D1 = sorted_SSketch(&miss_D1.ss);
+   idx_LL = sorted_SSketch(&miss_LL.ss);
+   fprint_miss_top(fp, "D1", &miss_D1, idx_D1);
+   fprint_miss_top(fp, "LL", &miss_LL, idx_LL);
+   fprint_miss_samples_of(fp, comm, VG_(getpid)(), "D1", &miss_D1, idx_D1);
+   fprint_miss_samples_of(fp, comm, VG_(getpid)(), "DL", &miss_LL, idx_LL);
+   VG_(free)(idx_D1);
+   VG_(free)(idx_LL);
+   VG_(fclose)(fp);
+}
+
+static void write_all_CC_tables(const HChar* dump)
+{
+   Word i;
+
+   write_CC_table(NULL, dump);
+   fprint_regions(dump);
+   fprint_evict_graph(dump);
+   fprint_access_patterns(dump);
+   fprint_miss_samples(dump);
+   if (clo_per_thread) {
+      for (i = 0; i < VG_(sizeXA)(all_threads); i++)
+         write_CC_table(*(ThreadInfo**)VG_(indexXA)(all_threads, i), dump);
+   }
+}
+
+static void zero_region_entries(Region* r)
+{
+   for (; r; r = r->next) {
+      r->entries = 0;
+      zero_region_entries(r->children);
+   }
+}
+
+// Zero every counter, including the shards' columns and the region entry
+// counts.  The cache contents, and so the evict rows that resident lines
+// will eventually charge their evictions to, are left alone.
+static void zero_CC_table(void)
+{
+   Word i;
+
+   zero_ccs(&shared_ccs);
+   for (i = 0; i < VG_(sizeXA)(all_shards); i++) {
+      CCShard* sh = *(CCShard**)VG_(indexXA)(all_shards, i);
+      zero_ccs(&sh->ccs);
+   }
+   zero_region_entries(top_regions);
+   cachesim_reset_evict_graph();
+   zero_patterns();
+   zero_miss_samples();
+
+   if (clo_interval > 0)
+      reset_interval_baseline();
+}
+
+// The file suffix for a dump:  the client's name with anything that
+// doesn't belong in a file name replaced, or "dump<n>" if it gave none.
+static HChar* dump_name(const HChar* name)
+{
+   static UInt n_dumps = 0;
+   HChar* s;
+   Int    i;
+
+   n_dumps++;
+   if (name == NULL || name[0] == '\0') {
+      s = VG_(malloc)("cg.main.dn.1", 16);
+      VG_(sprintf)(s, "dump%u", n_dumps);
+      return s;
+   }
+   s = VG_(strdup)("cg.main.dn.2", name);
+   for (i = 0; s[i]; i++) {
+      HChar c = s[i];
+      if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+            || (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.'))
+         s[i] = '_';
+   }
+   return s;
+}
+
 static void cg_fini(Int exitcode)
 {
    static HChar fmt[128];   // OK; large enough
@@ -2037,11 +5435,23 @@ static void cg_fini(Int exitcode)
          LL_total, LL_total_r, LL_total_w;
    Int l1, l2, l3;
 
-   cachesim_finish();
-   fprint_CC_table_and_calc_totals();
+   if (sim_daemon_live())
+      stop_sim_daemon();
+   else
+      drain_accesses();
+   finish_trace();
+
+   if (clo_cache_sim && clo_save_cache_state) {
+      HChar* state_file =
+         VG_(expand_file_name)("--save-cache-state", clo_save_cache_state);
+      cachesim_save_state(state_file);
+      VG_(free)(state_file);
+   }
 
-   fprint_CC_table_and_cache_d1_usage();
-   fprint_CC_table_and_cache_ll_usage();
+   cachesim_finish();
+   if (clo_interval > 0)
+      write_interval_snapshot(True);
+   write_all_CC_tables(NULL);
 
    if (VG_(clo_verbosity) == 0) 
       return;
@@ -2169,13 +5579,16 @@ static void cg_fini(Int exitcode)
                 fn_debugs * 100.0 / debug_lookups, fn_debugs);
       VG_(dmsg)("cachegrind: with zero      info:%6.1f%% (%d)\n", 
                 no_debugs * 100.0 / debug_lookups, no_debugs);
-
-      VG_(dmsg)("cachegrind: string table size: %u\n",
-                VG_(OSetGen_Size)(stringTable));
-      VG_(dmsg)("cachegrind: CC table size: %u\n",
-                VG_(OSetGen_Size)(CC_table));
-      VG_(dmsg)("cachegrind: InstrInfo table size: %u\n",
-                VG_(OSetGen_Size)(instrInfoTable));
+      VG_(dmsg)("cachegrind: memoised lookups   : %d\n", memo_lineCC_hits);
+      VG_(dmsg)("cachegrind: folded Ir events   : %d\n", folded_Irs);
+      VG_(dmsg)("cachegrind: folded D1 hits     : %d\n", folded_Ds);
+
+      VG_(dmsg)("cachegrind: string table size: %d\n",
+                VG_(HT_count_nodes)(stringTable));
+      VG_(dmsg)("cachegrind: CC table size: %d\n",
+                VG_(HT_count_nodes)(CC_table));
+      VG_(dmsg)("cachegrind: InstrInfo table size: %d\n",
+                VG_(HT_count_nodes)(instrInfoTable));
    }
 }
 
@@ -2201,11 +5614,13 @@ void cg_discard_superblock_info ( Addr orig_addr64, VexGuestExtents vge )
    // Get SB info, remove from table, free SB info. Simple! Unless
    // instrumentation is currently disabled, in which case we won't have an SB
    // info. Note that we use orig_addr, not the first instruction address in
-   // `vge`.
-   SB_info* sbInfo = VG_(OSetGen_Remove)(instrInfoTable, &orig_addr);
+   // `vge`.  Buffered accesses may point at its InstrInfos, so simulate
+   // them first.
+   drain_accesses();
+   SB_info* sbInfo = VG_(HT_remove)(instrInfoTable, orig_addr);
    if (sbInfo) {
       tl_assert(instr_enabled);
-      VG_(OSetGen_FreeNode)(instrInfoTable, sbInfo);
+      free_SB_info(sbInfo);
    } else {
       tl_assert(!instr_enabled);
    }
@@ -2215,8 +5630,32 @@ void cg_discard_superblock_info ( Addr orig_addr64, VexGuestExtents vge )
 /*--- Command line processing                                      ---*/
 /*--------------------------------------------------------------------*/
 
+// --sim-range=<start>:<len>, each a decimal or 0x-prefixed hex number.
+static Bool parse_sim_range(const HChar* val)
+{
+   HChar* end;
+   ULong  start, len;
+
+   if (val[0] == '0' && (val[1] == 'x' || val[1] == 'X'))
+      start = VG_(strtoull16)(val, &end);
+   else
+      start = VG_(strtoull10)(val, &end);
+   if (end == val || *end != ':')
+      return False;
+   val = end + 1;
+   if (val[0] == '0' && (val[1] == 'x' || val[1] == 'X'))
+      len = VG_(strtoull16)(val, &end);
+   else
+      len = VG_(strtoull10)(val, &end);
+   if (end == val || *end != '\0' || len == 0 || start + len < start)
+      return False;
+   return add_sim_range(start, len);
+}
+
 static Bool cg_process_cmd_line_option(const HChar* arg)
 {
+   const HChar* tmp_str;
+
    if (VG_(str_clo_cache_opt)(arg,
                               &clo_I1_cache,
                               &clo_D1_cache,
@@ -2228,6 +5667,56 @@ static Bool cg_process_cmd_line_option(const HChar* arg)
    else if VG_BOOL_CLO(arg, "--cache-sim",  clo_cache_sim)  {}
    else if VG_BOOL_CLO(arg, "--branch-sim", clo_branch_sim) {}
    else if VG_BOOL_CLO(arg, "--instr-at-start", clo_instr_at_start) {}
+   else if VG_XACT_CLO(arg, "--miss-classify=none",
+                            clo_miss_classify, MissClassifyNone) {}
+   else if VG_XACT_CLO(arg, "--miss-classify=d1",
+                            clo_miss_classify, MissClassifyD1) {}
+   else if VG_XACT_CLO(arg, "--miss-classify=all",
+                            clo_miss_classify, MissClassifyAll) {}
+   else if VG_STR_CLO( arg, "--load-cache-state", clo_load_cache_state) {}
+   else if VG_STR_CLO( arg, "--save-cache-state", clo_save_cache_state) {}
+   else if VG_BOOL_CLO(arg, "--per-thread", clo_per_thread) {}
+   else if VG_XACT_CLO(arg, "--output-format=text",
+                            clo_binary_output, False) {}
+   else if VG_XACT_CLO(arg, "--output-format=binary",
+                            clo_binary_output, True) {}
+   else if VG_BINT_CLO(arg, "--interval", clo_interval,
+                            0, 1000000000000000000LL) {}
+   else if VG_STR_CLO( arg, "--interval-out-file", clo_interval_out_file) {}
+   else if VG_BINT_CLO(arg, "--evict-pairs", clo_evict_pairs, 0, 1 << 20) {}
+   else if VG_STR_CLO( arg, "--evict-out-file", clo_evict_out_file) {}
+   else if VG_BOOL_CLO(arg, "--access-patterns", clo_access_patterns) {}
+   else if VG_BINT_CLO(arg, "--miss-samples", clo_miss_samples, 0, 1 << 20) {}
+   else if VG_STR_CLO( arg, "--miss-samples-out-file", clo_samples_out_file) {}
+   else if VG_STR_CLO( arg, "--access-patterns-out-file",
+                            clo_patterns_out_file) {}
+   else if VG_STR_CLO( arg, "--region-out-file", clo_region_out_file) {}
+   else if VG_BOOL_CLO(arg, "--batch-sim", clo_batch_sim) {}
+   else if VG_STR_CLO( arg, "--sim-daemon", clo_sim_daemon) {}
+   else if VG_STR_CLO( arg, "--record-trace", clo_record_trace) {}
+   else if VG_XACT_CLO(arg, "--LL-page-map=identity",
+                            clo_LL_map.page_map, LLPageIdentity) {}
+   else if VG_XACT_CLO(arg, "--LL-page-map=random",
+                            clo_LL_map.page_map, LLPageRandom) {}
+   else if VG_XACT_CLO(arg, "--LL-page-map=colored",
+                            clo_LL_map.page_map, LLPageColored) {}
+   else if VG_BINT_CLO(arg, "--LL-page-size", clo_LL_map.page_size,
+                            1, 1 << 30) {}
+   else if VG_BINT_CLO(arg, "--LL-page-seed", clo_LL_map.seed,
+                            0, 0x7FFFFFFFFFFFFFFFLL) {}
+   else if VG_BINT_CLO(arg, "--LL-slices", clo_LL_map.slices,
+                            1, LL_MAX_SLICES) {}
+   else if VG_STR_CLO( arg, "--sim-range", tmp_str) {
+      if (!parse_sim_range(tmp_str))
+         VG_(fmsg_bad_option)(arg, "expected <start>:<len>, at most %d "
+                              "of them\n", SIM_MAX_RANGES);
+   }
+   else if VG_STR_CLO( arg, "--sim-fn", tmp_str) {
+      if (!sim_fns)
+         sim_fns = VG_(newXA)(VG_(malloc), "cg.main.pclo.1", VG_(free),
+                              sizeof(HChar*));
+      VG_(addToXA)(sim_fns, &tmp_str);
+   }
    else
       return False;
 
@@ -2243,6 +5732,65 @@ static void cg_print_usage(void)
 "    --cache-sim=yes|no               collect cache stats? [no]\n"
 "    --branch-sim=yes|no              collect branch prediction stats? [no]\n"
 "    --instr-at-start=yes|no          instrument at start? [yes]\n"
+"    --miss-classify=none|d1|all      classify misses as compulsory/conflict/\n"
+"                                     capacity in no cache, D1 only, or D1 and LL [all]\n"
+"    --load-cache-state=<file>        start with the cache state saved in <file>\n"
+"    --save-cache-state=<file>        save the cache state to <file> at exit\n"
+"    --per-thread=yes|no              also write per-thread output files,\n"
+"                                     suffixed .t1, .t2, ... [no]\n"
+"    --output-format=text|binary      write the cachegrind.out and cacheusage\n"
+"                                     files as text, or everything as one\n"
+"                                     binary file (see cg_bin2text) [text]\n"
+"    --interval=<n>                   append the per-function counts of every\n"
+"                                     <n> instructions to a time series;\n"
+"                                     0 to disable [0]\n"
+"    --interval-out-file=<file>       time series file name\n"
+"                                     [cachegrind.intervals.%%p]\n"
+"    --region-out-file=<file>         region summary file name, written if\n"
+"                                     the client uses CACHEGRIND_REGION_BEGIN\n"
+"                                     [cachegrind.regions.%%p]\n"
+"    --evict-pairs=<k>                count which lines' misses evict which\n"
+"                                     lines' data, keeping the heaviest of\n"
+"                                     the D1 and LL pairs in <k> counters\n"
+"                                     each; 0 to disable [0]\n"
+"    --evict-out-file=<file>          eviction graph file name\n"
+"                                     [cachegrind.evictions.%%p]\n"
+"    --access-patterns=yes|no         class each memory instruction's\n"
+"                                     accesses as constant, sequential,\n"
+"                                     fixed-stride or irregular [no]\n"
+"    --access-patterns-out-file=<file>\n"
+"                                     access pattern file name\n"
+"                                     [cachegrind.patterns.%%p]\n"
+"    --miss-samples=<k>               keep the <k> instructions that miss\n"
+"                                     D1 most, and the <k> that miss LL\n"
+"                                     most, with samples of the addresses\n"
+"                                     they missed on; 0 to disable [0]\n"
+"    --miss-samples-out-file=<file>   miss sample file name, in the layout\n"
+"                                     of perf script [cachegrind.samples.%%p]\n"
+"    --batch-sim=yes|no               log cache accesses to a buffer and\n"
+"                                     simulate them in batches [no]\n"
+"    --sim-daemon=<prog>              simulate the caches in a separate\n"
+"                                     process, <prog> (see cg_simd.c);\n"
+"                                     implies --batch-sim=yes; not with\n"
+"                                     --evict-pairs, --miss-samples or\n"
+"                                     --load/save-cache-state\n"
+"    --record-trace=<file>            write every cache access to <file>,\n"
+"                                     for cg_replay; implies --batch-sim=yes\n"
+"    --LL-page-map=identity|random|colored\n"
+"                                     how virtual pages map to the frames\n"
+"                                     that index LL: identity (frame =\n"
+"                                     page), a random permutation, or\n"
+"                                     colour-preserving [identity]\n"
+"    --LL-page-size=<n>               page size for --LL-page-map [4096]\n"
+"    --LL-page-seed=<n>               seed for --LL-page-map [0]\n"
+"    --LL-slices=<n>                  LL slices, picked by the Intel slice\n"
+"                                     hash; 1, 2, 4 or 8 [1]\n"
+"    --sim-range=<start>:<len>        only simulate the data accesses to these\n"
+"                                     bytes (and to those of any other\n"
+"                                     --sim-range); the rest are only counted\n"
+"    --sim-fn=<glob>                  only simulate the data accesses of the\n"
+"                                     functions matching <glob> (and those\n"
+"                                     of any other --sim-fn)\n"
    );
    VG_(print_cache_clo_opts)();
 }
@@ -2291,6 +5839,9 @@ static Bool cg_handle_client_request(ThreadId tid, UWord *args, UWord *ret)
        && VG_USERREQ__GDB_MONITOR_COMMAND != args[0])
       return False;
 
+   // All of them look at or change the counts or the caches.
+   sync_accesses();
+
    switch(args[0]) {
    case VG_USERREQ__CG_START_INSTRUMENTATION:
       set_instr_enabled(True);
@@ -2302,6 +5853,79 @@ static Bool cg_handle_client_request(ThreadId tid, UWord *args, UWord *ret)
       *ret = 0;
       return True;
 
+   case VG_USERREQ__CG_SAVE_CACHE_STATE:
+   case VG_USERREQ__CG_LOAD_CACHE_STATE: {
+      const HChar* file = (const HChar*)args[1];
+      Bool ok;
+      if (!clo_cache_sim) {
+         VG_(dmsg)("warning: cache state requests need --cache-sim=yes\n");
+         *ret = 1;
+         return True;
+      }
+      if (clo_sim_daemon) {
+         VG_(dmsg)("warning: cache state requests don't work with "
+                   "--sim-daemon\n");
+         *ret = 1;
+         return True;
+      }
+      ok = args[0] == VG_USERREQ__CG_SAVE_CACHE_STATE
+              ? cachesim_save_state(file)
+              : cachesim_load_state(file);
+      *ret = ok ? 0 : 1;
+      return True;
+   }
+
+   case VG_USERREQ__CG_DUMP_STATS:
+   case VG_USERREQ__CG_DUMP_STATS_AND_ZERO: {
+      // Translations and cache contents are untouched;  lines still in
+      // the cache aren't counted in the eviction bins until they leave.
+      HChar* dump = dump_name((const HChar*)args[1]);
+      write_all_CC_tables(dump);
+      VG_(free)(dump);
+      if (args[0] == VG_USERREQ__CG_DUMP_STATS_AND_ZERO)
+         zero_CC_table();
+      *ret = 0;
+      return True;
+   }
+
+   case VG_USERREQ__CG_ZERO_STATS:
+      zero_CC_table();
+      *ret = 0;
+      return True;
+
+   case VG_USERREQ__CG_REGION_BEGIN:
+      region_begin(tid, (const HChar*)args[1]);
+      *ret = 0;
+      return True;
+
+   case VG_USERREQ__CG_REGION_END:
+      if (region_end(tid)) {
+         *ret = 0;
+      } else {
+         VG_(dmsg)("warning: CACHEGRIND_REGION_END with no region open\n");
+         *ret = 1;
+      }
+      return True;
+
+   case VG_USERREQ__CG_SIM_RANGE_ADD:
+      if (add_sim_range(args[1], args[2])) {
+         *ret = 0;
+      } else {
+         VG_(dmsg)("warning: CACHEGRIND_SIM_RANGE_ADD:  more than %d ranges\n",
+                   SIM_MAX_RANGES);
+         *ret = 1;
+      }
+      return True;
+
+   case VG_USERREQ__CG_SIM_RANGE_REMOVE:
+      if (remove_sim_range(args[1], args[2])) {
+         *ret = 0;
+      } else {
+         VG_(dmsg)("warning: CACHEGRIND_SIM_RANGE_REMOVE:  no such range\n");
+         *ret = 1;
+      }
+      return True;
+
    default:
       VG_(message)(Vg_UserMsg,
                    "Warning: unknown cachegrind client request code %llx\n",
@@ -2339,27 +5963,38 @@ static void cg_pre_clo_init(void)
                                    cg_print_usage,
                                    cg_print_debug_usage);
    VG_(needs_client_requests)(cg_handle_client_request);
+   VG_(needs_syscall_wrapper)(cg_pre_syscall, cg_post_syscall);
+
+   VG_(track_start_client_code)  (cg_start_client_code);
+   VG_(track_pre_thread_ll_exit) (cg_pre_thread_ll_exit);
 }
 
 static void cg_post_clo_init(void)
 {
    cache_t I1c, D1c, LLc; 
 
-   CC_table =
-      VG_(OSetGen_Create)(offsetof(LineCC, loc),
-                          cmp_CodeLoc_LineCC,
-                          VG_(malloc), "cg.main.cpci.1",
-                          VG_(free));
-   instrInfoTable =
-      VG_(OSetGen_Create)(/*keyOff*/0,
-                          NULL,
-                          VG_(malloc), "cg.main.cpci.2",
-                          VG_(free));
-   stringTable =
-      VG_(OSetGen_Create)(/*keyOff*/0,
-                          stringCmp,
-                          VG_(malloc), "cg.main.cpci.3",
-                          VG_(free));
+   CC_table = VG_(HT_construct)("cg.main.cpci.1");
+   instrInfoTable = VG_(HT_construct)("cg.main.cpci.2");
+   stringTable = VG_(HT_construct)("cg.main.cpci.3");
+   pathTable   = VG_(HT_construct)("cg.main.cpci.8");
+
+   if (clo_interval > 0) {
+      interval_fns  = VG_(HT_construct)("cg.main.cpci.5");
+      interval_next = clo_interval;
+   }
+
+   all_threads      = VG_(newXA)(VG_(malloc), "cg.main.cpci.4",
+                                 VG_(free), sizeof(ThreadInfo*));
+   all_shards       = VG_(newXA)(VG_(malloc), "cg.main.cpci.6",
+                                 VG_(free), sizeof(CCShard*));
+   no_region_shards = VG_(newXA)(VG_(malloc), "cg.main.cpci.7",
+                                 VG_(free), sizeof(CCShard*));
+
+   // Counter columns exist only for the features that are on.
+   cc_col_on[CCColIr]     = !clo_cache_sim;
+   cc_col_on[CCColCache]  = clo_cache_sim;
+   cc_col_on[CCColEvict]  = clo_cache_sim;
+   cc_col_on[CCColBranch] = clo_branch_sim;
 
    if (clo_cache_sim) {
       VG_(post_clo_init_configure_caches)(&I1c, &D1c, &LLc,
@@ -2387,7 +6022,65 @@ static void cg_post_clo_init(void)
          VG_(exit)(1);
       }
 
-      cachesim_initcaches(I1c, D1c, LLc);
+      {
+         const HChar* err = cachesim_set_LL_map(&clo_LL_map, LLc);
+         if (err) {
+            VG_(umsg)("Cachegrind: cannot continue: %s.\n", err);
+            VG_(exit)(1);
+         }
+      }
+      cachesim_initcaches(I1c, D1c, LLc, clo_miss_classify);
+      d_helpers = &d_cache_helpers[clo_miss_classify];
+
+      if (clo_sim_daemon) {
+         // The daemon has the caches, and doesn't report evictions or
+         // misses one by one.
+         const HChar* opt = clo_load_cache_state ? "--load-cache-state"
+                          : clo_save_cache_state ? "--save-cache-state"
+                          : clo_evict_pairs      ? "--evict-pairs"
+                          : clo_miss_samples     ? "--miss-samples"
+                          : NULL;
+         if (opt) {
+            VG_(umsg)("Cachegrind: cannot continue: %s can't be used "
+                      "with --sim-daemon.\n", opt);
+            VG_(exit)(1);
+         }
+         clo_batch_sim = True;
+         d_helpers     = &sim_daemon_helpers;
+         start_sim_daemon(I1c, D1c, LLc);
+      }
+      if (clo_record_trace) {
+         clo_batch_sim = True;
+         start_trace();
+      }
+      if (clo_evict_pairs)
+         cachesim_init_evict_graph(clo_evict_pairs);
+      if (clo_access_patterns)
+         patternTable = VG_(HT_construct)("cg.main.cpci.9");
+      if (sim_fns)
+         sim_fn_memo = VG_(HT_construct)("cg.main.cpci.10");
+      if (clo_miss_samples) {
+         init_miss_profile(&miss_D1, clo_miss_samples);
+         init_miss_profile(&miss_LL, clo_miss_samples);
+      }
+
+      if (clo_load_cache_state && !cachesim_load_state(clo_load_cache_state))
+         VG_(umsg)("       ... so starting with cold caches.\n");
+   } else {
+      // Nothing to batch:  without cache simulation the fetch helpers
+      // only count.
+      clo_batch_sim    = False;
+      clo_sim_daemon   = NULL;
+      clo_evict_pairs  = 0;
+      clo_miss_samples = 0;
+      if (clo_access_patterns) {
+         VG_(umsg)("warning: --access-patterns needs --cache-sim=yes\n");
+         clo_access_patterns = False;
+      }
+      if (clo_record_trace) {
+         VG_(umsg)("warning: --record-trace needs --cache-sim=yes\n");
+         clo_record_trace = NULL;
+      }
    }
 
    // When instrumentation client requests are enabled, we start with
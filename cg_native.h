@@ -0,0 +1,56 @@
+/*--------------------------------------------------------------------*/
+/*--- Valgrind basic types for native helper programs  cg_native.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* The post-processing programs (cg_bin2text etc.) are ordinary C
+   programs built against libc, not against the Valgrind core.  They share
+   format headers with the tool, which are written in terms of
+   pub_tool_basics.h types;  this provides those types on their own. */
+
+#ifndef __CG_NATIVE_H
+#define __CG_NATIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned char  UChar;
+typedef char           HChar;
+typedef uint16_t       UShort;
+typedef int32_t        Int;
+typedef uint32_t       UInt;
+typedef long long          Long;
+typedef unsigned long long ULong;
+typedef intptr_t       Word;
+typedef uintptr_t      UWord;
+typedef uintptr_t      Addr;
+typedef size_t         SizeT;
+typedef unsigned char  Bool;
+
+#define True   ((Bool)1)
+#define False  ((Bool)0)
+
+#endif   // __CG_NATIVE_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                              cg_native.h ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,122 @@
+/*--------------------------------------------------------------------*/
+/*--- The simulator outside Valgrind                cg_nativesim.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Native programs that run the tool's own simulator (cg_simd etc.)
+   #include cg_helper.c and cg_sim.c after this, just as cg_main.c does.
+   It maps the few core services those two use onto libc, so that the
+   simulation code is shared, not copied. */
+
+#ifndef __CG_NATIVESIM_H
+#define __CG_NATIVESIM_H
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cg_native.h"
+
+#define VG_(x)  cgn_##x
+
+// Native programs write no causage.dbg into the directory they run in.
+#define CG_SIM_CU_LOG  NULL
+
+#define tl_assert(e)   assert(e)
+#define LIKELY(x)      __builtin_expect(!!(x), 1)
+#define UNLIKELY(x)    __builtin_expect(!!(x), 0)
+
+#define VKI_O_CREAT    O_CREAT
+#define VKI_O_TRUNC    O_TRUNC
+#define VKI_O_WRONLY   O_WRONLY
+#define VKI_S_IRUSR    0400
+#define VKI_S_IWUSR    0200
+
+typedef FILE VgFile;
+
+// As in cg-arch.h.
+typedef struct {
+   Int size;        // bytes
+   Int assoc;
+   Int line_size;   // bytes
+} cache_t;
+
+static void cgn_tool_panic(const HChar* str)
+{
+   fprintf(stderr, "cachegrind simulator: the 'impossible' happened:\n   %s\n",
+           str);
+   abort();
+}
+
+static void* cgn_malloc(const HChar* cc, SizeT n)
+{
+   void* p = malloc(n);
+   if (!p) cgn_tool_panic(cc);
+   return p;
+}
+
+static void* cgn_calloc(const HChar* cc, SizeT n, SizeT size)
+{
+   void* p = calloc(n, size);
+   if (!p) cgn_tool_panic(cc);
+   return p;
+}
+
+static void* cgn_realloc(const HChar* cc, void* p, SizeT n)
+{
+   p = realloc(p, n);
+   if (!p) cgn_tool_panic(cc);
+   return p;
+}
+
+// Only ever used for writing, by the simulator.
+static VgFile* cgn_fopen(const HChar* name, Int flags, Int mode)
+{
+   (void)flags; (void)mode;
+   return fopen(name, "w");
+}
+
+// Like the core's, -1 if 'x' isn't a power of two.
+static Int cgn_log2(UInt x)
+{
+   Int i;
+   for (i = 0; i < 32; i++) {
+      if ((1U << i) == x) return i;
+   }
+   return -1;
+}
+
+// The tool's messages go to the Valgrind log, which is stderr by default.
+#define cgn_printf(...)  fprintf(stderr, __VA_ARGS__)
+#define cgn_fprintf      fprintf
+#define cgn_sprintf      sprintf
+#define cgn_strcmp       strcmp
+#define cgn_fclose       fclose
+#define cgn_exit         exit
+
+#endif   // __CG_NATIVESIM_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                           cg_nativesim.h ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,794 @@
+/*--------------------------------------------------------------------*/
+/*--- Reader for Cachegrind's output files            cg_outread.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cg_outread.h"
+
+const char* cgo_prog = "cg_outread";
+
+const char* const cgo_level_names[2] = { "D1", "LL" };
+
+const char* const cgo_usage_names[6] = {
+   "Access#", "Miss#", "Comp#", "Conf#", "Cap#", "Cacheline#"
+};
+
+char* cgo_col_names[CGO_MAX_COLS];
+Int   cgo_col_slot[CGO_MAX_COLS];
+UInt  cgo_n_cols, cgo_n_slots, cgo_n_sets = 1;
+
+char* cgo_descs[3];
+char* cgo_cmd;
+
+void cgo_fail(const char* fmt, ...)
+{
+   va_list vargs;
+
+   va_start(vargs, fmt);
+   fprintf(stderr, "%s: ", cgo_prog);
+   vfprintf(stderr, fmt, vargs);
+   fprintf(stderr, "\n");
+   va_end(vargs);
+   exit(1);
+}
+
+void* cgo_realloc(void* p, size_t n)
+{
+   p = realloc(p, n);
+   if (!p && n)
+      cgo_fail("out of memory");
+   return p;
+}
+
+char* cgo_strndup(const char* s, size_t n)
+{
+   char* d = cgo_realloc(NULL, n + 1);
+   memcpy(d, s, n);
+   d[n] = '\0';
+   return d;
+}
+
+/*------------------------------------------------------------*/
+/*--- Strings and columns                                  ---*/
+/*------------------------------------------------------------*/
+
+static UInt hash_bytes(const char* p, size_t n)
+{
+   ULong h = 0xcbf29ce484222325ULL;
+
+   while (n--)
+      h = (h ^ (UChar)*p++) * 0x100000001b3ULL;
+   return (UInt)(h ^ (h >> 32));
+}
+
+static void grow_names(CgoNames* t)
+{
+   UInt n = t->slots ? 2 * (t->mask + 1) : 1024, i, j;
+
+   free(t->slots);
+   t->slots = cgo_realloc(NULL, n * sizeof(UInt));
+   memset(t->slots, 0, n * sizeof(UInt));
+   t->mask = n - 1;
+   for (i = 0; i < t->n; i++) {
+      j = hash_bytes(t->strs[i], strlen(t->strs[i])) & t->mask;
+      while (t->slots[j])
+         j = (j + 1) & t->mask;
+      t->slots[j] = i + 1;
+   }
+}
+
+UInt cgo_intern(CgoNames* t, const char* p, size_t n)
+{
+   UInt i;
+
+   if (!t->slots || 2 * (t->n + 1) > t->mask + 1)
+      grow_names(t);
+   for (i = hash_bytes(p, n) & t->mask; t->slots[i];
+        i = (i + 1) & t->mask) {
+      const char* s = t->strs[t->slots[i] - 1];
+      if (strncmp(s, p, n) == 0 && s[n] == '\0')
+         return t->slots[i] - 1;
+   }
+   if (t->n == t->cap) {
+      t->cap  = t->cap ? 2 * t->cap : 1024;
+      t->strs = cgo_realloc(t->strs, t->cap * sizeof(char*));
+   }
+   t->strs[t->n] = cgo_strndup(p, n);
+   t->slots[i]   = ++t->n;
+   return t->n - 1;
+}
+
+Int cgo_find_col(const char* name)
+{
+   UInt c;
+
+   for (c = 0; c < cgo_n_cols; c++) {
+      if (strcmp(cgo_col_names[c], name) == 0)
+         return c;
+   }
+   return -1;
+}
+
+Int cgo_level_col(UInt l, const char* name)
+{
+   char buf[64];
+
+   snprintf(buf, sizeof(buf), "%s:%s", cgo_level_names[l], name);
+   return cgo_find_col(buf);
+}
+
+static UInt add_col(const char* prefix, const char* name, size_t n)
+{
+   char buf[256];
+   Int  c;
+
+   snprintf(buf, sizeof(buf), "%s%.*s", prefix, (int)n, name);
+   if ((c = cgo_find_col(buf)) >= 0)
+      return c;
+   if (cgo_n_cols == CGO_MAX_COLS)
+      cgo_fail("more than %d columns", CGO_MAX_COLS);
+   cgo_col_names[cgo_n_cols] = cgo_strndup(buf, strlen(buf));
+   cgo_col_slot[cgo_n_cols]  = -1;
+   return cgo_n_cols++;
+}
+
+Int cgo_need_col(Int c)
+{
+   if (c < 0)
+      return -1;
+   if (cgo_col_slot[c] < 0)
+      cgo_col_slot[c] = cgo_n_slots++;
+   return cgo_col_slot[c];
+}
+
+/*------------------------------------------------------------*/
+/*--- Rows                                                 ---*/
+/*------------------------------------------------------------*/
+
+static UInt hash_func(UInt file, UInt fn)
+{
+   ULong h = ((ULong)file << 32) ^ fn;
+
+   // The murmur3 finaliser:  the ids are small and dense.
+   h ^= h >> 33;
+   h *= 0xff51afd7ed558ccdULL;
+   h ^= h >> 33;
+   h *= 0xc4ceb9fe1a85ec53ULL;
+   h ^= h >> 33;
+   return (UInt)h;
+}
+
+static void grow_funcs(CgoFuncs* t)
+{
+   UInt n = t->slots ? 2 * (t->mask + 1) : 4096, i, j;
+
+   free(t->slots);
+   t->slots = cgo_realloc(NULL, n * sizeof(UInt));
+   memset(t->slots, 0, n * sizeof(UInt));
+   t->mask = n - 1;
+   for (i = 0; i < t->n; i++) {
+      j = hash_func(t->f[i]->file, t->f[i]->fn) & t->mask;
+      while (t->slots[j])
+         j = (j + 1) & t->mask;
+      t->slots[j] = i + 1;
+   }
+}
+
+CgoFunc* cgo_get_func(CgoFuncs* t, UInt file, UInt fn)
+{
+   CgoFunc* f;
+   UInt     i;
+
+   if (!t->slots || 2 * (t->n + 1) > t->mask + 1)
+      grow_funcs(t);
+   for (i = hash_func(file, fn) & t->mask; t->slots[i];
+        i = (i + 1) & t->mask) {
+      f = t->f[t->slots[i] - 1];
+      if (f->fn == fn && f->file == file) {
+         f->next = 0;
+         return f;
+      }
+   }
+   if (t->n == t->cap) {
+      t->cap = t->cap ? 2 * t->cap : 1024;
+      t->f   = cgo_realloc(t->f, t->cap * sizeof(CgoFunc*));
+   }
+   f = cgo_realloc(NULL, sizeof(CgoFunc));
+   memset(f, 0, sizeof(CgoFunc));
+   f->file = file;
+   f->fn   = fn;
+   t->f[t->n]  = f;
+   t->slots[i] = ++t->n;
+   return f;
+}
+
+void cgo_free_funcs(CgoFuncs* t)
+{
+   UInt i;
+
+   for (i = 0; i < t->n; i++) {
+      free(t->f[i]->lines);
+      free(t->f[i]->vals);
+      free(t->f[i]->sum);
+      free(t->f[i]);
+   }
+   for (i = 0; i < t->names.n; i++)
+      free(t->names.strs[i]);
+   free(t->names.strs);
+   free(t->names.slots);
+   free(t->f);
+   free(t->slots);
+   memset(t, 0, sizeof(*t));
+}
+
+ULong* cgo_func_line(CgoFunc* f, Int line)
+{
+   UInt   c = f->next;
+   size_t w = cgo_row_size();
+
+   if (c > 0 && f->lines[c - 1] >= line) {
+      // Out of order, or a line given twice:  search.
+      UInt lo = 0, hi = c - 1;
+      while (lo < hi) {
+         UInt mid = (lo + hi) / 2;
+         if (f->lines[mid] < line) lo = mid + 1;
+         else                      hi = mid;
+      }
+      c = lo;
+   }
+   while (c < f->n && f->lines[c] < line)
+      c++;
+   if (c == f->n || f->lines[c] != line) {
+      if (f->n == f->cap) {
+         f->cap   = f->cap ? 2 * f->cap : 16;
+         f->lines = cgo_realloc(f->lines, f->cap * sizeof(Int));
+         f->vals  = cgo_realloc(f->vals, f->cap * w * sizeof(ULong));
+      }
+      memmove(&f->lines[c + 1], &f->lines[c], (f->n - c) * sizeof(Int));
+      memmove(&f->vals[(c + 1) * w], &f->vals[c * w],
+              (f->n - c) * w * sizeof(ULong));
+      f->lines[c] = line;
+      memset(&f->vals[c * w], 0, w * sizeof(ULong));
+      f->n++;
+   }
+   f->next = c + 1;
+   return &f->vals[c * w];
+}
+
+/*------------------------------------------------------------*/
+/*--- Headers                                              ---*/
+/*------------------------------------------------------------*/
+
+static Bool starts(const UChar* p, SizeT len, const char* s)
+{
+   SizeT n = strlen(s);
+   return len >= n && memcmp(p, s, n) == 0;
+}
+
+static const UChar* skip_blanks(const UChar* p, const UChar* end)
+{
+   while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+      p++;
+   return p;
+}
+
+// Whether the desc: lines have been taken, from the first input.
+static Bool got_descs;
+
+// Add a column for each name in [p, end), as 'prefix'<name>.
+static void add_fields(CgoInput* in, const char* prefix,
+                       const UChar* p, const UChar* end)
+{
+   while ((p = skip_blanks(p, end)) < end) {
+      const UChar* q = p;
+      while (q < end && *q != ' ' && *q != '\t' && *q != '\r')
+         q++;
+      if (in->n_fields == CGO_MAX_COLS)
+         cgo_fail("%s: too many columns", in->name);
+      in->field_col[in->n_fields++] = add_col(prefix, (const char*)p, q - p);
+      p = q;
+   }
+}
+
+// A cacheusage file given without -d or -l:  go by its name.
+static CgoKind usage_kind_of(const char* name)
+{
+   const char* base = strrchr(name, '/');
+
+   base = base ? base + 1 : name;
+   if (strstr(base, ".d1."))
+      return CgoUsageD1;
+   if (strstr(base, ".ll."))
+      return CgoUsageLL;
+   cgo_fail("%s: is a cacheusage file;  give it with -d or -l", name);
+}
+
+static void read_text_header(CgoInput* in)
+{
+   const UChar *p = in->base, *end = p + in->size;
+   Bool  first = !got_descs;
+   UInt  n_descs = 0;
+
+   got_descs = True;
+   while (p < end) {
+      const UChar* nl   = memchr(p, '\n', end - p);
+      const UChar* eol  = nl ? nl : end;
+      const UChar* next = nl ? nl + 1 : end;
+      SizeT len = eol - p;
+
+      if (starts(p, len, "desc: ")) {
+         if (first && n_descs < 3)
+            cgo_descs[n_descs++] = cgo_strndup((const char*)p + 6, len - 6);
+      } else if (starts(p, len, "cmd: ")) {
+         if (!cgo_cmd)
+            cgo_cmd = cgo_strndup((const char*)p + 5, len - 5);
+      } else if (starts(p, len, "events:")) {
+         if (in->kind != CgoCachegrind)
+            cgo_fail("%s: is not a cacheusage file", in->name);
+         add_fields(in, "", p + 7, eol);
+         in->body = next;
+         return;
+      } else if (starts(p, len, "bins:")) {
+         if (in->kind == CgoCachegrind)
+            in->kind = usage_kind_of(in->name);
+         add_fields(in, in->kind == CgoUsageD1 ? "D1:" : "LL:", p + 5, eol);
+         in->body = next;
+         return;
+      } else if (skip_blanks(p, eol) != eol) {
+         break;
+      }
+      p = next;
+   }
+   cgo_fail("%s: no events: or bins: line", in->name);
+}
+
+static void read_binary_header(CgoInput* in)
+{
+   const CgbHeader* h = in->bin.hdr;
+   char  bin_name[16];
+   UInt  c, l, i;
+
+   if (in->kind != CgoCachegrind)
+      cgo_fail("%s: binary files have both levels;  "
+               "give it without -d or -l", in->name);
+   in->kind = CgoBinary;
+   if (!got_descs) {
+      static const char* const caches[3] = { "I1", "D1", "LL" };
+      got_descs = True;
+      for (i = 0; i < 3; i++) {
+         const char* d = cgb_string(&in->bin, h->desc_str[i]);
+         char buf[256];
+         if (!d)
+            continue;
+         // As on the text files' desc: lines.
+         snprintf(buf, sizeof(buf), "%s cache:         %s", caches[i], d);
+         cgo_descs[i] = cgo_strndup(buf, strlen(buf));
+      }
+   }
+   if (!cgo_cmd && cgb_string(&in->bin, h->cmd_str)) {
+      const char* c = cgb_string(&in->bin, h->cmd_str);
+      cgo_cmd = cgo_strndup(c, strlen(c));
+   }
+
+   for (c = 0; c < CGB_N_COLS; c++) {
+      const char* name = cgb_col_name(c);
+      in->bin_col[c] = c < CGB_EvD1_1 && cgb_has_col(&in->bin, c)
+                       ? (Int)add_col("", name, strlen(name)) : -1;
+   }
+   for (l = 0; l < 2; l++) {
+      char prefix[4];
+      snprintf(prefix, sizeof(prefix), "%s:", cgo_level_names[l]);
+      for (i = 0; i < 6 + CGB_N_BINS; i++) {
+         in->usage_col[l][i] = -1;
+         if (!(h->flags & CGB_FLAG_CACHE_SIM))
+            continue;
+         if (i < 6) {
+            in->usage_col[l][i] = add_col(prefix, cgo_usage_names[i],
+                                          strlen(cgo_usage_names[i]));
+         } else {
+            snprintf(bin_name, sizeof(bin_name), "%u-words", i - 5);
+            in->usage_col[l][i] = add_col(prefix, bin_name,
+                                          strlen(bin_name));
+         }
+      }
+   }
+}
+
+void cgo_open(CgoInput* in, const char* name, CgoKind kind, UInt set)
+{
+   struct stat st;
+   int fd;
+
+   memset(in, 0, sizeof(*in));
+   in->name = name;
+   in->kind = kind;
+   in->set  = set;
+   fd = open(name, O_RDONLY);
+   if (fd < 0 || fstat(fd, &st) != 0)
+      cgo_fail("%s: can't open file", name);
+   in->size = st.st_size;
+   if (in->size >= 8) {
+      HChar magic[8];
+      if (pread(fd, magic, 8, 0) == 8
+          && memcmp(magic, CGB_MAGIC, 8) == 0) {
+         const char* err;
+         close(fd);
+         if (cgb_open(&in->bin, name, &err) != 0)
+            cgo_fail("%s: %s", name, err);
+         read_binary_header(in);
+         return;
+      }
+   }
+   if (in->size > 0) {
+      void* p = mmap(NULL, in->size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED)
+         cgo_fail("%s: can't map file", name);
+      madvise(p, in->size, MADV_SEQUENTIAL);
+      in->base = p;
+   }
+   close(fd);
+   read_text_header(in);
+}
+
+/*------------------------------------------------------------*/
+/*--- Bodies                                               ---*/
+/*------------------------------------------------------------*/
+
+// Stands for the file or function in force at the start of a chunk,
+// which is only known once the chunk before it has been read.
+#define INHERITED  0xFFFFFFFFU
+
+// Text bodies are split into chunks of at least this many bytes.
+#define CHUNK_MIN  (16 << 20)
+
+// The slot, in set 'set's part of a row, of column 'c', or -1.
+static Int set_slot(UInt set, Int c)
+{
+   return c >= 0 && cgo_col_slot[c] >= 0
+          ? (Int)(set * cgo_n_slots + cgo_col_slot[c]) : -1;
+}
+
+// Read the rows in [p, end) into 't'.  '*file' and '*fn' are the names in
+// force at the start, and are left as those at the end.  A row is a line
+// number and its counts;  trailing zero counts may be left out, as in
+// cachegrind.out.
+static void read_rows(CgoFuncs* t, const UChar* p, const UChar* end,
+                      const Int* slot, UInt n_fields, UInt* file, UInt* fn)
+{
+   CgoFunc* f = NULL;
+   UInt     i;
+
+   while (p < end) {
+      const UChar* nl   = memchr(p, '\n', end - p);
+      const UChar* eol  = nl ? nl : end;
+      const UChar* next = nl ? nl + 1 : end;
+
+      if (*p >= '0' && *p <= '9') {
+         ULong* row;
+         Int    line = 0;
+         while (p < eol && *p >= '0' && *p <= '9')
+            line = line * 10 + (*p++ - '0');
+         if (!f)
+            f = cgo_get_func(t, *file, *fn);
+         row = cgo_func_line(f, line);
+         for (i = 0; i < n_fields; i++) {
+            ULong v = 0;
+            p = skip_blanks(p, eol);
+            if (p == eol || *p < '0' || *p > '9')
+               break;
+            while (p < eol && *p >= '0' && *p <= '9')
+               v = v * 10 + (*p++ - '0');
+            if (slot[i] >= 0)
+               row[slot[i]] += v;
+         }
+      } else if (eol - p >= 3 && p[2] == '=' && p[0] == 'f') {
+         // fi= and fe= (inlined code) change the file, but not the
+         // function, of the lines that follow.
+         if (p[1] == 'l' || p[1] == 'i' || p[1] == 'e') {
+            *file = cgo_intern(&t->names, (const char*)p + 3, eol - p - 3);
+            f     = NULL;
+         } else if (p[1] == 'n') {
+            *fn = cgo_intern(&t->names, (const char*)p + 3, eol - p - 3);
+            f   = NULL;
+         }
+      }
+      // summary: and anything else we don't know is skipped.
+      p = next;
+   }
+}
+
+static void read_binary_body(const CgoInput* in, CgoFuncs* t)
+{
+   const CgbHeader* h = in->bin.hdr;
+   Int*   lines = NULL;
+   ULong* vals  = NULL;
+   Int    bin_slot[CGB_N_COLS], usage_slot[2][6 + CGB_N_BINS];
+   UInt   max_rows = 0, b, r, c, l, i;
+
+   for (c = 0; c < CGB_N_COLS; c++)
+      bin_slot[c] = set_slot(in->set, in->bin_col[c]);
+   for (l = 0; l < 2; l++) {
+      for (i = 0; i < 6 + CGB_N_BINS; i++)
+         usage_slot[l][i] = set_slot(in->set, in->usage_col[l][i]);
+   }
+
+   for (b = 0; b < h->n_blocks; b++) {
+      const CgbIndexEntry* e = &in->bin.index[b];
+      const char* file = cgb_string(&in->bin, e->file_str);
+      const char* fn   = cgb_string(&in->bin, e->fn_str);
+      CgoFunc* func = cgo_get_func(t,
+                         cgo_intern(&t->names, file, strlen(file)),
+                         cgo_intern(&t->names, fn, strlen(fn)));
+
+      if (e->n_rows > max_rows) {
+         max_rows = e->n_rows;
+         lines = cgo_realloc(lines, max_rows * sizeof(Int));
+         vals  = cgo_realloc(vals, (size_t)max_rows * CGB_N_COLS
+                                   * sizeof(ULong));
+      }
+      if (cgb_decode_block(&in->bin, b, lines, vals) != 0)
+         cgo_fail("%s: block %u is corrupt", in->name, b);
+
+      for (r = 0; r < e->n_rows; r++) {
+         const ULong* v = &vals[(size_t)r * CGB_N_COLS];
+         ULong* row = cgo_func_line(func, lines[r]);
+
+         for (c = 0; c < CGB_N_COLS; c++) {
+            if (bin_slot[c] >= 0)
+               row[bin_slot[c]] += v[c];
+         }
+         if (!(h->flags & CGB_FLAG_CACHE_SIM))
+            continue;
+         for (l = 0; l < 2; l++) {
+            ULong ur[5 + CGB_N_BINS], u[6 + CGB_N_BINS], total = 0;
+
+            // As in the text files, which only have lines with evictions.
+            cgb_usage_row(l == 1, v, ur);
+            for (i = 0; i < CGB_N_BINS; i++) {
+               u[6 + i] = ur[5 + i];
+               total   += ur[5 + i];
+            }
+            if (!total)
+               continue;
+            memcpy(u, ur, 5 * sizeof(ULong));
+            u[5] = total;
+            for (i = 0; i < 6 + CGB_N_BINS; i++) {
+               if (usage_slot[l][i] >= 0)
+                  row[usage_slot[l][i]] += u[i];
+            }
+         }
+      }
+   }
+   free(lines);
+   free(vals);
+}
+
+// A piece of work for the pool:  a text body's chunk, or a binary file.
+typedef struct {
+   const CgoInput* in;
+   const Int*      slot;        // of the input's fields
+   const UChar*    p;
+   const UChar*    end;
+   Bool            first;       // the input's first chunk
+   CgoFuncs        t;
+   UInt            file, fn;    // at the end;  maybe INHERITED
+   Bool            done;
+} Chunk;
+
+static void read_chunk(Chunk* c)
+{
+   if (c->in->kind == CgoBinary) {
+      read_binary_body(c->in, &c->t);
+      c->file = c->fn = INHERITED;
+      return;
+   }
+   c->file = c->fn = c->first ? cgo_intern(&c->t.names, "???", 3)
+                              : INHERITED;
+   read_rows(&c->t, c->p, c->end, c->slot, c->in->n_fields,
+             &c->file, &c->fn);
+}
+
+// Chunk 'c's name 'id' in 't', given what INHERITED stands for.
+static UInt merge_name(CgoFuncs* t, const Chunk* c, UInt id, UInt inherited)
+{
+   const char* s;
+
+   if (id == INHERITED)
+      return inherited;
+   s = c->t.names.strs[id];
+   return cgo_intern(&t->names, s, strlen(s));
+}
+
+// Add chunk 'c' to 't'.  '*file' and '*fn' are the names in force at its
+// start, and are left as those at its end.
+static void merge_chunk(CgoFuncs* t, Chunk* c, UInt* file, UInt* fn)
+{
+   size_t w = cgo_row_size();
+   UInt   i, j, k;
+
+   for (i = 0; i < c->t.n; i++) {
+      const CgoFunc* src = c->t.f[i];
+      CgoFunc* dst = cgo_get_func(t, merge_name(t, c, src->file, *file),
+                                  merge_name(t, c, src->fn, *fn));
+      for (j = 0; j < src->n; j++) {
+         const ULong* v = &src->vals[j * w];
+         ULong* row = cgo_func_line(dst, src->lines[j]);
+         for (k = 0; k < w; k++)
+            row[k] += v[k];
+      }
+   }
+   *file = merge_name(t, c, c->file, *file);
+   *fn   = merge_name(t, c, c->fn, *fn);
+   cgo_free_funcs(&c->t);
+}
+
+typedef struct {
+   Chunk*          cs;
+   UInt            n, next;
+   pthread_mutex_t lock;
+   pthread_cond_t  done;
+} Pool;
+
+static void* pool_worker(void* v)
+{
+   Pool* pool = v;
+   UInt  i;
+
+   for (;;) {
+      pthread_mutex_lock(&pool->lock);
+      i = pool->next++;
+      pthread_mutex_unlock(&pool->lock);
+      if (i >= pool->n)
+         return NULL;
+      read_chunk(&pool->cs[i]);
+      pthread_mutex_lock(&pool->lock);
+      pool->cs[i].done = True;
+      pthread_cond_broadcast(&pool->done);
+      pthread_mutex_unlock(&pool->lock);
+   }
+}
+
+// How many chunks input 'in' is read in.
+static UInt n_chunks(const CgoInput* in, UInt n_threads)
+{
+   SizeT m = in->size / CHUNK_MIN;
+
+   if (in->kind == CgoBinary || m <= 1)
+      return 1;
+   return m < n_threads ? m : n_threads;
+}
+
+static void close_input(CgoInput* in)
+{
+   if (in->kind == CgoBinary)
+      cgb_close(&in->bin);
+   else if (in->base)
+      munmap((void*)in->base, in->size);
+   in->base = NULL;
+}
+
+// With one thread each input is read straight into 't'.  Otherwise big
+// text bodies are split into up to 'n_threads' chunks, and the pool's
+// threads read the chunks of all the inputs, so many small per-process
+// files are read in parallel as well as one big one.  The main thread
+// merges the chunks in order as they are done, so a chunk's first lines
+// get the names in force at the end of the one before.
+void cgo_read(CgoInput* ins, UInt n, CgoFuncs* t, UInt n_threads)
+{
+   Int*       slots;
+   Chunk*     cs;
+   Pool       pool;
+   pthread_t* threads;
+   UInt       n_cs = 0, n_workers, file = 0, fn = 0, i, j, k;
+
+   slots = cgo_realloc(NULL, (n * CGO_MAX_COLS + 1) * sizeof(Int));
+   for (i = 0; i < n; i++) {
+      for (j = 0; j < ins[i].n_fields; j++)
+         slots[i * CGO_MAX_COLS + j] = set_slot(ins[i].set,
+                                                ins[i].field_col[j]);
+      n_cs += n_chunks(&ins[i], n_threads);
+   }
+
+   if (n_threads <= 1 || n_cs <= 1) {
+      for (i = 0; i < n; i++) {
+         if (ins[i].kind == CgoBinary) {
+            read_binary_body(&ins[i], t);
+         } else if (ins[i].base) {
+            file = fn = cgo_intern(&t->names, "???", 3);
+            read_rows(t, ins[i].body, ins[i].base + ins[i].size,
+                      &slots[i * CGO_MAX_COLS], ins[i].n_fields, &file, &fn);
+         }
+         close_input(&ins[i]);
+      }
+      free(slots);
+      return;
+   }
+
+   cs = cgo_realloc(NULL, n_cs * sizeof(Chunk));
+   memset(cs, 0, n_cs * sizeof(Chunk));
+   for (i = 0, k = 0; i < n; i++) {
+      const UChar *p = ins[i].body, *end = ins[i].base + ins[i].size;
+      UInt m = n_chunks(&ins[i], n_threads);
+
+      for (j = 0; j < m; j++, k++) {
+         Chunk* c = &cs[k];
+         c->in    = &ins[i];
+         c->slot  = &slots[i * CGO_MAX_COLS];
+         c->first = j == 0;
+         if (ins[i].kind == CgoBinary || !ins[i].base)
+            continue;
+         c->p = j ? cs[k - 1].end : p;
+         if (j == m - 1) {
+            c->end = end;
+         } else {
+            const UChar* q  = p + (end - p) / m * (j + 1);
+            const UChar* nl;
+            if (q < c->p)
+               q = c->p;
+            nl = memchr(q, '\n', end - q);
+            c->end = nl ? nl + 1 : end;
+         }
+      }
+   }
+
+   pool.cs   = cs;
+   pool.n    = n_cs;
+   pool.next = 0;
+   pthread_mutex_init(&pool.lock, NULL);
+   pthread_cond_init(&pool.done, NULL);
+   n_workers = n_threads < n_cs ? n_threads : n_cs;
+   threads = cgo_realloc(NULL, n_workers * sizeof(pthread_t));
+   for (i = 0; i < n_workers; i++) {
+      if (pthread_create(&threads[i], NULL, pool_worker, &pool) != 0)
+         cgo_fail("can't start a thread");
+   }
+   for (k = 0; k < n_cs; k++) {
+      pthread_mutex_lock(&pool.lock);
+      while (!cs[k].done)
+         pthread_cond_wait(&pool.done, &pool.lock);
+      pthread_mutex_unlock(&pool.lock);
+      merge_chunk(t, &cs[k], &file, &fn);
+   }
+   for (i = 0; i < n_workers; i++)
+      pthread_join(threads[i], NULL);
+   for (i = 0; i < n; i++)
+      close_input(&ins[i]);
+   pthread_mutex_destroy(&pool.lock);
+   pthread_cond_destroy(&pool.done);
+   free(threads);
+   free(cs);
+   free(slots);
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                             cg_outread.c ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,154 @@
+/*--------------------------------------------------------------------*/
+/*--- Reader for Cachegrind's output files            cg_outread.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Reads any number of cachegrind.out, cacheusage.d1.out,
+   cacheusage.ll.out and --output-format=binary files into one table of
+   counts per (file, function, line), for cg_usage_annotate and
+   cg_usage_merge.
+
+   Every input's columns are named in one registry:  cachegrind.out
+   events as they are ("Ir", "D1mr"), cacheusage ones with their level
+   ("D1:Conf#", "LL:3-words").  Only the columns a tool asks for with
+   cgo_need_col() get a slot in the rows.  Each input belongs to one of
+   cgo_n_sets sets, and a row holds cgo_n_slots counts for each set, so
+   two runs read into the same table are already joined line by line.
+
+   All the headers are read first (cgo_open), so a tool can pick its
+   columns, and then all the bodies (cgo_read).  Text bodies are mapped
+   and split into chunks at line boundaries;  the chunks, and binary
+   files, are read by a pool of threads into tables of their own, which
+   are merged in order.  Each function's lines are kept sorted, and the
+   files list them in order, so merging is a merge of sorted runs rather
+   than a hash lookup per line.
+
+   Errors are fatal:  they are printed, after cgo_prog, and the program
+   exits. */
+
+#ifndef __CG_OUTREAD_H
+#define __CG_OUTREAD_H
+
+#include "cg_binread.h"
+
+#define CGO_MAX_COLS  256
+
+// File and function names, interned so rows can be keyed by number.
+typedef struct {
+   char** strs;
+   UInt   n, cap;
+   UInt*  slots;       // string id + 1, or 0
+   UInt   mask;
+} CgoNames;
+
+// A function's lines, sorted, each with cgo_row_size() counts.
+typedef struct {
+   UInt   file;
+   UInt   fn;
+   Int*   lines;
+   ULong* vals;
+   UInt   n, cap;
+   UInt   next;        // where the line after the last one added goes
+   ULong* sum;         // all its lines', if the tool asks for it
+} CgoFunc;
+
+// The functions of some input, or of all of them.
+typedef struct {
+   CgoNames  names;    // of their files and functions
+   CgoFunc** f;
+   UInt      n, cap;
+   UInt*     slots;    // func + 1, or 0
+   UInt      mask;
+} CgoFuncs;
+
+typedef enum { CgoCachegrind, CgoUsageD1, CgoUsageLL, CgoBinary } CgoKind;
+
+typedef struct {
+   const char*  name;
+   CgoKind      kind;
+   UInt         set;
+   const UChar* base;         // text files
+   SizeT        size;
+   const UChar* body;         // first line after events: or bins:
+   UInt         n_fields;
+   UInt         field_col[CGO_MAX_COLS];
+   CgbFile      bin;          // binary files
+   Int          bin_col[CGB_N_COLS];
+   Int          usage_col[2][6 + CGB_N_BINS];
+} CgoInput;
+
+extern const char* cgo_prog;
+
+/* "D1" and "LL", and the cacheusage columns as on the "bins:" line. */
+extern const char* const cgo_level_names[2];
+extern const char* const cgo_usage_names[6];
+
+/* The column registry. */
+extern char* cgo_col_names[CGO_MAX_COLS];
+extern Int   cgo_col_slot[CGO_MAX_COLS];      // or -1
+extern UInt  cgo_n_cols, cgo_n_slots, cgo_n_sets;
+
+/* The first input's desc: lines (I1, D1, LL) and the first cmd: line,
+   if any. */
+extern char* cgo_descs[3];
+extern char* cgo_cmd;
+
+void  cgo_fail(const char* fmt, ...) __attribute__((noreturn));
+void* cgo_realloc(void* p, size_t n);
+char* cgo_strndup(const char* s, size_t n);
+
+UInt cgo_intern(CgoNames* t, const char* p, size_t n);
+
+/* Column 'name', or -1. */
+Int cgo_find_col(const char* name);
+/* Column "<level>:<name>" of level 'l', or -1. */
+Int cgo_level_col(UInt l, const char* name);
+/* The slot for column 'c', given one if need be, or -1 if c is -1. */
+Int cgo_need_col(Int c);
+
+static __inline__ UInt cgo_row_size(void)
+{
+   return cgo_n_slots * cgo_n_sets;
+}
+
+/* Function 'fn' of 'file', ready for a block of its lines in order. */
+CgoFunc* cgo_get_func(CgoFuncs* t, UInt file, UInt fn);
+/* The counts of 'line' in 'f', added (zeroed) if need be. */
+ULong* cgo_func_line(CgoFunc* f, Int line);
+void cgo_free_funcs(CgoFuncs* t);
+
+/* Open input 'name' of set 'set' and read its header.  'kind' is
+   CgoUsageD1 or CgoUsageLL for a cacheusage file given as such, and
+   otherwise CgoCachegrind:  binary files are found by their magic, and
+   cacheusage ones by their "bins:" line and the ".d1." or ".ll." in
+   their name. */
+void cgo_open(CgoInput* in, const char* name, CgoKind kind, UInt set);
+
+/* Read the bodies of the n opened inputs into 't', on up to 'n_threads'
+   threads, and close them.  No column may be needed after this. */
+void cgo_read(CgoInput* ins, UInt n, CgoFuncs* t, UInt n_threads);
+
+#endif   // __CG_OUTREAD_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                             cg_outread.h ---*/
+/*--------------------------------------------------------------------*/
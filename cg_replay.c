@@ -0,0 +1,1154 @@
+/*--------------------------------------------------------------------*/
+/*--- Replay a --record-trace file                      cg_replay.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Runs the accesses of a trace recorded with --record-trace through the
+   tool's own simulator (cg_sim.c and cg_helper.c), with whatever cache
+   configuration is asked for, and writes a cachegrind.out file for
+   cg_annotate.  The caches not given are the ones the trace was recorded
+   with, which give the tool's own I/D counts, except with --sim-range or
+   --sim-fn:  the data accesses those leave out are only counted by the
+   tool and aren't in the trace, so the replay's Dr and Dw are lower.  I1
+   lines can't be smaller than the recorded ones:  the trace only counts
+   the fetches that hit the same I1 line as the fetch before.
+
+   Build:  gcc -O2 -pthread -o cgsim-replay cg_replay.c
+
+   Usage:  cgsim-replay [--I1=<size>,<assoc>,<line_size>] [--D1=...]
+                        [--LL=...] [--miss-classify=none|d1|all]
+                        [--threads=<n>] [--opt] [-o <cachegrind.out>]
+                        [--LL-page-map=identity|random|colored]
+                        [--LL-page-size=<n>] [--LL-page-seed=<n>]
+                        [--LL-slices=<n>] <trace-file>
+
+   With no -o, the cachegrind.out text goes to stdout.  A summary goes to
+   stderr.  The simulator only has LRU replacement.
+
+   --threads=<n> (a power of two) splits the sets of every cache between
+   n shards, by the low bits of the line number, and replays the shards
+   on threads of their own;  see "Sharded replay" below.  The counts are
+   the same as with one thread.
+
+   --opt also counts the misses D1 and LL would have with Belady's optimal
+   replacement, as the events ILmrOPT D1mrOPT DLmrOPT D1mwOPT DLmwOPT;
+   see "OPT" below.
+
+   --LL-page-map etc. are the tool's;  see cg_sim.c.  They can't be used
+   with --threads, as sharding by line number needs a virtually indexed
+   LL. */
+
+// Each shard has its own caches;  see cg_sim.c.
+#define CG_SIM_STATE  static __thread
+
+#include "cg_nativesim.h"
+#include "cg_helper.c"
+#include "cg_sim.c"
+#include "cg_binfmt.h"
+#include "cg_trace.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+   const UChar*     base;
+   SizeT            size;
+   const CgtHeader* hdr;
+   const ULong*     index;
+   const CgtInstr*  instrs;
+   const CgtExtra*  extras;
+   const CgtLine*   lines;
+   const UInt*      str_offs;
+   const HChar*     str_data;
+} Trace;
+
+static Trace   trace;
+static LineCC* lineCCs;      // by CgtLine index
+static UChar*  instr_NoX;    // cachesim_is_IrNoX of each instr
+static Bool    clo_opt = False;
+
+static void fail(const HChar* what)
+{
+   fprintf(stderr, "cgsim-replay: %s\n", what);
+   exit(1);
+}
+
+/*------------------------------------------------------------*/
+/*--- Reading the trace                                    ---*/
+/*------------------------------------------------------------*/
+
+static const HChar* trace_string(UInt id)
+{
+   return id < trace.hdr->n_strings ? trace.str_data + trace.str_offs[id]
+                                    : "???";
+}
+
+// Whether n elements of 'sz' bytes at 'off' are inside the file.
+static Bool in_file(ULong off, ULong n, ULong sz)
+{
+   return off <= trace.size && n <= (trace.size - off) / sz;
+}
+
+static void open_trace(const HChar* path)
+{
+   struct stat st;
+   const CgtHeader* h;
+   ULong i;
+   int   fd;
+
+   fd = open(path, O_RDONLY);
+   if (fd < 0 || fstat(fd, &st) != 0 || (SizeT)st.st_size < sizeof(CgtHeader))
+      fail("can't open the trace, or it is too short");
+   trace.size = st.st_size;
+   trace.base = mmap(NULL, trace.size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (trace.base == MAP_FAILED)
+      fail("can't map the trace");
+
+   h = trace.hdr = (const CgtHeader*)trace.base;
+   if (memcmp(h->magic, CGT_MAGIC, sizeof(h->magic)) != 0)
+      fail("not a Cachegrind trace");
+   if (!in_file(h->index_off,  h->n_blocks, sizeof(ULong))
+       || !in_file(h->instrs_off, h->n_instrs, sizeof(CgtInstr))
+       || !in_file(h->extras_off, h->n_extras, sizeof(CgtExtra))
+       || !in_file(h->lines_off,  h->n_lines,  sizeof(CgtLine))
+       || !in_file(h->strtab_off, h->n_strings, sizeof(UInt)))
+      fail("bad section offsets");
+   trace.index    = (const ULong*)(trace.base + h->index_off);
+   trace.instrs   = (const CgtInstr*)(trace.base + h->instrs_off);
+   trace.extras   = (const CgtExtra*)(trace.base + h->extras_off);
+   trace.lines    = (const CgtLine*)(trace.base + h->lines_off);
+   trace.str_offs = (const UInt*)(trace.base + h->strtab_off);
+   trace.str_data = (const HChar*)(trace.str_offs + h->n_strings);
+
+   for (i = 0; i < h->n_strings; i++) {
+      const HChar* end = (const HChar*)trace.base + trace.size;
+      if (trace.str_offs[i] >= (SizeT)(end - trace.str_data)
+          || !memchr(trace.str_data + trace.str_offs[i], '\0',
+                     end - (trace.str_data + trace.str_offs[i])))
+         fail("bad string table");
+   }
+   for (i = 0; i < h->n_instrs; i++) {
+      const CgtInstr* ti = &trace.instrs[i];
+      if (ti->line >= h->n_lines || ti->first_extra > h->n_extras
+          || ti->n_extras > h->n_extras - ti->first_extra)
+         fail("bad instr table");
+   }
+   for (i = 0; i < h->n_extras; i++) {
+      if (trace.extras[i].line >= h->n_lines)
+         fail("bad extras table");
+   }
+   for (i = 0; i < h->n_blocks; i++) {
+      CgtBlock b;
+      if (trace.index[i] < sizeof(CgtHeader)
+          || !in_file(trace.index[i], 1, sizeof(CgtBlock)))
+         fail("bad block index");
+      memcpy(&b, trace.base + trace.index[i], sizeof(b));
+      // The index follows the blocks, so a varint overrunning the last
+      // one stays inside the file.
+      if (trace.index[i] + sizeof(CgtBlock) + b.size > h->index_off)
+         fail("bad block index");
+   }
+}
+
+/*------------------------------------------------------------*/
+/*--- OPT                                                  ---*/
+/*------------------------------------------------------------*/
+
+/* With --opt, the LRU replay also records the lines that D1 and LL see:
+   every data access for D1, and the accesses that missed L1 under LRU
+   for LL, so that LL's bound is for the same L1 misses.  A backward pass
+   over each stream finds where every line is next used, and a forward
+   pass then runs the stream through a cache of the same geometry that,
+   on a miss, evicts the line of its set next used furthest away (without
+   bypassing:  a miss is always brought in, as in the LRU cache).  No
+   replacement policy can miss less, so the gap to LRU is what access
+   order costs.
+
+   An access straddling two lines is one miss if either line misses, as
+   in cg_sim.c.  LL sets are chosen as the LRU LL's are, through
+   --LL-page-map and --LL-slices.  The streams take 24 bytes per line
+   referenced. */
+
+#define OPT_NEVER  (~0ULL)
+
+typedef struct {
+   ULong block;
+   ULong next;          // index of the next ref to 'block', or OPT_NEVER
+   UInt  line;          // CgtLine index
+   UChar kind;          // CgtKind
+   Bool  second;        // the second line of a straddling access
+} OptRef;
+
+typedef struct {
+   OptRef* refs;
+   ULong   n, size;
+   UInt    line_bits;
+} OptStream;
+
+typedef struct {
+   ULong ILm, D1mr, DLmr, D1mw, DLmw;
+} OptCC;
+
+static OptStream opt_D1, opt_LL;
+static OptCC*    optCCs;         // by CgtLine index
+
+static void opt_push(OptStream* s, ULong block, UInt line, UChar kind,
+                     Bool second)
+{
+   OptRef* r;
+
+   if (s->n == s->size) {
+      s->size = s->size ? 2 * s->size : 1 << 16;
+      s->refs = VG_(realloc)("replay.opt", s->refs, s->size * sizeof(OptRef));
+   }
+   r = &s->refs[s->n++];
+   r->block  = block;
+   r->line   = line;
+   r->kind   = kind;
+   r->second = second;
+}
+
+static void opt_ref(OptStream* s, Addr a, UChar size, UInt line, UChar kind)
+{
+   ULong block1 =  a           >> s->line_bits;
+   ULong block2 = (a + size - 1) >> s->line_bits;
+
+   opt_push(s, block1, line, kind, False);
+   if (block2 != block1)
+      opt_push(s, block2, line, kind, True);
+}
+
+// The backward pass, with an open-addressing table from each line to
+// where it was last seen.
+static void opt_next_uses(OptStream* s)
+{
+   ULong* keys;          // block + 1;  0 is empty
+   ULong* seen;
+   ULong  size = 1 << 16, used = 0, i;
+
+   keys = VG_(calloc)("replay.opt.keys", size, sizeof(ULong));
+   seen = VG_(malloc)("replay.opt.seen", size * sizeof(ULong));
+   for (i = s->n; i-- > 0; ) {
+      OptRef* r = &s->refs[i];
+      ULong   k = r->block + 1;
+      ULong   h = (k * 0x9E3779B97F4A7C15ULL) >> 20;
+
+      for (;; h++) {
+         h &= size - 1;
+         if (keys[h] == k) {
+            r->next = seen[h];
+            break;
+         }
+         if (keys[h] == 0) {
+            r->next = OPT_NEVER;
+            keys[h] = k;
+            used++;
+            break;
+         }
+      }
+      seen[h] = i;
+
+      if (2 * used > size) {
+         ULong* old_keys = keys;
+         ULong* old_seen = seen;
+         ULong  j, old_size = size;
+
+         size *= 2;
+         keys = VG_(calloc)("replay.opt.keys", size, sizeof(ULong));
+         seen = VG_(malloc)("replay.opt.seen", size * sizeof(ULong));
+         for (j = 0; j < old_size; j++) {
+            if (old_keys[j] == 0)
+               continue;
+            h = (old_keys[j] * 0x9E3779B97F4A7C15ULL) >> 20;
+            for (;; h++) {
+               h &= size - 1;
+               if (keys[h] == 0)
+                  break;
+            }
+            keys[h] = old_keys[j];
+            seen[h] = old_seen[j];
+         }
+         free(old_keys);
+         free(old_seen);
+      }
+   }
+   free(keys);
+   free(seen);
+}
+
+// One line of an access;  True if it misses.
+__attribute__((always_inline))
+static __inline__
+Bool opt_access(ULong* tags, ULong* nexts, UInt assoc, const OptRef* r)
+{
+   UInt w, victim = 0;
+
+   for (w = 0; w < assoc; w++) {
+      if (tags[w] == r->block + 1) {
+         nexts[w] = r->next;
+         return False;
+      }
+   }
+   for (w = 0; w < assoc; w++) {
+      if (tags[w] == 0) {
+         victim = w;
+         break;
+      }
+      if (nexts[w] > nexts[victim])
+         victim = w;
+   }
+   tags[victim]  = r->block + 1;
+   nexts[victim] = r->next;
+   return True;
+}
+
+static ULong opt_set(ULong block, UInt sets, Bool is_LL)
+{
+   if (is_LL && LL_mapped)
+      return cachesim_LL_set(cachesim_LL_phys(block));
+   return block & (sets - 1);
+}
+
+static void opt_simulate(OptStream* s, const cache_t* c, Bool is_LL)
+{
+   UInt   sets = c->size / (c->assoc * c->line_size);
+   ULong* tags;          // block + 1;  0 is empty
+   ULong* nexts;
+   ULong  i;
+
+   opt_next_uses(s);
+   tags  = VG_(calloc)("replay.opt.tags", (ULong)sets * c->assoc, sizeof(ULong));
+   nexts = VG_(malloc)("replay.opt.nexts", (ULong)sets * c->assoc * sizeof(ULong));
+
+   for (i = 0; i < s->n; i++) {
+      const OptRef* r = &s->refs[i];
+      ULong  set  = opt_set(r->block, sets, is_LL) * c->assoc;
+      Bool   miss = opt_access(tags + set, nexts + set, c->assoc, r);
+      OptCC* cc   = &optCCs[r->line];
+
+      // Both lines are always done, as state is updated as side effect.
+      if (i + 1 < s->n && s->refs[i + 1].second) {
+         const OptRef* r2 = &s->refs[++i];
+         ULong set2 = opt_set(r2->block, sets, is_LL) * c->assoc;
+         miss |= opt_access(tags + set2, nexts + set2, c->assoc, r2);
+      }
+      if (!miss)
+         continue;
+      if (r->kind < CGT_Dr)       cc->ILm++;
+      else if (r->kind == CGT_Dr) (*(is_LL ? &cc->DLmr : &cc->D1mr))++;
+      else                        (*(is_LL ? &cc->DLmw : &cc->D1mw))++;
+   }
+   free(tags);
+   free(nexts);
+   free(s->refs);
+   s->refs = NULL;
+   s->n = s->size = 0;
+}
+
+/*------------------------------------------------------------*/
+/*--- Replaying                                            ---*/
+/*------------------------------------------------------------*/
+
+// 'mc' must be a compile-time constant, as in the tool.
+__attribute__((always_inline))
+static __inline__
+void replay_block(UInt blk, const MissClassify mc)
+{
+   CgtBlock     b;
+   const UChar* p;
+   const UChar* end;
+   ULong instr = 0;
+   Addr  addr  = 0;
+   UInt  r, e;
+
+   memcpy(&b, trace.base + trace.index[blk], sizeof(b));
+   p   = trace.base + trace.index[blk] + sizeof(CgtBlock);
+   end = p + b.size;
+
+   for (r = 0; r < b.n_recs; r++) {
+      ULong h    = cgb_get_varint(&p);
+      UInt  kind = h & CGT_KIND_MASK;
+      const CgtInstr* ti;
+      LineCC* cc;
+
+      instr += cgb_unzigzag(cgb_get_varint(&p));
+      if (instr >= trace.hdr->n_instrs)
+         fail("corrupt block");
+      ti = &trace.instrs[instr];
+      cc = &lineCCs[ti->line];
+
+      if (kind < CGT_Dr) {
+         ULong m1 = cc->Ir.m1;
+         if (instr_NoX[instr])
+            cachesim_I1_doref_NoX(ti->addr, ti->len, &cc->Ir.m1, &cc->Ir.mL);
+         else
+            cachesim_I1_doref_Gen(ti->addr, ti->len, &cc->Ir.m1, &cc->Ir.mL);
+         if (clo_opt && cc->Ir.m1 != m1)
+            opt_ref(&opt_LL, ti->addr, ti->len, ti->line, CGT_IrGen);
+         cc->Ir.a++;
+         for (e = 0; e < ti->n_extras; e++) {
+            const CgtExtra* x = &trace.extras[ti->first_extra + e];
+            LineCC* xcc = &lineCCs[x->line];
+            xcc->Ir.a += x->Ir;
+            xcc->Dr.a += x->Dr;
+            xcc->Dw.a += x->Dw;
+         }
+      } else {
+         UChar size = h >> CGT_KIND_BITS;
+         Bool  miss;
+         addr += cgb_unzigzag(cgb_get_varint(&p));
+         if (kind == CGT_Dr) {
+            miss = cachesim_D1_doref(addr, size, &cc->Dr.m1, &cc->Dr.mL,
+                                     cc->loc.line, &cc->ev, &cc->Dr, mc);
+            cc->Dr.a++;
+         } else {
+            miss = cachesim_D1_doref(addr, size, &cc->Dw.m1, &cc->Dw.mL,
+                                     cc->loc.line, &cc->ev, &cc->Dw, mc);
+            cc->Dw.a++;
+         }
+         if (clo_opt) {
+            opt_ref(&opt_D1, addr, size, ti->line, kind);
+            if (miss)
+               opt_ref(&opt_LL, addr, size, ti->line, kind);
+         }
+      }
+      if (p > end)
+         fail("corrupt block");
+   }
+}
+
+static void replay(MissClassify mc)
+{
+   UInt b;
+
+   for (b = 0; b < trace.hdr->n_blocks; b++) {
+      switch (mc) {
+      case MissClassifyNone: replay_block(b, MissClassifyNone); break;
+      case MissClassifyD1:   replay_block(b, MissClassifyD1);   break;
+      case MissClassifyAll:  replay_block(b, MissClassifyAll);  break;
+      }
+   }
+   cachesim_finish();
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Sharded replay                                       ---*/
+/*------------------------------------------------------------*/
+
+/* With n shards (a power of two), shard s holds the sets of I1, D1 and LL
+   that lines with (line number & (n-1)) == s map to.  So as the caches
+   share their line size, a line only ever meets one shard, and the
+   shards are n independent simulators 1/n the size of the real ones; a
+   line's number, less the shard bits, is its number inside its shard.
+   An access straddling two lines has a part in each of two neighbouring
+   shards.
+
+   The trace is replayed n blocks at a time, in rounds of four steps with
+   all threads meeting between them:
+
+     - decoding:  thread s decodes the round's block s, and sorts the parts
+       of its accesses by shard;
+     - L1:  each shard runs its parts of every block through I1 or D1, in
+       trace order;
+     - LL:  each shard runs the parts of the accesses that missed L1 (on
+       either part) through LL, in trace order, and those of D1 misses
+       through INFI, which also goes line by line;
+     - counting:  the shard of the first part of each access counts it.
+
+   The two parts of a straddling access meet through per-record verdicts.
+   The FA caches of the 3C classification can't be split by set, so they
+   run over all the data accesses on one more thread, alongside the L1
+   and LL steps;  with --miss-classify=none it isn't needed. */
+
+#define V_M1    1       // verdicts:  missed L1
+#define V_ML    2       //            missed LL
+#define V_INFI  4       //            missed INFI
+#define V_FA    1       // FA verdicts
+#define V_FA_LL 2
+
+typedef struct {
+   Addr  addr;
+   UInt  instr;
+   UChar kind;          // CgtKind
+   UChar size;
+   Bool  two;           // straddles two lines
+   UChar pad;
+} Access;
+
+typedef struct {
+   UInt    n_recs;
+   Access* recs;
+   UInt*   parts;       // (record << 1 | part), grouped by shard
+   UInt*   start;       // [n_shards + 1], each shard's first part
+   UChar*  v;           // verdicts, as 'parts'
+   UChar*  l1[2];       // L1 verdicts of straddling records, by part
+   UChar*  ll[2];       // LL and INFI verdicts of straddling records
+   UChar*  fa;          // FA verdicts of data records
+} Slot;
+
+static UInt    n_shards   = 1;
+static UInt    shard_bits;
+static UInt    line_bits;
+static Slot*   slots;
+static LineCC** shard_lines;   // each shard's counts, by CgtLine index
+static pthread_barrier_t all_met, shards_met;
+static cache_t shard_I1c, shard_D1c, shard_LLc;
+static cache_t whole_D1c, whole_LLc;     // for the FA caches
+static MissClassify replay_mc;
+
+static __inline__ UInt shard_of(Addr a)
+{
+   return (a >> line_bits) & (n_shards - 1);
+}
+
+// Part 'p' of access 'x', as an address inside its shard.
+static __inline__ void part_of(const Access* x, UInt p, Addr* a, UChar* size)
+{
+   Addr end  = x->addr + x->size;
+   Addr last = ((end - 1) >> line_bits) << line_bits;   // its last line
+
+   if (p == 0) {
+      *a    = x->addr;
+      *size = x->two ? last - x->addr : x->size;
+   } else {
+      *a    = last;
+      *size = end - last;
+   }
+   *a = (*a >> line_bits >> shard_bits << line_bits)
+        | (*a & ((1 << line_bits) - 1));
+}
+
+static void decode_slot(Slot* sl, UInt blk)
+{
+   CgtBlock     b;
+   const UChar* p;
+   const UChar* end;
+   ULong instr = 0;
+   Addr  addr  = 0;
+   UInt  r, s;
+
+   memcpy(&b, trace.base + trace.index[blk], sizeof(b));
+   p   = trace.base + trace.index[blk] + sizeof(CgtBlock);
+   end = p + b.size;
+
+   memset(sl->start, 0, (n_shards + 1) * sizeof(UInt));
+   for (r = 0; r < b.n_recs; r++) {
+      Access* x = &sl->recs[r];
+      ULong   h = cgb_get_varint(&p);
+
+      instr += cgb_unzigzag(cgb_get_varint(&p));
+      if (instr >= trace.hdr->n_instrs)
+         fail("corrupt block");
+      x->instr = instr;
+      x->kind  = h & CGT_KIND_MASK;
+      if (x->kind < CGT_Dr) {
+         x->addr = trace.instrs[instr].addr;
+         x->size = trace.instrs[instr].len;
+      } else {
+         addr += cgb_unzigzag(cgb_get_varint(&p));
+         x->addr = addr;
+         x->size = h >> CGT_KIND_BITS;
+      }
+      if (p > end || x->size == 0)
+         fail("corrupt block");
+      x->two = shard_of(x->addr) != shard_of(x->addr + x->size - 1);
+      sl->start[shard_of(x->addr) + 1]++;
+      if (x->two)
+         sl->start[shard_of(x->addr + x->size - 1) + 1]++;
+   }
+   sl->n_recs = b.n_recs;
+
+   // Sort the parts by shard, keeping them in trace order.
+   for (s = 0; s < n_shards; s++)
+      sl->start[s + 1] += sl->start[s];
+   {
+      UInt fill[n_shards];
+      memcpy(fill, sl->start, n_shards * sizeof(UInt));
+      for (r = 0; r < b.n_recs; r++) {
+         const Access* x = &sl->recs[r];
+         sl->parts[fill[shard_of(x->addr)]++] = r << 1;
+         if (x->two)
+            sl->parts[fill[shard_of(x->addr + x->size - 1)]++] = r << 1 | 1;
+      }
+   }
+}
+
+static void shard_L1(UInt s, const Slot* sl)
+{
+   UInt i;
+
+   for (i = sl->start[s]; i < sl->start[s + 1]; i++) {
+      UInt r = sl->parts[i] >> 1, p = sl->parts[i] & 1;
+      const Access* x = &sl->recs[r];
+      Bool  miss;
+      Addr  a;
+      UChar size;
+
+      part_of(x, p, &a, &size);
+      if (x->kind < CGT_Dr) {
+         miss = cachesim_ref_is_miss(&I1, a, size, 0, NULL);
+      } else {
+         UInt l = trace.instrs[x->instr].line;
+         miss = cachesim_ref_is_miss(&D1, a, size, lineCCs[l].loc.line,
+                                     &shard_lines[s][l].ev);
+      }
+      sl->v[i] = miss ? V_M1 : 0;
+      if (x->two)
+         sl->l1[p][r] = sl->v[i];
+   }
+}
+
+static void shard_LL(UInt s, const Slot* sl, MissClassify mc)
+{
+   UInt i;
+
+   for (i = sl->start[s]; i < sl->start[s + 1]; i++) {
+      UInt r = sl->parts[i] >> 1, p = sl->parts[i] & 1;
+      const Access* x = &sl->recs[r];
+      Addr  a;
+      UChar size;
+
+      if (!((sl->v[i] | (x->two ? sl->l1[1 - p][r] : 0)) & V_M1))
+         continue;
+      part_of(x, p, &a, &size);
+      if (x->kind < CGT_Dr) {
+         if (cachesim_ref_is_miss(&LL, a, size, 0, NULL))
+            sl->v[i] |= V_ML;
+      } else {
+         UInt l = trace.instrs[x->instr].line;
+
+         if (mc != MissClassifyNone && cacheinfi_ref_is_miss(&INFI, a, size))
+            sl->v[i] |= V_INFI;
+         if (cachesim_ref_is_miss(&LL, a, size, lineCCs[l].loc.line,
+                                  &shard_lines[s][l].ev))
+            sl->v[i] |= V_ML;
+      }
+      if (x->two)
+         sl->ll[p][r] = sl->v[i];
+   }
+}
+
+static void shard_count(UInt s, const Slot* sl, MissClassify mc)
+{
+   LineCC* lines = shard_lines[s];
+   UInt i, e;
+
+   for (i = sl->start[s]; i < sl->start[s + 1]; i++) {
+      UInt r = sl->parts[i] >> 1;
+      const Access*   x  = &sl->recs[r];
+      const CgtInstr* ti = &trace.instrs[x->instr];
+      LineCC* cc = &lines[ti->line];
+      UChar   v  = sl->v[i];
+
+      if (sl->parts[i] & 1)
+         continue;
+      // The second part's LL verdicts are only there if the access missed.
+      if (x->two) {
+         v |= sl->l1[1][r] & V_M1;
+         if (v & V_M1)
+            v |= sl->ll[1][r] & (V_ML | V_INFI);
+      }
+
+      if (x->kind < CGT_Dr) {
+         cc->Ir.a++;
+         cc->Ir.m1 += (v & V_M1) != 0;
+         cc->Ir.mL += (v & V_ML) != 0;
+         for (e = 0; e < ti->n_extras; e++) {
+            const CgtExtra* xe = &trace.extras[ti->first_extra + e];
+            LineCC* xcc = &lines[xe->line];
+            xcc->Ir.a += xe->Ir;
+            xcc->Dr.a += xe->Dr;
+            xcc->Dw.a += xe->Dw;
+         }
+      } else {
+         CacheCC* c = x->kind == CGT_Dr ? &cc->Dr : &cc->Dw;
+
+         // As cachesim_D1_doref_fa.
+         c->a++;
+         if (!(v & V_M1))
+            continue;
+         c->m1++;
+         if (mc != MissClassifyNone) {
+            if (v & V_INFI)                  c->m1_comp++;
+            else if (!(sl->fa[r] & V_FA))    c->m1_conf++;
+            else                             c->m1_cap++;
+         }
+         if (!(v & V_ML))
+            continue;
+         c->mL++;
+         if (mc == MissClassifyAll) {
+            if (v & V_INFI)                  c->mL_comp++;
+            else if (!(sl->fa[r] & V_FA_LL)) c->mL_conf++;
+            else                             c->mL_cap++;
+         }
+      }
+   }
+}
+
+static UInt n_rounds(void)
+{
+   return (trace.hdr->n_blocks + n_shards - 1) / n_shards;
+}
+
+static UInt slots_in_round(UInt round)
+{
+   UInt left = trace.hdr->n_blocks - round * n_shards;
+   return left < n_shards ? left : n_shards;
+}
+
+static void* shard_main(void* arg)
+{
+   UInt s = (UInt)(UWord)arg;
+   UInt round, i;
+
+   cachesim_initcache(shard_I1c, &I1);
+   cachesim_initcache(shard_D1c, &D1);
+   cachesim_initcache(shard_LLc, &LL);
+
+   for (round = 0; round < n_rounds(); round++) {
+      UInt n = slots_in_round(round);
+
+      if (s < n)
+         decode_slot(&slots[s], round * n_shards + s);
+      pthread_barrier_wait(&all_met);
+      for (i = 0; i < n; i++)
+         shard_L1(s, &slots[i]);
+      pthread_barrier_wait(&shards_met);
+      for (i = 0; i < n; i++)
+         shard_LL(s, &slots[i], replay_mc);
+      pthread_barrier_wait(&all_met);
+      for (i = 0; i < n; i++)
+         shard_count(s, &slots[i], replay_mc);
+      pthread_barrier_wait(&all_met);
+   }
+   cachesim_collect_undrained_lines(&D1);
+   cachesim_collect_undrained_lines(&LL);
+   return NULL;
+}
+
+// The FA caches, over every data access in trace order.
+static void* fa_main(void* arg)
+{
+   UInt round, i, r;
+
+   (void)arg;
+   cachefa_initcache(whole_D1c, &FA_D1);
+   if (replay_mc == MissClassifyAll)
+      cachefa_initcache(whole_LLc, &FA_LL);
+
+   for (round = 0; round < n_rounds(); round++) {
+      UInt n = slots_in_round(round);
+
+      pthread_barrier_wait(&all_met);
+      for (i = 0; i < n; i++) {
+         const Slot* sl = &slots[i];
+         for (r = 0; r < sl->n_recs; r++) {
+            const Access* x = &sl->recs[r];
+            UChar f = 0;
+
+            if (x->kind < CGT_Dr)
+               continue;
+            if (cachefa_ref_is_miss(&FA_D1, x->addr, x->size))
+               f |= V_FA;
+            if (replay_mc == MissClassifyAll
+                && cachefa_ref_is_miss(&FA_LL, x->addr, x->size))
+               f |= V_FA_LL;
+            sl->fa[r] = f;
+         }
+      }
+      pthread_barrier_wait(&all_met);
+      pthread_barrier_wait(&all_met);
+   }
+   return NULL;
+}
+
+static void add_CacheCC(CacheCC* to, const CacheCC* from)
+{
+   to->a += from->a;  to->m1 += from->m1;  to->mL += from->mL;
+   to->m1_comp += from->m1_comp;
+   to->m1_conf += from->m1_conf;
+   to->m1_cap  += from->m1_cap;
+   to->mL_comp += from->mL_comp;
+   to->mL_conf += from->mL_conf;
+   to->mL_cap  += from->mL_cap;
+}
+
+static void replay_sharded(void)
+{
+   Bool      fa = replay_mc != MissClassifyNone;
+   pthread_t threads[n_shards + 1];
+   UInt      max_recs = 1, b, s, i, j;
+
+   for (b = 0; b < trace.hdr->n_blocks; b++) {
+      CgtBlock blk;
+      memcpy(&blk, trace.base + trace.index[b], sizeof(blk));
+      if (blk.n_recs > max_recs)
+         max_recs = blk.n_recs;
+   }
+   if (max_recs > (1U << 31) / 2)
+      fail("corrupt block");
+
+   slots       = VG_(calloc)("replay.slots", n_shards, sizeof(Slot));
+   shard_lines = VG_(malloc)("replay.shard_lines", n_shards * sizeof(LineCC*));
+   for (s = 0; s < n_shards; s++) {
+      Slot* sl = &slots[s];
+      sl->recs  = VG_(malloc)("replay.recs",  max_recs * sizeof(Access));
+      sl->parts = VG_(malloc)("replay.parts", 2 * max_recs * sizeof(UInt));
+      sl->start = VG_(malloc)("replay.start", (n_shards + 1) * sizeof(UInt));
+      sl->v     = VG_(malloc)("replay.v",     2 * max_recs);
+      for (j = 0; j < 2; j++) {
+         sl->l1[j] = VG_(malloc)("replay.l1", max_recs);
+         sl->ll[j] = VG_(malloc)("replay.ll", max_recs);
+      }
+      sl->fa    = VG_(malloc)("replay.fa",    max_recs);
+      shard_lines[s] = VG_(calloc)("replay.lines", trace.hdr->n_lines + 1,
+                                   sizeof(LineCC));
+   }
+
+   pthread_barrier_init(&all_met, NULL, n_shards + fa);
+   pthread_barrier_init(&shards_met, NULL, n_shards);
+   for (s = 0; s < n_shards; s++) {
+      if (pthread_create(&threads[s], NULL, shard_main, (void*)(UWord)s) != 0)
+         fail("can't start a thread");
+   }
+   if (fa && pthread_create(&threads[n_shards], NULL, fa_main, NULL) != 0)
+      fail("can't start a thread");
+   for (s = 0; s < n_shards + fa; s++)
+      pthread_join(threads[s], NULL);
+
+   // Merge the shards' counts.
+   for (s = 0; s < n_shards; s++) {
+      for (i = 0; i < trace.hdr->n_lines; i++) {
+         LineCC*       to   = &lineCCs[i];
+         const LineCC* from = &shard_lines[s][i];
+         add_CacheCC(&to->Ir, &from->Ir);
+         add_CacheCC(&to->Dr, &from->Dr);
+         add_CacheCC(&to->Dw, &from->Dw);
+         for (j = 0; j < MAX_NUM_BINS; j++) {
+            to->ev.D1[j] += from->ev.D1[j];
+            to->ev.LL[j] += from->ev.LL[j];
+         }
+      }
+   }
+}
+
+/*------------------------------------------------------------*/
+/*--- Output                                               ---*/
+/*------------------------------------------------------------*/
+
+static int cmp_lines(const void* va, const void* vb)
+{
+   const LineCC* a = &lineCCs[*(const UInt*)va];
+   const LineCC* b = &lineCCs[*(const UInt*)vb];
+   Word res = cmp_CodeLoc_LineCC(&a->loc, b);
+   return res < 0 ? -1 : res > 0 ? 1 : 0;
+}
+
+static void write_cachegrind_out(FILE* fp)
+{
+   const HChar *curr_file = NULL, *curr_fn = NULL;
+   CacheCC Ir, Dr, Dw;
+   OptCC   opt;
+   UInt*   order;
+   UInt    i, n = 0;
+
+   order = VG_(malloc)("replay.order", (trace.hdr->n_lines + 1) * sizeof(UInt));
+   for (i = 0; i < trace.hdr->n_lines; i++) {
+      const LineCC* cc = &lineCCs[i];
+      if (cc->Ir.a || cc->Dr.a || cc->Dw.a)
+         order[n++] = i;
+   }
+   qsort(order, n, sizeof(UInt), cmp_lines);
+
+   fprintf(fp, "desc: I1 cache:         %s\n"
+               "desc: D1 cache:         %s\n"
+               "desc: LL cache:         %s\n",
+               I1.desc_line, D1.desc_line, LL.desc_line);
+   fprintf(fp, "cmd: %s", trace_string(trace.hdr->cmd_str));
+   fprintf(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw %s\n",
+           clo_opt ? "ILmrOPT D1mrOPT DLmrOPT D1mwOPT DLmwOPT " : "");
+
+   memset(&Ir, 0, sizeof(Ir));
+   memset(&Dr, 0, sizeof(Dr));
+   memset(&Dw, 0, sizeof(Dw));
+   memset(&opt, 0, sizeof(opt));
+   for (i = 0; i < n; i++) {
+      const LineCC* cc = &lineCCs[order[i]];
+      Bool just_hit_a_new_file = False;
+
+      if (cc->loc.file != curr_file) {
+         curr_file = cc->loc.file;
+         fprintf(fp, "fl=%s\n", curr_file);
+         just_hit_a_new_file = True;
+      }
+      if (just_hit_a_new_file || cc->loc.fn != curr_fn) {
+         curr_fn = cc->loc.fn;
+         fprintf(fp, "fn=%s\n", curr_fn);
+      }
+      fprintf(fp, "%d %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+              cc->loc.line,
+              cc->Ir.a, cc->Ir.m1, cc->Ir.mL,
+              cc->Dr.a, cc->Dr.m1, cc->Dr.mL,
+              cc->Dw.a, cc->Dw.m1, cc->Dw.mL);
+      if (clo_opt) {
+         const OptCC* o = &optCCs[order[i]];
+         fprintf(fp, " %llu %llu %llu %llu %llu",
+                 o->ILm, o->D1mr, o->DLmr, o->D1mw, o->DLmw);
+         opt.ILm  += o->ILm;   opt.D1mr += o->D1mr;  opt.DLmr += o->DLmr;
+         opt.D1mw += o->D1mw;  opt.DLmw += o->DLmw;
+      }
+      fprintf(fp, "\n");
+      Ir.a += cc->Ir.a;  Ir.m1 += cc->Ir.m1;  Ir.mL += cc->Ir.mL;
+      Dr.a += cc->Dr.a;  Dr.m1 += cc->Dr.m1;  Dr.mL += cc->Dr.mL;
+      Dw.a += cc->Dw.a;  Dw.m1 += cc->Dw.m1;  Dw.mL += cc->Dw.mL;
+      Dr.m1_comp += cc->Dr.m1_comp + cc->Dw.m1_comp;
+      Dr.m1_conf += cc->Dr.m1_conf + cc->Dw.m1_conf;
+      Dr.m1_cap  += cc->Dr.m1_cap  + cc->Dw.m1_cap;
+      Dr.mL_comp += cc->Dr.mL_comp + cc->Dw.mL_comp;
+      Dr.mL_conf += cc->Dr.mL_conf + cc->Dw.mL_conf;
+      Dr.mL_cap  += cc->Dr.mL_cap  + cc->Dw.mL_cap;
+   }
+   fprintf(fp, "summary: %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+           Ir.a, Ir.m1, Ir.mL, Dr.a, Dr.m1, Dr.mL, Dw.a, Dw.m1, Dw.mL);
+   if (clo_opt)
+      fprintf(fp, " %llu %llu %llu %llu %llu",
+              opt.ILm, opt.D1mr, opt.DLmr, opt.D1mw, opt.DLmw);
+   fprintf(fp, "\n");
+
+   fprintf(stderr, "I refs:        %llu\n"
+                   "I1  misses:    %llu\n"
+                   "LLi misses:    %llu\n"
+                   "D refs:        %llu\n"
+                   "D1  misses:    %llu  (%llu comp, %llu conf, %llu cap)\n"
+                   "LLd misses:    %llu  (%llu comp, %llu conf, %llu cap)\n",
+           Ir.a, Ir.m1, Ir.mL, Dr.a + Dw.a,
+           Dr.m1 + Dw.m1, Dr.m1_comp, Dr.m1_conf, Dr.m1_cap,
+           Dr.mL + Dw.mL, Dr.mL_comp, Dr.mL_conf, Dr.mL_cap);
+   if (clo_opt)
+      fprintf(stderr, "LLi OPT misses: %llu\n"
+                      "D1  OPT misses: %llu\n"
+                      "LLd OPT misses: %llu\n",
+              opt.ILm, opt.D1mr + opt.D1mw, opt.DLmr + opt.DLmw);
+   free(order);
+}
+
+/*------------------------------------------------------------*/
+/*--- Setup                                                ---*/
+/*------------------------------------------------------------*/
+
+static void usage(void)
+{
+   fprintf(stderr,
+      "usage: cgsim-replay [--I1=<size>,<assoc>,<line_size>] [--D1=...]\n"
+      "                    [--LL=...] [--miss-classify=none|d1|all]\n"
+      "                    [--threads=<n>] [--opt] [-o <cachegrind.out>]\n"
+      "                    [--LL-page-map=identity|random|colored]\n"
+      "                    [--LL-page-size=<n>] [--LL-page-seed=<n>]\n"
+      "                    [--LL-slices=<n>] <trace-file>\n");
+   exit(1);
+}
+
+static void parse_cache(const HChar* opt, cache_t* c)
+{
+   if (sscanf(opt, "%d,%d,%d", &c->size, &c->assoc, &c->line_size) != 3)
+      usage();
+}
+
+// The checks the core makes of --I1 etc., plus what the rest of the
+// simulator assumes:  the word-usage bins and the 3C caches are for 64B
+// lines, and no access may straddle more than two lines.
+static void check_cache(const HChar* name, const cache_t* c, Bool data)
+{
+   static HChar msg[128];
+   Int sets;
+
+   if (c->size <= 0 || c->assoc <= 0 || c->line_size <= 0
+       || c->size % (c->assoc * c->line_size) != 0) {
+      sprintf(msg, "%s: bad cache configuration", name);
+      fail(msg);
+   }
+   sets = c->size / (c->assoc * c->line_size);
+   if (VG_(log2)(sets) < 0 || VG_(log2)(c->line_size) < 0) {
+      sprintf(msg, "%s: sets and line size must be powers of two", name);
+      fail(msg);
+   }
+   if (data && c->line_size != 64) {
+      sprintf(msg, "%s: only 64B lines are supported", name);
+      fail(msg);
+   }
+   if (c->line_size < (Int)trace.hdr->max_size) {
+      sprintf(msg, "%s: lines must hold the largest access (%u bytes)",
+              name, trace.hdr->max_size);
+      fail(msg);
+   }
+}
+
+// Each shard must have whole sets.
+static void check_shards(const HChar* name, const cache_t* c)
+{
+   static HChar msg[128];
+
+   if ((UInt)(c->size / (c->assoc * c->line_size)) < n_shards) {
+      sprintf(msg, "%s: fewer sets than --threads", name);
+      fail(msg);
+   }
+}
+
+// The cache the trace was recorded with, unless one was given.
+static void default_cache(cache_t* c, const CgtCache* t)
+{
+   if (c->size == 0) {
+      c->size      = t->size;
+      c->assoc     = t->assoc;
+      c->line_size = t->line_size;
+   }
+}
+
+int main(int argc, char** argv)
+{
+   cache_t I1c = { 0, 0, 0 };
+   cache_t D1c = { 0, 0, 0 };
+   cache_t LLc = { 0, 0, 0 };
+   MissClassify mc = MissClassifyAll;
+   LLMap ll_map = { LLPageIdentity, 4096, 1, 0, 0 };
+   const HChar* out_name = NULL;
+   const HChar* err;
+   const HChar* in_name  = NULL;
+   FILE* fp;
+   ULong i;
+
+   for (i = 1; i < (ULong)argc; i++) {
+      const HChar* a = argv[i];
+      if      (strncmp(a, "--I1=", 5) == 0) parse_cache(a + 5, &I1c);
+      else if (strncmp(a, "--D1=", 5) == 0) parse_cache(a + 5, &D1c);
+      else if (strncmp(a, "--LL=", 5) == 0) parse_cache(a + 5, &LLc);
+      else if (strcmp(a, "--miss-classify=none") == 0) mc = MissClassifyNone;
+      else if (strcmp(a, "--miss-classify=d1") == 0)   mc = MissClassifyD1;
+      else if (strcmp(a, "--miss-classify=all") == 0)  mc = MissClassifyAll;
+      else if (strcmp(a, "--opt") == 0)                clo_opt = True;
+      else if (strcmp(a, "--LL-page-map=identity") == 0)
+         ll_map.page_map = LLPageIdentity;
+      else if (strcmp(a, "--LL-page-map=random") == 0)
+         ll_map.page_map = LLPageRandom;
+      else if (strcmp(a, "--LL-page-map=colored") == 0)
+         ll_map.page_map = LLPageColored;
+      else if (strncmp(a, "--LL-page-size=", 15) == 0)
+         ll_map.page_size = strtoul(a + 15, NULL, 0);
+      else if (strncmp(a, "--LL-page-seed=", 15) == 0)
+         ll_map.seed = strtoull(a + 15, NULL, 0);
+      else if (strncmp(a, "--LL-slices=", 12) == 0)
+         ll_map.slices = strtoul(a + 12, NULL, 0);
+      else if (strncmp(a, "--threads=", 10) == 0) {
+         n_shards = atoi(a + 10);
+         if (VG_(log2)(n_shards) < 0)
+            fail("--threads must be a power of two");
+      }
+      else if (strcmp(a, "-o") == 0 && i+1 < (ULong)argc) out_name = argv[++i];
+      else if (a[0] == '-' || in_name)                    usage();
+      else                                                in_name = a;
+   }
+   if (!in_name)
+      usage();
+
+   open_trace(in_name);
+   default_cache(&I1c, &trace.hdr->I1);
+   default_cache(&D1c, &trace.hdr->D1);
+   default_cache(&LLc, &trace.hdr->LL);
+   check_cache("I1", &I1c, False);
+   check_cache("D1", &D1c, True);
+   check_cache("LL", &LLc, True);
+   if (I1c.line_size < trace.hdr->I1.line_size) {
+      static HChar msg[128];
+      sprintf(msg, "I1: lines must be at least as big as the recorded ones "
+                   "(%d bytes)", trace.hdr->I1.line_size);
+      fail(msg);
+   }
+   if ((err = cachesim_set_LL_map(&ll_map, LLc)))
+      fail(err);
+   if (n_shards > 1) {
+      check_shards("I1", &I1c);
+      check_shards("D1", &D1c);
+      check_shards("LL", &LLc);
+      if (I1c.line_size != D1c.line_size)
+         fail("--threads needs I1 lines the size of D1's");
+      if (clo_opt)
+         fail("--opt needs --threads=1");
+      if (LL_mapped)
+         fail("--LL-page-map and --LL-slices need --threads=1");
+   }
+   // With shards, these are only for the descriptions.
+   cachesim_initcaches(I1c, D1c, LLc, n_shards > 1 ? MissClassifyNone : mc);
+
+   lineCCs = VG_(calloc)("replay.lines", trace.hdr->n_lines + 1, sizeof(LineCC));
+   for (i = 0; i < trace.hdr->n_lines; i++) {
+      const CgtLine* l = &trace.lines[i];
+      lineCCs[i].loc.file = (HChar*)trace_string(l->file_str);
+      lineCCs[i].loc.fn   = trace_string(l->fn_str);
+      lineCCs[i].loc.line = l->line;
+      lineCCs[i].id       = i;
+   }
+   instr_NoX = VG_(malloc)("replay.nox", trace.hdr->n_instrs + 1);
+   for (i = 0; i < trace.hdr->n_instrs; i++)
+      instr_NoX[i] = cachesim_is_IrNoX(trace.instrs[i].addr,
+                                       trace.instrs[i].len);
+
+   if (n_shards > 1) {
+      shard_bits = VG_(log2)(n_shards);
+      line_bits  = VG_(log2)(D1c.line_size);
+      shard_I1c  = I1c;  shard_I1c.size /= n_shards;
+      shard_D1c  = D1c;  shard_D1c.size /= n_shards;
+      shard_LLc  = LLc;  shard_LLc.size /= n_shards;
+      whole_D1c  = D1c;
+      whole_LLc  = LLc;
+      replay_mc  = mc;
+      replay_sharded();
+      close_cu_log();
+   } else {
+      if (clo_opt) {
+         optCCs = VG_(calloc)("replay.opt.lines", trace.hdr->n_lines + 1,
+                              sizeof(OptCC));
+         opt_D1.line_bits = VG_(log2)(D1c.line_size);
+         opt_LL.line_bits = VG_(log2)(LLc.line_size);
+      }
+      replay(mc);
+      if (clo_opt) {
+         opt_simulate(&opt_D1, &D1c, False);
+         opt_simulate(&opt_LL, &LLc, True);
+      }
+   }
+
+   fp = out_name && strcmp(out_name, "-") != 0 ? fopen(out_name, "w") : stdout;
+   if (!fp)
+      fail("can't open the output file");
+   write_cachegrind_out(fp);
+   if (fp != stdout && fclose(fp) != 0)
+      fail("can't write the output file");
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                               cg_replay.c ---*/
+/*--------------------------------------------------------------------*/
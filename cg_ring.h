@@ -0,0 +1,157 @@
+/*--------------------------------------------------------------------*/
+/*--- Access ring shared with the simulator daemon       cg_ring.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* With --sim-daemon, the tool (cg_main.c) doesn't simulate the caches
+   itself.  It writes its accesses into a ring in a shared file, and the
+   daemon (cg_simd.c) simulates them and hands back the miss counts.  The
+   file is unlinked as soon as it's made;  the daemon inherits its fd.  Like
+   cg_binfmt.h, this only uses the basic Valgrind types.
+
+   Layout of the file:
+
+     CgrHeader
+     CgrRec[n_slots]                  the ring
+     CgrResult[n_results_max]         miss counts, on a sync
+
+   The ring is single-producer (the tool, which advances 'head') and
+   single-consumer (the daemon, 'tail').  Inside the daemon, the FA stage
+   runs ahead of the main one and marks its verdicts in the records;
+   'fa_done' says how far it has got.
+
+   A sync:  the tool publishes everything, bumps 'sync_req' and waits.
+   Once the daemon has simulated all of it, it writes the counts of the
+   lines that changed since the last sync into the results area, up to
+   n_results_max at a time, each time setting 'n_results' and bumping
+   'res_seq', and waiting for the tool to merge them and set 'res_ack'.
+   Then it sets 'sync_done' = 'sync_req'.  The counts are deltas:  the
+   daemon zeroes its own after sending them.
+
+   Every record names the counter shard (see cg_main.c) it is charged
+   to, and the daemon keeps each shard's lines apart, so that a line's
+   eviction is charged to the shard whose access brought it in, as it
+   is in the tool.  A sync with 'finishing'
+   set first charges the lines left in the caches to the eviction bins,
+   as cachesim_finish does, and the daemon exits after it.
+*/
+
+#ifndef __CG_RING_H
+#define __CG_RING_H
+
+#define CGR_MAGIC       "CGRING03"
+#define CGR_N_SLOTS     (1 << 16)      // must be a power of two
+#define CGR_N_RESULTS   4096
+
+typedef enum {
+   CGR_IrNoX,
+   CGR_IrGen,
+   CGR_Dr,
+   CGR_Dw
+} CgrKind;
+
+// Set in CgrRec.flags by the FA stage.
+#define CGR_MISS_FA     0x1
+#define CGR_MISS_FA_LL  0x2
+
+typedef struct {
+   ULong addr;            // data address, or instr address for fetches
+   UInt  id;              // LineCC id the access is charged to
+   Int   line;            // its source line, for the D1 MISS trace
+   UChar kind;            // CgrKind
+   UChar size;
+   UChar flags;           // CGR_MISS_*
+   UChar pad;
+   UInt  shard;           // 0 for the shared counters, else shard id
+} CgrRec;
+
+// The per-line counts the simulator produces;  the access counts
+// themselves are kept by the tool.
+typedef enum {
+   CGR_Ir_m1, CGR_Ir_mL,
+   CGR_Dr_m1, CGR_Dr_mL,
+   CGR_Dr_m1_comp, CGR_Dr_m1_conf, CGR_Dr_m1_cap,
+   CGR_Dr_mL_comp, CGR_Dr_mL_conf, CGR_Dr_mL_cap,
+   CGR_Dw_m1, CGR_Dw_mL,
+   CGR_Dw_m1_comp, CGR_Dw_m1_conf, CGR_Dw_m1_cap,
+   CGR_Dw_mL_comp, CGR_Dw_mL_conf, CGR_Dw_mL_cap,
+   CGR_EvD1_1,
+   CGR_EvLL_1 = CGR_EvD1_1 + 8,
+   CGR_N_VALS = CGR_EvLL_1 + 8
+} CgrVal;
+
+typedef struct {
+   UInt  id;
+   UInt  shard;
+   ULong v[CGR_N_VALS];
+} CgrResult;
+
+// Each field written by one side and read by the other is on its own
+// cache line.
+#define CGR_LINE  64
+
+typedef struct {
+   HChar magic[8];
+   UInt  n_slots;
+   UInt  n_results_max;
+   UInt  miss_classify;   // MissClassify
+   Int   cache[3][3];     // I1, D1, LL:  size, assoc, line size
+   UInt  ll_page_map;     // the LLMap, see cg_sim.c
+   UInt  ll_page_size;
+   UInt  ll_slices;
+   UInt  pad0;
+   ULong ll_seed;
+   UChar pad0b[2 * CGR_LINE - 80];
+
+   ULong head;            // tool:   records published
+   UChar pad1[CGR_LINE - 8];
+   ULong fa_done;         // daemon: records seen by the FA stage
+   UChar pad2[CGR_LINE - 8];
+   ULong tail;            // daemon: records simulated
+   UChar pad3[CGR_LINE - 8];
+
+   ULong sync_req;        // tool
+   UInt  finishing;       // tool
+   UInt  pad4;
+   ULong res_ack;         // tool
+   UChar pad5[CGR_LINE - 24];
+   ULong sync_done;       // daemon
+   ULong res_seq;         // daemon
+   UInt  n_results;       // daemon
+   UInt  pad6;
+   UChar pad7[CGR_LINE - 24];
+} CgrHeader;
+
+#define CGR_RING_OFF(h)     ((ULong)sizeof(CgrHeader))
+#define CGR_RESULTS_OFF(h)  (CGR_RING_OFF(h) + (ULong)(h)->n_slots * sizeof(CgrRec))
+#define CGR_FILE_SIZE(h)    (CGR_RESULTS_OFF(h)                              \
+                             + (ULong)(h)->n_results_max * sizeof(CgrResult))
+
+// Shared fields are only touched through these.
+#define CGR_LOAD(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define CGR_STORE(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+#endif   // __CG_RING_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                cg_ring.h ---*/
+/*--------------------------------------------------------------------*/
@@ -62,9 +62,11 @@ typedef
 //------------------------------------------------------------
 // Primary data structure #1: CC table
 // - Holds the per-source-line hit/miss stats, grouped by file/function/line.
-// - an ordered set of CCs.  CC indexing done by file/function/line (as
-//   determined from the instrAddr).
-// - Traversed for dumping stats at end in file/func/line hierarchy.
+// - a hash table of CCs (see cg_main.c), indexed by file/function/line (as
+//   determined from the instrAddr).  The names are interned, so the index
+//   compares pointers, not strings.
+// - Traversed for dumping stats at end in file/func/line hierarchy;  the
+//   order is established by sorting with cmp_CodeLoc at that point.
 
 typedef struct {
    HChar* file;
@@ -81,25 +83,44 @@ typedef enum {
 
 MissType g_last_d1_miss_type = MISS_COMPULSORY;
 
+/* How much 3C (compulsory/conflict/capacity) classification to do.
+   Selected by --miss-classify and passed as a constant to the
+   always-inlined simulation functions, so that each helper family is
+   specialised at compile time and pays only for what it uses. */
+typedef enum {
+    MissClassifyNone,   /* plain D1/LL simulation, as in stock Cachegrind */
+    MissClassifyD1,     /* classify D1 misses only */
+    MissClassifyAll     /* classify D1 and LL misses */
+} MissClassify;
+
+/*----------Extension of cache efficiency -----------*/
+/* A line's eviction bins.  Cachelines point at the EvictCC of the line
+   whose access brought them in, which is charged when they leave. */
+typedef struct {
+   UInt  id;                 /* The line's id, as in LineCC */
+   UInt  pad;
+   ULong D1[MAX_NUM_BINS];   /* The number of cachline evictions with n(1~8) words used*/
+   ULong LL[MAX_NUM_BINS];   /* The number of cachline evictions with n(1~8) words used*/
+} EvictCC;
+
+/* All the counts of one line.  The tool keeps them in per-feature
+   columns instead, and only puts a LineCC together for output (see
+   cg_main.c);  the native programs use it as is. */
 typedef struct {
    CodeLoc  loc; /* Source location that these counts pertain to */
+   UInt     id;  /* Dense index of the line */
    CacheCC  Ir;  /* Insn read counts */
    CacheCC  Dr;  /* Data read counts */
    CacheCC  Dw;  /* Data write/modify counts */
    BranchCC Bc;  /* Conditional branch counts */
    BranchCC Bi;  /* Indirect branch counts */
-
-/*----------Extension of cache efficiency -----------*/
-   ULong num_evicts_D1[MAX_NUM_BINS]; /* The number of cachline evictions with n(1~8) words used*/
-   ULong num_evicts_LL[MAX_NUM_BINS]; /* The number of cachline evictions with n(1~8) words used*/
+   EvictCC  ev;  /* Eviction bins */
 } LineCC;
 
 // First compare file, then fn, then line.
-static Word cmp_CodeLoc_LineCC(const void *vloc, const void *vcc)
+static Word cmp_CodeLoc(const CodeLoc* a, const CodeLoc* b)
 {
    Word res;
-   const CodeLoc* a = (const CodeLoc*)vloc;
-   const CodeLoc* b = &(((const LineCC*)vcc)->loc);
 
    res = VG_(strcmp)(a->file, b->file);
    if (0 != res)
@@ -112,11 +133,17 @@ static Word cmp_CodeLoc_LineCC(const void *vloc, const void *vcc)
    return a->line - b->line;
 }
 
+__attribute__((unused))
+static Word cmp_CodeLoc_LineCC(const void *vloc, const void *vcc)
+{
+   return cmp_CodeLoc((const CodeLoc*)vloc, &((const LineCC*)vcc)->loc);
+}
+
 /*----------Extension of cache efficiency by JinChao-----------*/
 Int CU_DEBUG = 0;
 
 //Setting nth bit in a bitvector on.
-static
+static __attribute__((unused))
 void bitop_set(UChar* bv, UInt pos)
 {
 	if(bv == NULL || pos < 0)
@@ -150,12 +177,20 @@ UInt bitop_count(UChar bv)
 	return count;
 }
 
+// The simulator's debug log;  NULL for none.
+#ifndef CG_SIM_CU_LOG
+#define CG_SIM_CU_LOG  "causage.dbg"
+#endif
+
 static
 Int open_cu_log(void)
 {
-   const HChar* cu_out_file = "causage.dbg";
+   const HChar* cu_out_file = CG_SIM_CU_LOG;
 //      VG_(expand_file_name)("--cachegrind-out-file", clo_ce_out_file);
 
+   if (cu_out_file == NULL)
+      return -1;
+
    cu_fp = VG_(fopen)(cu_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
                                         VKI_S_IRUSR|VKI_S_IWUSR);
    if (cu_fp == NULL) 
@@ -177,7 +212,7 @@ typedef struct {
   UWord        tag;
   UInt         bitvector;   // keep track of word usage
   Int          line_num; // source code line number
-  LineCC       *src_line;   // pointer to LineCC in cg_main.c
+  EvictCC      *src;        // bins of the line that brought it in
 } cacheline_t;
 
 typedef struct {
@@ -198,13 +233,281 @@ typedef struct {
 } cache_t2;
 
 
-static cache_t2 LL;
-static cache_t2 I1;
-static cache_t2 D1;
+/* Native programs that run several simulators side by side, one per
+ * thread (cgsim-replay --threads), make the simulator state thread-local.
+ */
+#ifndef CG_SIM_STATE
+#define CG_SIM_STATE static
+#endif
+
+CG_SIM_STATE cache_t2 LL;
+CG_SIM_STATE cache_t2 I1;
+CG_SIM_STATE cache_t2 D1;
+
+CG_SIM_STATE cache_infi INFI;
+CG_SIM_STATE cache_fa FA_D1;
+CG_SIM_STATE cache_fa FA_LL;
+
+/* Physically indexed LL (--LL-page-map, --LL-slices).
+ *
+ * Real LLs are indexed by physical address, so which lines conflict
+ * depends on where the OS put the pages.  LL references are translated
+ * first:  each virtual page gets a frame from a keyed bijection of its
+ * number (random), or from one that keeps the page's colour, the low
+ * bits of its number that fall in the LL set index (colored).  Being a
+ * pure function, this needs no page table, so checkpoints and the
+ * simulator daemon only need the configuration.  With several slices,
+ * the slice comes from the physical address through the hash of Intel's
+ * sliced LLCs (Maurice et al., RAID 2015), and the set within the slice
+ * from the low bits of the line number.
+ *
+ * I1 and D1 (virtually indexed on real parts too) and INFI and FA_LL,
+ * which a bijection leaves alone, keep the virtual addresses.
+ */
+typedef enum {
+   LLPageIdentity,
+   LLPageRandom,
+   LLPageColored
+} LLPageMap;
+
+typedef struct {
+   UInt  page_map;      /* LLPageMap */
+   UInt  page_size;     /* bytes */
+   UInt  slices;
+   UInt  pad;
+   ULong seed;
+} LLMap;
+
+#define LL_MAX_SLICES  8
+
+static const ULong LL_slice_masks[3] = {
+   0x1b5f575440ULL, 0x2eb5faa880ULL, 0x3cccc93100ULL
+};
+
+static LLMap LL_map = { LLPageIdentity, 4096, 1, 0, 0 };
+static Bool  LL_mapped = False;      /* anything but identity, one slice */
+static Int   LL_page_line_bits;      /* log2(lines per page) */
+static Int   LL_page_no_bits;        /* bits in a page number */
+static Int   LL_color_bits;
+static Int   LL_slice_bits;
+static Int   LL_slice_set_bits;      /* log2(sets per slice) */
+
+/* Space-Saving sketch (Metwally et al., ICDT 2005), for the heaviest
+ * keys of a stream with far too many distinct keys to count them all.
+ * There are 'k' counters, and a key without one takes over the one with
+ * the lowest count, keeping that count as its 'err'.  Any key behind
+ * more than 1/k of the stream is sure to have a counter, and no count is
+ * more than 'err' too high.  The counters sit in a min-heap by count,
+ * and are found by key through a hash table.
+ */
+#define SS_NONE  0xFFFFFFFF
+
+typedef struct {
+   ULong key;
+   ULong count;
+   ULong err;
+   UInt  next;              /* hash chain */
+   UInt  heap_pos;
+} SSEntry;
 
-static cache_infi INFI;
-static cache_fa FA_D1;
-static cache_fa FA_LL;
+typedef struct {
+   UInt     k;
+   UInt     n;              /* counters in use */
+   UInt     bucket_mask;
+   ULong    total;          /* all counted, kept or not */
+   SSEntry* e;
+   UInt*    heap;           /* into e, least count first */
+   UInt*    buckets;
+} SSketch;
+
+// Forgets every key, but keeps the counters.
+static void ss_reset(SSketch* s)
+{
+   UInt i;
+
+   s->n     = 0;
+   s->total = 0;
+   for (i = 0; i <= s->bucket_mask; i++)
+      s->buckets[i] = SS_NONE;
+}
+
+static void ss_init(SSketch* s, UInt k)
+{
+   UInt size = 1;
+
+   while (size < 2 * k)
+      size <<= 1;
+   s->k           = k;
+   s->bucket_mask = size - 1;
+   s->e       = VG_(malloc)("cg.sim.ssi.1", k * sizeof(SSEntry));
+   s->heap    = VG_(malloc)("cg.sim.ssi.2", k * sizeof(UInt));
+   s->buckets = VG_(malloc)("cg.sim.ssi.3", size * sizeof(UInt));
+   ss_reset(s);
+}
+
+static __inline__ UInt ss_hash(const SSketch* s, ULong key)
+{
+   return (UInt)((key * 0x9E3779B97F4A7C15ULL) >> 32) & s->bucket_mask;
+}
+
+static void ss_place(SSketch* s, UInt pos, UInt i)
+{
+   s->heap[pos]     = i;
+   s->e[i].heap_pos = pos;
+}
+
+static void ss_sift_up(SSketch* s, UInt pos)
+{
+   UInt i = s->heap[pos];
+
+   while (pos > 0) {
+      UInt parent = (pos - 1) / 2;
+      if (s->e[s->heap[parent]].count <= s->e[i].count)
+         break;
+      ss_place(s, pos, s->heap[parent]);
+      pos = parent;
+   }
+   ss_place(s, pos, i);
+}
+
+static void ss_sift_down(SSketch* s, UInt pos)
+{
+   UInt i = s->heap[pos];
+
+   for (;;) {
+      UInt child = 2 * pos + 1;
+      if (child >= s->n)
+         break;
+      if (child + 1 < s->n && s->e[s->heap[child + 1]].count
+                              < s->e[s->heap[child]].count)
+         child++;
+      if (s->e[s->heap[child]].count >= s->e[i].count)
+         break;
+      ss_place(s, pos, s->heap[child]);
+      pos = child;
+   }
+   ss_place(s, pos, i);
+}
+
+// Counts 'key' once, and returns its counter.  *fresh is set if the
+// counter has just been given to 'key', so that whatever the caller
+// keeps alongside it is for another key.
+static UInt ss_count(SSketch* s, ULong key, Bool* fresh)
+{
+   UInt*    chain = &s->buckets[ss_hash(s, key)];
+   SSEntry* e;
+   UInt     i, *link;
+
+   s->total++;
+   *fresh = False;
+   for (i = *chain; i != SS_NONE; i = s->e[i].next) {
+      if (s->e[i].key == key)
+         break;
+   }
+   if (i == SS_NONE) {
+      if (s->n < s->k) {
+         i = s->n++;
+         e = &s->e[i];
+         e->count = 0;
+         e->err   = 0;
+         ss_place(s, i, i);
+      } else {
+         // Take over the least counted key.
+         i = s->heap[0];
+         e = &s->e[i];
+         link = &s->buckets[ss_hash(s, e->key)];
+         while (*link != i)
+            link = &s->e[*link].next;
+         *link  = e->next;
+         e->err = e->count;
+      }
+      e->key  = key;
+      e->next = *chain;
+      *chain  = i;
+      *fresh  = True;
+   }
+   e = &s->e[i];
+   e->count++;
+   if (e->count == 1)
+      ss_sift_up(s, e->heap_pos);
+   else
+      ss_sift_down(s, e->heap_pos);
+   return i;
+}
+
+/* Eviction graph (--evict-pairs).
+ *
+ * Every D1 and LL eviction is a pair of LineCCs:  the evictor, whose miss
+ * brings a line in, and the victim, whose miss brought in the line that
+ * goes.  A run has far too many pairs to count them all, so only the
+ * heaviest are kept, in a Space-Saving sketch keyed by evictor << 32 |
+ * victim.
+ *
+ * Pairs are keyed by EvictCC.id, so a line's rows in the shards of
+ * cg_main.c are one line here.  Fetches have no EvictCC, so they neither
+ * evict nor are evicted.  What kind of miss evicted is only known once
+ * the access is done, so cachesim_setref_is_miss leaves its pairs pending
+ * and cachesim_D1_doref_fa counts them.
+ */
+typedef struct {
+   SSketch ss;
+   ULong   (*by_type)[3];   /* per counter, by MissType, when classified */
+   UInt    n_pending;
+   ULong   pending[2];      /* two for a straddler */
+} EvictGraph;
+
+static Bool EG_on = False;
+CG_SIM_STATE EvictGraph EG_D1;
+CG_SIM_STATE EvictGraph EG_LL;
+
+static void evict_graph_init(EvictGraph* g, UInt k)
+{
+   ss_init(&g->ss, k);
+   g->by_type   = VG_(malloc)("cg.sim.egi.1", k * sizeof(g->by_type[0]));
+   g->n_pending = 0;
+}
+
+// Keep D1 and LL eviction graphs of 'k' counters each.
+__attribute__((unused))
+static void cachesim_init_evict_graph(UInt k)
+{
+   evict_graph_init(&EG_D1, k);
+   evict_graph_init(&EG_LL, k);
+   EG_on = True;
+}
+
+__attribute__((unused))
+static void cachesim_reset_evict_graph(void)
+{
+   if (EG_on) {
+      ss_reset(&EG_D1.ss);
+      ss_reset(&EG_LL.ss);
+      EG_D1.n_pending = EG_LL.n_pending = 0;
+   }
+}
+
+static __inline__ void evict_graph_note(EvictGraph* g, UInt evictor,
+                                        UInt victim)
+{
+   tl_assert(g->n_pending < 2);
+   g->pending[g->n_pending++] = (ULong)evictor << 32 | victim;
+}
+
+// 'type' is a MissType, or -1 if the miss wasn't classified.
+static void evict_graph_commit(EvictGraph* g, Int type)
+{
+   UInt i, c;
+   Bool fresh;
+
+   for (i = 0; i < g->n_pending; i++) {
+      c = ss_count(&g->ss, g->pending[i], &fresh);
+      if (fresh)
+         g->by_type[c][0] = g->by_type[c][1] = g->by_type[c][2] = 0;
+      if (type >= 0)
+         g->by_type[c][type]++;
+   }
+   g->n_pending = 0;
+}
 
 /* By this point, the size/assoc/line_size has been checked. */
 static void cachesim_initcache(cache_t config, cache_t2* c)
@@ -244,7 +547,7 @@ static void cachesim_initcache(cache_t config, cache_t2* c)
         c->cachelines[i].tag = 0;
         c->cachelines[i].bitvector = 0;
         c->cachelines[i].line_num = 0;
-        c->cachelines[i].src_line = NULL;
+        c->cachelines[i].src = NULL;
    }
 
    c->lru_list = VG_(malloc)("cg.sim.ci.2",
@@ -264,7 +567,7 @@ static void cachesim_initcache(cache_t config, cache_t2* c)
  */
 __attribute__((always_inline))
 static __inline__
-Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag, UInt word_begin, UInt word_end, Int line_num, void* line)
+Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag, UInt word_begin, UInt word_end, Int line_num, EvictCC* ev)
 {
    int i, j;
 //   UWord *set;
@@ -289,7 +592,7 @@ Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag, UInt word_begi
             tag, set_no, id[0], cache_line_number, line_num);
     }
     
-      /*if (CU_DEBUG && cu_fp && c == &LL) 
+      if (CU_DEBUG && cu_fp && c == &LL) 
          VG_(fprintf)(cu_fp,  "H %lx %x, line: %d, begin: %u, end: %u\n", tag, cacheline[id[0]].bitvector, line_num, word_begin, word_end);*/
 
       return False;
@@ -309,7 +612,7 @@ Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag, UInt word_begi
          /*if (c == &D1) {
             VG_(printf)("D1 HIT: addr=0x%lx set=%u line_num=%d\n", tag, set_no, line_num);
         }
-         /*if (CU_DEBUG && cu_fp && c == &LL) 
+         if (CU_DEBUG && cu_fp && c == &LL) 
             VG_(fprintf)(cu_fp,  "H %lx %x, line: %d, at line: %d, begin: %u, end: %u\n", tag, cacheline[tmp].bitvector, cacheline[tmp].line_num, line_num, word_begin, word_end);*/
 
          return False;
@@ -320,16 +623,16 @@ Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag, UInt word_begi
    UInt evict_id = id[c->assoc - 1];
    cacheline_t evict_line = cacheline[evict_id];
    num_words = bitop_count(evict_line.bitvector);
- // --- ADD THIS BLOCK ---
- const char* miss_type_str[] = {"compulsory", "conflict", "capacity"};
-   if (c == &D1 && evict_line.tag) {
-    int evicted_cache_line_number = set_no * c->assoc + evict_id;
-    VG_(printf)("D1 MISS:0x%lx evicted_addr=0x%lx set=%u way=%u evicted_cache_line=%d miss_type=%s line_num=%d\n",
-        tag, evict_line.tag, set_no, evict_id, evicted_cache_line_number, miss_type_str[g_last_d1_miss_type], line_num);
-}
-   // --- END ADDITION ---
+   if (CU_DEBUG && c == &D1 && evict_line.tag) {
+      static const char* const miss_type_str[] = {
+         "compulsory", "conflict", "capacity"
+      };
+      int evicted_cache_line_number = set_no * c->assoc + evict_id;
+      VG_(printf)("D1 MISS:0x%lx evicted_addr=0x%lx set=%u way=%u evicted_cache_line=%d miss_type=%s line_num=%d\n",
+          tag, evict_line.tag, set_no, evict_id, evicted_cache_line_number, miss_type_str[g_last_d1_miss_type], line_num);
+   }
    if (CU_DEBUG && (!num_words || num_words > MAX_NUM_BINS) && evict_line.tag && cu_fp && c == &D1)
-      VG_(fprintf)(cu_fp,  "ERROR: Ev %lx %x, %u, line: %d, %p\n", evict_line.tag, evict_line.bitvector, num_words, evict_line.line_num, evict_line.src_line);
+      VG_(fprintf)(cu_fp,  "ERROR: Ev %lx %x, %u, line: %d, %p\n", evict_line.tag, evict_line.bitvector, num_words, evict_line.line_num, evict_line.src);
 
    for (j = c->assoc - 1; j > 0; j--) {
       id[j] = id[j - 1];
@@ -337,20 +640,25 @@ Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag, UInt word_begi
    cacheline[evict_id].tag = tag;
    cacheline[evict_id].bitvector = 0;
    cacheline[evict_id].line_num = line_num;
-   cacheline[evict_id].src_line = line;
+   cacheline[evict_id].src = ev;
    bitop_set_range(&cacheline[evict_id].bitvector, word_begin, word_end);
    id[0] = evict_id;
 
-   if(evict_line.tag && evict_line.src_line)
+   if (UNLIKELY(EG_on) && evict_line.tag && evict_line.src && ev
+       && (c == &D1 || c == &LL))
+      evict_graph_note(c == &D1 ? &EG_D1 : &EG_LL, ev->id,
+                       evict_line.src->id);
+
+   if(evict_line.tag && evict_line.src)
    {
      if(c==&D1)
-       evict_line.src_line->num_evicts_D1[num_words-1]++;
+       evict_line.src->D1[num_words-1]++;
 
      if(c==&LL)
-       evict_line.src_line->num_evicts_LL[num_words-1]++;
+       evict_line.src->LL[num_words-1]++;
 
      if (CU_DEBUG && cu_fp && c == &LL) 
-       VG_(fprintf)(cu_fp,  "Ev %lx %x, %u, line: %d, %p\n", evict_line.tag, evict_line.bitvector, num_words, evict_line.line_num, evict_line.src_line);
+       VG_(fprintf)(cu_fp,  "Ev %lx %x, %u, line: %d, %p\n", evict_line.tag, evict_line.bitvector, num_words, evict_line.line_num, evict_line.src);
    }
 
    return True;
@@ -358,7 +666,7 @@ Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag, UInt word_begi
 
 __attribute__((always_inline))
 static __inline__
-Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size, Int line_num, LineCC *line)
+Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size, Int line_num, EvictCC *ev)
 {
    /* A memory block has the size of a cache line */
    UWord block1 =  a         >> c->line_size_bits;
@@ -383,7 +691,7 @@ Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size, Int line_num, LineCC
 
    /* Access entirely within line. */
    if (block1 == block2)
-      return cachesim_setref_is_miss(c, set1, tag1, word_begin, word_end1, line_num, line);
+      return cachesim_setref_is_miss(c, set1, tag1, word_begin, word_end1, line_num, ev);
 
    /* Access straddles two lines. */
    else if (block1 + 1 == block2) {
@@ -394,11 +702,11 @@ Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size, Int line_num, LineCC
       word_end1 = c->num_words_per_line - 1;
 
       /* always do both, as state is updated as side effect */
-      if (cachesim_setref_is_miss(c, set1, tag1, word_begin, word_end1, line_num, line)) {
-         cachesim_setref_is_miss(c, set2, tag2, 0, word_end2, line_num, line);
+      if (cachesim_setref_is_miss(c, set1, tag1, word_begin, word_end1, line_num, ev)) {
+         cachesim_setref_is_miss(c, set2, tag2, 0, word_end2, line_num, ev);
          return True;
       }
-      return cachesim_setref_is_miss(c, set2, tag2, 0, word_end2, line_num, line);
+      return cachesim_setref_is_miss(c, set2, tag2, 0, word_end2, line_num, ev);
    }
    VG_(printf)("addr: %lx  size: %u  blocks: %lu %lu",
                a, size, block1, block2);
@@ -407,6 +715,140 @@ Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size, Int line_num, LineCC
    return True;
 }
 
+/* Checks 'm' against the LL configuration and makes it the one in use;
+ * returns an error message if it doesn't fit.  Call before
+ * cachesim_initcaches. */
+__attribute__((unused))
+static const HChar* cachesim_set_LL_map(const LLMap* m, cache_t LLc)
+{
+   Int sets = LLc.size / (LLc.assoc * LLc.line_size);
+   Int page_bits = VG_(log2)(m->page_size);
+   Int line_bits = VG_(log2)(LLc.line_size);
+   Int set_bits  = VG_(log2)(sets);
+
+   if (m->page_map > LLPageColored)
+      return "bad LL page map";
+   if (page_bits < line_bits || page_bits > 30)
+      return "the LL page size must be a power of two, from the LL line size to 1GB";
+   if (VG_(log2)(m->slices) < 0 || m->slices > LL_MAX_SLICES
+       || (Int)m->slices > sets)
+      return "the number of LL slices must be a power of two, up to 8 "
+             "and the number of LL sets";
+
+   LL_map            = *m;
+   LL_map.pad        = 0;
+   LL_mapped         = m->page_map != LLPageIdentity || m->slices > 1;
+   LL_page_line_bits = page_bits - line_bits;
+   LL_page_no_bits   = 8 * sizeof(UWord) - page_bits;
+   LL_slice_bits     = VG_(log2)(m->slices);
+   LL_slice_set_bits = set_bits - LL_slice_bits;
+   // The page number bits that select sets within a slice.
+   LL_color_bits = LL_slice_set_bits - LL_page_line_bits;
+   if (LL_color_bits < 0)
+      LL_color_bits = 0;
+   return NULL;
+}
+
+// A bijection of the low 'bits' bits of x, keyed by the seed.
+__attribute__((always_inline))
+static __inline__
+UWord cachesim_LL_mix(UWord x, Int bits)
+{
+   UWord mask = bits >= 64 ? ~0UL : (1UL << bits) - 1;
+
+   x = (x ^ (UWord)LL_map.seed) & mask;
+   x = (x * 0x9E3779B97F4A7C15ULL) & mask;
+   x ^= x >> (bits / 2);
+   x = (x * 0xBF58476D1CE4E5B9ULL) & mask;
+   x ^= x >> (bits / 2);
+   return x;
+}
+
+// The physical line of virtual line 'block'.
+__attribute__((always_inline))
+static __inline__
+UWord cachesim_LL_phys(UWord block)
+{
+   UWord page = block >> LL_page_line_bits;
+   UWord off  = block & ((1UL << LL_page_line_bits) - 1);
+   UWord color;
+
+   switch (LL_map.page_map) {
+   case LLPageRandom:
+      page = cachesim_LL_mix(page, LL_page_no_bits);
+      break;
+   case LLPageColored:
+      color = page & ((1UL << LL_color_bits) - 1);
+      page  = cachesim_LL_mix(page >> LL_color_bits,
+                              LL_page_no_bits - LL_color_bits);
+      page  = (page << LL_color_bits) | color;
+      break;
+   default:
+      break;
+   }
+   return (page << LL_page_line_bits) | off;
+}
+
+// The LL set of physical line 'block'.
+__attribute__((always_inline))
+static __inline__
+UInt cachesim_LL_set(UWord block)
+{
+   UWord pa = block << LL.line_size_bits;
+   UInt  slice = 0;
+   Int   i;
+
+   for (i = 0; i < LL_slice_bits; i++)
+      slice |= __builtin_parityll(pa & LL_slice_masks[i]) << i;
+   return (slice << LL_slice_set_bits)
+          | (block & ((1UL << LL_slice_set_bits) - 1));
+}
+
+// cachesim_setref_is_miss for LL, from a virtual line.
+__attribute__((always_inline))
+static __inline__
+Bool cachesim_LL_setref_is_miss(UWord block, UInt word_begin, UInt word_end,
+                                Int line_num, EvictCC* ev)
+{
+   if (LIKELY(!LL_mapped))
+      return cachesim_setref_is_miss(&LL, block & LL.sets_min_1, block,
+                                     word_begin, word_end, line_num, ev);
+   block = cachesim_LL_phys(block);
+   return cachesim_setref_is_miss(&LL, cachesim_LL_set(block), block,
+                                  word_begin, word_end, line_num, ev);
+}
+
+// cachesim_ref_is_miss for LL.  The two lines of a straddling access may
+// be far apart physically, so they are translated one by one.
+__attribute__((always_inline))
+static __inline__
+Bool cachesim_LL_ref_is_miss(Addr a, UChar size, Int line_num, EvictCC *ev)
+{
+   UWord block1, block2, addr_offset, word_begin, word_end1, word_end2;
+   Bool  miss;
+
+   if (LIKELY(!LL_mapped))
+      return cachesim_ref_is_miss(&LL, a, size, line_num, ev);
+
+   block1      =  a         >> LL.line_size_bits;
+   block2      = (a+size-1) >> LL.line_size_bits;
+   addr_offset = a & LL.line_mask;
+   word_begin  = addr_offset >> LL.word_size_bits;
+   word_end1   = (addr_offset + size - 1) >> LL.word_size_bits;
+
+   if (block1 == block2)
+      return cachesim_LL_setref_is_miss(block1, word_begin, word_end1,
+                                        line_num, ev);
+   tl_assert(block1 + 1 == block2);
+   word_end2 = word_end1 - LL.num_words_per_line;
+   word_end1 = LL.num_words_per_line - 1;
+   /* always do both, as state is updated as side effect */
+   miss  = cachesim_LL_setref_is_miss(block1, word_begin, word_end1,
+                                      line_num, ev);
+   miss |= cachesim_LL_setref_is_miss(block2, 0, word_end2, line_num, ev);
+   return miss;
+}
+
 static
 void cachesim_collect_undrained_lines(cache_t2* c)
 {
@@ -418,19 +860,20 @@ void cachesim_collect_undrained_lines(cache_t2* c)
    {
      for (j = 0; j < c->assoc; j++)
      {
-        id = c->lru_list[i * c->assoc + j];
-        if(cl[id].tag && cl[id].src_line) 
+        /* lru_list holds way numbers within the set */
+        id = i * c->assoc + c->lru_list[i * c->assoc + j];
+        if(cl[id].tag && cl[id].src) 
         {
            num_words = bitop_count(cl[id].bitvector);
 /*           if (CU_DEBUG && (!num_words || num_words > MAX_NUM_BINS) && cu_fp && c == &D1)
-              VG_(fprintf)(cu_fp,  "ERROR: Ev %lx %x, %u, line: %d, %p, %llu\n", cl[id].tag, cl[id].bitvector, num_words, cl[id].line_num, cl[id].src_line, cl[id].src_line->num_evicts_D1[num_words-1]);*/
+              VG_(fprintf)(cu_fp,  "ERROR: Ev %lx %x, %u, line: %d, %p, %llu\n", cl[id].tag, cl[id].bitvector, num_words, cl[id].line_num, cl[id].src, cl[id].src->D1[num_words-1]);*/
 
            if(c==&D1)
-             cl[id].src_line->num_evicts_D1[num_words-1]++;
+             cl[id].src->D1[num_words-1]++;
            if(c==&LL)
-             cl[id].src_line->num_evicts_LL[num_words-1]++;
+             cl[id].src->LL[num_words-1]++;
            if (CU_DEBUG && cu_fp && c == &LL)
-              VG_(fprintf)(cu_fp,  "Ev %lx %x, %u, line: %d, %p, %llu\n", cl[id].tag, cl[id].bitvector, num_words, cl[id].line_num, cl[id].src_line, cl[id].src_line->num_evicts_LL[num_words-1]);
+              VG_(fprintf)(cu_fp,  "Ev %lx %x, %u, line: %d, %p, %llu\n", cl[id].tag, cl[id].bitvector, num_words, cl[id].line_num, cl[id].src, cl[id].src->LL[num_words-1]);
         }
      }
    }
@@ -438,11 +881,13 @@ void cachesim_collect_undrained_lines(cache_t2* c)
 
 static void cachefa_initcache(cache_t config, cache_fa* c)
 {
-   VG_(fprintf)(cu_fp, "cachefa_initcache capacity: %d\n", config.size);
+   if (cu_fp)
+      VG_(fprintf)(cu_fp, "cachefa_initcache capacity: %d\n", config.size);
    cachefa_setup(c, (config.size / config.line_size));
 }
 
-static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t LLc)
+static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t LLc,
+                                MissClassify mc)
 {
    open_cu_log();
 
@@ -450,8 +895,12 @@ static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t LLc)
    cachesim_initcache(D1c, &D1);
    cachesim_initcache(LLc, &LL);
 
-   cachefa_initcache(D1c, &FA_D1);
-   cachefa_initcache(LLc, &FA_LL);
+   // The FA caches are only consulted by the helpers of the modes that
+   // need them, so don't pay for them otherwise.
+   if (mc != MissClassifyNone)
+      cachefa_initcache(D1c, &FA_D1);
+   if (mc == MissClassifyAll)
+      cachefa_initcache(LLc, &FA_LL);
 }
 
 static void cachesim_finish(void)
@@ -467,7 +916,7 @@ void cachesim_I1_doref_Gen(Addr a, UChar size, ULong* m1, ULong *mL)
 {
    if (cachesim_ref_is_miss(&I1, a, size, 0, NULL)) {
       (*m1)++;
-      if (cachesim_ref_is_miss(&LL, a, size, 0, NULL))
+      if (cachesim_LL_ref_is_miss(a, size, 0, NULL))
          (*mL)++;
    }
 }
@@ -486,44 +935,63 @@ void cachesim_I1_doref_NoX(Addr a, UChar size, ULong* m1, ULong *mL)
 
    // use block as tag
    if (cachesim_setref_is_miss(&I1, I1_set, block, word_begin, word_end, 0, NULL)) {
-      UInt  LL_set = block & LL.sets_min_1;
       (*m1)++;
       // can use block as tag as L1I and LL cache line sizes are equal
-      if (cachesim_setref_is_miss(&LL, LL_set, block, word_begin, word_end, 0, NULL))
+      if (cachesim_LL_setref_is_miss(block, word_begin, word_end, 0, NULL))
          (*mL)++;
    }
 }
 
+/* The D1/LL part of cachesim_D1_doref, given what the FA caches said.
+ * The simulator daemon (cg_simd.c) runs the FA caches in a stage of
+ * their own and calls this directly.  INFI only records whether a block
+ * was ever touched: a D1 hit implies every block of the access is
+ * already recorded there, so INFI is consulted only when D1 misses. */
 __attribute__((always_inline))
 static __inline__
-Bool cachesim_D1_doref(Addr a, UChar size, ULong* m1, ULong *mL, int line_num, LineCC* line, CacheCC* cc)
+Bool cachesim_D1_doref_fa(Addr a, UChar size, ULong* m1, ULong *mL, int line_num, EvictCC* ev, CacheCC* cc,
+                          const MissClassify mc, Bool miss_fa, Bool miss_fa_LL)
 {
-   Bool miss_infi = cacheinfi_ref_is_miss(&INFI, a, size);
-   Bool miss_fa = cachefa_ref_is_miss(&FA_D1, a, size);
-   Bool miss_fa_LL = cachefa_ref_is_miss(&FA_LL, a, size);
+   Bool miss_infi  = False;
+   Int  LL_type    = -1;
 
-   if (cachesim_ref_is_miss(&D1, a, size, line_num, line)) {
+   if (cachesim_ref_is_miss(&D1, a, size, line_num, ev)) {
       (*m1)++;
 
-     if(miss_infi){
-        cc->m1_comp++;
-        g_last_d1_miss_type = MISS_COMPULSORY;}
-      else if(!miss_fa){
-        cc->m1_conf++;
-        g_last_d1_miss_type = MISS_CONFLICT;}
-      else{
-        cc->m1_cap++;
-        g_last_d1_miss_type = MISS_CAPACITY;
+      if (mc != MissClassifyNone) {
+         miss_infi = cacheinfi_ref_is_miss(&INFI, a, size);
+
+         if(miss_infi){
+            cc->m1_comp++;
+            g_last_d1_miss_type = MISS_COMPULSORY;}
+         else if(!miss_fa){
+            cc->m1_conf++;
+            g_last_d1_miss_type = MISS_CONFLICT;}
+         else{
+            cc->m1_cap++;
+            g_last_d1_miss_type = MISS_CAPACITY;
+         }
       }
-      if (cachesim_ref_is_miss(&LL, a, size, line_num, line)) {
+      if (UNLIKELY(EG_D1.n_pending))
+         evict_graph_commit(&EG_D1, mc != MissClassifyNone
+                                    ? (Int)g_last_d1_miss_type : -1);
+
+      if (cachesim_LL_ref_is_miss(a, size, line_num, ev)) {
          (*mL)++;
 
-         if(miss_infi)
-           cc->mL_comp++;
-         else if(miss_fa_LL)
-           cc->mL_conf++;
-         else
-           cc->mL_cap++;
+         if (mc == MissClassifyAll) {
+            if(miss_infi) {
+              cc->mL_comp++;
+              LL_type = MISS_COMPULSORY; }
+            else if(!miss_fa_LL) {
+              cc->mL_conf++;
+              LL_type = MISS_CONFLICT; }
+            else {
+              cc->mL_cap++;
+              LL_type = MISS_CAPACITY; }
+         }
+         if (UNLIKELY(EG_LL.n_pending))
+            evict_graph_commit(&EG_LL, LL_type);
       }
 
       return True;
@@ -531,6 +999,29 @@ Bool cachesim_D1_doref(Addr a, UChar size, ULong* m1, ULong *mL, int line_num, L
    return False;
 }
 
+/* 'mc' must be a compile-time constant; see MissClassify.
+ *
+ * The FA caches are LRU stacks, so they have to see every access, hits
+ * included, or their recency order drifts away from the real access
+ * stream.
+ */
+__attribute__((always_inline))
+static __inline__
+Bool cachesim_D1_doref(Addr a, UChar size, ULong* m1, ULong *mL, int line_num, EvictCC* ev, CacheCC* cc,
+                       const MissClassify mc)
+{
+   Bool miss_fa    = False;
+   Bool miss_fa_LL = False;
+
+   if (mc != MissClassifyNone)
+      miss_fa = cachefa_ref_is_miss(&FA_D1, a, size);
+   if (mc == MissClassifyAll)
+      miss_fa_LL = cachefa_ref_is_miss(&FA_LL, a, size);
+
+   return cachesim_D1_doref_fa(a, size, m1, mL, line_num, ev, cc, mc,
+                               miss_fa, miss_fa_LL);
+}
+
 /* Check for special case IrNoX. Called at instrumentation time.
  *
  * Does this Ir only touch one cache line, and are L1I/LL cache
@@ -538,6 +1029,7 @@ Bool cachesim_D1_doref(Addr a, UChar size, ULong* m1, ULong *mL, int line_num, L
  *
  * Returning false is always fine, as this calls the generic case
  */
+__attribute__((unused))
 static Bool cachesim_is_IrNoX(Addr a, UChar size)
 {
    UWord block1, block2;
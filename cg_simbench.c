@@ -0,0 +1,331 @@
+/*--------------------------------------------------------------------*/
+/*--- Simulator throughput benchmark                  cg_simbench.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Measures how many data accesses per second the tool's simulator
+   (cg_sim.c and cg_helper.c, built outside Valgrind via cg_nativesim.h)
+   gets through, for synthetic access patterns:
+
+     seq      8-byte reads and writes walking a 64MB buffer
+     stride   64-byte strides over a 256x256 int64 matrix, as stride.c
+     random   uniformly random words of a 64MB buffer
+     zipf     Zipfian (s = 0.99) over the lines of a 64MB buffer
+     chase    a pointer chase, one random cycle over the lines of 64MB
+
+   Each is run through every D1/LL geometry below, with and without the
+   3C classification.  The addresses are made before the clock starts,
+   so only the simulator is timed.  One line per run goes to stdout.
+
+   On one core of a development machine, with the default 4M accesses:
+   seq runs at 53-65 Macc/s without the classification and 33-41 with
+   it;  stride at 18-24 and 14-22;  random, zipf and chase, which mostly
+   miss, at 3-18 and 1-4, slowing as the LL grows.
+
+   Build:  gcc -O2 -o cg_simbench cg_simbench.c -lm
+
+   Usage:  cg_simbench [--accesses=<n>] [--pattern=<name>]
+                       [--miss-classify=none|d1|all] */
+
+#include "cg_nativesim.h"
+#include "cg_helper.c"
+#include "cg_sim.c"
+
+#include <math.h>
+#include <time.h>
+
+#define BUF_SIZE   (64 * 1024 * 1024)
+#define BUF_BASE   0x10000000UL
+#define N_LINES    (BUF_SIZE / 64)
+
+typedef enum { P_Seq, P_Stride, P_Random, P_Zipf, P_Chase, P_N } Pattern;
+
+static const HChar* pattern_name[P_N] = {
+   "seq", "stride", "random", "zipf", "chase"
+};
+
+static const cache_t D1_configs[] = {
+   { 32768,  8, 64 },
+   { 65536, 16, 64 },
+};
+
+static const cache_t LL_configs[] = {
+   {  1048576, 16, 64 },
+   {  8388608, 16, 64 },
+   { 33554432, 16, 64 },
+};
+
+#define N_CONFIGS(a)  (sizeof(a) / sizeof((a)[0]))
+
+static Addr*  addrs;
+static UChar* is_write;
+static ULong  n_accesses = 4000000;
+
+/*------------------------------------------------------------*/
+/*--- Patterns                                             ---*/
+/*------------------------------------------------------------*/
+
+static ULong rng_state = 0x9E3779B97F4A7C15ULL;
+
+// xorshift64*:  the same addresses on every run and every host.
+static ULong rng(void)
+{
+   rng_state ^= rng_state >> 12;
+   rng_state ^= rng_state << 25;
+   rng_state ^= rng_state >> 27;
+   return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+// Spreads line ranks over the sets, as an allocator would.
+static ULong scatter(ULong rank)
+{
+   return (rank * 0x9E3779B1ULL) & (N_LINES - 1);
+}
+
+static void make_zipf(void)
+{
+   double* cdf = VG_(malloc)("simbench.cdf", N_LINES * sizeof(double));
+   double  sum = 0;
+   ULong   i;
+
+   for (i = 0; i < N_LINES; i++) {
+      sum += 1.0 / pow(i + 1, 0.99);
+      cdf[i] = sum;
+   }
+   for (i = 0; i < n_accesses; i++) {
+      double u  = (rng() >> 11) * (1.0 / 9007199254740992.0) * sum;
+      ULong  lo = 0, hi = N_LINES - 1;
+      while (lo < hi) {
+         ULong mid = (lo + hi) / 2;
+         if (cdf[mid] < u) lo = mid + 1;
+         else              hi = mid;
+      }
+      addrs[i] = BUF_BASE + scatter(lo) * 64 + (rng() & 7) * 8;
+   }
+   free(cdf);
+}
+
+static void make_chase(void)
+{
+   UInt* next = VG_(malloc)("simbench.chase", N_LINES * sizeof(UInt));
+   UInt  cur = 0;
+   ULong i;
+
+   // Sattolo's shuffle gives a single cycle through every line.
+   for (i = 0; i < N_LINES; i++)
+      next[i] = i;
+   for (i = N_LINES - 1; i > 0; i--) {
+      ULong j = rng() % i;
+      UInt  t = next[i];
+      next[i] = next[j];
+      next[j] = t;
+   }
+   for (i = 0; i < n_accesses; i++) {
+      addrs[i] = BUF_BASE + (Addr)cur * 64;
+      cur = next[cur];
+   }
+   free(next);
+}
+
+static void make_pattern(Pattern p)
+{
+   ULong i;
+
+   rng_state = 0x9E3779B97F4A7C15ULL;
+   switch (p) {
+   case P_Seq:
+      for (i = 0; i < n_accesses; i++)
+         addrs[i] = BUF_BASE + (i * 8) % BUF_SIZE;
+      break;
+   case P_Stride:
+      for (i = 0; i < n_accesses; i++)
+         addrs[i] = BUF_BASE + (i * 64) % (256 * 256 * 8);
+      break;
+   case P_Random:
+      for (i = 0; i < n_accesses; i++)
+         addrs[i] = BUF_BASE + (rng() % (BUF_SIZE / 8)) * 8;
+      break;
+   case P_Zipf:
+      make_zipf();
+      break;
+   case P_Chase:
+      make_chase();
+      break;
+   default:
+      VG_(tool_panic)("bad pattern");
+   }
+   // A pointer chase only reads;  the rest write one access in four.
+   for (i = 0; i < n_accesses; i++)
+      is_write[i] = p != P_Chase && (i & 3) == 3;
+}
+
+/*------------------------------------------------------------*/
+/*--- Running                                              ---*/
+/*------------------------------------------------------------*/
+
+// Gives back all the simulator's state, so the next run starts cold.
+static void free_caches(void)
+{
+   cache_t2* caches[3] = { &I1, &D1, &LL };
+   cache_fa* fas[2]    = { &FA_D1, &FA_LL };
+   Int i;
+
+   for (i = 0; i < 3; i++) {
+      free(caches[i]->cachelines);
+      free(caches[i]->lru_list);
+      memset(caches[i], 0, sizeof(cache_t2));
+   }
+   for (i = 0; i < 2; i++) {
+      if (fas[i]->table) {
+         free(fas[i]->table->buckets);
+         free(fas[i]->table);
+         free(fas[i]->blocks_list);
+      }
+      memset(fas[i], 0, sizeof(cache_fa));
+   }
+   for (i = 0; i < INFI.cur_num_ranges; i++)
+      free(INFI.ranges[i].bitmap);
+   free(INFI.ranges);
+   memset(&INFI, 0, sizeof(INFI));
+}
+
+// 'mc' must be a compile-time constant, as in the tool.
+__attribute__((always_inline))
+static __inline__
+void simulate(LineCC* lines, const MissClassify mc)
+{
+   ULong i;
+
+   for (i = 0; i < n_accesses; i++) {
+      LineCC*  l  = &lines[i & 15];
+      CacheCC* cc = is_write[i] ? &l->Dw : &l->Dr;
+      cachesim_D1_doref(addrs[i], 8, &cc->m1, &cc->mL, l->loc.line, &l->ev, cc,
+                        mc);
+   }
+}
+
+static double now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run(Pattern p, const cache_t* D1c, const cache_t* LLc,
+                MissClassify mc)
+{
+   static const HChar* mc_name[] = { "none", "d1", "all" };
+   LineCC lines[16];
+   ULong  m1 = 0, mL = 0;
+   double t;
+   Int    i;
+
+   memset(lines, 0, sizeof(lines));
+   for (i = 0; i < 16; i++)
+      lines[i].loc.line = i + 1;
+   cachesim_initcaches(*D1c, *D1c, *LLc, mc);
+
+   t = now();
+   switch (mc) {
+   case MissClassifyNone: simulate(lines, MissClassifyNone); break;
+   case MissClassifyD1:   simulate(lines, MissClassifyD1);   break;
+   case MissClassifyAll:  simulate(lines, MissClassifyAll);  break;
+   }
+   t = now() - t;
+
+   cachesim_finish();
+   free_caches();
+
+   for (i = 0; i < 16; i++) {
+      m1 += lines[i].Dr.m1 + lines[i].Dw.m1;
+      mL += lines[i].Dr.mL + lines[i].Dw.mL;
+   }
+   printf("%-7s D1 %6d,%2d  LL %9d,%2d  3C %-4s  %8.2f Macc/s"
+          "  D1 miss %6.2f%%  LL miss %6.2f%%\n",
+          pattern_name[p], D1c->size, D1c->assoc, LLc->size, LLc->assoc,
+          mc_name[mc], n_accesses / t / 1e6,
+          100.0 * m1 / n_accesses, 100.0 * mL / n_accesses);
+   fflush(stdout);
+}
+
+/*------------------------------------------------------------*/
+/*--- Setup                                                ---*/
+/*------------------------------------------------------------*/
+
+static void usage(void)
+{
+   fprintf(stderr,
+      "usage: cg_simbench [--accesses=<n>] [--pattern=<name>]\n"
+      "                   [--miss-classify=none|d1|all]\n");
+   exit(1);
+}
+
+int main(int argc, char** argv)
+{
+   Int  only_pattern = -1, only_mc = -1;
+   UInt p, d, l;
+   Int  i;
+
+   for (i = 1; i < argc; i++) {
+      const HChar* a = argv[i];
+      if (strncmp(a, "--accesses=", 11) == 0) {
+         n_accesses = strtoull(a + 11, NULL, 10);
+         if (n_accesses == 0)
+            usage();
+      } else if (strncmp(a, "--pattern=", 10) == 0) {
+         for (p = 0; p < P_N; p++) {
+            if (strcmp(a + 10, pattern_name[p]) == 0)
+               only_pattern = p;
+         }
+         if (only_pattern < 0)
+            usage();
+      }
+      else if (strcmp(a, "--miss-classify=none") == 0) only_mc = MissClassifyNone;
+      else if (strcmp(a, "--miss-classify=d1") == 0)   only_mc = MissClassifyD1;
+      else if (strcmp(a, "--miss-classify=all") == 0)  only_mc = MissClassifyAll;
+      else                                             usage();
+   }
+
+   addrs    = VG_(malloc)("simbench.addrs", n_accesses * sizeof(Addr));
+   is_write = VG_(malloc)("simbench.writes", n_accesses);
+
+   for (p = 0; p < P_N; p++) {
+      if (only_pattern >= 0 && (Int)p != only_pattern)
+         continue;
+      make_pattern(p);
+      for (d = 0; d < N_CONFIGS(D1_configs); d++) {
+         for (l = 0; l < N_CONFIGS(LL_configs); l++) {
+            if (only_mc < 0) {
+               run(p, &D1_configs[d], &LL_configs[l], MissClassifyNone);
+               run(p, &D1_configs[d], &LL_configs[l], MissClassifyAll);
+            } else {
+               run(p, &D1_configs[d], &LL_configs[l], only_mc);
+            }
+         }
+      }
+   }
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                             cg_simbench.c ---*/
+/*--------------------------------------------------------------------*/
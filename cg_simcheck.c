@@ -0,0 +1,242 @@
+/*--------------------------------------------------------------------*/
+/*--- Miss classification against known answers       cg_simcheck.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Runs small kernels whose misses can be worked out by hand through the
+   tool's simulator (cg_sim.c and cg_helper.c, via cg_nativesim.h), and
+   checks the D1 and LL misses, their 3C splits and the D1 and LL
+   eviction bins against those answers.  Run it after touching the
+   simulator:  it prints a line per kernel and exits with 1 if any of
+   them is off.
+
+   Build:  gcc -O2 -o cg_simcheck cg_simcheck.c
+
+   Usage:  cg_simcheck
+
+   Every kernel reads, writes, or reads and then writes, 'size' bytes at
+   'offset' in every 'stride' bytes across 'span' bytes, 'passes' times
+   over.  The answers are for the reads, or for the writes if there are
+   no reads;  writes after reads must hit.  The caches are those below:
+   a 32KB 8-way D1 (64 sets of 64B lines, 512 lines) and either an LL
+   big enough that it only ever misses the first time a line is seen or,
+   for the kernels about the LL, a 128KB 4-way one (512 sets, 2048
+   lines).  Under LRU, cycling through more lines than a set (or the
+   cache) holds misses on every line, every pass.
+
+   A line's eviction bin is the number of its words that were used while
+   it was in the cache;  the lines still there at the end are counted
+   too (see cachesim_collect_undrained_lines).  Only D1 misses reach the
+   LL, so it sees only the words they use.  An access across two lines
+   is one miss, but both lines are filled and evicted. */
+
+#include "cg_nativesim.h"
+#include "cg_helper.c"
+#include "cg_sim.c"
+
+#define D1_SETS   64
+#define D1_WAYS   8
+#define D1_LINES  (D1_SETS * D1_WAYS)
+#define SET_SPAN  (D1_SETS * 64)       // bytes between lines of one set
+
+#define LL_SETS      512
+#define LL_WAYS      4
+#define LL_LINES     (LL_SETS * LL_WAYS)
+#define LL_SET_SPAN  (LL_SETS * 64)
+
+static const cache_t big_LL   = { 8388608, 16, 64 };
+static const cache_t small_LL = { LL_LINES * 64, LL_WAYS, 64 };
+
+typedef enum { Read, Write, Modify } Op;
+
+typedef struct {
+   const HChar*   name;
+   const cache_t* LLc;
+   Op    op;
+   UInt  offset, size;
+   UInt  stride, span, passes;
+   ULong m1, comp, conf, cap;
+   ULong mL, mL_comp, mL_conf, mL_cap;
+   UInt  bin, LL_bin;     // words used of every evicted D1 and LL line
+} Kernel;
+
+static const Kernel kernels[] = {
+   // 256 lines fit:  each is missed once, and all 8 words are used.
+   { "seq-fits",    &big_LL, Read, 0, 8, 8, 256 * 64, 4,
+     256, 256, 0, 0,   256, 256, 0, 0,   8, 1 },
+
+   // 9 lines a set cycle through 8 ways, and 576 through 512 lines:
+   // every line misses every pass, after the first as capacity.
+   { "seq-over",    &big_LL, Read, 0, 8, 8, (D1_LINES + D1_SETS) * 64, 4,
+     4 * 576, 576, 0, 3 * 576,   576, 576, 0, 0,   8, 1 },
+
+   // The same, written.
+   { "seq-write",   &big_LL, Write, 0, 8, 8, (D1_LINES + D1_SETS) * 64, 4,
+     4 * 576, 576, 0, 3 * 576,   576, 576, 0, 0,   8, 1 },
+
+   // The same, read and written back:  the reads miss.
+   { "seq-modify",  &big_LL, Modify, 0, 8, 8, (D1_LINES + D1_SETS) * 64, 4,
+     4 * 576, 576, 0, 3 * 576,   576, 576, 0, 0,   8, 1 },
+
+   // 8 lines in one set fit its ways.
+   { "set-fits",    &big_LL, Read, 0, 8, SET_SPAN, D1_WAYS * SET_SPAN, 4,
+     8, 8, 0, 0,   8, 8, 0, 0,   1, 1 },
+
+   // 9 lines in one set don't, though the cache could hold them:
+   // conflict misses.
+   { "set-over",    &big_LL, Read, 0, 8, SET_SPAN, (D1_WAYS + 1) * SET_SPAN, 4,
+     4 * 9, 9, 3 * 9, 0,   9, 9, 0, 0,   1, 1 },
+
+   // stride.c's walk:  a line per int64 element 8 apart, over a
+   // 256x256 matrix of 8192 lines;  its "Expected Cache Misses" a pass.
+   { "stride-64",   &big_LL, Read, 0, 8, 64, 256 * 256 * 8, 2,
+     2 * 8192, 8192, 0, 8192,   8192, 8192, 0, 0,   1, 1 },
+
+   // Two words a line, over twice the cache:  only the first of them
+   // misses, and reaches the LL.
+   { "stride-32",   &big_LL, Read, 0, 8, 32, 2 * D1_LINES * 64, 3,
+     3 * 1024, 1024, 0, 2 * 1024,   1024, 1024, 0, 0,   2, 1 },
+
+   // The last word of one line and the first of the next, every other
+   // line, over twice the cache.
+   { "straddle",    &big_LL, Read, 60, 8, 128, 2 * D1_LINES * 64, 3,
+     3 * 512, 512, 0, 2 * 512,   512, 512, 0, 0,   1, 1 },
+
+   // 9 lines in one set of both D1 and the small LL, cycling through
+   // 8 and 4 ways:  every pass after the first misses both as conflict.
+   { "ll-set-over", &small_LL, Read, 0, 8, LL_SET_SPAN, 9 * LL_SET_SPAN, 4,
+     4 * 9, 9, 3 * 9, 0,   4 * 9, 9, 3 * 9, 0,   1, 1 },
+
+   // A line a word over 2560 lines, more than the small LL holds:
+   // capacity misses in both.
+   { "ll-over",     &small_LL, Read, 0, 8, 64, (LL_LINES + LL_SETS) * 64, 3,
+     3 * 2560, 2560, 0, 2 * 2560,   3 * 2560, 2560, 0, 2 * 2560,   1, 1 },
+
+   // The same with 32-byte reads, half of every line.
+   { "ll-over-32B", &small_LL, Read, 0, 32, 64, (LL_LINES + LL_SETS) * 64, 3,
+     3 * 2560, 2560, 0, 2 * 2560,   3 * 2560, 2560, 0, 2 * 2560,   4, 4 },
+};
+
+#define N_KERNELS  (sizeof(kernels) / sizeof(kernels[0]))
+
+// Gives back all the simulator's state, so the next kernel starts cold.
+static void free_caches(void)
+{
+   cache_t2* caches[3] = { &I1, &D1, &LL };
+   cache_fa* fas[2]    = { &FA_D1, &FA_LL };
+   Int i;
+
+   for (i = 0; i < 3; i++) {
+      free(caches[i]->cachelines);
+      free(caches[i]->lru_list);
+      memset(caches[i], 0, sizeof(cache_t2));
+   }
+   for (i = 0; i < 2; i++) {
+      if (fas[i]->table) {
+         free(fas[i]->table->buckets);
+         free(fas[i]->table);
+         free(fas[i]->blocks_list);
+      }
+      memset(fas[i], 0, sizeof(cache_fa));
+   }
+   for (i = 0; i < INFI.cur_num_ranges; i++)
+      free(INFI.ranges[i].bitmap);
+   free(INFI.ranges);
+   memset(&INFI, 0, sizeof(INFI));
+}
+
+static Bool check(const HChar* kernel, const HChar* what, ULong got,
+                  ULong expected)
+{
+   if (got == expected)
+      return True;
+   printf("   %s: %s is %llu, expected %llu\n", kernel, what, got, expected);
+   return False;
+}
+
+static Bool run(const Kernel* k)
+{
+   cache_t  D1c = { D1_LINES * 64, D1_WAYS, 64 };
+   LineCC   line;
+   CacheCC* cc    = k->op == Write ? &line.Dw : &line.Dr;
+   CacheCC* other = k->op == Write ? &line.Dr : &line.Dw;
+   UInt     n_lines = ((k->offset & 63) + k->size + 63) / 64;
+   HChar    what[32];
+   Bool     ok = True;
+   UInt     p, off, b;
+   Addr     a;
+
+   memset(&line, 0, sizeof(line));
+   line.loc.line = 1;
+   cachesim_initcaches(D1c, D1c, *k->LLc, MissClassifyAll);
+   for (p = 0; p < k->passes; p++) {
+      for (off = 0; off < k->span; off += k->stride) {
+         a = 0x10000000 + off + k->offset;
+         if (k->op != Write)
+            cachesim_D1_doref(a, k->size, &line.Dr.m1, &line.Dr.mL,
+                              line.loc.line, &line.ev, &line.Dr,
+                              MissClassifyAll);
+         if (k->op != Read)
+            cachesim_D1_doref(a, k->size, &line.Dw.m1, &line.Dw.mL,
+                              line.loc.line, &line.ev, &line.Dw,
+                              MissClassifyAll);
+      }
+   }
+   cachesim_finish();
+   free_caches();
+
+   ok &= check(k->name, "D1 misses",      cc->m1,      k->m1);
+   ok &= check(k->name, "compulsory",     cc->m1_comp, k->comp);
+   ok &= check(k->name, "conflict",       cc->m1_conf, k->conf);
+   ok &= check(k->name, "capacity",       cc->m1_cap,  k->cap);
+   ok &= check(k->name, "LL misses",      cc->mL,      k->mL);
+   ok &= check(k->name, "LL compulsory",  cc->mL_comp, k->mL_comp);
+   ok &= check(k->name, "LL conflict",    cc->mL_conf, k->mL_conf);
+   ok &= check(k->name, "LL capacity",    cc->mL_cap,  k->mL_cap);
+   ok &= check(k->name, other == &line.Dw ? "Dw misses" : "Dr misses",
+               other->m1 + other->mL, 0);
+   // Every line filled is evicted once, or is still there at the end.
+   for (b = 0; b < MAX_NUM_BINS; b++) {
+      sprintf(what, "D1 bin %u", b + 1);
+      ok &= check(k->name, what, line.ev.D1[b],
+                  b + 1 == k->bin ? k->m1 * n_lines : 0);
+      sprintf(what, "LL bin %u", b + 1);
+      ok &= check(k->name, what, line.ev.LL[b],
+                  b + 1 == k->LL_bin ? k->mL * n_lines : 0);
+   }
+   printf("%-12s %s\n", k->name, ok ? "ok" : "FAILED");
+   return ok;
+}
+
+int main(void)
+{
+   Bool ok = True;
+   UInt i;
+
+   for (i = 0; i < N_KERNELS; i++)
+      ok &= run(&kernels[i]);
+   return ok ? 0 : 1;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                             cg_simcheck.c ---*/
+/*--------------------------------------------------------------------*/
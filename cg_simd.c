@@ -0,0 +1,387 @@
+/*--------------------------------------------------------------------*/
+/*--- Cache simulator daemon                              cg_simd.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* The other end of --sim-daemon (see cg_ring.h).  The tool starts this
+   with the fd of the ring file, which is already unlinked;  it runs the same simulator as the
+   tool (cg_sim.c and cg_helper.c), in two stages:
+
+     - the FA stage runs the fully-associative caches used by the 3C
+       classification, on its own thread, and marks its verdicts in the
+       records;
+     - the main stage, behind it, runs I1, D1, LL and the infinite cache,
+       which have to see the accesses in order as they share LL, and
+       keeps the per-line miss counts until the tool asks for them.
+
+   Build:  gcc -O2 -pthread -o cg_simd cg_simd.c
+
+   Usage:  cg_simd <ring-fd>         (only run by the tool) */
+
+#include "cg_nativesim.h"
+#include "cg_helper.c"
+#include "cg_sim.c"
+#include "cg_ring.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static CgrHeader* hdr;
+static CgrRec*    ring;
+static CgrResult* results;
+static ULong      ring_mask;
+static pid_t      tool_pid;
+
+/*------------------------------------------------------------*/
+/*--- LineCCs                                              ---*/
+/*------------------------------------------------------------*/
+
+// The daemon's LineCCs, by the tool's shard and line ids.  Only the
+// counts are used.  They are allocated in chunks, never moved, as the
+// cache lines keep pointers to them.
+#define LINES_PER_CHUNK  4096
+
+typedef struct {
+   LineCC** chunks;
+   UInt     n_chunks;
+} ShardLines;
+
+static ShardLines* shards   = NULL;
+static UInt        n_shards = 0;
+
+static LineCC* line_of(UInt shard, UInt id)
+{
+   UInt c = id / LINES_PER_CHUNK;
+   ShardLines* sl;
+
+   if (UNLIKELY(shard >= n_shards)) {
+      UInt n = n_shards ? n_shards : 4;
+      while (n <= shard) n *= 2;
+      shards = VG_(realloc)("cg_simd.shards", shards,
+                            n * sizeof(ShardLines));
+      memset(shards + n_shards, 0, (n - n_shards) * sizeof(ShardLines));
+      n_shards = n;
+   }
+   sl = &shards[shard];
+   if (UNLIKELY(c >= sl->n_chunks)) {
+      UInt n = sl->n_chunks ? sl->n_chunks : 16;
+      while (n <= c) n *= 2;
+      sl->chunks = VG_(realloc)("cg_simd.lines", sl->chunks,
+                                n * sizeof(LineCC*));
+      memset(sl->chunks + sl->n_chunks, 0,
+             (n - sl->n_chunks) * sizeof(LineCC*));
+      sl->n_chunks = n;
+   }
+   if (UNLIKELY(!sl->chunks[c]))
+      sl->chunks[c] = VG_(calloc)("cg_simd.chunk", LINES_PER_CHUNK,
+                                  sizeof(LineCC));
+   return &sl->chunks[c][id % LINES_PER_CHUNK];
+}
+
+/*------------------------------------------------------------*/
+/*--- Waiting                                              ---*/
+/*------------------------------------------------------------*/
+
+// Spins before idle() starts sleeping, and its longest sleep.
+#define IDLE_SPINS      256
+#define IDLE_MAX_NS     1000000
+
+// Nothing to do.  More usually comes soon, so give the core away a few
+// times, then sleep, a microsecond longer each time up to IDLE_MAX_NS.
+// '*n' counts the calls since the caller last had work.  Go if the
+// tool has gone.
+static void idle(UInt* n)
+{
+   struct timespec ts;
+   ULong ns;
+
+   if ((++*n & 0xFF) == 0 && getppid() != tool_pid)
+      exit(1);
+   if (*n <= IDLE_SPINS) {
+      sched_yield();
+      return;
+   }
+   ns = (ULong)(*n - IDLE_SPINS) * 1000;
+   if (ns > IDLE_MAX_NS)
+      ns = IDLE_MAX_NS;
+   ts.tv_sec  = 0;
+   ts.tv_nsec = ns;
+   nanosleep(&ts, NULL);
+}
+
+/*------------------------------------------------------------*/
+/*--- The FA stage                                         ---*/
+/*------------------------------------------------------------*/
+
+static void* fa_stage(void* arg)
+{
+   const MissClassify mc = (MissClassify)hdr->miss_classify;
+   ULong i = 0;
+   UInt  idling = 0;
+
+   (void)arg;
+   for (;;) {
+      ULong head = CGR_LOAD(&hdr->head);
+
+      if (i == head) {
+         idle(&idling);
+         continue;
+      }
+      idling = 0;
+      for (; i < head; i++) {
+         CgrRec* r = &ring[i & ring_mask];
+         UChar   f = 0;
+
+         if (r->kind >= CGR_Dr) {
+            if (mc != MissClassifyNone
+                && cachefa_ref_is_miss(&FA_D1, r->addr, r->size))
+               f |= CGR_MISS_FA;
+            if (mc == MissClassifyAll
+                && cachefa_ref_is_miss(&FA_LL, r->addr, r->size))
+               f |= CGR_MISS_FA_LL;
+         }
+         r->flags = f;
+         // Let the main stage in now and then, not just at the end.
+         if ((i & 0xFF) == 0xFF)
+            CGR_STORE(&hdr->fa_done, i + 1);
+      }
+      CGR_STORE(&hdr->fa_done, i);
+   }
+   return NULL;
+}
+
+/*------------------------------------------------------------*/
+/*--- The main stage                                       ---*/
+/*------------------------------------------------------------*/
+
+// 'mc' must be a compile-time constant, as for the tool's helpers.
+__attribute__((always_inline))
+static __inline__
+void simulate(ULong from, ULong to, const MissClassify mc)
+{
+   for (; from < to; from++) {
+      const CgrRec* r = &ring[from & ring_mask];
+      LineCC* l = line_of(r->shard, r->id);
+
+      switch (r->kind) {
+      case CGR_IrNoX:
+         cachesim_I1_doref_NoX(r->addr, r->size, &l->Ir.m1, &l->Ir.mL);
+         break;
+      case CGR_IrGen:
+         cachesim_I1_doref_Gen(r->addr, r->size, &l->Ir.m1, &l->Ir.mL);
+         break;
+      case CGR_Dr:
+         cachesim_D1_doref_fa(r->addr, r->size, &l->Dr.m1, &l->Dr.mL,
+                              r->line, &l->ev, &l->Dr, mc,
+                              r->flags & CGR_MISS_FA,
+                              r->flags & CGR_MISS_FA_LL);
+         break;
+      case CGR_Dw:
+         cachesim_D1_doref_fa(r->addr, r->size, &l->Dw.m1, &l->Dw.mL,
+                              r->line, &l->ev, &l->Dw, mc,
+                              r->flags & CGR_MISS_FA,
+                              r->flags & CGR_MISS_FA_LL);
+         break;
+      default:
+         VG_(tool_panic)("bad access record");
+      }
+   }
+}
+
+static void fill_cc(ULong* v, const CacheCC* cc)
+{
+   v[0] = cc->m1;       v[1] = cc->mL;
+   v[2] = cc->m1_comp;  v[3] = cc->m1_conf;  v[4] = cc->m1_cap;
+   v[5] = cc->mL_comp;  v[6] = cc->mL_conf;  v[7] = cc->mL_cap;
+}
+
+// Hand 'n' results to the tool and wait for it to take them.
+static void publish_results(UInt n)
+{
+   ULong seq = hdr->res_seq + 1;
+   UInt  idling = 0;
+
+   hdr->n_results = n;
+   CGR_STORE(&hdr->res_seq, seq);
+   while (CGR_LOAD(&hdr->res_ack) != seq)
+      idle(&idling);
+}
+
+// Send the counts of every line that has any, and clear them.
+static void send_results(void)
+{
+   UInt s, c, i, j, n = 0;
+
+   for (s = 0; s < n_shards; s++) {
+      for (c = 0; c < shards[s].n_chunks; c++) {
+         if (!shards[s].chunks[c])
+            continue;
+         for (i = 0; i < LINES_PER_CHUNK; i++) {
+            LineCC*    l = &shards[s].chunks[c][i];
+            CgrResult* r = &results[n];
+            Bool any = False;
+
+            r->id    = c * LINES_PER_CHUNK + i;
+            r->shard = s;
+            r->v[CGR_Ir_m1] = l->Ir.m1;
+            r->v[CGR_Ir_mL] = l->Ir.mL;
+            fill_cc(&r->v[CGR_Dr_m1], &l->Dr);
+            fill_cc(&r->v[CGR_Dw_m1], &l->Dw);
+            for (j = 0; j < MAX_NUM_BINS; j++) {
+               r->v[CGR_EvD1_1 + j] = l->ev.D1[j];
+               r->v[CGR_EvLL_1 + j] = l->ev.LL[j];
+            }
+            for (j = 0; j < CGR_N_VALS; j++)
+               any |= r->v[j] != 0;
+            if (!any)
+               continue;
+
+            memset(l, 0, sizeof(*l));
+            if (++n == hdr->n_results_max) {
+               publish_results(n);
+               n = 0;
+            }
+         }
+      }
+   }
+   if (n > 0)
+      publish_results(n);
+}
+
+static void main_stage(void)
+{
+   const MissClassify mc = (MissClassify)hdr->miss_classify;
+   ULong tail = 0;
+   UInt  idling = 0;
+
+   for (;;) {
+      ULong done = CGR_LOAD(&hdr->fa_done);
+
+      if (tail == done) {
+         ULong req = CGR_LOAD(&hdr->sync_req);
+
+         // The tool bumps sync_req after publishing its last records,
+         // so once they are all simulated the counts are complete.
+         if (req != hdr->sync_done && tail == CGR_LOAD(&hdr->head)) {
+            Bool finishing = CGR_LOAD(&hdr->finishing);
+            if (finishing)
+               cachesim_finish();
+            send_results();
+            CGR_STORE(&hdr->sync_done, req);
+            if (finishing)
+               exit(0);
+            idling = 0;
+            continue;
+         }
+         idle(&idling);
+         continue;
+      }
+      idling = 0;
+
+      switch (mc) {
+      case MissClassifyNone: simulate(tail, done, MissClassifyNone); break;
+      case MissClassifyD1:   simulate(tail, done, MissClassifyD1);   break;
+      case MissClassifyAll:  simulate(tail, done, MissClassifyAll);  break;
+      }
+      tail = done;
+      CGR_STORE(&hdr->tail, tail);
+   }
+}
+
+/*------------------------------------------------------------*/
+/*--- Setup                                                ---*/
+/*------------------------------------------------------------*/
+
+static cache_t config_of(const Int* c)
+{
+   cache_t config;
+   config.size      = c[0];
+   config.assoc     = c[1];
+   config.line_size = c[2];
+   return config;
+}
+
+int main(int argc, char** argv)
+{
+   struct stat st;
+   pthread_t   fa;
+   LLMap       ll_map;
+   UChar*      base;
+   char*       end;
+   int         fd;
+
+   if (argc != 2) {
+      fprintf(stderr, "usage: cg_simd <ring-fd>\n");
+      return 1;
+   }
+   tool_pid = getppid();
+
+   fd = (int)strtol(argv[1], &end, 10);
+   if (*end != '\0' || fd < 0 || fstat(fd, &st) != 0
+       || (SizeT)st.st_size < sizeof(CgrHeader)) {
+      fprintf(stderr, "cg_simd: fd %s: can't open ring\n", argv[1]);
+      return 1;
+   }
+   base = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (base == MAP_FAILED) {
+      fprintf(stderr, "cg_simd: fd %s: can't map ring\n", argv[1]);
+      return 1;
+   }
+   hdr = (CgrHeader*)base;
+   if (memcmp(hdr->magic, CGR_MAGIC, sizeof(hdr->magic)) != 0
+       || (hdr->n_slots & (hdr->n_slots - 1)) != 0
+       || (ULong)st.st_size < CGR_FILE_SIZE(hdr)) {
+      fprintf(stderr, "cg_simd: fd %s: not a ring\n", argv[1]);
+      return 1;
+   }
+   ring      = (CgrRec*)(base + CGR_RING_OFF(hdr));
+   results   = (CgrResult*)(base + CGR_RESULTS_OFF(hdr));
+   ring_mask = hdr->n_slots - 1;
+
+   ll_map.page_map  = hdr->ll_page_map;
+   ll_map.page_size = hdr->ll_page_size;
+   ll_map.slices    = hdr->ll_slices;
+   ll_map.seed      = hdr->ll_seed;
+   if (cachesim_set_LL_map(&ll_map, config_of(hdr->cache[2]))) {
+      fprintf(stderr, "cg_simd: fd %s: bad LL page map\n", argv[1]);
+      return 1;
+   }
+   cachesim_initcaches(config_of(hdr->cache[0]), config_of(hdr->cache[1]),
+                       config_of(hdr->cache[2]),
+                       (MissClassify)hdr->miss_classify);
+
+   if (pthread_create(&fa, NULL, fa_stage, NULL) != 0) {
+      fprintf(stderr, "cg_simd: can't start the FA stage\n");
+      return 1;
+   }
+   main_stage();
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                cg_simd.c ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,136 @@
+/*--------------------------------------------------------------------*/
+/*--- Format of --record-trace files                    cg_trace.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Written by the tool (cg_main.c, --record-trace) and replayed by
+   cg_replay.c.  Like cg_binfmt.h, whose varint and zigzag helpers it
+   uses, this only uses the basic Valgrind types.
+
+   Layout (all fixed-size integers in host byte order):
+
+     CgtHeader                        patched in place once all else is out
+     blocks                           CgtBlock, then 'size' bytes of records
+     index at index_off (8-aligned):  ULong[n_blocks], offset of each block
+     instrs at instrs_off:            CgtInstr[n_instrs]
+     extras at extras_off:            CgtExtra[n_extras]
+     lines at lines_off:              CgtLine[n_lines]
+     string table at strtab_off:      as in cg_binfmt.h
+
+   A record is one access, in the order the simulator saw them:
+
+     varint  kind | size << 2         CgtKind;  size only for data
+     varint  zigzag(instr - prev instr)
+     varint  zigzag(addr - prev addr)         data only
+
+   'instr' numbers a CgtInstr, which gives the address, length and line of
+   an instruction.  The deltas start from 0 in each block, so that blocks
+   can be decoded on their own.
+
+   The tool counts some accesses without simulating them, as it can tell
+   they hit (see fold_events in cg_main.c);  those aren't in the stream.
+   A replay counts them from the extras of the fetch that carries them:
+   instr.n_extras CgtExtras from instr.first_extra, each to be added to a
+   line's counts every time the instruction is fetched.  A fetch is only
+   folded when it is in the same I1 line as the one before, so the
+   counts are only right for I1 lines at least as big as the recorded
+   ones;  the header has the recorded caches.  The data accesses folded
+   lie within the access before them, which holds for any cache.  The
+   data accesses that --sim-range or --sim-fn leave out aren't recorded
+   at all.
+*/
+
+#ifndef __CG_TRACE_H
+#define __CG_TRACE_H
+
+#define CGT_MAGIC       "CGTRC002"
+#define CGT_BLOCK_SIZE  (256 * 1024)   // max bytes of records in a block
+#define CGT_MAX_REC     (3 * CGB_MAX_VARINT)
+
+typedef enum {
+   CGT_IrNoX,       // a fetch that the tool's config found in one line
+   CGT_IrGen,
+   CGT_Dr,          // also Dm
+   CGT_Dw
+} CgtKind;
+
+#define CGT_KIND_BITS   2
+#define CGT_KIND_MASK   ((1 << CGT_KIND_BITS) - 1)
+
+// As cache_t.
+typedef struct {
+   Int   size;
+   Int   assoc;
+   Int   line_size;
+} CgtCache;
+
+typedef struct {
+   HChar magic[8];
+   UInt  n_blocks;
+   UInt  max_size;        // largest data access
+   ULong n_recs;
+   ULong n_instrs;
+   ULong n_extras;
+   ULong n_lines;
+   UInt  n_strings;
+   UInt  cmd_str;
+   ULong index_off;
+   ULong instrs_off;
+   ULong extras_off;
+   ULong lines_off;
+   ULong strtab_off;
+   CgtCache I1, D1, LL;   // the caches it was recorded with
+   UInt  pad;
+} CgtHeader;
+
+typedef struct {
+   UInt  n_recs;
+   UInt  size;            // bytes of records that follow
+} CgtBlock;
+
+typedef struct {
+   ULong addr;
+   UInt  line;            // CgtLine index
+   UChar len;
+   UChar pad;
+   UShort n_extras;
+   ULong first_extra;
+} CgtInstr;
+
+typedef struct {
+   UInt  line;
+   UChar Ir, Dr, Dw;
+   UChar pad;
+} CgtExtra;
+
+typedef struct {
+   UInt  file_str;
+   UInt  fn_str;
+   Int   line;
+   UInt  pad;
+} CgtLine;
+
+#endif   // __CG_TRACE_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                               cg_trace.h ---*/
+/*--------------------------------------------------------------------*/
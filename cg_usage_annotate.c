@@ -0,0 +1,757 @@
+/*--------------------------------------------------------------------*/
+/*--- Annotator for the cacheusage files       cg_usage_annotate.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* cg_annotate for the cacheusage files.  Merges any number of
+   cacheusage.d1.out and cacheusage.ll.out files, cachegrind.out files
+   and --output-format=binary files (which hold all three), sorts the
+   functions and lines by any column or by a metric derived from the
+   eviction bins, and prints the source with each line's figures.
+
+   Build:  gcc -O2 -pthread -o cg_usage_annotate cg_usage_annotate.c \
+                   cg_outread.c cg_binread.c
+
+   Usage:  cg_usage_annotate [--show=<field>,...] [--sort=<field>,...]
+                             [--threshold=<pct>] [--auto=yes|no]
+                             [--context=<n>] [--threads=<n>] [-I <dir>]...
+                             [-d <cacheusage.d1.out>]...
+                             [-l <cacheusage.ll.out>]...
+                             [<cachegrind.out or binary file>]...
+
+   A cacheusage file can also be given without -d or -l if its name has
+   ".d1." or ".ll." in it.  Files of the same kind are summed, line by
+   line, so per-thread files and dumps can be merged.
+
+   The fields are the inputs' columns (cachegrind.out events such as Ir
+   or D1mr, and the cacheusage columns as "D1:Conf#", "LL:3-words" etc.)
+   and, for each cache level L with a cacheusage input, the metrics
+
+     L:words/ev   words used, on average, per evicted line
+     L:use%       words/ev as a percentage of the words in a line
+     L:wasted     words brought in with evicted lines but never used
+     L:miss%      misses per access
+     L:comp%      compulsory misses per miss  (and L:conf%, L:cap%)
+
+   --sort orders by its first field, then the next, and so on, biggest
+   first.  Only functions and lines with at least --threshold percent
+   (default 0.1) of the first sort field's total are listed;  for a ratio
+   that's of its denominator (Cacheline# for words/ev, Miss# for conf%
+   and so on), so a line with two misses can't top the conf% list.
+
+   With --auto=yes (the default), the source files of the listed
+   functions are annotated, showing --context lines (default 8) around
+   each line with counts.  Relative file names are looked for in the
+   current directory and then in each -I directory.
+
+   The inputs are read by cg_outread.c:  they are mapped, not read, only
+   the columns the fields need are kept, and big text files, and many
+   files, are parsed by --threads threads (by default, one per CPU). */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cg_outread.h"
+
+#define MAX_FIELDS   32
+#define MAX_DIRS     32
+
+static CgoInput* inputs;
+static UInt      n_inputs;
+static CgoFuncs  all;
+
+/*------------------------------------------------------------*/
+/*--- Fields                                               ---*/
+/*------------------------------------------------------------*/
+
+typedef enum {
+   FRaw, FWordsPerEv, FUsePct, FWasted, FMissPct, FCompPct, FConfPct,
+   FCapPct, FN
+} FieldKind;
+
+static const char* const metric_names[FN] = {
+   NULL, "words/ev", "use%", "wasted", "miss%", "comp%", "conf%", "cap%"
+};
+
+typedef struct {
+   const char* name;
+   FieldKind   kind;
+   Int         slot;     // FRaw
+   UInt        level;    // the metrics
+   int         width;
+} Field;
+
+// The slots of a level's cacheusage columns.
+typedef struct {
+   Bool  on;
+   Int   acc, miss, comp, conf, cap, ev;
+   Int   bin[CGB_N_BINS];
+   UInt  n_bins;
+} Level;
+
+static Level levels[2];
+static Field show[MAX_FIELDS], sort[MAX_FIELDS];
+static UInt  n_show, n_sort;
+
+static void need_level(UInt l)
+{
+   Level* L = &levels[l];
+   char   bin_name[16];
+   Int    c;
+
+   if (L->on)
+      return;
+   if (cgo_level_col(l, "Cacheline#") < 0)
+      cgo_fail("the %s metrics need a cacheusage.%s input", cgo_level_names[l],
+           l ? "ll" : "d1");
+   L->on   = True;
+   L->acc  = cgo_need_col(cgo_level_col(l, "Access#"));
+   L->miss = cgo_need_col(cgo_level_col(l, "Miss#"));
+   L->comp = cgo_need_col(cgo_level_col(l, "Comp#"));
+   L->conf = cgo_need_col(cgo_level_col(l, "Conf#"));
+   L->cap  = cgo_need_col(cgo_level_col(l, "Cap#"));
+   L->ev   = cgo_need_col(cgo_level_col(l, "Cacheline#"));
+   for (L->n_bins = 0; L->n_bins < CGB_N_BINS; L->n_bins++) {
+      snprintf(bin_name, sizeof(bin_name), "%u-words", L->n_bins + 1);
+      if ((c = cgo_level_col(l, bin_name)) < 0)
+         break;
+      L->bin[L->n_bins] = cgo_need_col(c);
+   }
+}
+
+static void list_fields(void)
+{
+   UInt c, l, k;
+
+   fprintf(stderr, "columns:");
+   for (c = 0; c < cgo_n_cols; c++)
+      fprintf(stderr, " %s", cgo_col_names[c]);
+   fprintf(stderr, "\n");
+   for (l = 0; l < 2; l++) {
+      if (cgo_level_col(l, "Cacheline#") < 0)
+         continue;
+      fprintf(stderr, "metrics:");
+      for (k = 1; k < FN; k++)
+         fprintf(stderr, " %s:%s", cgo_level_names[l], metric_names[k]);
+      fprintf(stderr, "\n");
+   }
+}
+
+static void parse_field(Field* f, const char* name)
+{
+   Int  c = cgo_find_col(name);
+   UInt l, k;
+
+   memset(f, 0, sizeof(*f));
+   f->name = name;
+   if (c >= 0) {
+      f->kind = FRaw;
+      f->slot = cgo_need_col(c);
+      return;
+   }
+   for (l = 0; l < 2; l++) {
+      if (strncmp(name, cgo_level_names[l], 2) != 0 || name[2] != ':')
+         continue;
+      for (k = 1; k < FN; k++) {
+         if (strcmp(name + 3, metric_names[k]) == 0) {
+            need_level(l);
+            f->kind  = k;
+            f->level = l;
+            return;
+         }
+      }
+   }
+   list_fields();
+   cgo_fail("no column or metric '%s'", name);
+}
+
+static UInt parse_fields(Field* fs, char* list)
+{
+   UInt  n = 0;
+   char* tok;
+
+   for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+      if (n == MAX_FIELDS)
+         cgo_fail("more than %d fields", MAX_FIELDS);
+      parse_field(&fs[n++], tok);
+   }
+   return n;
+}
+
+static ULong slot_val(const ULong* v, Int s)
+{
+   return s >= 0 ? v[s] : 0;
+}
+
+// Words of the evicted lines that were used, and that weren't.
+static void words_of(const Level* L, const ULong* v, ULong* used,
+                     ULong* wasted)
+{
+   UInt k;
+
+   *used = *wasted = 0;
+   for (k = 0; k < L->n_bins; k++) {
+      ULong b = v[L->bin[k]];
+      *used   += (k + 1) * b;
+      *wasted += (L->n_bins - 1 - k) * b;
+   }
+}
+
+// What a field's share of the total is judged by:  the count itself, or
+// a metric's denominator.
+static ULong field_weight(const Field* f, const ULong* v)
+{
+   const Level* L = &levels[f->level];
+   ULong used, wasted;
+
+   switch (f->kind) {
+   case FRaw:
+      return v[f->slot];
+   case FWasted:
+      words_of(L, v, &used, &wasted);
+      return wasted;
+   case FWordsPerEv:
+   case FUsePct:
+      return slot_val(v, L->ev);
+   case FMissPct:
+      return slot_val(v, L->acc);
+   default:
+      return slot_val(v, L->miss);
+   }
+}
+
+// A field's value, or -1 if it's a metric with a zero denominator.
+static double field_value(const Field* f, const ULong* v)
+{
+   const Level* L = &levels[f->level];
+   ULong  used, wasted, d = field_weight(f, v);
+
+   if (f->kind == FRaw || f->kind == FWasted)
+      return (double)d;
+   if (d == 0)
+      return -1;
+   switch (f->kind) {
+   case FWordsPerEv:
+      words_of(L, v, &used, &wasted);
+      return (double)used / d;
+   case FUsePct:
+      words_of(L, v, &used, &wasted);
+      return 100.0 * used / ((double)d * L->n_bins);
+   case FMissPct:
+      return 100.0 * slot_val(v, L->miss) / d;
+   case FCompPct:
+      return 100.0 * slot_val(v, L->comp) / d;
+   case FConfPct:
+      return 100.0 * slot_val(v, L->conf) / d;
+   default:
+      return 100.0 * slot_val(v, L->cap) / d;
+   }
+}
+
+// 'n' with thousands separators.
+static void fmt_count(char* buf, ULong n)
+{
+   char tmp[32];
+   int  len = snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long)n);
+   int  i, j = 0;
+
+   for (i = 0; i < len; i++) {
+      if (i > 0 && (len - i) % 3 == 0)
+         buf[j++] = ',';
+      buf[j++] = tmp[i];
+   }
+   buf[j] = '\0';
+}
+
+static void fmt_field(char* buf, const Field* f, const ULong* v)
+{
+   double x = field_value(f, v);
+
+   if (f->kind == FRaw || f->kind == FWasted) {
+      if (x == 0)
+         strcpy(buf, ".");
+      else
+         fmt_count(buf, (ULong)x);
+   } else if (x < 0) {
+      strcpy(buf, ".");
+   } else {
+      snprintf(buf, 32, f->kind == FWordsPerEv ? "%.2f" : "%.1f", x);
+   }
+}
+
+static void set_widths(const ULong* total)
+{
+   char buf[32];
+   UInt i;
+
+   for (i = 0; i < n_show; i++) {
+      int w;
+      fmt_field(buf, &show[i], total);
+      w = strlen(buf);
+      show[i].width = (int)strlen(show[i].name);
+      if (w > show[i].width)
+         show[i].width = w;
+   }
+}
+
+static void print_fields(const ULong* v)
+{
+   char buf[32];
+   UInt i;
+
+   for (i = 0; i < n_show; i++) {
+      if (v)
+         fmt_field(buf, &show[i], v);
+      else
+         strcpy(buf, ".");
+      printf("%s%*s", i ? " " : "", show[i].width, buf);
+   }
+}
+
+static void print_field_names(void)
+{
+   UInt i;
+
+   for (i = 0; i < n_show; i++)
+      printf("%s%*s", i ? " " : "", show[i].width, show[i].name);
+}
+
+/*------------------------------------------------------------*/
+/*--- Sorting and listing                                  ---*/
+/*------------------------------------------------------------*/
+
+// A function or a line to list.
+typedef struct {
+   const CgoFunc*  f;
+   Int          line;
+   const ULong* v;
+} Row;
+
+static int cmp_ids(UInt a, UInt b)
+{
+   int res;
+
+   if (a == b)
+      return 0;
+   res = strcmp(all.names.strs[a], all.names.strs[b]);
+   return res ? res : a < b ? -1 : 1;
+}
+
+// By the sort fields, biggest first, then by name and line.
+static int cmp_Row(const void* va, const void* vb)
+{
+   const Row* a = va;
+   const Row* b = vb;
+   UInt i;
+   int  res;
+
+   for (i = 0; i < n_sort; i++) {
+      double p = field_value(&sort[i], a->v), q = field_value(&sort[i], b->v);
+      if (p != q)
+         return p > q ? -1 : 1;
+   }
+   if ((res = cmp_ids(a->f->file, b->f->file)) != 0)
+      return res;
+   if ((res = cmp_ids(a->f->fn, b->f->fn)) != 0)
+      return res;
+   return a->line < b->line ? -1 : a->line > b->line ? 1 : 0;
+}
+
+// The functions, or if 'lines' the lines, with at least 'threshold'
+// percent of the first sort field's weight in 'total', sorted.  Returns
+// how many.
+static UInt select_rows(Bool lines, const ULong* total, double threshold,
+                        Row** out)
+{
+   double min = threshold / 100 * (double)field_weight(&sort[0], total);
+   Row*   rows = NULL;
+   UInt   n = 0, cap = 0, i, j;
+
+   for (i = 0; i < all.n; i++) {
+      const CgoFunc* f = all.f[i];
+      UInt n_rows = lines ? f->n : 1;
+
+      for (j = 0; j < n_rows; j++) {
+         const ULong* v = lines ? &f->vals[(size_t)j * cgo_n_slots] : f->sum;
+         ULong w = field_weight(&sort[0], v);
+         if (w == 0 || (double)w < min)
+            continue;
+         if (n == cap) {
+            cap  = cap ? 2 * cap : 256;
+            rows = cgo_realloc(rows, cap * sizeof(Row));
+         }
+         rows[n].f    = f;
+         rows[n].line = lines ? f->lines[j] : 0;
+         rows[n].v    = v;
+         n++;
+      }
+   }
+   qsort(rows, n, sizeof(Row), cmp_Row);
+   *out = rows;
+   return n;
+}
+
+static void print_rule(void)
+{
+   printf("-----------------------------------------------------------"
+          "---------------------\n");
+}
+
+static void print_section(const char* title)
+{
+   printf("\n");
+   print_rule();
+   printf("-- %s\n", title);
+   print_rule();
+}
+
+/*------------------------------------------------------------*/
+/*--- Source annotation                                    ---*/
+/*------------------------------------------------------------*/
+
+static const char* dirs[MAX_DIRS];
+static UInt        n_dirs;
+
+typedef struct {
+   Int    line;
+   ULong* v;
+} SrcRow;
+
+static int cmp_SrcRow(const void* va, const void* vb)
+{
+   const SrcRow* a = va;
+   const SrcRow* b = vb;
+   return a->line < b->line ? -1 : a->line > b->line ? 1 : 0;
+}
+
+static Bool any_counts(const ULong* v)
+{
+   UInt i;
+
+   for (i = 0; i < cgo_n_slots; i++) {
+      if (v[i])
+         return True;
+   }
+   return False;
+}
+
+static int open_source(const char* name)
+{
+   char path[4096];
+   UInt i;
+   int  fd = open(name, O_RDONLY);
+
+   for (i = 0; fd < 0 && name[0] != '/' && i < n_dirs; i++) {
+      snprintf(path, sizeof(path), "%s/%s", dirs[i], name);
+      fd = open(path, O_RDONLY);
+   }
+   return fd;
+}
+
+// The lines of 'file', summed over the functions they were charged to,
+// with 'context' lines around each one that has counts.
+static void annotate_file(UInt file, Int context)
+{
+   SrcRow* rows;
+   ULong*  sums;
+   UInt    n = 0, r, j, k;
+   struct stat st;
+   const char *p, *end;
+   char*  src = NULL;
+   Int    line, last_printed = 0;
+   int    fd;
+
+   // Gather and merge the file's lines.
+   for (r = 0; r < all.n; r++)
+      n += all.f[r]->file == file ? all.f[r]->n : 0;
+   rows = cgo_realloc(NULL, (n + 1) * sizeof(SrcRow));
+   sums = cgo_realloc(NULL, ((size_t)n + 1) * cgo_n_slots * sizeof(ULong));
+   for (r = 0, n = 0; r < all.n; r++) {
+      const CgoFunc* f = all.f[r];
+      if (f->file != file)
+         continue;
+      for (j = 0; j < f->n; j++) {
+         if (f->lines[j] <= 0)
+            continue;
+         rows[n].line = f->lines[j];
+         rows[n].v    = &f->vals[(size_t)j * cgo_n_slots];
+         n++;
+      }
+   }
+   qsort(rows, n, sizeof(SrcRow), cmp_SrcRow);
+   for (j = 0, k = 0; j < n; k++) {
+      ULong* s = &sums[(size_t)k * cgo_n_slots];
+      memcpy(s, rows[j].v, cgo_n_slots * sizeof(ULong));
+      rows[k].line = rows[j].line;
+      for (j++; j < n && rows[j].line == rows[k].line; j++) {
+         UInt i;
+         for (i = 0; i < cgo_n_slots; i++)
+            s[i] += rows[j].v[i];
+      }
+      rows[k].v = s;
+   }
+   n = k;
+   for (j = 0, k = 0; j < n; j++) {
+      if (any_counts(rows[j].v))
+         rows[k++] = rows[j];
+   }
+   n = k;
+
+   print_section("Annotated source file");
+   printf("-- %s\n", all.names.strs[file]);
+   fd = open_source(all.names.strs[file]);
+   if (fd < 0 || fstat(fd, &st) != 0) {
+      printf("-- not found;  use -I to say where to look\n");
+      if (fd >= 0)
+         close(fd);
+      free(rows);
+      free(sums);
+      return;
+   }
+   if (st.st_size > 0) {
+      src = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (src == MAP_FAILED)
+         src = NULL;
+   }
+   close(fd);
+   print_rule();
+   print_field_names();
+   printf("\n\n");
+
+   // j:  the first counted line not above the current one minus the
+   // context;  k:  the first not below the current one.
+   p   = src;
+   end = src ? src + st.st_size : NULL;
+   for (line = 1, j = 0, k = 0; p && p < end && j < n; line++) {
+      const char* nl  = memchr(p, '\n', end - p);
+      const char* eol = nl ? nl : end;
+
+      while (j < n && rows[j].line < line - context)
+         j++;
+      while (k < n && rows[k].line < line)
+         k++;
+      if (j < n && rows[j].line <= line + context) {
+         if (line != last_printed + 1)
+            printf("-- line %d ----------------------------------------\n",
+                   line);
+         print_fields(k < n && rows[k].line == line ? rows[k].v : NULL);
+         printf("  %.*s\n", (int)(eol - p), p);
+         last_printed = line;
+      }
+      p = nl ? nl + 1 : end;
+   }
+   for (; k < n; k++) {
+      if (rows[k].line < line)
+         continue;
+      printf("-- line %d is past the end of the file\n", rows[k].line);
+      print_fields(rows[k].v);
+      printf("\n");
+   }
+   if (src)
+      munmap(src, st.st_size);
+   free(rows);
+   free(sums);
+}
+
+/*------------------------------------------------------------*/
+/*--- main                                                 ---*/
+/*------------------------------------------------------------*/
+
+static void usage(void)
+{
+   fprintf(stderr,
+      "usage: cg_usage_annotate [--show=<field>,...] [--sort=<field>,...]\n"
+      "                         [--threshold=<pct>] [--auto=yes|no]\n"
+      "                         [--context=<n>] [--threads=<n>] [-I <dir>]...\n"
+      "                         [-d <cacheusage.d1.out>]...\n"
+      "                         [-l <cacheusage.ll.out>]...\n"
+      "                         [<cachegrind.out or binary file>]...\n");
+   exit(1);
+}
+
+static void add_input(const char* name, CgoKind kind)
+{
+   inputs = cgo_realloc(inputs, (n_inputs + 1) * sizeof(CgoInput));
+   memset(&inputs[n_inputs], 0, sizeof(CgoInput));
+   inputs[n_inputs].name = name;
+   inputs[n_inputs].kind = kind;
+   n_inputs++;
+}
+
+// The default fields:  Ir, then for each level there is the misses, the
+// evictions and how well the evicted lines were used.
+static void default_fields(char* show_list, char* sort_list, size_t n)
+{
+   UInt l;
+
+   show_list[0] = sort_list[0] = '\0';
+   if (cgo_find_col("Ir") >= 0)
+      strcpy(show_list, "Ir");
+   for (l = 0; l < 2; l++) {
+      const char* L = cgo_level_names[l];
+      if (cgo_level_col(l, "Cacheline#") < 0)
+         continue;
+      snprintf(show_list + strlen(show_list), n - strlen(show_list),
+               "%s%s:Miss#,%s:Conf#,%s:Cacheline#,%s:words/ev,%s:wasted",
+               show_list[0] ? "," : "", L, L, L, L, L);
+      if (!sort_list[0])
+         snprintf(sort_list, n, "%s:Miss#", L);
+   }
+   if (!show_list[0] && cgo_n_cols > 0)
+      snprintf(show_list, n, "%s", cgo_col_names[0]);
+   if (!sort_list[0])
+      snprintf(sort_list, n, "%s", show_list);
+}
+
+int main(int argc, char** argv)
+{
+   char   show_def[512], sort_def[512];
+   char*  show_list = NULL;
+   char*  sort_list = NULL;
+   double threshold = 0.1;
+   Bool   autoann = True;
+   Int    context = 8;
+   long   n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+   UInt   n_threads = n_cpus < 1 ? 1 : n_cpus > 32 ? 32 : n_cpus;
+   ULong* total;
+   Row*   rows;
+   UInt*  ann_files;
+   UInt   n_rows, n_ann = 0, i, j, r;
+   int    a;
+
+   cgo_prog = "cg_usage_annotate";
+   for (a = 1; a < argc; a++) {
+      const char* s = argv[a];
+      if      (strncmp(s, "--show=", 7) == 0)      show_list = argv[a] + 7;
+      else if (strncmp(s, "--sort=", 7) == 0)      sort_list = argv[a] + 7;
+      else if (strncmp(s, "--threshold=", 12) == 0) threshold = atof(s + 12);
+      else if (strcmp(s, "--auto=yes") == 0)       autoann = True;
+      else if (strcmp(s, "--auto=no") == 0)        autoann = False;
+      else if (strncmp(s, "--context=", 10) == 0)  context = atoi(s + 10);
+      else if (strncmp(s, "--threads=", 10) == 0)  n_threads = atoi(s + 10);
+      else if (strcmp(s, "-I") == 0 && a+1 < argc) {
+         if (n_dirs == MAX_DIRS)
+            cgo_fail("more than %d -I directories", MAX_DIRS);
+         dirs[n_dirs++] = argv[++a];
+      }
+      else if (strcmp(s, "-d") == 0 && a+1 < argc) add_input(argv[++a], CgoUsageD1);
+      else if (strcmp(s, "-l") == 0 && a+1 < argc) add_input(argv[++a], CgoUsageLL);
+      else if (s[0] == '-')                        usage();
+      else                                         add_input(s, CgoCachegrind);
+   }
+   if (n_inputs == 0 || threshold < 0 || context < 0 || n_threads < 1)
+      usage();
+
+   // All the headers first, so the fields can be checked and only their
+   // columns kept before the bodies are read.
+   for (i = 0; i < n_inputs; i++)
+      cgo_open(&inputs[i], inputs[i].name, inputs[i].kind, 0);
+   default_fields(show_def, sort_def, sizeof(show_def));
+   n_show = parse_fields(show, show_list ? show_list : show_def);
+   n_sort = parse_fields(sort, sort_list ? sort_list : sort_def);
+   if (n_show == 0 || n_sort == 0)
+      usage();
+
+   cgo_read(inputs, n_inputs, &all, n_threads);
+
+   total = cgo_realloc(NULL, (cgo_n_slots + 1) * sizeof(ULong));
+   memset(total, 0, (cgo_n_slots + 1) * sizeof(ULong));
+   for (r = 0; r < all.n; r++) {
+      CgoFunc* f = all.f[r];
+      f->sum = cgo_realloc(NULL, (cgo_n_slots + 1) * sizeof(ULong));
+      memset(f->sum, 0, (cgo_n_slots + 1) * sizeof(ULong));
+      for (j = 0; j < f->n; j++) {
+         for (i = 0; i < cgo_n_slots; i++)
+            f->sum[i] += f->vals[(size_t)j * cgo_n_slots + i];
+      }
+      for (i = 0; i < cgo_n_slots; i++)
+         total[i] += f->sum[i];
+   }
+   set_widths(total);
+
+   print_rule();
+   printf("Files:        ");
+   for (i = 0; i < n_inputs; i++)
+      printf(" %s", inputs[i].name);
+   printf("\n");
+   for (i = 0; i < 3; i++) {
+      if (cgo_descs[i])
+         printf("%s\n", cgo_descs[i]);
+   }
+   printf("Command:       %s\n", cgo_cmd ? cgo_cmd : "");
+   printf("Show:         ");
+   for (i = 0; i < n_show; i++)
+      printf(" %s", show[i].name);
+   printf("\nSort:         ");
+   for (i = 0; i < n_sort; i++)
+      printf(" %s", sort[i].name);
+   printf("\nThreshold:     %g%%\n", threshold);
+
+   print_section("Summary");
+   print_field_names();
+   printf("\n\n");
+   print_fields(total);
+   printf("  PROGRAM TOTALS\n");
+
+   print_section("Function summary");
+   print_field_names();
+   printf("  file:function\n\n");
+   n_rows = select_rows(False, total, threshold, &rows);
+   ann_files = cgo_realloc(NULL, (n_rows + 1) * sizeof(UInt));
+   for (i = 0; i < n_rows; i++) {
+      const CgoFunc* f = rows[i].f;
+      print_fields(rows[i].v);
+      printf("  %s:%s\n", all.names.strs[f->file], all.names.strs[f->fn]);
+      for (j = 0; j < n_ann && ann_files[j] != f->file; j++)
+         ;
+      if (j == n_ann && strcmp(all.names.strs[f->file], "???") != 0)
+         ann_files[n_ann++] = f->file;
+   }
+   free(rows);
+
+   print_section("Line summary");
+   print_field_names();
+   printf("  file:line function\n\n");
+   n_rows = select_rows(True, total, threshold, &rows);
+   for (i = 0; i < n_rows; i++) {
+      const CgoFunc* f = rows[i].f;
+      print_fields(rows[i].v);
+      printf("  %s:%d %s\n", all.names.strs[f->file], rows[i].line, all.names.strs[f->fn]);
+   }
+   free(rows);
+
+   if (autoann) {
+      for (i = 0; i < n_ann; i++)
+         annotate_file(ann_files[i], context);
+   }
+   free(ann_files);
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                      cg_usage_annotate.c ---*/
+/*--------------------------------------------------------------------*/
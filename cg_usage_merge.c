@@ -0,0 +1,619 @@
+/*--------------------------------------------------------------------*/
+/*--- Merger and differ for the output files      cg_usage_merge.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a high-precision tracing profiler
+   built with Valgrind.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Merges and diffs sets of output files.  With %p in the output file
+   names each forked process writes its own cachegrind.out and cacheusage
+   files;  a set is any number of those, and of --output-format=binary
+   files, and is summed line by line, counters and eviction bins alike.
+
+   Build:  gcc -O2 -pthread -o cg_usage_merge cg_usage_merge.c \
+                   cg_outread.c cg_binread.c
+
+   Usage:  cg_usage_merge [--threads=<n>] [-o <cachegrind.out>]
+                          [-d <cacheusage.d1.out>] [-l <cacheusage.ll.out>]
+                          <file>...
+           cg_usage_merge --diff [--show=<column>,...] [--sort=<column>]
+                          [--threshold=<pct>] [--threads=<n>]
+                          <before> <after>
+
+   Merging writes the summed set in the formats the tool writes, for
+   cg_annotate, cg_usage_annotate and visu.py:  cachegrind.out to -o,
+   and the D1 and LL cacheusage files to -d and -l.  With none of them,
+   the cachegrind.out text goes to stdout.  Cacheusage inputs are told
+   apart by the ".d1." or ".ll." in their names, as the default
+   cacheusage.d1.out.%p names have.
+
+   Diffing takes two sets, each a comma-separated list of files or glob
+   patterns (quoted, so the shell leaves them alone), e.g.
+
+     cg_usage_merge --diff 'before/cache*.out.*' 'after/cache*.out.*'
+
+   and prints, for each --show column, the totals before and after and
+   the change, and then the functions and lines whose --sort column
+   changed by at least --threshold percent (default 0.1) of its total,
+   biggest change first, each with the --sort column before and after and
+   every --show column's change.  The columns are the inputs' (see
+   cg_usage_annotate);  by default, for each level with cacheusage
+   inputs, the misses and their 3C split (L:Miss#, L:Comp#, L:Conf#,
+   L:Cap#), sorted by the first level's Miss#.  Lines are matched by
+   number, so a change that moves code shows as a pair of lines;  the
+   function deltas don't depend on line numbers.
+
+   The sets are read by cg_outread.c into one table, with a row holding
+   both sets' counts, so the join is done as the files are read:  by
+   --threads threads (by default, one per CPU), which share out big files'
+   chunks and whole small files alike. */
+
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cg_outread.h"
+
+#define MAX_SHOW  32
+
+typedef enum { OutCachegrind, OutUsageD1, OutUsageLL } OutKind;
+
+static CgoInput* inputs;
+static UInt      n_inputs;
+static CgoFuncs  all;
+
+// Add the files matching 'pattern', which may be a plain file name, to
+// set 'set'.
+static void add_pattern(const char* pattern, UInt set)
+{
+   glob_t g;
+   size_t i;
+   int    r = glob(pattern, 0, NULL, &g);
+
+   if (r == GLOB_NOMATCH)
+      cgo_fail("%s: no such file", pattern);
+   if (r != 0)
+      cgo_fail("%s: can't expand pattern", pattern);
+   inputs = cgo_realloc(inputs, (n_inputs + g.gl_pathc) * sizeof(CgoInput));
+   for (i = 0; i < g.gl_pathc; i++) {
+      const char* name = cgo_strndup(g.gl_pathv[i], strlen(g.gl_pathv[i]));
+      cgo_open(&inputs[n_inputs++], name, CgoCachegrind, set);
+   }
+   globfree(&g);
+}
+
+// Add each of the comma-separated patterns in 'list' to set 'set'.
+static void add_set(const char* list, UInt set)
+{
+   while (*list) {
+      const char* comma = strchr(list, ',');
+      size_t n = comma ? (size_t)(comma - list) : strlen(list);
+      if (n > 0) {
+         char* pattern = cgo_strndup(list, n);
+         add_pattern(pattern, set);
+         free(pattern);
+      }
+      list += comma ? n + 1 : n;
+   }
+}
+
+/*------------------------------------------------------------*/
+/*--- Merging                                              ---*/
+/*------------------------------------------------------------*/
+
+static Bool is_out_col(UInt c, OutKind kind)
+{
+   const char* name = cgo_col_names[c];
+
+   switch (kind) {
+   case OutCachegrind: return strchr(name, ':') == NULL;
+   case OutUsageD1:    return strncmp(name, "D1:", 3) == 0;
+   default:            return strncmp(name, "LL:", 3) == 0;
+   }
+}
+
+// Write the summed 'kind' file to 'fp'.  As in the tool's own files, a
+// cacheusage file only has the lines with evictions.
+static void write_merged(FILE* fp, OutKind kind)
+{
+   UInt   cols[CGO_MAX_COLS], n_cols = 0, file = 0, fn = 0, c, i, j;
+   Int    key = -1;
+   ULong* sum;
+   Bool   first = True;
+
+   for (c = 0; c < cgo_n_cols; c++) {
+      if (is_out_col(c, kind))
+         cols[n_cols++] = c;
+   }
+   if (n_cols == 0)
+      cgo_fail("no %s input", kind == OutCachegrind ? "cachegrind.out"
+                              : kind == OutUsageD1  ? "cacheusage.d1"
+                                                    : "cacheusage.ll");
+   if (kind != OutCachegrind)
+      key = cgo_level_col(kind == OutUsageLL, "Cacheline#");
+   sum = cgo_realloc(NULL, n_cols * sizeof(ULong));
+   memset(sum, 0, n_cols * sizeof(ULong));
+
+   for (i = 0; i < 3; i++) {
+      if (cgo_descs[i])
+         fprintf(fp, "desc: %s\n", cgo_descs[i]);
+   }
+   fprintf(fp, "cmd: %s\n", cgo_cmd ? cgo_cmd : "");
+   // As the tool writes them, with a blank after each name, and the
+   // cacheusage columns without their "D1:" or "LL:".
+   fprintf(fp, kind == OutCachegrind ? "events: " : "bins: ");
+   for (c = 0; c < n_cols; c++)
+      fprintf(fp, "%s ", cgo_col_names[cols[c]]
+                         + (kind == OutCachegrind ? 0 : 3));
+   fprintf(fp, "\n");
+
+   for (i = 0; i < all.n; i++) {
+      const CgoFunc* f = all.f[i];
+      for (j = 0; j < f->n; j++) {
+         const ULong* v = &f->vals[(size_t)j * cgo_row_size()];
+         if (key >= 0) {
+            if (v[cgo_col_slot[key]] == 0)
+               continue;
+         } else {
+            for (c = 0; c < n_cols && v[cgo_col_slot[cols[c]]] == 0; c++)
+               ;
+            if (c == n_cols)
+               continue;
+         }
+         if (first || f->file != file) {
+            fprintf(fp, "fl=%s\n", all.names.strs[f->file]);
+            fprintf(fp, "fn=%s\n", all.names.strs[f->fn]);
+         } else if (f->fn != fn) {
+            fprintf(fp, "fn=%s\n", all.names.strs[f->fn]);
+         }
+         first = False;
+         file  = f->file;
+         fn    = f->fn;
+         fprintf(fp, "%d", f->lines[j]);
+         for (c = 0; c < n_cols; c++) {
+            ULong x = v[cgo_col_slot[cols[c]]];
+            fprintf(fp, " %llu", (unsigned long long)x);
+            sum[c] += x;
+         }
+         fprintf(fp, "\n");
+      }
+   }
+
+   fprintf(fp, "summary:");
+   for (c = 0; c < n_cols; c++)
+      fprintf(fp, " %llu", (unsigned long long)sum[c]);
+   fprintf(fp, "\n");
+   free(sum);
+}
+
+/*------------------------------------------------------------*/
+/*--- Diffing                                              ---*/
+/*------------------------------------------------------------*/
+
+typedef struct {
+   const char* name;
+   Int         slot;
+   int         width;
+} Field;
+
+static Field show[MAX_SHOW], sort_field;
+static UInt  n_show;
+
+static void fill_field(Field* f, const char* name)
+{
+   Int c = cgo_find_col(name);
+
+   if (c < 0) {
+      fprintf(stderr, "columns:");
+      for (c = 0; c < (Int)cgo_n_cols; c++)
+         fprintf(stderr, " %s", cgo_col_names[c]);
+      fprintf(stderr, "\n");
+      cgo_fail("no column '%s'", name);
+   }
+   f->name = cgo_col_names[c];
+   f->slot = cgo_need_col(c);
+}
+
+static UInt parse_fields(const char* list)
+{
+   UInt n = 0;
+
+   while (*list) {
+      const char* comma = strchr(list, ',');
+      size_t len = comma ? (size_t)(comma - list) : strlen(list);
+      if (len > 0) {
+         char* name = cgo_strndup(list, len);
+         if (n == MAX_SHOW)
+            cgo_fail("more than %d columns", MAX_SHOW);
+         fill_field(&show[n++], name);
+         free(name);
+      }
+      list += comma ? len + 1 : len;
+   }
+   return n;
+}
+
+// The default columns:  for each level, the misses and their 3C split,
+// or if there are no cacheusage inputs, cachegrind.out's misses.
+static void default_fields(char* list, size_t n)
+{
+   static const char* const misses[6] = {
+      "I1mr", "ILmr", "D1mr", "DLmr", "D1mw", "DLmw"
+   };
+   UInt l, i;
+
+   list[0] = '\0';
+   for (l = 0; l < 2; l++) {
+      const char* L = cgo_level_names[l];
+      if (cgo_level_col(l, "Miss#") < 0)
+         continue;
+      snprintf(list + strlen(list), n - strlen(list),
+               "%s%s:Miss#,%s:Comp#,%s:Conf#,%s:Cap#",
+               list[0] ? "," : "", L, L, L, L);
+   }
+   for (i = 0; i < 6 && !strchr(list, ':'); i++) {
+      if (cgo_find_col(misses[i]) >= 0)
+         snprintf(list + strlen(list), n - strlen(list), "%s%s",
+                  list[0] ? "," : "", misses[i]);
+   }
+   if (!list[0] && cgo_n_cols > 0)
+      snprintf(list, n, "%s", cgo_col_names[0]);
+}
+
+static ULong before(const Field* f, const ULong* v)
+{
+   return v[f->slot];
+}
+
+static ULong after(const Field* f, const ULong* v)
+{
+   return v[cgo_n_slots + f->slot];
+}
+
+static Long delta(const Field* f, const ULong* v)
+{
+   return (Long)(after(f, v) - before(f, v));
+}
+
+static void fmt_count(char* buf, ULong n)
+{
+   char tmp[32];
+   int  len = snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long)n);
+   int  i, j = 0;
+
+   for (i = 0; i < len; i++) {
+      if (i > 0 && (len - i) % 3 == 0)
+         buf[j++] = ',';
+      buf[j++] = tmp[i];
+   }
+   buf[j] = '\0';
+}
+
+static void fmt_delta(char* buf, Long d)
+{
+   if (d == 0) {
+      strcpy(buf, ".");
+      return;
+   }
+   buf[0] = d < 0 ? '-' : '+';
+   fmt_count(buf + 1, d < 0 ? -(ULong)d : (ULong)d);
+}
+
+typedef struct {
+   const CgoFunc* f;
+   Int            line;     // or -1 for the whole function
+   const ULong*   v;
+} Row;
+
+static int cmp_Row(const void* pa, const void* pb)
+{
+   const Row* a = pa;
+   const Row* b = pb;
+   Long da = delta(&sort_field, a->v), db = delta(&sort_field, b->v);
+   ULong aa = da < 0 ? -(ULong)da : (ULong)da;
+   ULong ab = db < 0 ? -(ULong)db : (ULong)db;
+   int res;
+
+   if (aa != ab)
+      return aa > ab ? -1 : 1;
+   if (da != db)
+      return da < db ? -1 : 1;
+   res = strcmp(all.names.strs[a->f->file], all.names.strs[b->f->file]);
+   if (res == 0)
+      res = strcmp(all.names.strs[a->f->fn], all.names.strs[b->f->fn]);
+   if (res == 0)
+      res = a->line < b->line ? -1 : a->line > b->line;
+   return res;
+}
+
+// The functions, or the lines, whose sort column changed by at least
+// 'limit', and some column at all.
+static UInt select_rows(Bool lines, ULong limit, Row** out)
+{
+   Row* rows = NULL;
+   UInt n = 0, cap = 0, i, j, k;
+
+   for (i = 0; i < all.n; i++) {
+      const CgoFunc* f = all.f[i];
+      UInt n_lines = lines ? f->n : 1;
+      for (j = 0; j < n_lines; j++) {
+         const ULong* v = lines ? &f->vals[(size_t)j * cgo_row_size()]
+                                : f->sum;
+         Long d = delta(&sort_field, v);
+         if ((ULong)(d < 0 ? -d : d) < limit)
+            continue;
+         for (k = 0; k < n_show && delta(&show[k], v) == 0; k++)
+            ;
+         if (k == n_show && d == 0)
+            continue;
+         if (n == cap) {
+            cap  = cap ? 2 * cap : 256;
+            rows = cgo_realloc(rows, cap * sizeof(Row));
+         }
+         rows[n].f    = f;
+         rows[n].line = lines ? f->lines[j] : -1;
+         rows[n].v    = v;
+         n++;
+      }
+   }
+   qsort(rows, n, sizeof(Row), cmp_Row);
+   *out = rows;
+   return n;
+}
+
+static void print_rule(void)
+{
+   printf("-----------------------------------------------------------"
+          "---------------------\n");
+}
+
+static void print_section(const char* title)
+{
+   printf("\n");
+   print_rule();
+   printf("-- %s\n", title);
+   print_rule();
+}
+
+// Each delta row:  the sort column before and after, then each show
+// column's change.
+static void print_row(const ULong* v, const char* loc)
+{
+   char buf[64];
+   UInt i;
+
+   fmt_count(buf, before(&sort_field, v));
+   printf("%*s", sort_field.width, buf);
+   fmt_count(buf, after(&sort_field, v));
+   printf(" %*s ", sort_field.width, buf);
+   for (i = 0; i < n_show; i++) {
+      fmt_delta(buf, delta(&show[i], v));
+      printf(" %*s", show[i].width, buf);
+   }
+   printf("  %s\n", loc);
+}
+
+static void print_row_names(const char* loc)
+{
+   UInt i;
+
+   printf("%*s %*s ", sort_field.width, "before", sort_field.width, "after");
+   for (i = 0; i < n_show; i++)
+      printf(" %*s", show[i].width, show[i].name);
+   printf("  %s\n\n", loc);
+}
+
+static void diff(double threshold)
+{
+   ULong* total = cgo_realloc(NULL, cgo_row_size() * sizeof(ULong));
+   ULong  limit;
+   Row*   rows;
+   char   buf[64], loc[1024];
+   UInt   n_rows, i, j, k;
+
+   memset(total, 0, cgo_row_size() * sizeof(ULong));
+   for (i = 0; i < all.n; i++) {
+      CgoFunc* f = all.f[i];
+      f->sum = cgo_realloc(NULL, cgo_row_size() * sizeof(ULong));
+      memset(f->sum, 0, cgo_row_size() * sizeof(ULong));
+      for (j = 0; j < f->n; j++) {
+         for (k = 0; k < cgo_row_size(); k++)
+            f->sum[k] += f->vals[(size_t)j * cgo_row_size() + k];
+      }
+      for (k = 0; k < cgo_row_size(); k++)
+         total[k] += f->sum[k];
+   }
+
+   // Wide enough for the totals, with a sign.
+   sort_field.width = 6;
+   for (i = 0; i < n_show; i++) {
+      ULong m = before(&show[i], total) > after(&show[i], total)
+                ? before(&show[i], total) : after(&show[i], total);
+      fmt_count(buf, m);
+      show[i].width = strlen(buf) + 1;
+      if (show[i].width < (int)strlen(show[i].name))
+         show[i].width = strlen(show[i].name);
+      if (show[i].width > sort_field.width)
+         sort_field.width = show[i].width;
+   }
+   limit = before(&sort_field, total) > after(&sort_field, total)
+           ? before(&sort_field, total) : after(&sort_field, total);
+   limit = (ULong)(limit * threshold / 100);
+
+   print_rule();
+   for (j = 0; j < 2; j++) {
+      printf(j ? "After:        " : "Before:       ");
+      for (i = 0; i < n_inputs; i++) {
+         if (inputs[i].set == j)
+            printf(" %s", inputs[i].name);
+      }
+      printf("\n");
+   }
+   for (i = 0; i < 3; i++) {
+      if (cgo_descs[i])
+         printf("%s\n", cgo_descs[i]);
+   }
+   printf("Command:       %s\n", cgo_cmd ? cgo_cmd : "");
+   printf("Show:         ");
+   for (i = 0; i < n_show; i++)
+      printf(" %s", show[i].name);
+   printf("\nSort:          %s\n", sort_field.name);
+   printf("Threshold:     %g%%\n", threshold);
+
+   print_section("Summary");
+   printf("%-14s %*s %*s %*s\n\n", "", sort_field.width, "before",
+          sort_field.width, "after", sort_field.width, "change");
+   for (i = 0; i < n_show; i++) {
+      ULong b = before(&show[i], total), a = after(&show[i], total);
+      printf("%-14s", show[i].name);
+      fmt_count(buf, b);
+      printf(" %*s", sort_field.width, buf);
+      fmt_count(buf, a);
+      printf(" %*s", sort_field.width, buf);
+      fmt_delta(buf, delta(&show[i], total));
+      printf(" %*s", sort_field.width, buf);
+      if (b > 0)
+         printf(" %+8.1f%%\n", 100.0 * ((double)a - (double)b) / b);
+      else
+         printf("\n");
+   }
+
+   print_section("Function deltas");
+   print_row_names("file:function");
+   n_rows = select_rows(False, limit, &rows);
+   for (i = 0; i < n_rows; i++) {
+      const CgoFunc* f = rows[i].f;
+      snprintf(loc, sizeof(loc), "%s:%s", all.names.strs[f->file],
+               all.names.strs[f->fn]);
+      print_row(rows[i].v, loc);
+   }
+   free(rows);
+
+   print_section("Line deltas");
+   print_row_names("file:line function");
+   n_rows = select_rows(True, limit, &rows);
+   for (i = 0; i < n_rows; i++) {
+      const CgoFunc* f = rows[i].f;
+      snprintf(loc, sizeof(loc), "%s:%d %s", all.names.strs[f->file],
+               rows[i].line, all.names.strs[f->fn]);
+      print_row(rows[i].v, loc);
+   }
+   free(rows);
+   free(total);
+}
+
+/*------------------------------------------------------------*/
+/*--- main                                                 ---*/
+/*------------------------------------------------------------*/
+
+static void usage(void)
+{
+   fprintf(stderr,
+      "usage: cg_usage_merge [--threads=<n>] [-o <cachegrind.out>]\n"
+      "                      [-d <cacheusage.d1.out>] [-l <cacheusage.ll.out>]\n"
+      "                      <file>...\n"
+      "       cg_usage_merge --diff [--show=<column>,...] [--sort=<column>]\n"
+      "                      [--threshold=<pct>] [--threads=<n>]\n"
+      "                      <before> <after>\n");
+   exit(1);
+}
+
+int main(int argc, char** argv)
+{
+   const char* out_name[3] = { NULL, NULL, NULL };
+   const char* show_list = NULL;
+   const char* sort_name = NULL;
+   const char** files = NULL;
+   char   show_def[512];
+   double threshold = 0.1;
+   Bool   diffing = False;
+   long   n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+   UInt   n_threads = n_cpus < 1 ? 1 : n_cpus > 32 ? 32 : n_cpus;
+   UInt   n_files = 0, i, k;
+   int    a;
+
+   cgo_prog = "cg_usage_merge";
+   files = cgo_realloc(NULL, argc * sizeof(char*));
+   for (a = 1; a < argc; a++) {
+      const char* s = argv[a];
+      if      (strcmp(s, "--diff") == 0)            diffing = True;
+      else if (strncmp(s, "--show=", 7) == 0)       show_list = s + 7;
+      else if (strncmp(s, "--sort=", 7) == 0)       sort_name = s + 7;
+      else if (strncmp(s, "--threshold=", 12) == 0) threshold = atof(s + 12);
+      else if (strncmp(s, "--threads=", 10) == 0)   n_threads = atoi(s + 10);
+      else if (strcmp(s, "-o") == 0 && a+1 < argc)  out_name[OutCachegrind] = argv[++a];
+      else if (strcmp(s, "-d") == 0 && a+1 < argc)  out_name[OutUsageD1]    = argv[++a];
+      else if (strcmp(s, "-l") == 0 && a+1 < argc)  out_name[OutUsageLL]    = argv[++a];
+      else if (s[0] == '-')                         usage();
+      else                                          files[n_files++] = s;
+   }
+   if (n_files == 0 || threshold < 0 || n_threads < 1)
+      usage();
+
+   if (!diffing) {
+      FILE* fp;
+
+      if (show_list || sort_name)
+         usage();
+      for (i = 0; i < n_files; i++)
+         add_pattern(files[i], 0);
+      for (i = 0; i < cgo_n_cols; i++)
+         cgo_need_col(i);
+      cgo_read(inputs, n_inputs, &all, n_threads);
+
+      if (!out_name[0] && !out_name[1] && !out_name[2]) {
+         write_merged(stdout, OutCachegrind);
+         return 0;
+      }
+      for (k = 0; k < 3; k++) {
+         if (!out_name[k])
+            continue;
+         fp = fopen(out_name[k], "w");
+         if (!fp)
+            cgo_fail("%s: can't create file", out_name[k]);
+         write_merged(fp, k);
+         fclose(fp);
+      }
+      return 0;
+   }
+
+   if (n_files != 2 || out_name[0] || out_name[1] || out_name[2])
+      usage();
+   cgo_n_sets = 2;
+   add_set(files[0], 0);
+   add_set(files[1], 1);
+   default_fields(show_def, sizeof(show_def));
+   n_show = parse_fields(show_list ? show_list : show_def);
+   if (n_show == 0)
+      usage();
+   if (sort_name)
+      fill_field(&sort_field, sort_name);
+   else
+      sort_field = show[0];
+   cgo_read(inputs, n_inputs, &all, n_threads);
+   diff(threshold);
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                         cg_usage_merge.c ---*/
+/*--------------------------------------------------------------------*/